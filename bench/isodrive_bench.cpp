@@ -0,0 +1,334 @@
+/**
+ * @file isodrive_bench.cpp
+ * @brief Microbenchmarks for image probing and mount orchestration.
+ *
+ * Runs each benchmark a fixed number of times on synthetic images and a
+ * fake configfs tree (on tmpfs when /dev/shm is available) and prints
+ * the timings as JSON. With --compare, reads two such reports and
+ * flags benchmarks whose median got slower than a threshold.
+ *
+ * Usage:
+ *   isodrive_bench [--iterations N] [--filter SUBSTRING] [--out FILE]
+ *   isodrive_bench --compare BASELINE.json CURRENT.json [--threshold PERCENT]
+ */
+
+#include "bootloader.h"
+#include "configfsisomanager.h"
+#include "gadgetsession.h"
+#include "imageprobe.h"
+#include "logger.h"
+#include "probecache.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Timings of one benchmark in nanoseconds.
+ */
+struct BenchResult {
+    std::string name;
+    size_t iterations = 0;
+    double min_ns = 0;
+    double median_ns = 0;
+    double mean_ns = 0;
+    double max_ns = 0;
+};
+
+// Helper: Run fn once to warm up, then time it for the given iterations
+static BenchResult run_bench(const std::string& name, size_t iterations, const std::function<void()>& fn) {
+    fn();
+
+    std::vector<double> samples;
+    samples.reserve(iterations);
+    for (size_t i = 0; i < iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        samples.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult r;
+    r.name = name;
+    r.iterations = iterations;
+    r.min_ns = samples.front();
+    r.max_ns = samples.back();
+    r.median_ns = samples[samples.size() / 2];
+    double total = 0;
+    for (double s : samples) total += s;
+    r.mean_ns = total / samples.size();
+    return r;
+}
+
+// Helper: Write a sparse image of the given size with an optional ISO 9660
+// PVD label and MBR boot signature
+static std::string create_image(const std::string& path, uint64_t size, const std::string& label, bool hybrid) {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (hybrid) {
+        char mbr[512] = {};
+        mbr[510] = 0x55;
+        mbr[511] = static_cast<char>(0xAA);
+        f.write(mbr, sizeof(mbr));
+    }
+    if (!label.empty()) {
+        char pvd[ISO_SECTOR_SIZE] = {};
+        pvd[0] = 1;
+        std::memcpy(pvd + 1, "CD001", 5);
+        pvd[6] = 1;
+        std::string vol_id = label;
+        vol_id.resize(32, ' ');
+        std::memcpy(pvd + 40, vol_id.data(), 32);
+        f.seekp(ISO_PVD_SECTOR * ISO_SECTOR_SIZE);
+        f.write(pvd, sizeof(pvd));
+
+        char terminator[ISO_SECTOR_SIZE] = {};
+        terminator[0] = static_cast<char>(0xFF);
+        std::memcpy(terminator + 1, "CD001", 5);
+        f.write(terminator, sizeof(terminator));
+    }
+    f.close();
+    fs::resize_file(path, size);
+    return path;
+}
+
+// Helper: Build a configfs-like tree with one bound gadget
+static void create_fake_configfs(const std::string& root) {
+    auto write = [&](const std::string& relative, const std::string& content) {
+        fs::path full = fs::path(root) / relative;
+        fs::create_directories(full.parent_path());
+        std::ofstream(full) << content;
+    };
+    write("usb_gadget/g1/UDC", "bench-udc.0\n");
+    write("usb_gadget/g1/idVendor", "0x18d1\n");
+    fs::create_directories(root + "/usb_gadget/g1/configs/c.1");
+    write("usb_gadget/g1/functions/mass_storage.0/stall", "1\n");
+    std::string lun = "usb_gadget/g1/functions/mass_storage.0/lun.0/";
+    write(lun + "file", "\n");
+    write(lun + "cdrom", "0\n");
+    write(lun + "ro", "1\n");
+    write(lun + "removable", "1\n");
+    write(lun + "forced_eject", "");
+}
+
+// Helper: JSON-escape a benchmark name
+static std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static std::string to_json(const std::vector<BenchResult>& results) {
+    std::ostringstream out;
+    out << "{\n  \"version\": 1,\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "    {\"name\": " << json_string(r.name)
+            << ", \"iterations\": " << r.iterations
+            << ", \"min_ns\": " << static_cast<uint64_t>(r.min_ns)
+            << ", \"median_ns\": " << static_cast<uint64_t>(r.median_ns)
+            << ", \"mean_ns\": " << static_cast<uint64_t>(r.mean_ns)
+            << ", \"max_ns\": " << static_cast<uint64_t>(r.max_ns) << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return out.str();
+}
+
+// Helper: Read name/median pairs back from a report written by to_json()
+static bool load_report(const std::string& path, std::vector<BenchResult>& results) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot read " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t name = line.find("\"name\": \"");
+        size_t median = line.find("\"median_ns\": ");
+        if (name == std::string::npos || median == std::string::npos) continue;
+
+        BenchResult r;
+        size_t start = name + 9;
+        size_t end = line.find('"', start);
+        if (end == std::string::npos) continue;
+        r.name = line.substr(start, end - start);
+        r.median_ns = std::strtod(line.c_str() + median + 13, nullptr);
+        results.push_back(r);
+    }
+    return true;
+}
+
+// Helper: Print a comparison table; returns the number of regressions
+static int compare_reports(const std::vector<BenchResult>& base, const std::vector<BenchResult>& current, double threshold) {
+    int regressions = 0;
+    std::printf("%-44s %14s %14s %9s\n", "benchmark", "baseline ns", "current ns", "change");
+    for (const BenchResult& cur : current) {
+        auto it = std::find_if(base.begin(), base.end(),
+                               [&](const BenchResult& b) { return b.name == cur.name; });
+        if (it == base.end()) {
+            std::printf("%-44s %14s %14.0f %9s\n", cur.name.c_str(), "-", cur.median_ns, "new");
+            continue;
+        }
+        double change = it->median_ns > 0 ? (cur.median_ns - it->median_ns) * 100.0 / it->median_ns : 0;
+        bool regressed = change > threshold;
+        if (regressed) regressions++;
+        std::printf("%-44s %14.0f %14.0f %+8.1f%%%s\n", cur.name.c_str(), it->median_ns, cur.median_ns,
+                    change, regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+static void print_usage() {
+    std::cout << "Usage:\n"
+              << "isodrive_bench [--iterations N] [--filter SUBSTRING] [--out FILE]\n"
+              << "isodrive_bench --compare BASELINE.json CURRENT.json [--threshold PERCENT]\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t iterations = 200;
+    std::string filter;
+    std::string out_path;
+    std::string compare_base;
+    std::string compare_current;
+    double threshold = 10.0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--out" && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            threshold = std::atof(argv[++i]);
+        } else if (arg == "--compare" && i + 2 < argc) {
+            compare_base = argv[++i];
+            compare_current = argv[++i];
+        } else {
+            print_usage();
+            return 2;
+        }
+    }
+
+    if (!compare_base.empty()) {
+        std::vector<BenchResult> base, current;
+        if (!load_report(compare_base, base) || !load_report(compare_current, current)) {
+            return 2;
+        }
+        int regressions = compare_reports(base, current, threshold);
+        if (regressions > 0) {
+            std::printf("\n%d benchmark(s) regressed by more than %.1f%%\n", regressions, threshold);
+            return 1;
+        }
+        return 0;
+    }
+
+    log_set_level(LogLevel::SILENT);
+
+    // Keep the synthetic images and fake configfs on tmpfs so the
+    // numbers measure isodrive rather than the storage device
+    std::string base_dir = isdir("/dev/shm") ? "/dev/shm" : fs::temp_directory_path().string();
+    std::string work = base_dir + "/isodrive_bench_" + std::to_string(getpid());
+    fs::create_directories(work);
+    probe_cache_set_dir(work + "/cache");
+
+    struct ImageCase {
+        std::string name;
+        uint64_t size;
+        std::string label;
+        bool hybrid;
+    };
+    std::vector<ImageCase> cases = {
+        {"plain_1m", 1ull << 20, "", false},
+        {"linux_64m", 64ull << 20, "UBUNTU_24_04", true},
+        {"windows_1g", 1ull << 30, "CCCOMA_X64FRE_EN-US_DV9", false},
+    };
+
+    std::vector<BenchResult> results;
+    auto bench = [&](const std::string& name, const std::function<void()>& fn) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) return;
+        results.push_back(run_bench(name, iterations, fn));
+    };
+
+    for (const ImageCase& c : cases) {
+        std::string path = create_image(work + "/" + c.name + ".iso", c.size, c.label, c.hybrid);
+        bench("get_windows_iso_info/" + c.name, [&] { get_windows_iso_info(path); });
+        bench("is_hybrid_iso/" + c.name, [&] { is_hybrid_iso(path); });
+        bench("probe_image/" + c.name, [&] { probe_image(path); });
+        bench("probe_image_cached/" + c.name, [&] { probe_image_cached(path); });
+    }
+
+    // Boot loader fingerprinting over a boot-image-sized buffer with no matches
+    std::string boot_image(1 << 20, '\x90');
+    bench("scan_bootloaders/1m", [&] { scan_bootloaders(boot_image.data(), boot_image.size()); });
+
+    bench("fs_mount_point/configfs", [] { fs_mount_point("configfs"); });
+    bench("find_configfs_root", [] { find_configfs_root(); });
+
+    // Mount orchestration against a fake configfs tree
+    std::string configfs = work + "/configfs";
+    create_fake_configfs(configfs);
+    std::string image_a = work + "/plain_1m.iso";
+    std::string image_b = work + "/linux_64m.iso";
+
+    WindowsMountOptions no_windows = {};
+    no_windows.version = WindowsVersion::NONE;
+
+    bench("gadget_session/discover", [&] { GadgetSession session(configfs); });
+
+    {
+        GadgetSession session(configfs);
+        bool cdrom = false;
+        bench("mount_iso/full_cycle", [&] {
+            // Toggling the device type forces unbind, commit and bind each time
+            cdrom = !cdrom;
+            mount_iso(session, image_a, cdrom, true, no_windows);
+        });
+        bench("mount_iso/unchanged", [&] { mount_iso(session, image_a, cdrom, true, no_windows); });
+
+        mount_iso(session, image_a, false, true, no_windows);
+        bool flip = false;
+        bench("mount_iso/swap_media", [&] {
+            flip = !flip;
+            mount_iso(session, flip ? image_b : image_a, false, true, no_windows);
+        });
+        bench("mount_iso/fresh_session", [&] {
+            GadgetSession fresh(configfs);
+            flip = !flip;
+            mount_iso(fresh, flip ? image_b : image_a, false, true, no_windows);
+        });
+    }
+
+    std::error_code ec;
+    fs::remove_all(work, ec);
+
+    std::string json = to_json(results);
+    if (out_path.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream out(out_path);
+        out << json;
+        if (!out) {
+            std::cerr << "Cannot write " << out_path << std::endl;
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "androidusbisomanager.h"
 #include "logger.h"
+#include "trace.h"
 #include "util.h"
 #include <string>
 
@@ -8,9 +9,12 @@ bool usb_supported() {
 }
 
 bool usb_mount_iso(const std::string& iso_path) {
-  log_debug("Mounting ISO via Android sysfs: " + iso_path);
+  TraceSpan span("usb_mount_iso");
+  span.detail(iso_path);
+  LOG_DEBUG("Mounting ISO via Android sysfs: " + iso_path);
 
   if (usb_enabled()) {
+    TRACE_SPAN("usb_disable");
     if (!usb_set_enabled(false)) {
       log_error("Failed to disable USB before mounting");
       return false;
@@ -29,6 +33,7 @@ bool usb_mount_iso(const std::string& iso_path) {
     return false;
   }
 
+  TRACE_SPAN("usb_enable");
   if (!usb_set_enabled(true)) {
     log_error("Failed to re-enable USB after mounting");
     return false;
@@ -39,7 +44,7 @@ bool usb_mount_iso(const std::string& iso_path) {
 }
 
 bool usb_reset_iso() {
-  log_debug("Resetting Android USB to default state");
+  LOG_DEBUG("Resetting Android USB to default state");
 
   // Clear the image file first
   if (!sysfs_write(ANDROID0_SYSFS_IMG_FILE, "")) {
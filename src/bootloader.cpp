@@ -0,0 +1,101 @@
+#include "bootloader.h"
+#include "eltorito.h"
+#include "imageprobe.h"
+#include "logger.h"
+#include "patternscan.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+    // System area searched for MBR boot code and embedded first stages
+    const size_t SYSTEM_AREA_BYTES = 16 * ISO_SECTOR_SIZE;
+
+    // Smallest span scanned per boot image; no-emulation loaders record only their first sectors
+    const uint64_t MIN_IMAGE_SCAN = 64 * 1024;
+
+    struct LoaderName {
+        uint32_t loader;
+        const char* name;
+    };
+
+    const LoaderName LOADER_NAMES[] = {
+        {BOOTLOADER_GRUB, "grub"},
+        {BOOTLOADER_ISOLINUX, "isolinux"},
+        {BOOTLOADER_SYSLINUX, "syslinux"},
+        {BOOTLOADER_SYSTEMD_BOOT, "systemd-boot"},
+        {BOOTLOADER_BOOTMGR, "bootmgr"},
+        {BOOTLOADER_LIMINE, "limine"},
+    };
+}
+
+// Helper: Scanner over the strings each loader's binaries carry
+static const PatternScanner& loader_scanner() {
+  static const PatternScanner scanner({
+    {std::string("GRUB \0Geom", 10), BOOTLOADER_GRUB},      // boot.img MBR code
+    {"GNU GRUB", BOOTLOADER_GRUB},                          // core.img and grubx64.efi
+    {"ISOLINUX", BOOTLOADER_ISOLINUX},                      // isolinux.bin
+    {"SYSLINUX", BOOTLOADER_SYSLINUX},                      // ldlinux.sys, syslinux.efi
+    {"isolinux.bin missing", BOOTLOADER_SYSLINUX},          // isohybrid MBR code
+    {"systemd-boot", BOOTLOADER_SYSTEMD_BOOT},              // LoaderInfo in systemd-bootx64.efi
+    {"BOOTMGR", BOOTLOADER_BOOTMGR},                        // etfsboot.com and bootmgr
+    {"Limine", BOOTLOADER_LIMINE},                          // limine-bios-cd.bin, BOOTX64.EFI
+    {"limine", BOOTLOADER_LIMINE},
+  });
+  return scanner;
+}
+
+uint32_t scan_bootloaders(const void* data, size_t len) {
+  return loader_scanner().scan(data, len);
+}
+
+void fingerprint_bootloaders(ImageProbe& probe, BootFingerprint& fingerprint) {
+  fingerprint = BootFingerprint();
+
+  size_t area = static_cast<size_t>(std::min<uint64_t>(SYSTEM_AREA_BYTES, probe.size()));
+  const unsigned char* head = probe.head(0, area);
+  if (head) {
+    fingerprint.system_area = scan_bootloaders(head, area);
+  } else {
+    std::vector<unsigned char> buffer(area);
+    if (probe.read(0, buffer.data(), buffer.size())) {
+      fingerprint.system_area = scan_bootloaders(buffer.data(), buffer.size());
+    }
+  }
+
+  BootCatalog catalog;
+  if (read_boot_catalog(probe, catalog)) {
+    std::vector<uint64_t> scanned;
+    uint64_t budget = BOOTLOADER_SCAN_MAX_BYTES;
+    std::vector<unsigned char> buffer;
+    for (const BootEntry& entry : catalog.entries) {
+      if (budget == 0) break;
+      if (entry.offset >= probe.size()) continue;
+      if (std::find(scanned.begin(), scanned.end(), entry.offset) != scanned.end()) continue;
+      scanned.push_back(entry.offset);
+
+      uint64_t length = std::min({std::max(entry.length, MIN_IMAGE_SCAN), BOOTLOADER_SCAN_IMAGE_BYTES,
+                                  probe.size() - entry.offset, budget});
+      buffer.resize(static_cast<size_t>(length));
+      if (!probe.read(entry.offset, buffer.data(), buffer.size())) continue;
+      fingerprint.boot_images |= scan_bootloaders(buffer.data(), buffer.size());
+      budget -= length;
+    }
+  }
+
+  if (fingerprint.system_area || fingerprint.boot_images) {
+    LOG_DEBUG("Boot loaders in " + probe.path() + ": system area [" + bootloader_names(fingerprint.system_area) +
+              "], boot images [" + bootloader_names(fingerprint.boot_images) + "] (" +
+              pattern_scan_implementation() + " scan)");
+  }
+}
+
+std::string bootloader_names(uint32_t loaders) {
+  std::string names;
+  for (const LoaderName& entry : LOADER_NAMES) {
+    if (!(loaders & entry.loader)) continue;
+    if (!names.empty()) names += ',';
+    names += entry.name;
+  }
+  return names;
+}
@@ -0,0 +1,187 @@
+#include "bootwarm.h"
+#include "eltorito.h"
+#include "imageprobe.h"
+#include "logger.h"
+#include "partitiontable.h"
+#include "trace.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    // Size assumed for no-emulation images whose load size is not their size
+    const uint64_t MIN_BOOT_IMAGE = 64 << 10;
+
+    // Interval between residency checks while waiting
+    const int RESIDENCY_POLL_US = 1000;
+}
+
+// Helper: Append a region unless an earlier one already covers it
+static void add_region(std::vector<BootRegion>& regions, uint64_t offset, uint64_t length, const std::string& what) {
+  length = std::min(length, BOOT_WARM_MAX_REGION);
+  if (length == 0) return;
+  for (const BootRegion& region : regions) {
+    if (offset >= region.offset && offset + length <= region.offset + region.length) return;
+  }
+  regions.push_back({offset, length, what});
+}
+
+// Helper: Bytes a boot image occupies, beyond what the catalog says is loaded
+static uint64_t boot_image_size(ImageProbe& probe, const BootEntry& entry) {
+  // EFI images are FAT filesystems whose load size is often 0 or 1;
+  // the BPB has the real size
+  if (entry.platform == ELTORITO_PLATFORM_EFI && entry.length <= ISO_SECTOR_SIZE) {
+    const unsigned char* bpb = probe.sector(entry.load_rba);
+    if (bpb && bpb[510] == 0x55 && bpb[511] == 0xaa) {
+      uint64_t sector_size = le16(bpb + 11);
+      uint64_t sectors = le16(bpb + 19) ? le16(bpb + 19) : le32(bpb + 32);
+      if (sector_size >= 512 && sector_size <= 4096) {
+        return std::max<uint64_t>(entry.length, sector_size * sectors);
+      }
+    }
+  }
+
+  // A no-emulation loader reads the rest of itself after the first sectors
+  return entry.media == 0 ? std::max(entry.length, MIN_BOOT_IMAGE) : entry.length;
+}
+
+// Helper: El Torito boot catalog and the images it lists
+static void find_el_torito(ImageProbe& probe, std::vector<BootRegion>& regions) {
+  BootCatalog catalog;
+  if (!read_boot_catalog(probe, catalog)) return;
+  add_region(regions, static_cast<uint64_t>(catalog.lba) * ISO_SECTOR_SIZE, ISO_SECTOR_SIZE, "boot catalog");
+  for (const BootEntry& entry : catalog.entries) {
+    if (!entry.bootable || entry.load_rba == 0) continue;
+    add_region(regions, entry.offset, boot_image_size(probe, entry),
+               entry.platform == ELTORITO_PLATFORM_EFI ? "EFI boot image" : "boot image");
+  }
+}
+
+// Helper: Partitions of a hybrid MBR or GPT
+static void find_partitions(ImageProbe& probe, std::vector<BootRegion>& regions) {
+  PartitionTable table;
+  read_partition_table(probe, table);
+  for (const Partition& partition : table.partitions) {
+    add_region(regions, partition.offset,
+               partition.esp ? partition.length : std::min(partition.length, BOOT_WARM_PARTITION_HEAD),
+               partition.esp ? "EFI system partition" : "partition start");
+  }
+}
+
+bool find_boot_regions(const std::string& path, std::vector<BootRegion>& regions, uint64_t budget) {
+  regions.clear();
+  ImageProbe probe(path);
+  if (!probe.is_open()) {
+    return false;
+  }
+
+  // The system area and volume descriptors come first in every boot
+  add_region(regions, 0, IMAGE_PROBE_HEAD_SECTORS * ISO_SECTOR_SIZE, "system area");
+  find_el_torito(probe, regions);
+  find_partitions(probe, regions);
+
+  // Clip to the image and to the budget, keeping the earlier regions
+  uint64_t total = 0;
+  std::vector<BootRegion> kept;
+  for (BootRegion& region : regions) {
+    if (region.offset >= probe.size() || total >= budget) continue;
+    region.length = std::min({region.length, probe.size() - region.offset, budget - total});
+    total += region.length;
+    kept.push_back(region);
+  }
+  regions.swap(kept);
+  return true;
+}
+
+BootWarmer::BootWarmer(const std::vector<std::string>& paths)
+    : next_(0), bytes_(0), start_(std::chrono::steady_clock::now()) {
+  TRACE_SPAN("boot_warm_start");
+  for (const std::string& path : paths) {
+    std::vector<BootRegion> regions;
+    if (!find_boot_regions(path, regions) || regions.empty()) continue;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    for (const BootRegion& region : regions) {
+      LOG_DEBUG("Warming " + region.what + " of " + path + " (" + std::to_string(region.length >> 10) + " KiB)");
+      targets_.push_back({fd, path, region});
+      bytes_ += region.length;
+    }
+  }
+
+  // readahead() blocks while it submits, so regions are issued in
+  // parallel to keep several requests in flight on the backing device
+  unsigned threads = static_cast<unsigned>(std::min<size_t>(targets_.size(), BOOT_WARM_THREADS));
+  for (unsigned i = 0; i < threads; i++) {
+    workers_.emplace_back([this] {
+      for (size_t t; (t = next_.fetch_add(1)) < targets_.size();) {
+        const Target& target = targets_[t];
+        if (readahead(target.fd, static_cast<off64_t>(target.region.offset), target.region.length) != 0) {
+          posix_fadvise(target.fd, static_cast<off_t>(target.region.offset),
+                        static_cast<off_t>(target.region.length), POSIX_FADV_WILLNEED);
+        }
+      }
+    });
+  }
+}
+
+BootWarmer::~BootWarmer() {
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+  int last = -1;
+  for (const Target& target : targets_) {
+    if (target.fd != last) close(target.fd);
+    last = target.fd;
+  }
+}
+
+bool BootWarmer::resident(const Target& target) const {
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  uint64_t start = target.region.offset / page_size * page_size;
+  size_t length = static_cast<size_t>(target.region.offset + target.region.length - start);
+  void* map = mmap(nullptr, length, PROT_READ, MAP_SHARED, target.fd, static_cast<off_t>(start));
+  if (map == MAP_FAILED) {
+    return true;  // Nothing to wait for if residency cannot be checked
+  }
+  std::vector<unsigned char> residency((length + page_size - 1) / page_size);
+  bool ok = mincore(map, length, residency.data()) == 0;
+  munmap(map, length);
+  return !ok || std::all_of(residency.begin(), residency.end(), [](unsigned char r) { return r & 1; });
+}
+
+bool BootWarmer::wait(int budget_ms) {
+  if (targets_.empty()) {
+    return true;
+  }
+  TRACE_SPAN("boot_warm_wait");
+  auto deadline = start_ + std::chrono::milliseconds(budget_ms);
+  std::vector<bool> done(targets_.size(), false);
+  size_t remaining = targets_.size();
+  for (;;) {
+    for (size_t i = 0; i < targets_.size(); i++) {
+      if (!done[i] && resident(targets_[i])) {
+        done[i] = true;
+        remaining--;
+      }
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (remaining == 0 || now >= deadline) {
+      long ms = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(now - start_).count());
+      if (remaining == 0) {
+        LOG_DEBUG("Boot regions resident after " + std::to_string(ms) + " ms (" +
+                  std::to_string(bytes_ >> 10) + " KiB)");
+      } else {
+        LOG_DEBUG("Boot warm-up budget ran out after " + std::to_string(ms) + " ms with " +
+                  std::to_string(remaining) + " of " + std::to_string(targets_.size()) + " regions cold");
+      }
+      return remaining == 0;
+    }
+    usleep(RESIDENCY_POLL_US);
+  }
+}
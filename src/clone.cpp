@@ -0,0 +1,278 @@
+#include "clone.h"
+#include "logger.h"
+#include "probecache.h"
+#include "trace.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <linux/fs.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+    // Directory created next to images, and the pool inside it
+    const char* const CLONE_DIR_NAME = ".isodrive-clones";
+    const char* const POOL_DIR_NAME = "pool";
+    const char* const CLONE_EXTENSION = ".img";
+
+    // Buffer for copies that cannot use copy_file_range()
+    constexpr size_t COPY_BUFFER_SIZE = 1 << 20;
+}
+
+const char* clone_method_name(CloneMethod method) {
+  switch (method) {
+    case CloneMethod::POOL: return "pool";
+    case CloneMethod::REFLINK: return "reflink";
+    case CloneMethod::COPY: return "copy";
+  }
+  return "unknown";
+}
+
+// Helper: Clones directory under the state directory
+static std::string state_clone_dir() {
+  return probe_cache_dir() + "/clones";
+}
+
+std::string clone_dir(const std::string& source) {
+  std::error_code ec;
+  fs::path parent = fs::absolute(source, ec).parent_path();
+  if (!ec) {
+    fs::path dir = parent / CLONE_DIR_NAME;
+    fs::create_directories(dir, ec);
+    if (!ec && access(dir.c_str(), W_OK) == 0) {
+      return dir.string();
+    }
+  }
+  ec.clear();
+  fs::create_directories(state_clone_dir(), ec);
+  return state_clone_dir();
+}
+
+// Helper: Write a whole buffer at an offset
+static bool pwrite_all(int fd, const char* data, size_t len, off_t offset) {
+  while (len > 0) {
+    ssize_t n = pwrite(fd, data, len, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    len -= static_cast<size_t>(n);
+    offset += n;
+  }
+  return true;
+}
+
+// Helper: Copy len bytes at offset, with copy_file_range() while it works
+static bool copy_range(int in, int out, off_t offset, off_t len, bool& use_copy_range) {
+  off_t end = offset + len;
+#ifdef __NR_copy_file_range
+  while (use_copy_range && offset < end) {
+    loff_t off_in = offset;
+    loff_t off_out = offset;
+    ssize_t n = syscall(__NR_copy_file_range, in, &off_in, out, &off_out,
+                        static_cast<size_t>(end - offset), 0u);
+    if (n > 0) {
+      offset += n;
+    } else if (n == 0) {
+      return false;
+    } else if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+      // Not supported between these files; finish with read/write
+      use_copy_range = false;
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+#else
+  use_copy_range = false;
+#endif
+
+  std::vector<char> buffer;
+  while (offset < end) {
+    if (buffer.empty()) buffer.resize(COPY_BUFFER_SIZE);
+    size_t want = static_cast<size_t>(std::min<off_t>(end - offset, COPY_BUFFER_SIZE));
+    ssize_t n = pread(in, buffer.data(), want, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0 || !pwrite_all(out, buffer.data(), static_cast<size_t>(n), offset)) {
+      return false;
+    }
+    offset += n;
+  }
+  return true;
+}
+
+// Helper: Copy only the data segments of a file, leaving holes unallocated
+static bool sparse_copy(int in, int out, off_t size) {
+  bool use_copy_range = true;
+  off_t pos = 0;
+  while (pos < size) {
+    off_t data = lseek(in, pos, SEEK_DATA);
+    if (data < 0) {
+      // ENXIO: only a hole remains; otherwise holes are not reported
+      if (errno == ENXIO) break;
+      data = pos;
+    }
+    off_t hole = lseek(in, data, SEEK_HOLE);
+    if (hole < 0 || hole > size) hole = size;
+    if (hole > data && !copy_range(in, out, data, hole - data, use_copy_range)) {
+      return false;
+    }
+    pos = hole;
+  }
+  return true;
+}
+
+bool clone_file(const std::string& source, const std::string& target, CloneMethod& method, bool allow_copy) {
+  int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    log_error("Cannot open " + source + ": " + std::string(std::strerror(errno)));
+    return false;
+  }
+  struct stat st;
+  if (fstat(in, &st) != 0) {
+    close(in);
+    return false;
+  }
+  int out = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out < 0) {
+    log_error("Cannot create " + target + ": " + std::string(std::strerror(errno)));
+    close(in);
+    return false;
+  }
+
+  bool ok;
+  errno = 0;
+  if (ioctl(out, FICLONE, in) == 0) {
+    method = CloneMethod::REFLINK;
+    ok = true;
+  } else if (!allow_copy) {
+    LOG_DEBUG("Reflink unavailable (" + std::string(std::strerror(errno)) + "); not copying " + source);
+    close(in);
+    close(out);
+    unlink(target.c_str());
+    return false;
+  } else {
+    method = CloneMethod::COPY;
+    LOG_DEBUG("Reflink unavailable (" + std::string(std::strerror(errno)) + "); copying " + source);
+    errno = 0;
+    ok = sparse_copy(in, out, st.st_size) && ftruncate(out, st.st_size) == 0 && fdatasync(out) == 0;
+  }
+  int err = errno;
+  close(in);
+  close(out);
+  if (!ok) {
+    log_error("Failed to copy " + source + (err ? ": " + std::string(std::strerror(err)) : ""));
+    unlink(target.c_str());
+  }
+  return ok;
+}
+
+bool clone_image(const std::string& source, std::string& clone_path, CloneMethod& method) {
+  TraceSpan span("clone_image");
+  span.detail(source);
+  ImageKey key;
+  if (!image_key(source, key)) {
+    log_error("Cannot stat " + source + ": " + std::string(std::strerror(errno)));
+    return false;
+  }
+
+  // Every mount gets its own clone, so a remount never reuses old writes
+  std::string dir = clone_dir(source);
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  clone_path = dir + "/" + image_key_name(key) + "." +
+               std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()) +
+               CLONE_EXTENSION;
+
+  std::string pooled = dir + "/" + POOL_DIR_NAME + "/" + image_key_name(key) + CLONE_EXTENSION;
+  if (rename(pooled.c_str(), clone_path.c_str()) == 0) {
+    method = CloneMethod::POOL;
+  } else {
+    std::string tmp = clone_path + ".tmp." + std::to_string(getpid());
+    if (!clone_file(source, tmp, method)) {
+      return false;
+    }
+    if (rename(tmp.c_str(), clone_path.c_str()) != 0) {
+      log_error("Cannot create " + clone_path + ": " + std::string(std::strerror(errno)));
+      unlink(tmp.c_str());
+      return false;
+    }
+  }
+
+  span.detail(clone_method_name(method));
+  log_info("Mounting a writable clone of " + source + " (" + clone_method_name(method) + ")");
+  LOG_DEBUG("Clone: " + clone_path);
+  return true;
+}
+
+bool clone_pool_fill(const std::string& source, bool allow_copy) {
+  TraceSpan span("clone_pool_fill");
+  span.detail(source);
+  ImageKey key;
+  if (!image_key(source, key)) {
+    return false;
+  }
+
+  std::string dir = clone_dir(source) + "/" + POOL_DIR_NAME;
+  std::string path = dir + "/" + image_key_name(key) + CLONE_EXTENSION;
+  if (isfile(path)) {
+    return true;
+  }
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    LOG_DEBUG("Cannot create clone pool " + dir + ": " + ec.message());
+    return false;
+  }
+
+  // Drop clones of older versions, then the least recently refilled
+  // sources until there is room for this one. Partial clones (.tmp.<pid>)
+  // belong to a refill in progress and are left alone.
+  std::string prefix = image_key_prefix(key);
+  std::vector<std::pair<fs::file_time_type, fs::path>> pooled;
+  for (const auto& entry : fs::directory_iterator(dir, ec)) {
+    if (entry.path().extension() != CLONE_EXTENSION) continue;
+    std::string name = entry.path().filename().string();
+    if (name.compare(0, prefix.size(), prefix) == 0) {
+      fs::remove(entry.path(), ec);
+    } else {
+      pooled.emplace_back(entry.last_write_time(ec), entry.path());
+    }
+  }
+  std::sort(pooled.begin(), pooled.end());
+  for (size_t i = 0; i + CLONE_POOL_MAX_ENTRIES <= pooled.size(); i++) {
+    LOG_DEBUG("Evicting pooled clone " + pooled[i].second.string());
+    fs::remove(pooled[i].second, ec);
+  }
+
+  CloneMethod method;
+  std::string tmp = path + ".tmp." + std::to_string(getpid());
+  if (!clone_file(source, tmp, method, allow_copy) || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  LOG_DEBUG(std::string("Refilled clone pool for ") + source + " (" + clone_method_name(method) + ")");
+  return true;
+}
+
+bool is_clone(const std::string& path) {
+  fs::path p(path);
+  if (p.extension() != CLONE_EXTENSION) return false;
+  fs::path parent = p.parent_path();
+  return parent.filename() == CLONE_DIR_NAME || parent == fs::path(state_clone_dir());
+}
+
+bool clone_discard(const std::string& path) {
+  if (!is_clone(path) || unlink(path.c_str()) != 0) {
+    return false;
+  }
+  LOG_DEBUG("Discarded clone " + path);
+  return true;
+}
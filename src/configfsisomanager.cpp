@@ -1,97 +1,81 @@
 #include "configfsisomanager.h"
+#include "bootwarm.h"
+#include "clone.h"
+#include "enumeration.h"
+#include "gadgetsession.h"
+#include "gadgetsnapshot.h"
+#include "gadgettransaction.h"
+#include "hotpages.h"
 #include "logger.h"
+#include "trace.h"
 #include "util.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <string>
+#include <unistd.h>
 #include <vector>
 
 namespace fs = std::filesystem;
 
+namespace {
+    // Delays between attempts to write a busy UDC attribute
+    const int UDC_RETRY_INITIAL_MS = 2;
+    const int UDC_RETRY_MAX_MS = 200;
+}
+
 bool supported() {
-    return !fs_mount_point("configfs").empty();
+  GadgetSession session;
+  return session.supported();
 }
 
 std::string get_gadget_root() {
-  std::string configFsRoot = fs_mount_point("configfs");
-  if (configFsRoot.empty()) return "";
-
-  fs::path usbGadgetRoot = fs::path(configFsRoot) / "usb_gadget";
-
-  if (!fs::exists(usbGadgetRoot) || !fs::is_directory(usbGadgetRoot)) {
-      log_debug("usb_gadget directory not found at " + usbGadgetRoot.string());
-      return "";
-  }
-
-  for (const auto& entry : fs::directory_iterator(usbGadgetRoot)) {
-      if (entry.path().filename().string()[0] == '.') continue;
-
-      fs::path gadget = entry.path();
-      fs::path udcFile = gadget / "UDC";
-
-      if (!sysfs_read(udcFile.string()).empty()) {
-          log_debug("Found active gadget: " + gadget.string());
-          return gadget.string();
-      }
-  }
-  log_debug("No active gadget found in " + usbGadgetRoot.string());
-  return "";
+  GadgetSession session;
+  return session.gadget_root();
 }
 
 std::string get_config_root() {
-  std::string gadgetRoot = get_gadget_root();
-  if (gadgetRoot.empty()) return "";
-
-  fs::path usbConfigRoot = fs::path(gadgetRoot) / "configs";
-
-  if (!fs::exists(usbConfigRoot) || !fs::is_directory(usbConfigRoot)) {
-    log_debug("configs directory not found at " + usbConfigRoot.string());
-    return "";
-  }
-
-  for (const auto& entry : fs::directory_iterator(usbConfigRoot)) {
-       if (entry.path().filename().string()[0] != '.') {
-           return entry.path().string();
-       }
-  }
-  log_debug("No config found in " + usbConfigRoot.string());
-  return "";
+  GadgetSession session;
+  return session.config_root();
 }
 
-static bool configure_windows_descriptors(const std::string& gadgetRoot, const WindowsMountOptions& win_opts) {
+static bool configure_windows_descriptors(GadgetTransaction& txn, GadgetSession& session, const WindowsMountOptions& win_opts) {
+  TRACE_SPAN("configure_windows_descriptors");
   log_info("");
   log_info("=== Configuring Windows-compatible USB descriptors ===");
   
-  fs::path root = gadgetRoot;
-  bool success = true;
+  fs::path root = session.gadget_root();
 
   // Set vendor/product IDs that Windows recognizes
   // Using IDs commonly associated with CD-ROM/mass storage devices
-  success &= sysfs_write((root / "idVendor").string(), "0x058f");  // Alcor Micro Corp
-  success &= sysfs_write((root / "idProduct").string(), "0x6387"); // Mass Storage
+  txn.set((root / "idVendor").string(), "0x058f");  // Alcor Micro Corp
+  txn.set((root / "idProduct").string(), "0x6387"); // Mass Storage
   
   // Set USB version based on options
   if (win_opts.use_usb3) {
     log_info("Using USB 3.0 descriptors");
-    success &= sysfs_write((root / "bcdUSB").string(), "0x0300");
+    txn.set((root / "bcdUSB").string(), "0x0300");
   } else {
-    success &= sysfs_write((root / "bcdUSB").string(), "0x0200");
+    txn.set((root / "bcdUSB").string(), "0x0200");
   }
   
   // Set device version
-  success &= sysfs_write((root / "bcdDevice").string(), "0x0100");
+  txn.set((root / "bcdDevice").string(), "0x0100");
   
   // Set device class to 0x00 (defined at interface level)
-  success &= sysfs_write((root / "bDeviceClass").string(), "0x00");
-  success &= sysfs_write((root / "bDeviceSubClass").string(), "0x00");
-  success &= sysfs_write((root / "bDeviceProtocol").string(), "0x00");
+  txn.set((root / "bDeviceClass").string(), "0x00");
+  txn.set((root / "bDeviceSubClass").string(), "0x00");
+  txn.set((root / "bDeviceProtocol").string(), "0x00");
   
   // Set max power (important for USB 3.0)
-  fs::path maxPowerFile = root / "configs/c.1/MaxPower";
-  if (fs::exists(maxPowerFile.parent_path())) {
+  if (!session.config_root().empty()) {
+    fs::path maxPowerFile = fs::path(session.config_root()) / "MaxPower";
     if (win_opts.use_usb3) {
-      success &= sysfs_write(maxPowerFile.string(), "896");  // 896mA for USB 3.0
+      txn.set(maxPowerFile.string(), "896");  // 896mA for USB 3.0
     } else {
-      success &= sysfs_write(maxPowerFile.string(), "500");  // 500mA for USB 2.0
+      txn.set(maxPowerFile.string(), "500");  // 500mA for USB 2.0
     }
   }
   
@@ -99,7 +83,7 @@ static bool configure_windows_descriptors(const std::string& gadgetRoot, const W
   fs::path stringsPath = root / "strings/0x409";
   
   // Create strings directory if it doesn't exist
-  if (!fs::exists(stringsPath)) {
+  if (!session.gadget_has("strings/0x409")) {
     std::error_code ec;
     fs::create_directories(stringsPath, ec);
     if (ec) {
@@ -116,37 +100,28 @@ static bool configure_windows_descriptors(const std::string& gadgetRoot, const W
     product_string = "USB CD-ROM Drive";
   }
   
-  success &= sysfs_write((stringsPath / "manufacturer").string(), "Generic");
-  success &= sysfs_write((stringsPath / "product").string(), product_string);
-  success &= sysfs_write((stringsPath / "serialnumber").string(), "000000000001");
-  
-  if (success) {
-    log_info("Windows USB descriptors configured");
-  } else {
-    log_warn("Some Windows USB descriptor writes failed");
-  }
+  txn.set((stringsPath / "manufacturer").string(), "Generic");
+  txn.set((stringsPath / "product").string(), product_string);
+  txn.set((stringsPath / "serialnumber").string(), "000000000001");
   
-  return success;
+  return true;
 }
 
-static bool configure_windows_mass_storage(const std::string& lunRoot, const WindowsMountOptions& win_opts) {
+static void configure_windows_mass_storage(GadgetTransaction& txn, GadgetSession& session, const std::string& lunRoot, const WindowsMountOptions& win_opts) {
   log_info("Configuring Windows mass storage settings...");
   
   fs::path root = lunRoot;
-  bool success = true;
 
   // Set removable flag (critical for Windows CD-ROM recognition)
-  success &= sysfs_write((root / "removable").string(), "1");
+  txn.set((root / "removable").string(), "1");
   
   // Disable forced unit access for better stability
-  fs::path nofuaFile = root / "nofua";
-  if (fs::exists(nofuaFile)) {
-    success &= sysfs_write(nofuaFile.string(), "1");
+  if (session.lun_supports("nofua")) {
+    txn.set((root / "nofua").string(), "1");
   }
   
   // Set inquiry string based on Windows version
-  fs::path inquiryFile = root / "inquiry_string";
-  if (fs::exists(inquiryFile)) {
+  if (session.lun_supports("inquiry_string")) {
     std::string inquiry;
     if (win_opts.version == WindowsVersion::WIN11) {
       inquiry = "Generic  USB CD-ROM       1.00";
@@ -155,16 +130,8 @@ static bool configure_windows_mass_storage(const std::string& lunRoot, const Win
     } else {
       inquiry = "Generic  USB CD-ROM       1.00";
     }
-    success &= sysfs_write(inquiryFile.string(), inquiry);
-  }
-  
-  if (success) {
-    log_info("Windows mass storage settings configured");
-  } else {
-    log_warn("Some Windows mass storage settings failed");
+    txn.set((root / "inquiry_string").string(), inquiry);
   }
-  
-  return success;
 }
 
 static void print_windows_info(const WindowsMountOptions& win_opts) {
@@ -198,127 +165,278 @@ static void print_windows_info(const WindowsMountOptions& win_opts) {
   log_info("");
 }
 
-bool mount_iso(const std::string& iso_path, bool cdrom, bool ro, const WindowsMountOptions& win_opts) {
-  std::string gadgetRoot = get_gadget_root();
+static void print_windows_success(const WindowsMountOptions& win_opts) {
+  log_info("");
+  log_info("****************************************");
+  log_info("Windows ISO mounted successfully!");
+  log_info("");
+  log_info("The device should be recognized by Windows");
+  log_info("Setup as a bootable CD-ROM drive.");
+  
+  if (win_opts.has_uefi) {
+    log_info("");
+    log_info("For UEFI boot:");
+    log_info("  - Select UEFI boot from your boot menu");
+    log_info("  - Secure Boot may need to be disabled");
+  }
+  
+  if (win_opts.has_legacy) {
+    log_info("");
+    log_info("For Legacy BIOS boot:");
+    log_info("  - Select USB-CDROM from your boot menu");
+  }
+  
+  log_info("****************************************");
+  log_info("");
+}
+
+// Helper: Stage the LUN settings, closing the current file first when needed
+static void stage_lun(GadgetTransaction& txn, GadgetSession& session, const fs::path& lunRoot,
+                      const std::string& iso_path, bool cdrom, bool ro, const WindowsMountOptions& win_opts) {
+  TraceSpan span("stage_lun");
+  span.detail(lunRoot.string());
+  fs::path lunFile = lunRoot / "file";
+  fs::path lunCdRom = lunRoot / "cdrom";
+  fs::path lunRo = lunRoot / "ro";
+
+  // The kernel refuses to change cdrom/ro while a file is open, so
+  // close the current file first whenever the LUN has to change.
+  // forced_eject also works while the host holds a medium-removal lock.
+  bool reopen = !txn.matches(lunFile.string(), iso_path) ||
+                !txn.matches(lunCdRom.string(), cdrom ? "1" : "0") ||
+                !txn.matches(lunRo.string(), ro ? "1" : "0");
+  if (reopen && !txn.current(lunFile.string()).empty()) {
+    if (session.lun_supports("forced_eject")) {
+      txn.set((lunRoot / "forced_eject").string(), "1");
+    }
+    txn.set(lunFile.string(), "");
+  }
+
+  txn.set(lunCdRom.string(), cdrom ? "1" : "0");
+  txn.set(lunRo.string(), ro ? "1" : "0");
+
+  // Apply Windows-specific mass storage settings
+  if (win_opts.enabled) {
+    configure_windows_mass_storage(txn, session, lunRoot.string(), win_opts);
+  }
+
+  txn.set(lunFile.string(), iso_path);
+}
 
-  if (gadgetRoot.empty()) {
+// Helper: Check that the session found a bound gadget
+static bool session_ready(const GadgetSession& session) {
+  if (session.gadget_root().empty()) {
     log_error("No active gadget found!");
     return false;
   }
-  std::string configRoot = get_config_root();
-  std::string udc = get_udc();
-
-  if (udc.empty()) {
+  if (session.udc().empty()) {
     log_error("Failed to get UDC!");
     return false;
   }
+  return true;
+}
 
-  fs::path functionRoot = fs::path(gadgetRoot) / "functions";
-  fs::path massStorageRoot = functionRoot / "mass_storage.0";
-  fs::path lunRoot = massStorageRoot / "lun.0";
+// Helper: Stage the writes that put back the descriptors saved before the first mount
+static void stage_snapshot_restore(GadgetTransaction& txn, const GadgetSnapshot& snapshot) {
+  for (const auto& attribute : snapshot.attributes) {
+    txn.set((fs::path(snapshot.gadget_root) / attribute.first).string(), attribute.second);
+  }
+}
+
+// Helper: Path of lun.N in the mass storage function
+static fs::path lun_path(const fs::path& massStorageRoot, unsigned index) {
+  return massStorageRoot / ("lun." + std::to_string(index));
+}
+
+// Helper: Save what the host read from outgoing images and warm up incoming ones,
+// returning the incoming images
+static std::vector<std::string> exchange_hot_pages(GadgetTransaction& txn, const fs::path& massStorageRoot,
+                                                   unsigned existing, const std::vector<LunMedia>& images) {
+  std::vector<std::string> incoming;
+  for (unsigned i = 0; i < existing || i < images.size(); i++) {
+    std::string current = i < existing ? txn.current((lun_path(massStorageRoot, i) / "file").string()) : "";
+    std::string next = i < images.size() ? images[i].path : "";
+    if (current == next) continue;
+    // A clone is discarded after use, so its page map would never be read
+    if (!current.empty() && !is_clone(current)) hot_pages_record(current);
+    if (!next.empty()) {
+      hot_pages_prefetch(next);
+      incoming.push_back(next);
+    }
+  }
+  return incoming;
+}
+
+// Helper: Note what the incoming images already have resident as the host session starts
+static void mark_hot_page_baselines(const std::vector<std::string>& incoming) {
+  for (const std::string& path : incoming) {
+    if (!is_clone(path)) hot_pages_mark_baseline(path);
+  }
+}
 
+bool mount_images(GadgetSession& session, const std::vector<LunMedia>& images, const WindowsMountOptions& win_opts) {
+  TRACE_SPAN("mount_images");
+  if (!session_ready(session)) {
+    return false;
+  }
+  const std::string& gadgetRoot = session.gadget_root();
+  const std::string& udc = session.udc();
+
+  fs::path massStorageRoot = fs::path(session.functions_root()) / "mass_storage.0";
   fs::path stallFile = massStorageRoot / "stall";
-  fs::path lunFile = lunRoot / "file";
-  fs::path lunCdRom = lunRoot / "cdrom";
-  fs::path lunRo = lunRoot / "ro";
 
-  bool success = true;
+  // Save the gadget as it was before isodrive's first change, and put
+  // it back when everything is unmounted
+  GadgetSnapshot snapshot;
+  bool restore = false;
+  if (!images.empty()) {
+    gadget_snapshot_ensure(session);
+  } else {
+    restore = gadget_snapshot_load(gadgetRoot, snapshot);
+  }
 
-  // Disable UDC before making changes
-  if (!set_udc("", gadgetRoot)) {
-    log_warn("Failed to disable UDC before configuration");
+  GadgetTransaction txn;
+  if (restore) {
+    stage_snapshot_restore(txn, snapshot);
   }
 
   // If Windows mode is enabled, configure USB descriptors
-  if (win_opts.enabled) {
+  if (win_opts.enabled && !images.empty()) {
     print_windows_info(win_opts);
     
-    if (!configure_windows_descriptors(gadgetRoot, win_opts)) {
+    if (!configure_windows_descriptors(txn, session, win_opts)) {
       log_warn("Windows descriptor configuration had errors");
     }
-    
+  }
+
+  if (!session.ensure_function("mass_storage.0")) {
+    return false;
+  }
+
+  // LUNs can only be added or removed while the function is unlinked,
+  // so a change in their number forces an unlink inside the UDC cycle
+  unsigned wanted = images.empty() ? 1 : static_cast<unsigned>(images.size());
+  unsigned existing = session.lun_count("mass_storage.0");
+  bool restructure = existing != wanted;
+  bool linked = session.function_linked("mass_storage.0");
+  bool relink = linked && restructure && !images.empty();
+
+  // Issued before the UDC cycle so the reads overlap with configuration
+  std::vector<std::string> incoming = exchange_hot_pages(txn, massStorageRoot, existing, images);
+  BootWarmer warmer(incoming);
+
+  // Disable stall for better Windows compatibility. The kernel only
+  // accepts this while the function is not linked into a config.
+  if (!linked || relink) {
+    txn.set(stallFile.string(), "0");
+  }
+
+  for (unsigned i = 0; i < images.size(); i++) {
+    LunMedia media = images[i];
+    WindowsMountOptions lun_opts = win_opts;
+    lun_opts.enabled = win_opts.enabled && media.windows;
+
     // Force CD-ROM and read-only mode for Windows ISOs
-    cdrom = true;
-    ro = true;
-    
-    log_info("Forced CD-ROM mode: enabled");
-    log_info("Forced read-only: enabled");
+    if (lun_opts.enabled) {
+      media.cdrom = true;
+      media.ro = true;
+      log_info("LUN " + std::to_string(i) + ": forced CD-ROM and read-only mode");
+    }
+    stage_lun(txn, session, lun_path(massStorageRoot, i), media.path, media.cdrom, media.ro, lun_opts);
   }
 
-  if (!fs::exists(massStorageRoot)) {
-    std::error_code ec;
-    fs::create_directories(massStorageRoot, ec);
-    if (ec) {
-      log_error("Failed to create mass_storage function: " + ec.message());
-      set_udc(udc, gadgetRoot);
+  // Close the files of LUNs that are no longer requested
+  for (unsigned i = static_cast<unsigned>(images.size()); i < existing; i++) {
+    txn.set((lun_path(massStorageRoot, i) / "file").string(), "");
+  }
+
+  // Skip the UDC cycle entirely when the gadget is already in the requested state
+  bool link_ok = images.empty() ? (restore ? gadget_snapshot_links_match(session, snapshot) : !linked) : linked;
+  size_t changes = txn.pending();
+  if (link_ok && !restructure && changes == 0) {
+    log_info(images.empty() ? "Nothing mounted; gadget unchanged" : "Already mounted; gadget unchanged");
+    if (restore) gadget_snapshot_discard(gadgetRoot);
+    return true;
+  }
+
+  // Fast path: with the function already linked and bound, removable
+  // LUNs can swap their media like a CD tray; the host sees a media change
+  // instead of a disconnect. Device descriptors, the LUN set and each
+  // LUN's device type are fixed at enumeration, so any change there
+  // needs the full cycle.
+  bool swappable = !images.empty() && linked && !restructure &&
+                   session.lun_supports("forced_eject");
+  size_t lun_changes = 0;
+  for (unsigned i = 0; swappable && i < images.size(); i++) {
+    fs::path lunRoot = lun_path(massStorageRoot, i);
+    bool cdrom = images[i].cdrom || (win_opts.enabled && images[i].windows);
+    lun_changes += txn.pending_under(lunRoot.string());
+    swappable = txn.matches((lunRoot / "removable").string(), "1") &&
+                txn.matches((lunRoot / "cdrom").string(), cdrom ? "1" : "0");
+  }
+  if (swappable && lun_changes == changes) {
+    log_info("Swapping media without re-enumeration");
+    warmer.wait();
+    if (!txn.commit()) {
+      log_error("Failed to swap media; previous settings restored");
       return false;
     }
+    mark_hot_page_baselines(incoming);
+    if (win_opts.enabled) {
+      print_windows_success(win_opts);
+    }
+    return true;
   }
 
-  // Disable stall for better Windows compatibility
-  success &= sysfs_write(stallFile.string(), "0");
+  // The firmware reads the boot regions right after enumeration; waiting
+  // for them here rather than before the bind keeps the host connected
+  warmer.wait();
 
-  success &= sysfs_write(lunFile.string(), "");
+  // Disable UDC before making changes
+  if (!set_udc("", gadgetRoot)) {
+    log_warn("Failed to disable UDC before configuration");
+  }
 
-  if (!iso_path.empty())
-  {
-    fs::path linkPath = fs::path(configRoot) / "mass_storage.0";
-    if (!fs::exists(linkPath)) {
-      std::error_code ec;
-      fs::create_directory_symlink(massStorageRoot, linkPath, ec);
-      if (ec) {
-        log_error("Failed to create symlink: " + ec.message());
-        set_udc(udc, gadgetRoot);
-        return false;
-      }
-    }
-    
-    success &= sysfs_write(lunCdRom.string(), cdrom ? "1" : "0");
-    success &= sysfs_write(lunRo.string(), ro ? "1" : "0");
+  if (relink && !session.unlink_function("mass_storage.0")) {
+    set_udc(udc, gadgetRoot);
+    return false;
+  }
 
-    // Apply Windows-specific mass storage settings
-    if (win_opts.enabled) {
-      if (!configure_windows_mass_storage(lunRoot.string(), win_opts)) {
-        log_warn("Windows mass storage configuration had errors");
-      }
+  for (unsigned i = existing; i < images.size(); i++) {
+    if (!session.create_lun("mass_storage.0", i)) {
+      if (relink) session.link_function("mass_storage.0");
+      set_udc(udc, gadgetRoot);
+      return false;
     }
+  }
+
+  if (!txn.commit()) {
+    log_error("Failed to configure mass storage; previous settings restored");
+    if (relink) session.link_function("mass_storage.0");
+    set_udc(udc, gadgetRoot);
+    return false;
+  }
 
-    success &= sysfs_write(lunFile.string(), iso_path);
+  if (images.empty() && linked) {
+    session.unlink_function("mass_storage.0");
+  }
 
-    if (win_opts.enabled) {
-      log_info("");
-      log_info("****************************************");
-      log_info("Windows ISO mounted successfully!");
-      log_info("");
-      log_info("The device should be recognized by Windows");
-      log_info("Setup as a bootable CD-ROM drive.");
-      
-      if (win_opts.has_uefi) {
-        log_info("");
-        log_info("For UEFI boot:");
-        log_info("  - Select UEFI boot from your boot menu");
-        log_info("  - Secure Boot may need to be disabled");
-      }
-      
-      if (win_opts.has_legacy) {
-        log_info("");
-        log_info("For Legacy BIOS boot:");
-        log_info("  - Select USB-CDROM from your boot menu");
-      }
-      
-      log_info("****************************************");
-      log_info("");
+  // Drop the LUNs beyond the requested set (lun.0 always stays)
+  if (!linked || relink || images.empty()) {
+    for (unsigned i = existing; i-- > wanted;) {
+      session.remove_lun("mass_storage.0", i);
     }
   }
-  else
-  {
-    fs::path linkPath = fs::path(configRoot) / "mass_storage.0";
-    if (fs::exists(linkPath)) {
-      std::error_code ec;
-      fs::remove(linkPath, ec);
-      if (ec) {
-        log_warn("Failed to remove symlink: " + ec.message());
-      }
+
+  // Relink the functions the gadget had before, adb and MTP among them
+  if (restore && !gadget_snapshot_restore_links(session, snapshot)) {
+    log_warn("Some of the gadget's original functions could not be relinked");
+  }
+
+  if (!images.empty() && (!linked || relink)) {
+    if (!session.link_function("mass_storage.0")) {
+      set_udc(udc, gadgetRoot);
+      return false;
     }
   }
 
@@ -326,19 +444,208 @@ bool mount_iso(const std::string& iso_path, bool cdrom, bool ro, const WindowsMo
     log_error("Failed to re-enable UDC");
     return false;
   }
+  session.note_bind();
+  mark_hot_page_baselines(incoming);
+
+  if (restore) {
+    gadget_snapshot_discard(gadgetRoot);
+    log_info("Restored the gadget's original configuration");
+  }
+  if (images.size() > 1) {
+    log_info("Mounted " + std::to_string(images.size()) + " images in one UDC cycle");
+  }
+  if (win_opts.enabled && !images.empty()) {
+    print_windows_success(win_opts);
+  }
+
+  return true;
+}
+
+bool mount_iso(GadgetSession& session, const std::string& iso_path, bool cdrom, bool ro, const WindowsMountOptions& win_opts) {
+  std::vector<LunMedia> images;
+  if (!iso_path.empty()) {
+    images.push_back({iso_path, cdrom, ro, win_opts.enabled});
+  }
+  return mount_images(session, images, win_opts);
+}
+
+bool mount_iso(const std::string& iso_path, bool cdrom, bool ro, const WindowsMountOptions& win_opts) {
+  GadgetSession session;
+  return mount_iso(session, iso_path, cdrom, ro, win_opts);
+}
+
+bool prepare_mass_storage(GadgetSession& session) {
+  if (!session_ready(session)) {
+    return false;
+  }
+  const std::string& gadgetRoot = session.gadget_root();
+  const std::string& udc = session.udc();
+
+  fs::path massStorageRoot = fs::path(session.functions_root()) / "mass_storage.0";
+  fs::path lunRoot = massStorageRoot / "lun.0";
+
+  if (!session.ensure_function("mass_storage.0")) {
+    return false;
+  }
+
+  GadgetTransaction txn;
+  bool linked = session.function_linked("mass_storage.0");
+  if (!linked) {
+    txn.set((massStorageRoot / "stall").string(), "0");
+    txn.set((lunRoot / "file").string(), "");
+  }
+  txn.set((lunRoot / "removable").string(), "1");
+
+  if (linked && txn.pending() == 0) {
+    log_info("Mass storage function already prepared");
+    return true;
+  }
+  if (!session.lun_supports("forced_eject")) {
+    log_warn("Kernel does not support forced_eject; mounts will re-enumerate the device");
+  }
+  gadget_snapshot_ensure(session);
+
+  if (!set_udc("", gadgetRoot)) {
+    log_warn("Failed to disable UDC before configuration");
+  }
+
+  if (!txn.commit()) {
+    log_error("Failed to prepare mass storage function");
+    set_udc(udc, gadgetRoot);
+    return false;
+  }
+
+  if (!linked && !session.link_function("mass_storage.0")) {
+    set_udc(udc, gadgetRoot);
+    return false;
+  }
+
+  if (!set_udc(udc, gadgetRoot)) {
+    log_error("Failed to re-enable UDC");
+    return false;
+  }
+  session.note_bind();
+
+  log_info("Mass storage function prepared; later mounts will swap media in place");
+  return true;
+}
+
+bool prepare_mass_storage() {
+  GadgetSession session;
+  return prepare_mass_storage(session);
+}
+
+bool eject_iso(GadgetSession& session) {
+  if (session.gadget_root().empty()) {
+    log_error("No active gadget found!");
+    return false;
+  }
 
-  return success;
+  fs::path massStorageRoot = fs::path(session.functions_root()) / "mass_storage.0";
+  bool forced = session.lun_supports("forced_eject");
+
+  GadgetTransaction txn;
+  unsigned luns = session.lun_count("mass_storage.0");
+  for (unsigned i = 0; i < luns; i++) {
+    fs::path lunRoot = lun_path(massStorageRoot, i);
+    const std::string& current = txn.current((lunRoot / "file").string());
+    if (current.empty()) continue;
+    if (!is_clone(current)) hot_pages_record(current);
+    if (forced) {
+      txn.set((lunRoot / "forced_eject").string(), "1");
+    }
+    txn.set((lunRoot / "file").string(), "");
+  }
+
+  if (txn.pending() == 0) {
+    log_info("Nothing mounted");
+    return true;
+  }
+  if (!txn.commit()) {
+    log_error("Failed to eject media");
+    return false;
+  }
+  log_info("Media ejected");
+  return true;
+}
+
+bool eject_iso() {
+  GadgetSession session;
+  return eject_iso(session);
+}
+
+// Helper: Whether a failed UDC write may succeed once the controller settles
+static bool udc_error_transient(int err, bool bind) {
+  return err == EBUSY || err == EAGAIN || (bind && err == ENODEV);
 }
 
 bool set_udc(const std::string& udc, const std::string& gadget) {
-  fs::path udcFile = fs::path(gadget) / "UDC";
-  return sysfs_write(udcFile.string(), udc);
+  TraceSpan span(udc.empty() ? "udc_unbind" : "udc_bind");
+  span.detail(udc);
+  std::string udcFile = (fs::path(gadget) / "UDC").string();
+  bool bind = !udc.empty();
+
+  // Unbinding names no controller, so find the one whose state to watch
+  std::string controller = udc;
+  if (!bind && attribute_read(udcFile, controller)) {
+    while (!controller.empty() && (controller.back() == '\n' || controller.back() == ' ')) {
+      controller.pop_back();
+    }
+  }
+  // A controller that is already detached (or has no state attribute) has nothing to wait for
+  std::string initial_state = bind || controller.empty() ? "" : udc_state(controller);
+
+  LOG_DEBUG("Write: " + udc + " -> " + udcFile);
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::milliseconds(UDC_RETRY_TIMEOUT_MS);
+  int delay = UDC_RETRY_INITIAL_MS;
+  for (int attempt = 1;; attempt++) {
+    int err = 0;
+    if (attribute_write(udcFile, udc, &err)) {
+      if (attempt > 1) {
+        LOG_DEBUG("UDC write succeeded after " + std::to_string(attempt) + " attempts");
+      }
+      break;
+    }
+    if (!bind && err == ENODEV) {
+      LOG_DEBUG("Gadget was not bound to a UDC");
+      return true;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (!udc_error_transient(err, bind) || now + std::chrono::milliseconds(delay) > deadline) {
+      log_error("Failed to write " + udcFile + ": " + std::strerror(err) +
+                (attempt > 1 ? " (after " + std::to_string(attempt) + " attempts)" : ""));
+      return false;
+    }
+    LOG_DEBUG("UDC busy (" + std::string(std::strerror(err)) + "), retrying within " +
+              std::to_string(delay) + " ms");
+
+    // A state change usually means the teardown finished, so retry on it
+    std::string before = controller.empty() ? "" : udc_state(controller);
+    std::string state;
+    if (before.empty() ||
+        !wait_for_udc_state(controller, [&before](const std::string& s) { return s != before; }, delay, state)) {
+      if (state.empty()) usleep(delay * 1000);
+    }
+    delay = std::min(delay * 2, UDC_RETRY_MAX_MS);
+  }
+
+  // The controller may still be disconnecting; binding again too early is what fails with EBUSY
+  if (!bind && !initial_state.empty() && initial_state != "not attached") {
+    std::string state;
+    if (wait_for_udc_state(controller, [](const std::string& s) { return s == "not attached"; },
+                           UDC_DETACH_TIMEOUT_MS, state)) {
+      double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      LOG_DEBUG("UDC " + controller + " detached after " + std::to_string(static_cast<int>(ms)) + " ms");
+    } else if (!state.empty()) {
+      LOG_DEBUG("UDC " + controller + " still reports '" + state + "' after unbind");
+    }
+  }
+  return true;
 }
 
 std::string get_udc() {
-  std::string gadget_root = get_gadget_root();
-  if (gadget_root.empty()) return "";
-
-  fs::path udcFile = fs::path(gadget_root) / "UDC";
-  return sysfs_read(udcFile.string());
+  GadgetSession session;
+  return session.udc();
 }
@@ -0,0 +1,296 @@
+#include "daemon.h"
+#include "logger.h"
+#include "mountrequest.h"
+#include "trace.h"
+#include "util.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Largest request the daemon accepts
+static constexpr size_t DAEMON_MAX_REQUEST = 64 * 1024;
+
+// Set by SIGINT/SIGTERM to end IsoDaemon::serve()
+static volatile sig_atomic_t g_daemon_stop = 0;
+
+static void daemon_signal_handler(int) {
+  g_daemon_stop = 1;
+}
+
+std::string daemon_socket_path() {
+  if (isdir("/dev/socket")) {
+    return "/dev/socket/isodrived";
+  }
+  return "/run/isodrived.sock";
+}
+
+// Helper: Fill a sockaddr_un, rejecting paths that do not fit
+static bool socket_address(const std::string& path, struct sockaddr_un& addr) {
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size());
+  return true;
+}
+
+// Helper: Write a whole buffer to a socket
+static bool send_all(int fd, const std::string& data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    done += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+IsoDaemon::IsoDaemon(const std::string& configfs_root)
+    : configfs_root_(configfs_root), session_(new GadgetSession(configfs_root)) {}
+
+void IsoDaemon::refresh_session() {
+  // Rediscover if the gadget went away or was rebound to another UDC
+  // (e.g. Android switching USB modes) since the session was built
+  bool stale = !session_->supported() || session_->gadget_root().empty();
+  if (!stale) {
+    std::string udc;
+    stale = !attribute_read(session_->gadget_root() + "/UDC", udc) ||
+            (!udc.empty() && udc != session_->udc());
+  }
+  if (stale) {
+    LOG_DEBUG("Rediscovering gadget layout");
+    session_.reset(new GadgetSession(configfs_root_));
+  }
+}
+
+ImageProbeResult IsoDaemon::probe(const std::string& path) {
+  ImageKey key;
+  bool have_key = image_key(path, key);
+  if (have_key) {
+    auto it = probes_.find(path);
+    if (it != probes_.end() && it->second.key == key) {
+      LOG_DEBUG("Probe result held in memory for " + path);
+      return it->second.result;
+    }
+  }
+
+  ImageProbeResult result = probe_image_cached(path);
+  if (have_key && result.readable) {
+    // Bounded like the on-disk cache; a full reset is enough here
+    if (probes_.size() >= PROBE_CACHE_MAX_ENTRIES) {
+      probes_.clear();
+    }
+    probes_[path] = {key, result};
+  }
+  return result;
+}
+
+std::string IsoDaemon::handle(const std::string& request) {
+  TRACE_SPAN("daemon_request");
+  std::ostringstream response;
+
+  LogLevel saved_level = log_get_level();
+  MountRequest parsed;
+  LogLevel verbosity;
+  if (!decode_request(request, parsed, verbosity)) {
+    response << "log " << static_cast<int>(LogLevel::ERROR) << " Malformed request\n";
+    response << "exit 1\n";
+    return response.str();
+  }
+
+  // Capture this request's output for the client at the level it asked for
+  log_set_level(verbosity);
+  log_set_sink([&response](LogLevel level, const std::string& message) {
+    size_t start = 0;
+    while (true) {
+      size_t end = message.find('\n', start);
+      response << "log " << static_cast<int>(level) << " " << message.substr(start, end - start) << "\n";
+      if (end == std::string::npos) break;
+      start = end + 1;
+    }
+  });
+
+  bool ok = false;
+  if (validate_request(parsed)) {
+    refresh_session();
+    ImageProber prober = [this](const std::string& path) { return probe(path); };
+    if (parsed.no_probe_cache) {
+      // Neither the results held in memory nor the on-disk cache are used
+      prober = probe_image;
+    }
+    ok = run_request(*session_, parsed, prober);
+    if (ok) {
+      refill_ = parsed;
+    }
+  }
+
+  log_set_sink(nullptr);
+  log_set_level(saved_level);
+
+  response << "exit " << (ok ? 0 : 1) << "\n";
+  return response.str();
+}
+
+void IsoDaemon::finish_request() {
+  MountRequest request;
+  std::swap(request, refill_);
+  refill_clone_pools(request, true);
+}
+
+bool IsoDaemon::serve(const std::string& socket_path) {
+  struct sockaddr_un addr;
+  if (!socket_address(socket_path, addr)) {
+    log_error("Invalid socket path: " + socket_path);
+    return false;
+  }
+
+  // Refuse to start twice; a socket nobody answers on is stale
+  int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe_fd >= 0) {
+    bool running = connect(probe_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0;
+    close(probe_fd);
+    if (running) {
+      log_error("isodrive daemon already running on " + socket_path);
+      return false;
+    }
+  }
+  unlink(socket_path.c_str());
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    log_error("Failed to create socket: " + std::string(std::strerror(errno)));
+    return false;
+  }
+  if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      chmod(socket_path.c_str(), 0600) != 0 || listen(listen_fd, 8) != 0) {
+    log_error("Failed to listen on " + socket_path + ": " + std::strerror(errno));
+    close(listen_fd);
+    return false;
+  }
+
+  // No SA_RESTART: a signal must interrupt accept()
+  struct sigaction sa;
+  std::memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = daemon_signal_handler;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  g_daemon_stop = 0;
+
+  log_info("isodrive daemon listening on " + socket_path);
+
+  while (!g_daemon_stop) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EINTR) {
+        log_warn("accept failed: " + std::string(std::strerror(errno)));
+      }
+      continue;
+    }
+
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 || cred.uid != 0) {
+      log_warn("Rejected request from non-root client");
+      close(fd);
+      continue;
+    }
+
+    // A stalled client must not block everyone else
+    struct timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buf[4096];
+    while (request.size() < DAEMON_MAX_REQUEST && request.find("\n\n") == std::string::npos) {
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      request.append(buf, static_cast<size_t>(n));
+    }
+
+    std::string response = handle(request);
+    if (!send_all(fd, response)) {
+      log_warn("Failed to send response: " + std::string(std::strerror(errno)));
+    }
+    close(fd);
+    finish_request();
+  }
+
+  close(listen_fd);
+  unlink(socket_path.c_str());
+  log_info("isodrive daemon stopped");
+  return true;
+}
+
+bool daemon_forward(const std::string& request, const std::string& socket_path, int& exit_code) {
+  TRACE_SPAN("daemon_forward");
+  struct sockaddr_un addr;
+  if (!socket_address(socket_path, addr)) {
+    return false;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return false;
+  }
+  LOG_DEBUG("Forwarding request to isodrive daemon at " + socket_path);
+
+  exit_code = 1;
+  if (!send_all(fd, request)) {
+    log_error("Failed to send request to daemon: " + std::string(std::strerror(errno)));
+    close(fd);
+    return true;
+  }
+
+  std::string response;
+  char buf[4096];
+  while (true) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    response.append(buf, static_cast<size_t>(n));
+  }
+  close(fd);
+
+  // Replay the daemon's output through the local logger
+  bool finished = false;
+  std::istringstream lines(response);
+  std::string line;
+  while (std::getline(lines, line)) {
+    if (line.compare(0, 4, "log ") == 0 && line.size() >= 6) {
+      std::string message = line.size() > 7 ? line.substr(7) : "";
+      switch (static_cast<LogLevel>(line[4] - '0')) {
+        case LogLevel::ERROR: log_error(message); break;
+        case LogLevel::WARN: log_warn(message); break;
+        case LogLevel::INFO: log_info(message); break;
+        case LogLevel::DEBUG: LOG_DEBUG(message); break;
+        default: break;
+      }
+    } else if (line.compare(0, 5, "exit ") == 0) {
+      exit_code = std::atoi(line.c_str() + 5);
+      finished = true;
+    }
+  }
+
+  if (!finished) {
+    log_error("isodrive daemon closed the connection without a result");
+    exit_code = 1;
+  }
+  return true;
+}
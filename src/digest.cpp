@@ -0,0 +1,356 @@
+#include "digest.h"
+#include "util.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define ISODRIVE_SHA256_X86 1
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#define ISODRIVE_SHA256_ARM 1
+#endif
+
+namespace {
+    alignas(16) const uint32_t SHA256_K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    const uint32_t SHA256_INIT[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    const uint32_t MD5_K[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+    };
+
+    const uint8_t MD5_SHIFT[64] = {
+        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+        5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+    };
+
+    using BlockFunction = void (*)(uint32_t* state, const uint8_t* data, size_t blocks);
+
+    struct Sha256Backend {
+        BlockFunction blocks;
+        const char* name;
+    };
+
+    std::atomic<bool> g_force_portable{false};
+}
+
+// Helper: Rotate right
+static inline uint32_t rotr(uint32_t x, unsigned n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+// Helper: Rotate left
+static inline uint32_t rotl(uint32_t x, unsigned n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+// Helper: Load a big-endian word
+static inline uint32_t load_be32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+// Helper: Portable SHA-256 compression
+static void sha256_blocks_portable(uint32_t* state, const uint8_t* data, size_t blocks) {
+  for (; blocks > 0; blocks--, data += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+      w[i] = load_be32(data + 4 * i);
+    }
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+      uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#ifdef ISODRIVE_SHA256_X86
+// Helper: SHA-256 compression with the x86 SHA extensions
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t* state, const uint8_t* data, size_t blocks) {
+  const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  // The rounds instruction works on ABEF/CDGH halves
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xb1);
+  __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1b);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  for (; blocks > 0; blocks--, data += 64) {
+    __m128i abef = state0;
+    __m128i cdgh = state1;
+    __m128i msg[4];
+    for (int g = 0; g < 16; g++) {
+      __m128i w;
+      if (g < 4) {
+        w = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * g)), byteswap);
+      } else {
+        w = _mm_sha256msg1_epu32(msg[g % 4], msg[(g + 1) % 4]);
+        w = _mm_add_epi32(w, _mm_alignr_epi8(msg[(g + 3) % 4], msg[(g + 2) % 4], 4));
+        w = _mm_sha256msg2_epu32(w, msg[(g + 3) % 4]);
+      }
+      msg[g % 4] = w;
+      __m128i wk = _mm_add_epi32(w, _mm_load_si128(reinterpret_cast<const __m128i*>(&SHA256_K[4 * g])));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0e));
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+#endif
+
+#ifdef ISODRIVE_SHA256_ARM
+// Helper: SHA-256 compression with the ARMv8 cryptography extensions
+static void sha256_blocks_armv8(uint32_t* state, const uint8_t* data, size_t blocks) {
+  uint32x4_t state0 = vld1q_u32(&state[0]);
+  uint32x4_t state1 = vld1q_u32(&state[4]);
+
+  for (; blocks > 0; blocks--, data += 64) {
+    uint32x4_t abcd = state0;
+    uint32x4_t efgh = state1;
+    uint32x4_t msg[4];
+    for (int g = 0; g < 16; g++) {
+      uint32x4_t w;
+      if (g < 4) {
+        w = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * g)));
+      } else {
+        w = vsha256su1q_u32(vsha256su0q_u32(msg[g % 4], msg[(g + 1) % 4]), msg[(g + 2) % 4], msg[(g + 3) % 4]);
+      }
+      msg[g % 4] = w;
+      uint32x4_t wk = vaddq_u32(w, vld1q_u32(&SHA256_K[4 * g]));
+      uint32x4_t previous = state0;
+      state0 = vsha256hq_u32(state0, state1, wk);
+      state1 = vsha256h2q_u32(state1, previous, wk);
+    }
+    state0 = vaddq_u32(state0, abcd);
+    state1 = vaddq_u32(state1, efgh);
+  }
+
+  vst1q_u32(&state[0], state0);
+  vst1q_u32(&state[4], state1);
+}
+#endif
+
+// Helper: Pick the fastest SHA-256 block function this CPU supports
+static Sha256Backend select_sha256_backend() {
+#ifdef ISODRIVE_SHA256_X86
+  unsigned a, b, c, d;
+  bool sse41 = __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_1) && (c & bit_SSSE3);
+  bool sha = __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA);
+  if (sse41 && sha) {
+    return {sha256_blocks_shani, "sha-ni"};
+  }
+#endif
+#ifdef ISODRIVE_SHA256_ARM
+  if (getauxval(AT_HWCAP) & HWCAP_SHA2) {
+    return {sha256_blocks_armv8, "armv8-ce"};
+  }
+#endif
+  return {sha256_blocks_portable, "portable"};
+}
+
+// Helper: The SHA-256 block function chosen for this process
+static const Sha256Backend& sha256_backend() {
+  static const Sha256Backend backend = select_sha256_backend();
+  static const Sha256Backend portable = {sha256_blocks_portable, "portable"};
+  return g_force_portable.load(std::memory_order_relaxed) ? portable : backend;
+}
+
+void sha256_force_portable(bool force) {
+  g_force_portable = force;
+}
+
+// Helper: Feed data through a 64-byte block buffer
+template <typename Blocks>
+static void absorb(uint8_t* buffer, size_t& buffered, uint64_t& length, const void* data, size_t len,
+                   Blocks blocks) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  length += len;
+  if (buffered > 0) {
+    size_t take = std::min(len, 64 - buffered);
+    std::memcpy(buffer + buffered, p, take);
+    buffered += take;
+    p += take;
+    len -= take;
+    if (buffered < 64) return;
+    blocks(buffer, 1);
+    buffered = 0;
+  }
+  if (len >= 64) {
+    blocks(p, len / 64);
+    p += len & ~static_cast<size_t>(63);
+    len &= 63;
+  }
+  std::memcpy(buffer, p, len);
+  buffered = len;
+}
+
+// Helper: Format bytes as lowercase hex
+static std::string to_hex(const uint8_t* bytes, size_t len) {
+  static const char digits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(len * 2);
+  for (size_t i = 0; i < len; i++) {
+    hex += digits[bytes[i] >> 4];
+    hex += digits[bytes[i] & 15];
+  }
+  return hex;
+}
+
+Sha256::Sha256() : length_(0), buffered_(0) {
+  std::memcpy(state_, SHA256_INIT, sizeof(state_));
+}
+
+void Sha256::update(const void* data, size_t len) {
+  BlockFunction blocks = sha256_backend().blocks;
+  absorb(buffer_, buffered_, length_, data, len,
+         [&](const uint8_t* p, size_t n) { blocks(state_, p, n); });
+}
+
+std::string Sha256::hex_digest() {
+  uint64_t bits = length_ * 8;
+  uint8_t pad[72] = {0x80};
+  size_t pad_len = (buffered_ < 56 ? 56 : 120) - buffered_;
+  for (int i = 0; i < 8; i++) {
+    pad[pad_len + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+  }
+  update(pad, pad_len + 8);
+
+  uint8_t digest[32];
+  for (int i = 0; i < 8; i++) {
+    digest[4 * i] = static_cast<uint8_t>(state_[i] >> 24);
+    digest[4 * i + 1] = static_cast<uint8_t>(state_[i] >> 16);
+    digest[4 * i + 2] = static_cast<uint8_t>(state_[i] >> 8);
+    digest[4 * i + 3] = static_cast<uint8_t>(state_[i]);
+  }
+  return to_hex(digest, sizeof(digest));
+}
+
+const char* Sha256::implementation() {
+  return sha256_backend().name;
+}
+
+// Helper: MD5 compression
+static void md5_blocks(uint32_t* state, const uint8_t* data, size_t blocks) {
+  for (; blocks > 0; blocks--, data += 64) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) {
+      m[i] = le32(data + 4 * i);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++) {
+      uint32_t f;
+      int g;
+      if (i < 16) {
+        f = (b & c) | (~b & d);
+        g = i;
+      } else if (i < 32) {
+        f = (d & b) | (~d & c);
+        g = (5 * i + 1) % 16;
+      } else if (i < 48) {
+        f = b ^ c ^ d;
+        g = (3 * i + 5) % 16;
+      } else {
+        f = c ^ (b | ~d);
+        g = (7 * i) % 16;
+      }
+      f += a + MD5_K[i] + m[g];
+      a = d;
+      d = c;
+      c = b;
+      b += rotl(f, MD5_SHIFT[i]);
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+  }
+}
+
+Md5::Md5() : state_{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476}, length_(0), buffered_(0) {}
+
+void Md5::update(const void* data, size_t len) {
+  absorb(buffer_, buffered_, length_, data, len,
+         [&](const uint8_t* p, size_t n) { md5_blocks(state_, p, n); });
+}
+
+std::string Md5::hex_digest() {
+  uint64_t bits = length_ * 8;
+  uint8_t pad[72] = {0x80};
+  size_t pad_len = (buffered_ < 56 ? 56 : 120) - buffered_;
+  for (int i = 0; i < 8; i++) {
+    pad[pad_len + i] = static_cast<uint8_t>(bits >> (8 * i));
+  }
+  update(pad, pad_len + 8);
+
+  uint8_t digest[16];
+  for (int i = 0; i < 4; i++) {
+    digest[4 * i] = static_cast<uint8_t>(state_[i]);
+    digest[4 * i + 1] = static_cast<uint8_t>(state_[i] >> 8);
+    digest[4 * i + 2] = static_cast<uint8_t>(state_[i] >> 16);
+    digest[4 * i + 3] = static_cast<uint8_t>(state_[i] >> 24);
+  }
+  return to_hex(digest, sizeof(digest));
+}
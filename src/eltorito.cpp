@@ -0,0 +1,107 @@
+#include "eltorito.h"
+#include "imageprobe.h"
+#include "logger.h"
+#include "util.h"
+#include <cstring>
+#include <string>
+
+namespace {
+    // Catalog pointer in the boot record and the size of catalog entries
+    const size_t BOOT_CATALOG_POINTER = 0x47;
+    const size_t CATALOG_ENTRY_SIZE = 32;
+    const size_t CATALOG_ENTRIES = ISO_SECTOR_SIZE / CATALOG_ENTRY_SIZE;
+
+    // First byte of each kind of catalog entry
+    const unsigned char VALIDATION_ENTRY = 0x01;
+    const unsigned char BOOTABLE = 0x88;
+    const unsigned char NOT_BOOTABLE = 0x00;
+    const unsigned char SECTION_HEADER = 0x90;
+    const unsigned char FINAL_SECTION_HEADER = 0x91;
+    const unsigned char EXTENSION_ENTRY = 0x44;
+
+    // Bytes loaded for the floppy emulation media types 1-3
+    const uint64_t FLOPPY_SIZES[] = {1228800, 1474560, 2949120};
+}
+
+// Helper: Check the validation entry's key bytes and word checksum
+static bool validation_entry_valid(const unsigned char* entry) {
+  if (entry[0] != VALIDATION_ENTRY || entry[30] != 0x55 || entry[31] != 0xaa) return false;
+  uint16_t sum = 0;
+  for (size_t i = 0; i < CATALOG_ENTRY_SIZE; i += 2) {
+    sum = static_cast<uint16_t>(sum + le16(entry + i));
+  }
+  return sum == 0;
+}
+
+// Helper: Decode an initial/default or section entry
+static BootEntry decode_entry(const unsigned char* entry, unsigned char platform) {
+  BootEntry boot = {};
+  boot.platform = platform;
+  boot.bootable = entry[0] == BOOTABLE;
+  boot.media = entry[1] & 0x0f;
+  boot.sector_count = le16(entry + 6);
+  boot.load_rba = le32(entry + 8);
+  boot.offset = static_cast<uint64_t>(boot.load_rba) * ISO_SECTOR_SIZE;
+  boot.length = boot.media >= 1 && boot.media <= 3 ? FLOPPY_SIZES[boot.media - 1]
+                                                   : static_cast<uint64_t>(boot.sector_count) * 512;
+  return boot;
+}
+
+// Helper: Platform name for logs
+static std::string platform_name(unsigned char platform) {
+  switch (platform) {
+    case ELTORITO_PLATFORM_BIOS: return "BIOS";
+    case ELTORITO_PLATFORM_EFI: return "EFI";
+    default: return "platform " + std::to_string(platform);
+  }
+}
+
+bool read_boot_catalog(ImageProbe& probe, BootCatalog& catalog) {
+  catalog = BootCatalog();
+  const unsigned char* record = probe.sector(ELTORITO_BOOT_RECORD_SECTOR);
+  if (!record || record[0] != 0 || std::memcmp(record + 1, "CD001", 5) != 0 ||
+      std::memcmp(record + 7, "EL TORITO SPECIFICATION", 23) != 0) {
+    return false;
+  }
+
+  catalog.lba = le32(record + BOOT_CATALOG_POINTER);
+  const unsigned char* sector = probe.sector(catalog.lba);
+  if (!sector || !validation_entry_valid(sector)) {
+    LOG_DEBUG("No valid El Torito boot catalog at sector " + std::to_string(catalog.lba));
+    return false;
+  }
+
+  // The initial/default entry belongs to the validation entry's platform
+  catalog.entries.push_back(decode_entry(sector + CATALOG_ENTRY_SIZE, sector[1]));
+
+  // Sections: a header, its entries (each possibly followed by extensions), repeat
+  size_t i = 2;
+  bool final_section = false;
+  while (!final_section && i < CATALOG_ENTRIES) {
+    const unsigned char* header = sector + i * CATALOG_ENTRY_SIZE;
+    if (header[0] != SECTION_HEADER && header[0] != FINAL_SECTION_HEADER) break;
+    final_section = header[0] == FINAL_SECTION_HEADER;
+    unsigned char platform = header[1];
+    unsigned count = le16(header + 2);
+    i++;
+    for (unsigned n = 0; n < count && i < CATALOG_ENTRIES; n++) {
+      const unsigned char* entry = sector + i++ * CATALOG_ENTRY_SIZE;
+      if (entry[0] != BOOTABLE && entry[0] != NOT_BOOTABLE) {
+        final_section = true;
+        break;
+      }
+      catalog.entries.push_back(decode_entry(entry, platform));
+      while (i < CATALOG_ENTRIES && sector[i * CATALOG_ENTRY_SIZE] == EXTENSION_ENTRY) i++;
+    }
+  }
+
+  for (const BootEntry& entry : catalog.entries) {
+    if (!entry.bootable) continue;
+    catalog.has_bios |= entry.platform == ELTORITO_PLATFORM_BIOS;
+    catalog.has_uefi |= entry.platform == ELTORITO_PLATFORM_EFI;
+    LOG_DEBUG("El Torito " + platform_name(entry.platform) + " boot image at sector " +
+              std::to_string(entry.load_rba) + ", " + std::to_string(entry.length) + " bytes loaded" +
+              (entry.media ? ", emulation type " + std::to_string(entry.media) : ""));
+  }
+  return true;
+}
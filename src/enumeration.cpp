@@ -0,0 +1,160 @@
+#include "enumeration.h"
+#include "logger.h"
+#include "probecache.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <poll.h>
+#include <string>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Re-read interval when no notification arrives
+static constexpr int ENUMERATION_POLL_SLICE_MS = 50;
+
+// Rotate the history once it grows past this size
+static constexpr uintmax_t ENUMERATION_LOG_MAX_BYTES = 256 * 1024;
+
+static std::string g_udc_class_root;
+
+std::string udc_class_root() {
+  return g_udc_class_root.empty() ? "/sys/class/udc" : g_udc_class_root;
+}
+
+void udc_set_class_root(const std::string& dir) {
+  g_udc_class_root = dir;
+}
+
+// Helper: Read a sysfs attribute from offset 0 through an open descriptor
+static std::string read_attribute_fd(int fd) {
+  char buf[64];
+  ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (n <= 0) return "";
+  std::string value(buf, static_cast<size_t>(n));
+  while (!value.empty() && (value.back() == '\n' || value.back() == ' ')) {
+    value.pop_back();
+  }
+  return value;
+}
+
+// Helper: Read a sysfs attribute by path
+static std::string read_attribute(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return "";
+  std::string value = read_attribute_fd(fd);
+  close(fd);
+  return value;
+}
+
+// Helper: Re-read the state attribute until done accepts it or the deadline passes
+static bool poll_state(int fd, std::chrono::steady_clock::time_point deadline,
+                       const std::function<bool(const std::string&)>& done, std::string& state) {
+  while (true) {
+    // sysfs only reports a change to a reader that has consumed the
+    // current value, so read before every poll
+    state = read_attribute_fd(fd);
+    if (done(state)) {
+      return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      return false;
+    }
+
+    int remaining = static_cast<int>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+    struct pollfd pfd = {fd, POLLPRI | POLLERR, 0};
+    if (poll(&pfd, 1, std::min(remaining, ENUMERATION_POLL_SLICE_MS)) < 0 && errno != EINTR) {
+      LOG_DEBUG("poll on UDC state failed: " + std::string(std::strerror(errno)));
+      usleep(ENUMERATION_POLL_SLICE_MS * 1000);
+    }
+  }
+}
+
+std::string udc_state(const std::string& udc) {
+  return read_attribute(udc_class_root() + "/" + udc + "/state");
+}
+
+bool wait_for_udc_state(const std::string& udc, const std::function<bool(const std::string&)>& done,
+                        int timeout_ms, std::string& state) {
+  state.clear();
+  int fd = open((udc_class_root() + "/" + udc + "/state").c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  bool reached = poll_state(fd, deadline, done, state);
+  close(fd);
+  return reached;
+}
+
+bool wait_for_configured(const std::string& udc, std::chrono::steady_clock::time_point since,
+                         int timeout_ms, EnumerationResult& result) {
+  TRACE_SPAN("wait_for_configured");
+  result = EnumerationResult();
+
+  std::string udcRoot = udc_class_root() + "/" + udc;
+  int fd = open((udcRoot + "/state").c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    log_warn("Cannot watch " + udcRoot + "/state: " + std::string(std::strerror(errno)));
+    return false;
+  }
+
+  auto deadline = since + std::chrono::milliseconds(timeout_ms);
+  result.configured = poll_state(fd, deadline, [](const std::string& state) { return state == "configured"; },
+                                 result.state);
+  result.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+  close(fd);
+
+  result.speed = read_attribute(udcRoot + "/current_speed");
+  return result.configured;
+}
+
+std::string enumeration_to_json(const std::string& udc, const EnumerationResult& result) {
+  char elapsed[32];
+  snprintf(elapsed, sizeof(elapsed), "%.1f", result.elapsed_ms);
+  // UDC names and sysfs state/speed values never need escaping
+  return std::string("{\"udc\":\"") + udc + "\",\"configured\":" + (result.configured ? "true" : "false") +
+         ",\"state\":\"" + result.state + "\",\"speed\":\"" + result.speed +
+         "\",\"elapsed_ms\":" + elapsed + "}";
+}
+
+bool enumeration_record(const std::string& udc, const EnumerationResult& result) {
+  std::string dir = probe_cache_dir();
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    LOG_DEBUG("Cannot create state directory " + dir + ": " + ec.message());
+    return false;
+  }
+
+  std::string path = dir + "/enumeration.jsonl";
+  if (fs::file_size(path, ec) > ENUMERATION_LOG_MAX_BYTES && !ec) {
+    fs::rename(path, path + ".1", ec);
+  }
+
+  struct utsname uts;
+  std::string kernel = uname(&uts) == 0 ? uts.release : "";
+
+  // Prefix the result object with when and where it was measured
+  std::string line = enumeration_to_json(udc, result);
+  line = "{\"time\":" + std::to_string(static_cast<long long>(std::time(nullptr))) +
+         ",\"kernel\":\"" + kernel + "\"," + line.substr(1) + "\n";
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG_DEBUG("Cannot write " + path + ": " + std::string(std::strerror(errno)));
+    return false;
+  }
+  bool ok = write(fd, line.data(), line.size()) == static_cast<ssize_t>(line.size());
+  close(fd);
+  return ok;
+}
@@ -0,0 +1,562 @@
+#include "ffsbackend.h"
+#include "bootwarm.h"
+#include "hotpages.h"
+#include "logger.h"
+#include "trace.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <endian.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <linux/usb/ch9.h>
+#include <linux/usb/functionfs.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+    // Bulk-Only Transport wrappers and class requests
+    const uint32_t CBW_SIGNATURE = 0x43425355;  // "USBC"
+    const uint32_t CSW_SIGNATURE = 0x53425355;  // "USBS"
+    const size_t CBW_SIZE = 31;
+    const size_t CSW_SIZE = 13;
+    const uint8_t BOT_GET_MAX_LUN = 0xfe;
+    const uint8_t BOT_RESET = 0xff;
+
+    const char INTERFACE_NAME[] = "isodrive Mass Storage";
+
+    struct InterfaceDescriptors {
+        struct usb_interface_descriptor intf;
+        struct usb_endpoint_descriptor_no_audio in;
+        struct usb_endpoint_descriptor_no_audio out;
+    } __attribute__((packed));
+
+    struct SuperSpeedDescriptors {
+        struct usb_interface_descriptor intf;
+        struct usb_endpoint_descriptor_no_audio in;
+        struct usb_ss_ep_comp_descriptor in_comp;
+        struct usb_endpoint_descriptor_no_audio out;
+        struct usb_ss_ep_comp_descriptor out_comp;
+    } __attribute__((packed));
+
+    struct Descriptors {
+        struct usb_functionfs_descs_head_v2 header;
+        __le32 fs_count;
+        __le32 hs_count;
+        __le32 ss_count;
+        InterfaceDescriptors fs;
+        InterfaceDescriptors hs;
+        SuperSpeedDescriptors ss;
+    } __attribute__((packed));
+
+    struct Strings {
+        struct usb_functionfs_strings_head header;
+        struct {
+            __le16 code;
+            char name[sizeof(INTERFACE_NAME)];
+        } __attribute__((packed)) lang0;
+    } __attribute__((packed));
+
+    // Data phase of one BOT command. Every write to the IN endpoint is a
+    // separate USB transfer and only the last may end in a short packet,
+    // so data is passed through in whole packets where possible.
+    class BotTransfer : public ScsiTransfer {
+    public:
+        BotTransfer(int ep_in, int ep_out, size_t packet) : ep_in_(ep_in), ep_out_(ep_out), packet_(packet) {}
+
+        bool send(const uint8_t* data, size_t len) override;
+        bool receive(uint8_t* data, size_t len) override;
+        bool finish(size_t sent, size_t expected);
+        bool discard(size_t len);
+
+    private:
+        int ep_in_;
+        int ep_out_;
+        size_t packet_;
+        std::vector<uint8_t> pending_;
+    };
+
+    BotServer* g_ffs_server = nullptr;
+}
+
+// Helper: write() all of a buffer, retrying interrupted and short writes
+static bool write_all(int fd, const uint8_t* data, size_t len) {
+  do {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += n;
+    len -= static_cast<size_t>(n);
+  } while (len > 0);
+  return true;
+}
+
+bool BotTransfer::send(const uint8_t* data, size_t len) {
+  if (pending_.empty() && len % packet_ == 0) {
+    return write_all(ep_in_, data, len);
+  }
+  pending_.insert(pending_.end(), data, data + len);
+  size_t whole = pending_.size() - pending_.size() % packet_;
+  if (whole == 0) return true;
+  bool ok = write_all(ep_in_, pending_.data(), whole);
+  pending_.erase(pending_.begin(), pending_.begin() + static_cast<long>(whole));
+  return ok;
+}
+
+bool BotTransfer::receive(uint8_t* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(ep_out_, data, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool BotTransfer::finish(size_t sent, size_t expected) {
+  if (!pending_.empty()) {
+    // Ends the transfer with a short packet
+    bool ok = write_all(ep_in_, pending_.data(), pending_.size());
+    pending_.clear();
+    return ok;
+  }
+  // Sent less than the host asked for in whole packets: terminate the
+  // transfer with a zero-length packet
+  if (sent < expected) {
+    uint8_t none = 0;
+    return write(ep_in_, &none, 0) == 0;
+  }
+  return true;
+}
+
+bool BotTransfer::discard(size_t len) {
+  uint8_t scratch[4096];
+  while (len > 0) {
+    size_t n = std::min(len, sizeof(scratch));
+    if (!receive(scratch, n)) return false;
+    len -= n;
+  }
+  return true;
+}
+
+// Helper: Fill one speed's interface and endpoint descriptors
+static void fill_interface(struct usb_interface_descriptor& intf, struct usb_endpoint_descriptor_no_audio& in,
+                           struct usb_endpoint_descriptor_no_audio& out, uint16_t max_packet) {
+  intf.bLength = USB_DT_INTERFACE_SIZE;
+  intf.bDescriptorType = USB_DT_INTERFACE;
+  intf.bNumEndpoints = 2;
+  intf.bInterfaceClass = USB_CLASS_MASS_STORAGE;
+  intf.bInterfaceSubClass = 0x06;  // SCSI transparent command set
+  intf.bInterfaceProtocol = 0x50;  // Bulk-Only Transport
+  intf.iInterface = 1;
+
+  in.bLength = USB_DT_ENDPOINT_SIZE;
+  in.bDescriptorType = USB_DT_ENDPOINT;
+  in.bEndpointAddress = 1 | USB_DIR_IN;
+  in.bmAttributes = USB_ENDPOINT_XFER_BULK;
+  in.wMaxPacketSize = htole16(max_packet);
+
+  out = in;
+  out.bEndpointAddress = 2 | USB_DIR_OUT;
+}
+
+std::vector<uint8_t> ffs_descriptors() {
+  Descriptors d;
+  std::memset(&d, 0, sizeof(d));
+  d.header.magic = htole32(FUNCTIONFS_DESCRIPTORS_MAGIC_V2);
+  d.header.length = htole32(sizeof(d));
+  d.header.flags = htole32(FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC | FUNCTIONFS_HAS_SS_DESC);
+  d.fs_count = htole32(3);
+  d.hs_count = htole32(3);
+  d.ss_count = htole32(5);
+
+  fill_interface(d.fs.intf, d.fs.in, d.fs.out, 64);
+  fill_interface(d.hs.intf, d.hs.in, d.hs.out, 512);
+  fill_interface(d.ss.intf, d.ss.in, d.ss.out, 1024);
+  d.ss.in_comp.bLength = USB_DT_SS_EP_COMP_SIZE;
+  d.ss.in_comp.bDescriptorType = USB_DT_SS_ENDPOINT_COMP;
+  d.ss.out_comp = d.ss.in_comp;
+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(&d);
+  return std::vector<uint8_t>(p, p + sizeof(d));
+}
+
+std::vector<uint8_t> ffs_strings() {
+  Strings s;
+  std::memset(&s, 0, sizeof(s));
+  s.header.magic = htole32(FUNCTIONFS_STRINGS_MAGIC);
+  s.header.length = htole32(sizeof(s));
+  s.header.str_count = htole32(1);
+  s.header.lang_count = htole32(1);
+  s.lang0.code = htole16(0x0409);
+  std::memcpy(s.lang0.name, INTERFACE_NAME, sizeof(INTERFACE_NAME));
+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(&s);
+  return std::vector<uint8_t>(p, p + sizeof(s));
+}
+
+bool ffs_open_endpoints(const std::string& dir, FfsEndpoints& endpoints) {
+  TRACE_SPAN("ffs_open_endpoints");
+  endpoints = FfsEndpoints();
+  endpoints.ep0 = open((dir + "/ep0").c_str(), O_RDWR | O_CLOEXEC);
+  if (endpoints.ep0 < 0) {
+    log_error("Cannot open " + dir + "/ep0: " + std::string(std::strerror(errno)));
+    return false;
+  }
+
+  // The bulk endpoint files only appear once the descriptors are accepted
+  std::vector<uint8_t> descriptors = ffs_descriptors();
+  std::vector<uint8_t> strings = ffs_strings();
+  if (!write_all(endpoints.ep0, descriptors.data(), descriptors.size()) ||
+      !write_all(endpoints.ep0, strings.data(), strings.size())) {
+    log_error("FunctionFS rejected the descriptors: " + std::string(std::strerror(errno)));
+    ffs_close_endpoints(endpoints);
+    return false;
+  }
+
+  endpoints.ep_in = open((dir + "/ep1").c_str(), O_RDWR | O_CLOEXEC);
+  endpoints.ep_out = open((dir + "/ep2").c_str(), O_RDWR | O_CLOEXEC);
+  if (endpoints.ep_in < 0 || endpoints.ep_out < 0) {
+    log_error("Cannot open the bulk endpoints in " + dir + ": " + std::string(std::strerror(errno)));
+    ffs_close_endpoints(endpoints);
+    return false;
+  }
+  return true;
+}
+
+void ffs_close_endpoints(FfsEndpoints& endpoints) {
+  for (int* fd : {&endpoints.ep_out, &endpoints.ep_in, &endpoints.ep0}) {
+    if (*fd >= 0) close(*fd);
+    *fd = -1;
+  }
+}
+
+BotServer::BotServer(const FfsEndpoints& endpoints, ScsiLun& lun)
+    : endpoints_(endpoints), lun_(lun), stop_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      enable_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)), stopping_(false), packet_size_(0) {}
+
+BotServer::~BotServer() {
+  if (stop_fd_ >= 0) close(stop_fd_);
+  if (enable_fd_ >= 0) close(enable_fd_);
+}
+
+void BotServer::stop() {
+  stopping_ = true;
+  uint64_t one = 1;
+  ssize_t ignored = write(stop_fd_, &one, sizeof(one));
+  (void)ignored;
+}
+
+size_t BotServer::packet_size() {
+  // The bulk endpoint's descriptor for the negotiated speed
+  size_t size = packet_size_;
+  if (size == 0) {
+    struct usb_endpoint_descriptor desc;
+    size = 512;
+    if (ioctl(endpoints_.ep_in, FUNCTIONFS_ENDPOINT_DESC, &desc) == 0 && (le16toh(desc.wMaxPacketSize) & 0x7ff)) {
+      size = le16toh(desc.wMaxPacketSize) & 0x7ff;
+    }
+    packet_size_ = size;
+  }
+  return size;
+}
+
+void BotServer::control_loop() {
+  struct usb_functionfs_event events[4];
+  while (!stopping_) {
+    struct pollfd fds[2] = {{endpoints_.ep0, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (fds[1].revents) break;
+    if (!(fds[0].revents & POLLIN)) {
+      if (fds[0].revents & (POLLHUP | POLLERR)) break;
+      continue;
+    }
+
+    ssize_t n = read(endpoints_.ep0, events, sizeof(events));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+
+    for (size_t i = 0; i < static_cast<size_t>(n) / sizeof(events[0]); i++) {
+      const struct usb_ctrlrequest& setup = events[i].u.setup;
+      switch (events[i].type) {
+        case FUNCTIONFS_ENABLE: {
+          LOG_DEBUG("FunctionFS: host enabled the interface");
+          packet_size_ = 0;
+          uint64_t one = 1;
+          ssize_t ignored = write(enable_fd_, &one, sizeof(one));
+          (void)ignored;
+          break;
+        }
+        case FUNCTIONFS_DISABLE: {
+          LOG_DEBUG("FunctionFS: interface disabled");
+          // Forget earlier enables, so the command loop waits for the next one
+          uint64_t count;
+          ssize_t ignored = read(enable_fd_, &count, sizeof(count));
+          (void)ignored;
+          break;
+        }
+        case FUNCTIONFS_SETUP:
+          if (setup.bRequestType == (USB_DIR_IN | USB_TYPE_CLASS | USB_RECIP_INTERFACE) &&
+              setup.bRequest == BOT_GET_MAX_LUN) {
+            uint8_t max_lun = 0;
+            write_all(endpoints_.ep0, &max_lun, 1);
+          } else if (setup.bRequestType == (USB_DIR_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE) &&
+                     setup.bRequest == BOT_RESET) {
+            LOG_DEBUG("FunctionFS: Bulk-Only reset");
+            ssize_t ignored = read(endpoints_.ep0, nullptr, 0);  // Status stage
+            (void)ignored;
+          } else {
+            // Stall unknown requests by doing I/O in the wrong direction
+            ssize_t ignored = (setup.bRequestType & USB_DIR_IN) ? read(endpoints_.ep0, nullptr, 0)
+                                                                 : write(endpoints_.ep0, nullptr, 0);
+            (void)ignored;
+          }
+          break;
+        default:
+          break;
+      }
+    }
+  }
+}
+
+bool BotServer::handle_command(const uint8_t* cbw) {
+  uint32_t tag = le32(cbw + 4);
+  size_t length = le32(cbw + 8);
+  bool in = cbw[12] & 0x80;
+  uint8_t lun = cbw[13] & 0x0f;
+  uint8_t cb_len = cbw[14] & 0x1f;
+
+  BotTransfer io(endpoints_.ep_in, endpoints_.ep_out, packet_size());
+  size_t transferred = 0;
+  ScsiStatus status = ScsiStatus::CHECK_CONDITION;
+  if (lun == 0 && cb_len > 0 && cb_len <= 16) {
+    status = lun_.execute(cbw + 15, cb_len, length, in, io, transferred);
+  }
+  commands_++;
+
+  // Complete the data phase the host set up, however much was used
+  if (length > 0) {
+    bool ok = in ? io.finish(transferred, length) : io.discard(length - transferred);
+    if (!ok) return false;
+  }
+
+  uint8_t csw[CSW_SIZE];
+  put_le32(csw, CSW_SIGNATURE);
+  put_le32(csw + 4, tag);
+  put_le32(csw + 8, static_cast<uint32_t>(length - transferred));
+  csw[12] = status == ScsiStatus::GOOD ? 0 : status == ScsiStatus::CHECK_CONDITION ? 1 : 2;
+  return write_all(endpoints_.ep_in, csw, sizeof(csw));
+}
+
+bool BotServer::wait_for_enable() {
+  // An enable that predates the disconnect may still be counted; it
+  // costs one more failed read before this blocks
+  while (!stopping_) {
+    struct pollfd fds[2] = {{enable_fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (fds[1].revents) return false;
+    uint64_t count;
+    if (read(enable_fd_, &count, sizeof(count)) == sizeof(count)) return true;
+  }
+  return false;
+}
+
+bool BotServer::serve() {
+  // Signals must interrupt the command loop's blocking reads, so keep
+  // them away from the control thread
+  sigset_t signals, previous;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, &previous);
+  std::thread control(&BotServer::control_loop, this);
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+  bool ok = true;
+  uint8_t cbw[CBW_SIZE];
+  while (!stopping_) {
+    struct pollfd fds[2] = {{endpoints_.ep_out, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+      ok = false;
+      break;
+    }
+    if (stopping_ || fds[1].revents) break;
+    if (!(fds[0].revents & (POLLIN | POLLHUP))) continue;
+
+    ssize_t n = read(endpoints_.ep_out, cbw, sizeof(cbw));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == ESHUTDOWN || errno == ECONNRESET) {
+        // Host disconnected mid-transfer; wait for it to enable the interface again
+        LOG_DEBUG("FunctionFS: waiting for the host to reconnect");
+        if (!wait_for_enable()) break;
+        continue;
+      }
+      log_error("FunctionFS read failed: " + std::string(std::strerror(errno)));
+      ok = false;
+      break;
+    }
+    // Only the test stand-ins hang up; FunctionFS endpoints never do
+    if (n == 0 && (fds[0].revents & POLLHUP)) break;
+    if (static_cast<size_t>(n) != CBW_SIZE || le32(cbw) != CBW_SIGNATURE) {
+      LOG_DEBUG("Ignoring invalid CBW of " + std::to_string(n) + " bytes");
+      continue;
+    }
+    if (!handle_command(cbw) && !stopping_) {
+      LOG_DEBUG("Command transfer failed: " + std::string(std::strerror(errno)));
+    }
+  }
+
+  stop();
+  control.join();
+  return ok;
+}
+
+// Helper: Signal handler that stops the running server
+static void stop_ffs_server(int) {
+  if (g_ffs_server) g_ffs_server->stop();
+}
+
+// Helper: Put the gadget back the way ffs_serve() found it
+static bool restore_gadget(GadgetSession& session, bool relink_mass_storage) {
+  const std::string& gadgetRoot = session.gadget_root();
+  set_udc("", gadgetRoot);
+  bool ok = true;
+  if (session.function_linked(FFS_FUNCTION)) {
+    ok = session.unlink_function(FFS_FUNCTION);
+  }
+  if (relink_mass_storage) {
+    ok = session.link_function("mass_storage.0") && ok;
+  }
+  if (!set_udc(session.udc(), gadgetRoot)) {
+    log_error("Failed to re-enable UDC");
+    return false;
+  }
+  session.note_bind();
+  return ok;
+}
+
+// Helper: Open the image, mount FunctionFS and bind the ffs function in
+// place of mass_storage.0
+static bool ffs_setup(GadgetSession& session, const LunMedia& media, const std::string& mount_dir,
+                      int& image, bool& mounted, FfsEndpoints& endpoints, bool& had_mass_storage) {
+  TraceSpan span("ffs_setup");
+  span.detail(media.path);
+  bool ro = media.ro || media.cdrom;
+  image = open(media.path.c_str(), (ro ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+  if (image < 0) {
+    log_error("Cannot open " + media.path + ": " + std::string(std::strerror(errno)));
+    return false;
+  }
+
+  if (!session.ensure_function(FFS_FUNCTION)) {
+    return false;
+  }
+
+  // The function instance name is the FunctionFS device name
+  std::error_code ec;
+  fs::create_directories(mount_dir, ec);
+  if (!isfile(mount_dir + "/ep0")) {
+    std::string device = std::string(FFS_FUNCTION).substr(4);
+    if (mount(device.c_str(), mount_dir.c_str(), "functionfs", 0, nullptr) != 0) {
+      log_error("Failed to mount FunctionFS at " + mount_dir + ": " + std::string(std::strerror(errno)));
+      return false;
+    }
+    mounted = true;
+  }
+
+  if (!ffs_open_endpoints(mount_dir, endpoints)) {
+    return false;
+  }
+
+  hot_pages_prefetch(media.path);
+  BootWarmer warmer({media.path});
+  warmer.wait();
+  had_mass_storage = session.function_linked("mass_storage.0");
+  if (!set_udc("", session.gadget_root())) {
+    log_warn("Failed to disable UDC before configuration");
+  }
+  if (had_mass_storage) {
+    session.unlink_function("mass_storage.0");
+  }
+  if (!session.link_function(FFS_FUNCTION) || !set_udc(session.udc(), session.gadget_root())) {
+    log_error("Failed to bind the FunctionFS gadget");
+    restore_gadget(session, had_mass_storage);
+    return false;
+  }
+  session.note_bind();
+  hot_pages_mark_baseline(media.path);
+  return true;
+}
+
+bool ffs_serve(GadgetSession& session, const LunMedia& media, const std::string& mount_dir) {
+  if (session.gadget_root().empty()) {
+    log_error("No active gadget found!");
+    return false;
+  }
+  if (session.udc().empty()) {
+    log_error("Failed to get UDC!");
+    return false;
+  }
+
+  int image = -1;
+  bool mounted = false;
+  bool had_mass_storage = false;
+  FfsEndpoints endpoints;
+  auto cleanup = [&]() {
+    ffs_close_endpoints(endpoints);
+    if (mounted) umount2(mount_dir.c_str(), MNT_DETACH);
+    if (image >= 0) close(image);
+  };
+
+  struct stat st;
+  if (!ffs_setup(session, media, mount_dir, image, mounted, endpoints, had_mass_storage) ||
+      fstat(image, &st) != 0) {
+    cleanup();
+    return false;
+  }
+
+  ImageReader reader(image, static_cast<uint64_t>(st.st_size));
+  ScsiLun lun(reader, media.cdrom, media.ro);
+  BotServer server(endpoints, lun);
+  log_info("Serving " + media.path + " from userspace (" + (reader.using_uring() ? "io_uring" : "pread") +
+           " reads); press Ctrl+C to stop");
+
+  struct sigaction action = {};
+  action.sa_handler = stop_ffs_server;
+  sigemptyset(&action.sa_mask);
+  struct sigaction old_int, old_term;
+  g_ffs_server = &server;
+  sigaction(SIGINT, &action, &old_int);
+  sigaction(SIGTERM, &action, &old_term);
+  bool ok = server.serve();
+  sigaction(SIGINT, &old_int, nullptr);
+  sigaction(SIGTERM, &old_term, nullptr);
+  g_ffs_server = nullptr;
+  log_info("Stopped after " + std::to_string(server.commands()) + " commands");
+  hot_pages_record(media.path);
+
+  ok = restore_gadget(session, had_mass_storage) && ok;
+  cleanup();
+  return ok;
+}
@@ -0,0 +1,240 @@
+#include "gadgetsession.h"
+#include "logger.h"
+#include "trace.h"
+#include "util.h"
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+// Helper: Decode the octal escapes (\040 etc.) used in mountinfo paths
+static std::string unescape_mount_path(const std::string& path) {
+  std::string out;
+  for (size_t i = 0; i < path.size(); i++) {
+    if (path[i] == '\\' && i + 3 < path.size()) {
+      const char* p = path.c_str() + i + 1;
+      if (p[0] >= '0' && p[0] <= '7' && p[1] >= '0' && p[1] <= '7' && p[2] >= '0' && p[2] <= '7') {
+        out += static_cast<char>(((p[0] - '0') << 6) | ((p[1] - '0') << 3) | (p[2] - '0'));
+        i += 3;
+        continue;
+      }
+    }
+    out += path[i];
+  }
+  return out;
+}
+
+// Helper: Confirm a directory is a configfs mount with a usb_gadget subsystem
+static bool is_configfs(const std::string& path) {
+  struct statfs sfs;
+  if (statfs(path.c_str(), &sfs) != 0) return false;
+  if (static_cast<long>(sfs.f_type) != CONFIGFS_MAGIC_NUMBER) return false;
+  return isdir(path + "/usb_gadget");
+}
+
+std::string find_configfs_root() {
+  TRACE_SPAN("find_configfs_root");
+  std::ifstream mountinfo("/proc/self/mountinfo");
+  std::string line;
+  while (std::getline(mountinfo, line)) {
+    // Fields: id parent major:minor root mount_point options [optional...] - fstype source ...
+    size_t sep = line.find(" - ");
+    if (sep == std::string::npos) continue;
+
+    std::istringstream tail(line.substr(sep + 3));
+    std::string fstype;
+    tail >> fstype;
+    if (fstype != "configfs") continue;
+
+    std::istringstream head(line.substr(0, sep));
+    std::string id, parent, dev, root, mount_point;
+    head >> id >> parent >> dev >> root >> mount_point;
+    mount_point = unescape_mount_path(mount_point);
+    if (is_configfs(mount_point)) {
+      LOG_DEBUG("Found configfs at " + mount_point);
+      return mount_point;
+    }
+  }
+
+  // Alternate search locations (Android mounts configfs at /config)
+  for (const char* candidate : {"/config", "/sys/kernel/config"}) {
+    if (is_configfs(candidate)) {
+      LOG_DEBUG(std::string("Found configfs at ") + candidate);
+      return candidate;
+    }
+  }
+  return "";
+}
+
+GadgetSession::GadgetSession(const std::string& configfs_root)
+    : gadget_fd_(-1), config_fd_(-1), functions_fd_(-1) {
+  TRACE_SPAN("gadget_session_discover");
+  if (!configfs_root.empty()) {
+    if (isdir(configfs_root + "/usb_gadget")) {
+      configfs_root_ = configfs_root;
+    }
+  } else {
+    configfs_root_ = find_configfs_root();
+  }
+
+  if (configfs_root_.empty()) {
+    LOG_DEBUG("configfs usb_gadget not available");
+    return;
+  }
+  discover_gadget();
+}
+
+GadgetSession::~GadgetSession() {
+  for (int fd : {gadget_fd_, config_fd_, functions_fd_}) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+void GadgetSession::discover_gadget() {
+  std::string usbGadgetRoot = configfs_root_ + "/usb_gadget";
+  DIR* dir = opendir(usbGadgetRoot.c_str());
+  if (!dir) {
+    LOG_DEBUG("usb_gadget directory not found at " + usbGadgetRoot);
+    return;
+  }
+
+  // One pass over the gadgets, reading each UDC file once
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.') continue;
+
+    std::string gadget = usbGadgetRoot + "/" + entry->d_name;
+    std::string udc;
+    if (attribute_read(gadget + "/UDC", udc) && !udc.empty()) {
+      gadget_root_ = gadget;
+      udc_ = udc;
+      break;
+    }
+  }
+  closedir(dir);
+
+  if (gadget_root_.empty()) {
+    LOG_DEBUG("No active gadget found in " + usbGadgetRoot);
+    return;
+  }
+  LOG_DEBUG("Found active gadget: " + gadget_root_ + " (UDC " + udc_ + ")");
+
+  gadget_fd_ = open(gadget_root_.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  functions_fd_ = openat(gadget_fd_, "functions", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+  std::string configs = gadget_root_ + "/configs";
+  dir = opendir(configs.c_str());
+  if (!dir) {
+    LOG_DEBUG("configs directory not found at " + configs);
+    return;
+  }
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_name[0] != '.') {
+      config_root_ = configs + "/" + entry->d_name;
+      break;
+    }
+  }
+  closedir(dir);
+
+  if (config_root_.empty()) {
+    LOG_DEBUG("No config found in " + configs);
+    return;
+  }
+  config_fd_ = open(config_root_.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+std::string GadgetSession::functions_root() const {
+  if (gadget_root_.empty()) return "";
+  return gadget_root_ + "/functions";
+}
+
+bool GadgetSession::lun_supports(const std::string& attribute) {
+  auto it = lun_attributes_.find(attribute);
+  if (it != lun_attributes_.end()) return it->second;
+  if (functions_fd_ < 0) return false;
+
+  // Only cache once the LUN exists; before that nothing can be known
+  if (faccessat(functions_fd_, "mass_storage.0/lun.0", F_OK, 0) != 0) return false;
+
+  std::string relative = "mass_storage.0/lun.0/" + attribute;
+  bool present = faccessat(functions_fd_, relative.c_str(), F_OK, 0) == 0;
+  lun_attributes_[attribute] = present;
+  LOG_DEBUG("LUN attribute " + attribute + (present ? " supported" : " not supported"));
+  return present;
+}
+
+bool GadgetSession::gadget_has(const std::string& relative) const {
+  return gadget_fd_ >= 0 && faccessat(gadget_fd_, relative.c_str(), F_OK, 0) == 0;
+}
+
+bool GadgetSession::function_linked(const std::string& function) const {
+  struct stat st;
+  return config_fd_ >= 0 && fstatat(config_fd_, function.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+bool GadgetSession::ensure_function(const std::string& function) {
+  if (functions_fd_ < 0) return false;
+  if (faccessat(functions_fd_, function.c_str(), F_OK, 0) == 0) return true;
+  if (mkdirat(functions_fd_, function.c_str(), 0755) != 0) {
+    log_error("Failed to create " + function + " function: " + std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool GadgetSession::link_function(const std::string& function) {
+  if (config_fd_ < 0) return false;
+  std::string target = functions_root() + "/" + function;
+  if (symlinkat(target.c_str(), config_fd_, function.c_str()) != 0) {
+    log_error("Failed to create symlink: " + std::string(std::strerror(errno)));
+    return false;
+  }
+  return true;
+}
+
+bool GadgetSession::unlink_function(const std::string& function) {
+  if (config_fd_ < 0) return false;
+  if (unlinkat(config_fd_, function.c_str(), 0) != 0) {
+    log_warn("Failed to remove symlink: " + std::string(std::strerror(errno)));
+    return false;
+  }
+  return true;
+}
+
+unsigned GadgetSession::lun_count(const std::string& function) const {
+  if (functions_fd_ < 0) return 0;
+  unsigned count = 0;
+  while (true) {
+    std::string relative = function + "/lun." + std::to_string(count);
+    if (faccessat(functions_fd_, relative.c_str(), F_OK, 0) != 0) break;
+    count++;
+  }
+  return count;
+}
+
+bool GadgetSession::create_lun(const std::string& function, unsigned index) {
+  if (functions_fd_ < 0) return false;
+  std::string relative = function + "/lun." + std::to_string(index);
+  if (faccessat(functions_fd_, relative.c_str(), F_OK, 0) == 0) return true;
+  if (mkdirat(functions_fd_, relative.c_str(), 0755) != 0) {
+    log_error("Failed to create " + relative + ": " + std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool GadgetSession::remove_lun(const std::string& function, unsigned index) {
+  if (functions_fd_ < 0 || index == 0) return false;
+  std::string relative = function + "/lun." + std::to_string(index);
+  if (unlinkat(functions_fd_, relative.c_str(), AT_REMOVEDIR) != 0) {
+    log_warn("Failed to remove " + relative + ": " + std::strerror(errno));
+    return false;
+  }
+  return true;
+}
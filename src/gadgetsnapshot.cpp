@@ -0,0 +1,287 @@
+#include "gadgetsnapshot.h"
+#include "logger.h"
+#include "probecache.h"
+#include "trace.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+    const char* const SNAPSHOT_HEADER = "isodrive-gadget-snapshot 2";
+    const char* const BOOT_ID_FILE = "/proc/sys/kernel/random/boot_id";
+
+    // Everything configure_windows_descriptors() may write, besides MaxPower
+    const char* const DESCRIPTOR_ATTRIBUTES[] = {
+        "idVendor", "idProduct", "bcdUSB", "bcdDevice",
+        "bDeviceClass", "bDeviceSubClass", "bDeviceProtocol",
+    };
+    const char* const STRINGS_DIR = "strings/0x409";
+    const char* const STRING_ATTRIBUTES[] = {"manufacturer", "product", "serialnumber"};
+
+    typedef std::vector<std::pair<std::string, std::string>> LinkList;
+}
+
+// Helper: Read an attribute relative to a directory descriptor
+static bool read_at(int dirfd, const std::string& relative, std::string& value) {
+  int fd = openat(dirfd, relative.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  char buf[256];
+  ssize_t n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if (n < 0) return false;
+  value.assign(buf, static_cast<size_t>(n));
+  while (!value.empty() && (value.back() == '\n' || value.back() == '\0')) {
+    value.pop_back();
+  }
+  return true;
+}
+
+// Helper: One pass over the config directory, collecting its links and MaxPower
+static bool scan_config(const GadgetSession& session, LinkList& links, std::string* max_power) {
+  DIR* dir = opendir(session.config_root().c_str());
+  if (!dir) {
+    LOG_DEBUG("Cannot read " + session.config_root() + ": " + std::strerror(errno));
+    return false;
+  }
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.') continue;
+    struct stat st;
+    bool link = entry->d_type == DT_LNK ||
+                (entry->d_type == DT_UNKNOWN &&
+                 fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode));
+    if (link) {
+      char target[PATH_MAX];
+      ssize_t n = readlinkat(dirfd(dir), entry->d_name, target, sizeof(target) - 1);
+      if (n > 0) {
+        links.push_back({entry->d_name, std::string(target, static_cast<size_t>(n))});
+      }
+    } else if (max_power && std::strcmp(entry->d_name, "MaxPower") == 0) {
+      read_at(dirfd(dir), entry->d_name, *max_power);
+    }
+  }
+  closedir(dir);
+  std::sort(links.begin(), links.end());
+  return true;
+}
+
+// Helper: Keep a value on its own line of the snapshot file
+static std::string one_line(std::string value) {
+  std::replace(value.begin(), value.end(), '\n', ' ');
+  std::replace(value.begin(), value.end(), '\t', ' ');
+  return value;
+}
+
+std::string gadget_snapshot_boot_id() {
+  std::string id;
+  if (!attribute_read(BOOT_ID_FILE, id)) return "";
+  return id;
+}
+
+bool gadget_snapshot_take(const GadgetSession& session, GadgetSnapshot& snapshot) {
+  TRACE_SPAN("gadget_snapshot_take");
+  snapshot = GadgetSnapshot();
+  if (session.gadget_fd() < 0 || session.config_root().empty()) {
+    return false;
+  }
+  snapshot.gadget_root = session.gadget_root();
+  snapshot.boot_id = gadget_snapshot_boot_id();
+
+  std::string value;
+  for (const char* name : DESCRIPTOR_ATTRIBUTES) {
+    if (read_at(session.gadget_fd(), name, value)) {
+      snapshot.attributes.push_back({name, value});
+    }
+  }
+
+  if (!session.gadget_has(STRINGS_DIR)) {
+    snapshot.absent.push_back(STRINGS_DIR);
+  } else {
+    for (const char* name : STRING_ATTRIBUTES) {
+      std::string relative = std::string(STRINGS_DIR) + "/" + name;
+      if (read_at(session.gadget_fd(), relative, value)) {
+        snapshot.attributes.push_back({relative, value});
+      }
+    }
+  }
+
+  std::string maxPower;
+  if (!scan_config(session, snapshot.links, &maxPower)) {
+    return false;
+  }
+  if (!maxPower.empty()) {
+    std::string config = session.config_root().substr(session.gadget_root().size() + 1);
+    snapshot.attributes.push_back({config + "/MaxPower", maxPower});
+  }
+  return true;
+}
+
+std::string gadget_snapshot_path(const std::string& gadget_root) {
+  return probe_cache_dir() + "/gadget-" + fs::path(gadget_root).filename().string() + ".snapshot";
+}
+
+bool gadget_snapshot_save(const GadgetSnapshot& snapshot) {
+  std::string dir = probe_cache_dir();
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    log_warn("Cannot create state directory " + dir + ": " + ec.message());
+    return false;
+  }
+
+  std::string data = std::string(SNAPSHOT_HEADER) + "\n";
+  data += "gadget " + one_line(snapshot.gadget_root) + "\n";
+  data += "boot " + one_line(snapshot.boot_id) + "\n";
+  for (const auto& attribute : snapshot.attributes) {
+    data += "attr " + attribute.first + "\t" + one_line(attribute.second) + "\n";
+  }
+  for (const std::string& relative : snapshot.absent) {
+    data += "absent " + relative + "\n";
+  }
+  for (const auto& link : snapshot.links) {
+    data += "link " + one_line(link.first) + "\t" + one_line(link.second) + "\n";
+  }
+
+  // The snapshot is the only record of the original gadget, so make it durable
+  std::string path = gadget_snapshot_path(snapshot.gadget_root);
+  int err = 0;
+  if (!write_file_atomic(path, data, true, &err)) {
+    log_warn("Failed to save gadget snapshot " + path + ": " + std::strerror(err));
+    return false;
+  }
+  LOG_DEBUG("Saved gadget configuration to " + path);
+  return true;
+}
+
+bool gadget_snapshot_load(const std::string& gadget_root, GadgetSnapshot& snapshot) {
+  snapshot = GadgetSnapshot();
+  std::ifstream file(gadget_snapshot_path(gadget_root));
+  if (!file) return false;
+
+  std::string line;
+  if (!std::getline(file, line) || line != SNAPSHOT_HEADER) {
+    LOG_DEBUG("Ignoring gadget snapshot with unknown format");
+    return false;
+  }
+
+  while (std::getline(file, line)) {
+    size_t space = line.find(' ');
+    if (space == std::string::npos) continue;
+    std::string kind = line.substr(0, space);
+    std::string rest = line.substr(space + 1);
+    size_t tab = rest.find('\t');
+
+    if (kind == "gadget") {
+      snapshot.gadget_root = rest;
+    } else if (kind == "boot") {
+      snapshot.boot_id = rest;
+    } else if (kind == "absent") {
+      snapshot.absent.push_back(rest);
+    } else if (tab != std::string::npos && kind == "attr") {
+      snapshot.attributes.push_back({rest.substr(0, tab), rest.substr(tab + 1)});
+    } else if (tab != std::string::npos && kind == "link") {
+      snapshot.links.push_back({rest.substr(0, tab), rest.substr(tab + 1)});
+    }
+  }
+
+  // The file is named after the gadget directory only, so confirm the full path
+  if (snapshot.gadget_root != gadget_root) {
+    LOG_DEBUG("Gadget snapshot belongs to " + snapshot.gadget_root + ", not " + gadget_root);
+    return false;
+  }
+  // After a reboot the gadget may have been rebuilt with other IDs or functions
+  if (snapshot.boot_id != gadget_snapshot_boot_id()) {
+    LOG_DEBUG("Ignoring gadget snapshot from an earlier boot");
+    return false;
+  }
+  return true;
+}
+
+bool gadget_snapshot_ensure(const GadgetSession& session) {
+  GadgetSnapshot snapshot;
+  if (gadget_snapshot_load(session.gadget_root(), snapshot)) {
+    if (session.function_linked("mass_storage.0")) {
+      return true;
+    }
+    // Nothing of isodrive's is active, so the gadget may have been
+    // reconfigured since (USB mode switch, manual edits)
+    LOG_DEBUG("No isodrive mount active; taking a new gadget snapshot");
+  }
+  if (!gadget_snapshot_take(session, snapshot)) {
+    log_warn("Cannot read the gadget configuration; unmounting will not restore it");
+    return false;
+  }
+  return gadget_snapshot_save(snapshot);
+}
+
+void gadget_snapshot_discard(const std::string& gadget_root) {
+  std::string path = gadget_snapshot_path(gadget_root);
+  if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+    LOG_DEBUG("Cannot remove " + path + ": " + std::strerror(errno));
+  }
+}
+
+// Helper: Whether a list holds a link with this name
+static bool has_link(const LinkList& links, const std::string& name) {
+  return std::any_of(links.begin(), links.end(),
+                     [&name](const std::pair<std::string, std::string>& link) { return link.first == name; });
+}
+
+bool gadget_snapshot_links_match(const GadgetSession& session, const GadgetSnapshot& snapshot) {
+  LinkList current;
+  if (!scan_config(session, current, nullptr)) {
+    return false;
+  }
+  if (current.size() != snapshot.links.size()) {
+    return false;
+  }
+  for (const auto& link : snapshot.links) {
+    if (!has_link(current, link.first)) return false;
+  }
+  return true;
+}
+
+bool gadget_snapshot_restore_links(GadgetSession& session, const GadgetSnapshot& snapshot) {
+  TRACE_SPAN("gadget_snapshot_restore_links");
+  LinkList current;
+  if (session.config_fd() < 0 || !scan_config(session, current, nullptr)) {
+    return false;
+  }
+
+  bool ok = true;
+  for (const auto& link : current) {
+    if (has_link(snapshot.links, link.first)) continue;
+    if (unlinkat(session.config_fd(), link.first.c_str(), 0) != 0) {
+      log_warn("Failed to remove link " + link.first + ": " + std::strerror(errno));
+      ok = false;
+    }
+  }
+  for (const auto& link : snapshot.links) {
+    if (has_link(current, link.first)) continue;
+    if (symlinkat(link.second.c_str(), session.config_fd(), link.first.c_str()) != 0) {
+      log_warn("Failed to restore link " + link.first + ": " + std::strerror(errno));
+      ok = false;
+    }
+  }
+
+  // configfs removes a group's attributes along with its directory
+  for (const std::string& relative : snapshot.absent) {
+    if (session.gadget_has(relative) && unlinkat(session.gadget_fd(), relative.c_str(), AT_REMOVEDIR) != 0) {
+      LOG_DEBUG("Cannot remove " + relative + ": " + std::strerror(errno));
+    }
+  }
+  return ok;
+}
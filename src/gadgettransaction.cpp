@@ -0,0 +1,152 @@
+#include "gadgettransaction.h"
+#include "logger.h"
+#include "trace.h"
+#include "util.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+namespace {
+    // Attributes the kernel parses with kstrto*(..., 0); everything else
+    // (strings, serial numbers, file paths) is compared verbatim
+    const std::unordered_set<std::string> NUMERIC_ATTRIBUTES = {
+        "idVendor", "idProduct", "bcdDevice", "bcdUSB",
+        "bDeviceClass", "bDeviceSubClass", "bDeviceProtocol", "bMaxPacketSize0",
+        "MaxPower", "bmAttributes",
+        "ro", "cdrom", "removable", "nofua", "stall",
+    };
+}
+
+// Helper: Trim surrounding whitespace
+static std::string trim(const std::string& s) {
+  size_t start = s.find_first_not_of(" \t\n");
+  if (start == std::string::npos) return "";
+  size_t end = s.find_last_not_of(" \t\n");
+  return s.substr(start, end - start + 1);
+}
+
+// Helper: Parse a number as the kernel does (0x hexadecimal, leading 0 octal)
+static bool parse_number(const std::string& s, unsigned long long& out) {
+  if (s.empty()) return false;
+  char* end = nullptr;
+  errno = 0;
+  out = std::strtoull(s.c_str(), &end, 0);
+  return errno == 0 && end && *end == '\0';
+}
+
+bool GadgetTransaction::numeric_attribute(const std::string& path) {
+  size_t slash = path.rfind('/');
+  return NUMERIC_ATTRIBUTES.count(slash == std::string::npos ? path : path.substr(slash + 1)) != 0;
+}
+
+bool GadgetTransaction::values_equal(const std::string& path, const std::string& a, const std::string& b) {
+  std::string ta = trim(a);
+  std::string tb = trim(b);
+  if (ta == tb) return true;
+  if (!numeric_attribute(path)) return false;
+
+  unsigned long long na, nb;
+  return parse_number(ta, na) && parse_number(tb, nb) && na == nb;
+}
+
+void GadgetTransaction::set(const std::string& path, const std::string& value) {
+  writes_.push_back({path, value});
+}
+
+const GadgetTransaction::Current& GadgetTransaction::lookup(const std::string& path) {
+  auto it = current_.find(path);
+  if (it != current_.end()) return it->second;
+
+  Current cur;
+  cur.readable = attribute_read(path, cur.value);
+  return current_.emplace(path, std::move(cur)).first->second;
+}
+
+const std::string& GadgetTransaction::current(const std::string& path) {
+  return lookup(path).value;
+}
+
+bool GadgetTransaction::matches(const std::string& path, const std::string& value) {
+  const Current& cur = lookup(path);
+  return cur.readable && values_equal(path, cur.value, value);
+}
+
+std::vector<size_t> GadgetTransaction::plan() {
+  TRACE_SPAN("transaction_plan");
+  // Simulate the staged writes in order so repeated writes to one
+  // attribute are compared against the value left by the previous one
+  std::unordered_map<std::string, const std::string*> simulated;
+  std::vector<size_t> needed;
+
+  for (size_t i = 0; i < writes_.size(); i++) {
+    const Write& w = writes_[i];
+    auto it = simulated.find(w.path);
+    bool differs;
+    if (it != simulated.end()) {
+      differs = !values_equal(w.path, *it->second, w.value);
+    } else {
+      const Current& cur = lookup(w.path);
+      differs = !cur.readable || !values_equal(w.path, cur.value, w.value);
+    }
+    if (differs) {
+      needed.push_back(i);
+    }
+    simulated[w.path] = &w.value;
+  }
+  return needed;
+}
+
+size_t GadgetTransaction::pending() {
+  return plan().size();
+}
+
+size_t GadgetTransaction::pending_under(const std::string& prefix) {
+  std::string dir = prefix;
+  if (!dir.empty() && dir.back() != '/') dir += '/';
+
+  size_t count = 0;
+  for (size_t index : plan()) {
+    if (writes_[index].path.compare(0, dir.size(), dir) == 0) count++;
+  }
+  return count;
+}
+
+bool GadgetTransaction::commit() {
+  TRACE_SPAN("transaction_commit");
+  std::vector<size_t> needed = plan();
+  std::vector<size_t> done;
+  written_ = 0;
+
+  for (size_t index : needed) {
+    const Write& w = writes_[index];
+    LOG_DEBUG("Write: " + w.value + " -> " + w.path);
+
+    int err = 0;
+    if (attribute_write(w.path, w.value, &err)) {
+      done.push_back(index);
+      continue;
+    }
+
+    log_error("Failed to write " + w.path + ": " + std::strerror(err));
+
+    // Restore every attribute this transaction touched, newest first,
+    // to the value it held before the transaction started
+    for (auto it = done.rbegin(); it != done.rend(); ++it) {
+      const Write& prev = writes_[*it];
+      const Current& cur = lookup(prev.path);
+      if (!cur.readable) continue;
+      LOG_DEBUG("Restore: " + cur.value + " -> " + prev.path);
+      if (!attribute_write(prev.path, cur.value)) {
+        log_warn("Failed to restore " + prev.path);
+      }
+    }
+    return false;
+  }
+
+  written_ = done.size();
+  LOG_DEBUG("Transaction wrote " + std::to_string(written_) + " of " +
+            std::to_string(writes_.size()) + " staged attributes");
+  return true;
+}
@@ -0,0 +1,312 @@
+#include "hotpages.h"
+#include "logger.h"
+#include "trace.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+    const char* const MAP_HEADER = "isodrive-hot-pages 2";
+    const char* const MAP_EXTENSION = ".pages";
+    const char* const BASELINE_EXTENSION = ".base";
+
+    // Age of a page that is not hot
+    const uint32_t NOT_HOT = UINT32_MAX;
+}
+
+// Helper: Path of the page map for one image version
+static std::string map_path(const ImageKey& key) {
+  return hot_pages_dir() + "/" + image_key_name(key) + MAP_EXTENSION;
+}
+
+// Helper: Path of the session baseline for one image version
+static std::string baseline_path(const ImageKey& key) {
+  return hot_pages_dir() + "/" + image_key_name(key) + BASELINE_EXTENSION;
+}
+
+// Helper: Turn a residency vector into runs, merging runs up to merge_gap pages apart
+static void residency_runs(const unsigned char* residency, size_t pages, size_t page_size, size_t merge_gap,
+                           std::vector<PageRange>& ranges) {
+  ranges.clear();
+  size_t i = 0;
+  while (i < pages) {
+    if (!(residency[i] & 1)) {
+      i++;
+      continue;
+    }
+    size_t start = i;
+    size_t end = i + 1;
+    // Extend the run across resident pages and short holes
+    size_t j = end;
+    while (j < pages && j - end <= merge_gap) {
+      if (residency[j] & 1) end = j + 1;
+      j++;
+    }
+    ranges.push_back({static_cast<uint64_t>(start) * page_size,
+                      static_cast<uint64_t>(end - start) * page_size});
+    i = end;
+  }
+}
+
+void hot_pages_from_residency(const unsigned char* residency, size_t pages, size_t page_size,
+                              std::vector<PageRange>& ranges) {
+  residency_runs(residency, pages, page_size, HOT_PAGES_MERGE_GAP, ranges);
+}
+
+bool hot_pages_snapshot(const std::string& path, std::vector<PageRange>& ranges, size_t merge_gap) {
+  ranges.clear();
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return true;
+  }
+
+  // Mapping does not fault anything in; mincore() only reports
+  size_t length = static_cast<size_t>(st.st_size);
+  void* map = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    LOG_DEBUG("Cannot map " + path + ": " + std::string(std::strerror(errno)));
+    return false;
+  }
+
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t pages = (length + page_size - 1) / page_size;
+  std::vector<unsigned char> residency(pages);
+  bool ok = mincore(map, length, residency.data()) == 0;
+  munmap(map, length);
+  if (!ok) {
+    LOG_DEBUG("mincore failed on " + path + ": " + std::string(std::strerror(errno)));
+    return false;
+  }
+
+  residency_runs(residency.data(), pages, page_size, merge_gap, ranges);
+  return true;
+}
+
+// Helper: Write ranges to a file
+static bool write_ranges(const std::string& path, const std::vector<PageRange>& ranges) {
+  std::ostringstream out;
+  out << MAP_HEADER << "\n";
+  for (const PageRange& range : ranges) {
+    out << range.offset << ' ' << range.length << ' ' << range.age << "\n";
+  }
+  std::string data = out.str();
+
+  // A map is only a hint, so it is not fsync()ed; a torn map fails to
+  // parse and is ignored
+  int err = 0;
+  if (!write_file_atomic(path, data, false, &err)) {
+    LOG_DEBUG("Failed to update page map " + path + ": " + std::strerror(err));
+    return false;
+  }
+  return true;
+}
+
+// Helper: Read ranges saved by write_ranges(), rejecting unordered or out-of-bounds ones
+static bool read_ranges(const std::string& path, uint64_t size, std::vector<PageRange>& ranges) {
+  ranges.clear();
+  std::ifstream file(path);
+  std::string line;
+  if (!file || !std::getline(file, line) || line != MAP_HEADER) {
+    return false;
+  }
+
+  uint64_t end = 0;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    PageRange range;
+    if (!(fields >> range.offset >> range.length >> range.age) || range.length == 0 ||
+        range.offset < end || range.offset > size) {
+      ranges.clear();
+      return false;
+    }
+    end = range.offset + range.length;
+    ranges.push_back(range);
+  }
+  return true;
+}
+
+std::string hot_pages_dir() {
+  return probe_cache_dir() + "/hotpages";
+}
+
+bool hot_pages_save(const ImageKey& key, const std::vector<PageRange>& ranges) {
+  std::string dir = hot_pages_dir();
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    LOG_DEBUG("Cannot create page map directory " + dir + ": " + ec.message());
+    return false;
+  }
+
+  // Maps of older versions of this file can never match again
+  std::string prefix = image_key_prefix(key);
+  std::string current = image_key_name(key) + ".";
+  for (const auto& entry : fs::directory_iterator(dir, ec)) {
+    std::string name = entry.path().filename().string();
+    if (name.compare(0, prefix.size(), prefix) == 0 && name.compare(0, current.size(), current) != 0) {
+      fs::remove(entry.path(), ec);
+    }
+  }
+  return write_ranges(map_path(key), ranges);
+}
+
+bool hot_pages_load(const ImageKey& key, std::vector<PageRange>& ranges) {
+  return read_ranges(map_path(key), key.size, ranges);
+}
+
+bool hot_pages_mark_baseline(const std::string& path) {
+  TraceSpan span("hot_pages_mark_baseline");
+  span.detail(path);
+  ImageKey key;
+  std::vector<PageRange> ranges;
+  if (!image_key(path, key) || !hot_pages_snapshot(path, ranges, 0)) {
+    return false;
+  }
+  std::error_code ec;
+  fs::create_directories(hot_pages_dir(), ec);
+  return write_ranges(baseline_path(key), ranges);
+}
+
+// Helper: Set value for the pages covered by ranges
+template <typename T>
+static void mark_pages(const std::vector<PageRange>& ranges, size_t page_size, std::vector<T>& pages,
+                       const T& value) {
+  for (const PageRange& range : ranges) {
+    size_t first = static_cast<size_t>(range.offset / page_size);
+    size_t last = std::min(pages.size(), static_cast<size_t>((range.offset + range.length + page_size - 1) / page_size));
+    for (size_t p = first; p < last; p++) {
+      pages[p] = value;
+    }
+  }
+}
+
+// Helper: Turn per-page ages into runs of one age, merging runs up to
+// HOT_PAGES_MERGE_GAP pages apart
+static void age_runs(const std::vector<uint32_t>& ages, size_t page_size, std::vector<PageRange>& ranges) {
+  ranges.clear();
+  size_t i = 0;
+  while (i < ages.size()) {
+    if (ages[i] == NOT_HOT) {
+      i++;
+      continue;
+    }
+    size_t start = i;
+    size_t end = i + 1;
+    // Extend the run across pages of the same age and short holes
+    size_t j = end;
+    while (j < ages.size() && j - end <= HOT_PAGES_MERGE_GAP) {
+      if (ages[j] != NOT_HOT) {
+        if (ages[j] != ages[start]) break;
+        end = j + 1;
+      }
+      j++;
+    }
+    ranges.push_back({static_cast<uint64_t>(start) * page_size,
+                      static_cast<uint64_t>(end - start) * page_size, ages[start]});
+    i = end;
+  }
+}
+
+bool hot_pages_record(const std::string& path) {
+  TraceSpan span("hot_pages_record");
+  span.detail(path);
+  ImageKey key;
+  std::vector<PageRange> resident;
+  if (!image_key(path, key) || !hot_pages_snapshot(path, resident, 0)) {
+    return false;
+  }
+
+  // Pages resident at the start of the session were read by isodrive
+  // (probe, verify, warm-up, prefetch) or left over from earlier use;
+  // those the previous map already called hot age by one session
+  std::vector<PageRange> baseline, previous;
+  std::string base = baseline_path(key);
+  bool have_baseline = read_ranges(base, key.size, baseline);
+  unlink(base.c_str());
+  hot_pages_load(key, previous);
+
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t pages = static_cast<size_t>((key.size + page_size - 1) / page_size);
+  std::vector<unsigned char> now(pages), before(pages);
+  std::vector<uint32_t> ages(pages, NOT_HOT);
+  mark_pages(resident, page_size, now, static_cast<unsigned char>(1));
+  mark_pages(baseline, page_size, before, static_cast<unsigned char>(1));
+  for (const PageRange& range : previous) {
+    mark_pages({range}, page_size, ages, range.age < HOT_PAGES_MAX_AGE ? range.age + 1 : NOT_HOT);
+  }
+  for (size_t p = 0; p < pages; p++) {
+    if (!now[p]) {
+      ages[p] = NOT_HOT;
+    } else if (have_baseline && !before[p]) {
+      ages[p] = 0;
+    }
+  }
+
+  std::vector<PageRange> ranges;
+  age_runs(ages, page_size, ranges);
+  if (ranges.empty()) {
+    // A map whose ranges all went cold would keep prefetching them
+    unlink(map_path(key).c_str());
+    return false;
+  }
+
+  uint64_t hot_bytes = 0;
+  for (const PageRange& range : ranges) {
+    hot_bytes += range.length;
+  }
+  LOG_DEBUG("Recorded " + std::to_string(hot_bytes >> 10) + " KiB in " + std::to_string(ranges.size()) +
+            " hot ranges of " + path);
+  return hot_pages_save(key, ranges);
+}
+
+uint64_t hot_pages_prefetch(const std::string& path, uint64_t budget) {
+  ImageKey key;
+  std::vector<PageRange> ranges;
+  if (!image_key(path, key) || !hot_pages_load(key, ranges) || ranges.empty()) {
+    return 0;
+  }
+
+  TraceSpan span("hot_pages_prefetch");
+  span.detail(path);
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+
+  uint64_t issued = 0;
+  for (const PageRange& range : ranges) {
+    if (issued >= budget) break;
+    uint64_t length = std::min(range.length, budget - issued);
+    if (posix_fadvise(fd, static_cast<off_t>(range.offset), static_cast<off_t>(length),
+                      POSIX_FADV_WILLNEED) != 0) {
+      break;
+    }
+    issued += length;
+  }
+  close(fd);
+
+  LOG_DEBUG("Prefetching " + std::to_string(issued >> 10) + " KiB of hot ranges of " + path);
+  return issued;
+}
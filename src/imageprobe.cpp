@@ -0,0 +1,342 @@
+#include "imageprobe.h"
+#include "eltorito.h"
+#include "iso9660.h"
+#include "patternscan.h"
+#include "logger.h"
+#include "trace.h"
+#include "udf.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Helper: pread() until len bytes are read, EOF or an error
+static ssize_t pread_full(int fd, void* buf, size_t len, uint64_t offset) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pread(fd, static_cast<char*>(buf) + done, len - done,
+                      static_cast<off_t>(offset + done));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) break;
+    done += static_cast<size_t>(n);
+  }
+  return static_cast<ssize_t>(done);
+}
+
+ImageProbe::ImageProbe(const std::string& path, size_t head_sectors)
+    : path_(path), fd_(-1), size_(0) {
+  fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    LOG_DEBUG("Cannot open image for probing: " + path);
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd_, &st) == 0) {
+    size_ = static_cast<uint64_t>(st.st_size);
+  }
+
+  // One read covers the system area and the volume descriptors
+  head_.resize(head_sectors * ISO_SECTOR_SIZE);
+  ssize_t n = pread_full(fd_, head_.data(), head_.size(), 0);
+  if (n < 0) {
+    LOG_DEBUG("Failed to read image head: " + path);
+    n = 0;
+  }
+  head_.resize(static_cast<size_t>(n));
+  LOG_DEBUG("Probe loaded " + std::to_string(n) + " bytes from " + path);
+}
+
+ImageProbe::~ImageProbe() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+const unsigned char* ImageProbe::head(uint64_t offset, size_t len) const {
+  if (offset + len > head_.size()) return nullptr;
+  return head_.data() + offset;
+}
+
+const unsigned char* ImageProbe::sector(uint64_t lba) {
+  const unsigned char* cached = head(lba * ISO_SECTOR_SIZE, ISO_SECTOR_SIZE);
+  if (cached) return cached;
+  if (fd_ < 0) return nullptr;
+
+  auto it = sectors_.find(lba);
+  if (it != sectors_.end()) return it->second.data();
+
+  std::vector<unsigned char> buffer(ISO_SECTOR_SIZE);
+  if (!read(lba * ISO_SECTOR_SIZE, buffer.data(), buffer.size())) {
+    return nullptr;
+  }
+  return sectors_.emplace(lba, std::move(buffer)).first->second.data();
+}
+
+bool ImageProbe::read(uint64_t offset, void* buf, size_t len) const {
+  if (fd_ < 0) return false;
+  return pread_full(fd_, buf, len, offset) == static_cast<ssize_t>(len);
+}
+
+// Helper: Check for the MBR boot signature (0x55AA) at offset 510-511
+static bool detect_hybrid(const ImageProbe& probe) {
+  const unsigned char* sig = probe.head(510, 2);
+  if (!sig) {
+    LOG_DEBUG("Image too small for hybrid check: " + probe.path());
+    return false;
+  }
+  bool is_hybrid = (sig[0] == 0x55 && sig[1] == 0xAA);
+  LOG_DEBUG("ISO " + probe.path() + " hybrid check: " + (is_hybrid ? "true" : "false"));
+  return is_hybrid;
+}
+
+// Helper: Extract the volume label from the ISO 9660 Primary Volume Descriptor
+static bool read_iso_volume_label(ImageProbe& probe, std::string& volume_id) {
+  const unsigned char* pvd = probe.sector(ISO_PVD_SECTOR);
+  if (!pvd) {
+    return false;
+  }
+
+  // Verify this is a Primary Volume Descriptor
+  // Byte 0: Type (1 = PVD)
+  // Bytes 1-5: "CD001"
+  if (pvd[0] != 1 || std::memcmp(pvd + 1, "CD001", 5) != 0) {
+    LOG_DEBUG("Not a valid ISO 9660 Primary Volume Descriptor");
+    return false;
+  }
+
+  // Volume Identifier is at offset 40, 32 bytes, space-padded
+  volume_id.assign(reinterpret_cast<const char*>(pvd + 40), 32);
+
+  // Trim trailing spaces
+  size_t end = volume_id.find_last_not_of(' ');
+  if (end != std::string::npos) {
+    volume_id.resize(end + 1);
+  } else {
+    volume_id.clear();
+  }
+
+  LOG_DEBUG("ISO volume label: " + volume_id);
+  return true;
+}
+
+// Helper: Check if the volume label matches known Windows installer patterns
+static bool iso_contains_windows_markers(const std::string& volume_label) {
+  std::string upper_label = volume_label;
+  std::transform(upper_label.begin(), upper_label.end(), upper_label.begin(), ::toupper);
+
+  // Common Windows ISO volume labels
+  if (upper_label.find("WIN") != std::string::npos) return true;
+  if (upper_label.find("WINDOWS") != std::string::npos) return true;
+  if (upper_label.find("CCCOMA") != std::string::npos) return true;  // Windows Media Creation Tool
+  if (upper_label.find("ESD-ISO") != std::string::npos) return true;  // Windows ESD
+  if (upper_label.find("J_CCSA") != std::string::npos) return true;   // Some Windows ISOs
+  if (upper_label.find("CPBA") != std::string::npos) return true;     // Some Windows ISOs
+
+  return false;
+}
+
+// Helper: Detect Windows version from volume label
+static WindowsVersion detect_version_from_label(const std::string& volume_label) {
+  std::string upper_label = volume_label;
+  std::transform(upper_label.begin(), upper_label.end(), upper_label.begin(), ::toupper);
+
+  // Windows 11 patterns
+  if (upper_label.find("WIN11") != std::string::npos) return WindowsVersion::WIN11;
+  if (upper_label.find("WINDOWS 11") != std::string::npos) return WindowsVersion::WIN11;
+  if (upper_label.find("W11") != std::string::npos) return WindowsVersion::WIN11;
+
+  // Windows 10 patterns
+  if (upper_label.find("WIN10") != std::string::npos) return WindowsVersion::WIN10;
+  if (upper_label.find("WINDOWS 10") != std::string::npos) return WindowsVersion::WIN10;
+  if (upper_label.find("W10") != std::string::npos) return WindowsVersion::WIN10;
+
+  // CCCOMA_X64FRE and friends are Media Creation Tool ISOs; the label
+  // alone does not tell Windows 10 from Windows 11
+  return WindowsVersion::WIN_UNKNOWN;
+}
+
+// Helper: Check the directory tree for files only Windows installers ship
+static bool iso_contains_windows_files(Iso9660Reader& iso, UdfReader& udf) {
+  if (iso.valid() && (iso.exists("/sources/install.wim") || iso.exists("/sources/install.esd"))) {
+    LOG_DEBUG("Found Windows install image in ISO");
+    return true;
+  }
+
+  // UDF bridge images may hide the installer tree from the ISO 9660 side
+  if (!udf.valid()) return false;
+  static const char* const images[] = {"/sources/install.wim", "/sources/install.esd"};
+  for (const char* image : images) {
+    IsoFileInfo file;
+    if (udf.lookup(image, file) && !file.is_dir) {
+      LOG_DEBUG(std::string("Found Windows install image ") + image + " on UDF volume: " +
+                std::to_string(file.size) + " bytes in " + std::to_string(file.extents.size()) +
+                " extent(s)" + (file.extents.empty() ? "" : " from sector " +
+                                std::to_string(file.extents.front().lba)));
+      return true;
+    }
+  }
+  return false;
+}
+
+// Helper: Look for El Torito and UEFI boot support
+static void search_iso_for_bootloader(ImageProbe& probe, const BootCatalog* catalog, Iso9660Reader& iso,
+                                      UdfReader& udf, bool& has_uefi, bool& has_legacy) {
+  has_uefi = false;
+  has_legacy = false;
+
+  // The boot catalog names the platform of every boot image
+  if (catalog) {
+    has_legacy = catalog->has_bios;
+    has_uefi = catalog->has_uefi;
+    return;
+  }
+
+  // Without a readable catalog, fall back to the boot record and file heuristics.
+  // Check for El Torito signature in the Boot Record at sector 17
+  // Byte 0: Type (0 = Boot Record)
+  // Bytes 1-5: "CD001"
+  // Bytes 7-38: "EL TORITO SPECIFICATION"
+  const unsigned char* boot = probe.sector(ELTORITO_BOOT_RECORD_SECTOR);
+  if (boot && boot[0] == 0 && std::memcmp(boot + 1, "CD001", 5) == 0) {
+    if (std::memcmp(boot + 7, "EL TORITO SPECIFICATION", 23) == 0) {
+      LOG_DEBUG("Found El Torito boot record");
+      has_legacy = true;
+    }
+  }
+
+  // With a readable directory tree, UEFI support is the presence of a
+  // removable-media boot loader
+  if (iso.valid() || udf.valid()) {
+    static const char* const loaders[] = {
+      "/efi/boot/bootx64.efi", "/efi/boot/bootaa64.efi", "/efi/boot/bootia32.efi"
+    };
+    for (const char* loader : loaders) {
+      if (iso.exists(loader) || udf.exists(loader)) {
+        LOG_DEBUG(std::string("Found UEFI boot loader ") + loader);
+        has_uefi = true;
+        break;
+      }
+    }
+    return;
+  }
+
+  // Otherwise fall back to looking for EFI signatures in the volume descriptors
+  static const PatternScanner markers({{"EFI BOOT", 1}, {"efi", 1}, {"BOOTX64", 1}});
+  for (uint64_t lba = ISO_PVD_SECTOR; lba < 20 && !has_uefi; lba++) {
+    const unsigned char* data = probe.sector(lba);
+    if (!data) break;
+    if (markers.scan(data, ISO_SECTOR_SIZE)) {
+      has_uefi = true;
+      LOG_DEBUG("Found UEFI boot markers in ISO");
+    }
+  }
+
+  // Most modern Windows ISOs are dual-boot (UEFI + Legacy), so an
+  // El Torito image without explicit markers is assumed to be UEFI capable
+  if (has_legacy && !has_uefi) {
+    LOG_DEBUG("Assuming UEFI support for modern Windows ISO");
+    has_uefi = true;
+  }
+}
+
+ImageProbeResult ImageProbe::run() {
+  ImageProbeResult result = {};
+  result.windows.version = WindowsVersion::NONE;
+
+  if (!is_open()) {
+    return result;
+  }
+  result.readable = true;
+  result.size = size_;
+  result.is_hybrid = detect_hybrid(*this);
+
+  // A few sector reads catch a truncated download before the host boots it
+  PartitionTable table;
+  read_partition_table(*this, table);
+  result.partitions = table.scheme;
+  result.has_esp = table.esp >= 0;
+  result.declared_size = table.declared_size;
+  result.truncated = table.truncated;
+  fingerprint_bootloaders(*this, result.bootloaders);
+
+  WindowsIsoInfo& info = result.windows;
+  result.is_iso9660 = read_iso_volume_label(*this, info.volume_label);
+  if (!result.is_iso9660) {
+    LOG_DEBUG("Could not read volume label from: " + path_);
+    return result;
+  }
+
+  TRACE_SPAN("probe_iso9660");
+  // Any ISO can carry an El Torito catalog, not only Windows media
+  BootCatalog catalog;
+  bool have_catalog = read_boot_catalog(*this, catalog);
+  if (have_catalog) {
+    result.boot_uefi = catalog.has_uefi;
+    result.boot_legacy = catalog.has_bios;
+  }
+
+  Iso9660Reader iso(*this);
+  UdfReader udf(*this);
+  info.is_windows = iso_contains_windows_markers(info.volume_label) ||
+                    iso_contains_windows_files(iso, udf);
+  if (!info.is_windows) {
+    return result;
+  }
+
+  info.version = detect_version_from_label(info.volume_label);
+  search_iso_for_bootloader(*this, have_catalog ? &catalog : nullptr, iso, udf, info.has_uefi, info.has_legacy);
+  result.boot_uefi = info.has_uefi;
+  result.boot_legacy = info.has_legacy;
+
+  LOG_DEBUG("Windows ISO detected: " + info.volume_label +
+            ", version: " + windows_version_to_string(info.version) +
+            ", UEFI: " + (info.has_uefi ? "yes" : "no") +
+            ", Legacy: " + (info.has_legacy ? "yes" : "no"));
+
+  return result;
+}
+
+ImageProbeResult probe_image(const std::string& path) {
+  TraceSpan span("probe_image");
+  span.detail(path);
+  ImageProbe probe(path);
+  return probe.run();
+}
+
+void probe_result_write(std::ostream& out, const ImageProbeResult& result) {
+  out << result.is_hybrid << ' ' << result.is_iso9660 << ' ' << result.windows.is_windows << ' '
+      << result.boot_uefi << ' ' << result.boot_legacy << ' '
+      << static_cast<int>(result.windows.version) << ' ' << static_cast<int>(result.partitions) << ' '
+      << result.has_esp << ' ' << result.declared_size << ' ' << result.truncated << ' '
+      << result.bootloaders.system_area << ' ' << result.bootloaders.boot_images;
+}
+
+bool probe_result_read(std::istream& in, ImageProbeResult& result) {
+  int hybrid, iso9660, windows, uefi, legacy, version, scheme, esp, truncated;
+  if (!(in >> hybrid >> iso9660 >> windows >> uefi >> legacy >> version >> scheme >> esp >>
+        result.declared_size >> truncated >> result.bootloaders.system_area >> result.bootloaders.boot_images)) {
+    return false;
+  }
+  result.is_hybrid = hybrid != 0;
+  result.is_iso9660 = iso9660 != 0;
+  result.windows.is_windows = windows != 0;
+  result.boot_uefi = uefi != 0;
+  result.boot_legacy = legacy != 0;
+  result.windows.has_uefi = result.windows.is_windows && result.boot_uefi;
+  result.windows.has_legacy = result.windows.is_windows && result.boot_legacy;
+  result.windows.version = static_cast<WindowsVersion>(version);
+  result.partitions = static_cast<PartitionScheme>(scheme);
+  result.has_esp = esp != 0;
+  result.truncated = truncated != 0;
+  return true;
+}
@@ -0,0 +1,184 @@
+#include "imagereader.h"
+#include "logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+ImageReader::ImageReader(int fd, uint64_t size) : fd_(fd), size_(size), slots_(SLOT_COUNT) {
+  for (Slot& slot : slots_) {
+    slot.data.resize(CHUNK_SIZE);
+  }
+  if (ring_.init(SLOT_COUNT)) {
+    LOG_DEBUG("Image reads use io_uring");
+  }
+}
+
+ImageReader::~ImageReader() {
+  // Reads still in flight target the slot buffers
+  drain();
+}
+
+int ImageReader::find(uint64_t chunk) const {
+  for (size_t i = 0; i < slots_.size(); i++) {
+    if (slots_[i].state != SlotState::EMPTY && slots_[i].chunk == chunk) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+int ImageReader::allocate(uint64_t chunk) {
+  // Reuse the least recently used slot that has no read in flight
+  int victim = -1;
+  for (size_t i = 0; i < slots_.size(); i++) {
+    const Slot& slot = slots_[i];
+    if (slot.state == SlotState::PENDING) continue;
+    if (victim < 0 || slot.state == SlotState::EMPTY ||
+        (slots_[victim].state != SlotState::EMPTY && slot.last_used < slots_[victim].last_used)) {
+      victim = static_cast<int>(i);
+      if (slot.state == SlotState::EMPTY) break;
+    }
+  }
+  if (victim < 0) return -1;
+
+  Slot& slot = slots_[victim];
+  slot.chunk = chunk;
+  slot.state = SlotState::EMPTY;
+  slot.length = static_cast<size_t>(std::min<uint64_t>(CHUNK_SIZE, size_ - chunk * CHUNK_SIZE));
+  slot.last_used = ++clock_;
+  return victim;
+}
+
+void ImageReader::fetch(int index) {
+  Slot& slot = slots_[index];
+  uint64_t offset = slot.chunk * CHUNK_SIZE;
+  if (ring_.ready()) {
+    slot.state = SlotState::PENDING;
+    if (ring_.queue_read(fd_, slot.data.data(), slot.length, offset, static_cast<uint64_t>(index))) {
+      return;
+    }
+    // Queue full: push what is queued and fall back to a synchronous read
+    ring_.submit();
+  }
+
+  size_t done = 0;
+  while (done < slot.length) {
+    ssize_t n = pread(fd_, slot.data.data() + done, slot.length - done, static_cast<off_t>(offset + done));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    done += static_cast<size_t>(n);
+  }
+  complete(static_cast<uint64_t>(index), done == slot.length ? static_cast<int>(done) : -EIO);
+}
+
+void ImageReader::complete(uint64_t index, int result) {
+  if (index >= slots_.size()) return;
+  Slot& slot = slots_[index];
+  if (result == static_cast<int>(slot.length)) {
+    slot.state = SlotState::READY;
+  } else {
+    LOG_DEBUG("Read of chunk " + std::to_string(slot.chunk) + " failed: " +
+              (result < 0 ? std::string(std::strerror(-result)) : "short read"));
+    slot.state = SlotState::FAILED;
+  }
+}
+
+void ImageReader::reap_ready() {
+  uint64_t index;
+  int result;
+  while (ring_.reap(index, result, false)) {
+    complete(index, result);
+  }
+}
+
+void ImageReader::drain() {
+  uint64_t index;
+  int result;
+  while (ring_.in_flight() > 0 && ring_.reap(index, result, true)) {
+    complete(index, result);
+  }
+}
+
+const uint8_t* ImageReader::read(uint64_t offset, size_t max, size_t& len) {
+  len = 0;
+  if (offset >= size_ || max == 0) return nullptr;
+  reap_ready();
+
+  uint64_t chunk = offset / CHUNK_SIZE;
+  int index = find(chunk);
+  if (index < 0 || slots_[index].state == SlotState::FAILED) {
+    if (index < 0) index = allocate(chunk);
+    if (index < 0) {
+      drain();
+      index = allocate(chunk);
+    }
+    fetch(index);
+  }
+  slots_[index].last_used = ++clock_;
+
+  // Keep the chunks after a sequential reader in flight
+  bool sequential = chunk == last_chunk_ || chunk == last_chunk_ + 1;
+  last_chunk_ = chunk;
+  uint64_t last = (size_ - 1) / CHUNK_SIZE;
+  for (uint64_t ahead = chunk + 1; sequential && ahead <= std::min(last, chunk + READAHEAD_CHUNKS); ahead++) {
+    if (find(ahead) >= 0) continue;
+    if (ring_.ready()) {
+      int slot = allocate(ahead);
+      if (slot < 0) break;
+      fetch(slot);
+    } else {
+      posix_fadvise(fd_, static_cast<off_t>(ahead * CHUNK_SIZE),
+                    static_cast<off_t>((std::min(last, chunk + READAHEAD_CHUNKS) - ahead + 1) * CHUNK_SIZE),
+                    POSIX_FADV_WILLNEED);
+      break;
+    }
+  }
+  ring_.submit();
+
+  uint64_t done;
+  int result;
+  while (slots_[index].state == SlotState::PENDING) {
+    if (!ring_.reap(done, result, true)) {
+      slots_[index].state = SlotState::FAILED;
+      break;
+    }
+    complete(done, result);
+  }
+
+  const Slot& slot = slots_[index];
+  if (slot.state != SlotState::READY) return nullptr;
+  size_t within = static_cast<size_t>(offset - chunk * CHUNK_SIZE);
+  len = std::min(max, slot.length - within);
+  return slot.data.data() + within;
+}
+
+bool ImageReader::write(uint64_t offset, const uint8_t* data, size_t len) {
+  if (len == 0) return true;
+
+  // Let in-flight reads land before dropping the chunks they fill
+  drain();
+  uint64_t first = offset / CHUNK_SIZE;
+  uint64_t last = (offset + len - 1) / CHUNK_SIZE;
+  for (Slot& slot : slots_) {
+    if (slot.state != SlotState::EMPTY && slot.chunk >= first && slot.chunk <= last) {
+      slot.state = SlotState::EMPTY;
+    }
+  }
+
+  while (len > 0) {
+    ssize_t n = pwrite(fd_, data, len, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    len -= static_cast<size_t>(n);
+    offset += static_cast<uint64_t>(n);
+  }
+  return true;
+}
+
+bool ImageReader::flush() {
+  return fdatasync(fd_) == 0;
+}
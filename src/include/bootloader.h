@@ -0,0 +1,78 @@
+#ifndef BOOTLOADER_H
+#define BOOTLOADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class ImageProbe;
+
+/**
+ * @file bootloader.h
+ * @brief Boot loader fingerprinting of the system area and boot images.
+ *
+ * The system area (the first 32 KiB, where isohybrid and disk images
+ * keep their MBR boot code) tells what a firmware runs when the image
+ * is attached as a disk. The El Torito boot images tell what it runs
+ * when the image is attached as a CD-ROM. Both are searched for the
+ * identifying strings of each boot loader in one pass per region.
+ */
+
+/**
+ * @brief Boot loader bits of a fingerprint.
+ */
+constexpr uint32_t BOOTLOADER_GRUB = 1u << 0;
+constexpr uint32_t BOOTLOADER_ISOLINUX = 1u << 1;
+constexpr uint32_t BOOTLOADER_SYSLINUX = 1u << 2;
+constexpr uint32_t BOOTLOADER_SYSTEMD_BOOT = 1u << 3;
+constexpr uint32_t BOOTLOADER_BOOTMGR = 1u << 4;
+constexpr uint32_t BOOTLOADER_LIMINE = 1u << 5;
+
+/**
+ * @brief Bytes scanned from the start of each El Torito boot image.
+ *
+ * EFI entries often record a load size of 0 or 512 bytes, so the
+ * recorded size is raised to at least 64 KiB and capped here.
+ */
+constexpr uint64_t BOOTLOADER_SCAN_IMAGE_BYTES = 512 * 1024;
+
+/**
+ * @brief Total bytes scanned across all boot images of one image.
+ */
+constexpr uint64_t BOOTLOADER_SCAN_MAX_BYTES = 2 * 1024 * 1024;
+
+/**
+ * @struct BootFingerprint
+ * @brief Boot loaders found in each boot path of an image.
+ */
+struct BootFingerprint {
+    uint32_t system_area;   ///< Loaders in the MBR boot code region (disk boot)
+    uint32_t boot_images;   ///< Loaders in the El Torito boot images (CD-ROM boot)
+};
+
+/**
+ * @brief Search raw bytes for boot loader strings.
+ *
+ * @param data Bytes to search.
+ * @param len Number of bytes.
+ * @return BOOTLOADER_* bits of every loader found.
+ */
+uint32_t scan_bootloaders(const void* data, size_t len);
+
+/**
+ * @brief Fingerprint the system area and boot images of an image.
+ *
+ * @param probe Open probe of the image.
+ * @param fingerprint Receives the loaders found.
+ */
+void fingerprint_bootloaders(ImageProbe& probe, BootFingerprint& fingerprint);
+
+/**
+ * @brief Comma-separated loader names for logs and reports.
+ *
+ * @param loaders BOOTLOADER_* bits.
+ * @return Names such as "grub,isolinux", or an empty string.
+ */
+std::string bootloader_names(uint32_t loaders);
+
+#endif // ifndef BOOTLOADER_H
@@ -0,0 +1,123 @@
+#ifndef BOOTWARM_H
+#define BOOTWARM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file bootwarm.h
+ * @brief Reading the regions a firmware boots from before the host sees them.
+ *
+ * A firmware booting from the gadget first reads the El Torito boot
+ * catalog, the boot images it names, and the EFI system partition
+ * (through El Torito or the hybrid MBR/GPT). With flash-backed images
+ * those reads hit cold storage while the host's timeouts run. This
+ * module finds the regions and reads them into the page cache in
+ * parallel. mount_images() waits for them, within a latency budget,
+ * before it touches the UDC.
+ */
+
+/**
+ * @brief Time mount_images() waits for boot regions to become resident.
+ */
+constexpr int BOOT_WARM_BUDGET_MS = 250;
+
+/**
+ * @brief Maximum number of bytes warmed per image.
+ */
+constexpr uint64_t BOOT_WARM_MAX_BYTES = 64ull << 20;
+
+/**
+ * @brief Maximum size of a single region (boot images, EFI partitions).
+ */
+constexpr uint64_t BOOT_WARM_MAX_REGION = 32ull << 20;
+
+/**
+ * @brief Bytes warmed at the start of partitions that are not EFI system
+ *        partitions (their filesystem headers).
+ */
+constexpr uint64_t BOOT_WARM_PARTITION_HEAD = 1ull << 20;
+
+/**
+ * @brief Number of threads issuing readahead.
+ */
+constexpr unsigned BOOT_WARM_THREADS = 4;
+
+/**
+ * @struct BootRegion
+ * @brief A region of an image read early during boot.
+ */
+struct BootRegion {
+    uint64_t offset;    ///< Start of the region in bytes
+    uint64_t length;    ///< Length of the region in bytes
+    std::string what;   ///< Description for logs ("boot catalog", "EFI system partition", ...)
+};
+
+/**
+ * @brief Find the boot-critical regions of an image.
+ *
+ * Covers the system area and volume descriptors, the El Torito boot
+ * catalog and every boot image it lists, and the partitions of a hybrid
+ * MBR or GPT (EFI system partitions in full, others only their start).
+ * Regions are clipped to the image, to BOOT_WARM_MAX_REGION each and to
+ * budget bytes in total, in that order of priority.
+ *
+ * @param path Image file.
+ * @param regions Receives the regions.
+ * @param budget Maximum total length.
+ * @return false if the image could not be read.
+ */
+bool find_boot_regions(const std::string& path, std::vector<BootRegion>& regions,
+                       uint64_t budget = BOOT_WARM_MAX_BYTES);
+
+/**
+ * @class BootWarmer
+ * @brief Reads the boot regions of a set of images in the background.
+ */
+class BootWarmer {
+public:
+    /**
+     * @brief Find the regions and start reading them.
+     *
+     * @param paths Image files.
+     */
+    explicit BootWarmer(const std::vector<std::string>& paths);
+    ~BootWarmer();
+
+    BootWarmer(const BootWarmer&) = delete;
+    BootWarmer& operator=(const BootWarmer&) = delete;
+
+    /**
+     * @brief Wait until every region is in the page cache.
+     *
+     * @param budget_ms Latency budget, measured from construction.
+     * @return true if every region is resident, false if the budget ran out.
+     */
+    bool wait(int budget_ms = BOOT_WARM_BUDGET_MS);
+
+    /**
+     * @return Total number of bytes being warmed.
+     */
+    uint64_t bytes() const { return bytes_; }
+
+private:
+    struct Target {
+        int fd;
+        std::string path;
+        BootRegion region;
+    };
+
+    bool resident(const Target& target) const;
+
+    std::vector<Target> targets_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_;
+    uint64_t bytes_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif // ifndef BOOTWARM_H
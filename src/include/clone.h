@@ -0,0 +1,110 @@
+#ifndef CLONE_H
+#define CLONE_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @file clone.h
+ * @brief Disposable copy-on-write clones of images for -rw-clone mounts.
+ *
+ * A -rw-clone mount exposes a writable clone of the image instead of the
+ * image itself, so the host can modify the disk without touching the
+ * golden copy. Clones are made with the FICLONE ioctl (a reflink, O(1)
+ * on btrfs, XFS and bcachefs). Where reflinks are unavailable, the
+ * image is copied with copy_file_range(), visiting only its data
+ * segments, so holes stay holes.
+ *
+ * Clones live in a .isodrive-clones directory next to the image, where
+ * a reflink can share its extents. If that directory cannot be
+ * created, they go under the state directory. Each source also keeps
+ * one ready-made clone in a pool, refilled after every clone mount, so
+ * images that are used often are mounted with a single rename().
+ */
+
+/**
+ * @brief Maximum number of sources with a ready-made clone in a pool.
+ */
+constexpr size_t CLONE_POOL_MAX_ENTRIES = 4;
+
+/**
+ * @enum CloneMethod
+ * @brief How a clone was produced.
+ */
+enum class CloneMethod {
+    POOL,       ///< Taken from the pool of ready-made clones
+    REFLINK,    ///< FICLONE shares the source's extents
+    COPY        ///< Sparse copy_file_range() (or read/write) copy
+};
+
+/**
+ * @brief Get a printable name for a clone method.
+ *
+ * @param method Clone method.
+ * @return "pool", "reflink" or "copy".
+ */
+const char* clone_method_name(CloneMethod method);
+
+/**
+ * @brief Directory holding the clones of an image.
+ *
+ * @param source Image file.
+ * @return .isodrive-clones next to the image, or the state directory's
+ *         clones directory if that cannot be created.
+ */
+std::string clone_dir(const std::string& source);
+
+/**
+ * @brief Copy a file into a new file, preferring a reflink.
+ *
+ * @param source File to copy.
+ * @param target New file; replaced if it exists.
+ * @param method Receives REFLINK or COPY.
+ * @param allow_copy Fall back to copying the data when a reflink fails.
+ * @return true if the copy is complete.
+ */
+bool clone_file(const std::string& source, const std::string& target, CloneMethod& method,
+                bool allow_copy = true);
+
+/**
+ * @brief Create a fresh writable clone of an image.
+ *
+ * Takes the source's ready-made clone from the pool when there is one.
+ *
+ * @param source Image file; never modified.
+ * @param clone_path Receives the path of the clone.
+ * @param method Receives how the clone was made.
+ * @return true on success; errors are logged.
+ */
+bool clone_image(const std::string& source, std::string& clone_path, CloneMethod& method);
+
+/**
+ * @brief Make sure a ready-made clone of an image is waiting in the pool.
+ *
+ * Evicts pooled clones of older versions of the image and, beyond
+ * CLONE_POOL_MAX_ENTRIES, of the least recently refilled sources.
+ *
+ * @param source Image file.
+ * @param allow_copy Copy the image where a reflink is unavailable;
+ *        without it the pool is only filled when that is O(1).
+ * @return true if the pool holds a clone of the current version.
+ */
+bool clone_pool_fill(const std::string& source, bool allow_copy = true);
+
+/**
+ * @brief Check whether a path is a clone made by clone_image().
+ *
+ * @param path File path.
+ * @return true for mounted clones (pooled clones are not included).
+ */
+bool is_clone(const std::string& path);
+
+/**
+ * @brief Delete a clone that is no longer mounted.
+ *
+ * @param path Path of the clone; anything that is not a clone is left alone.
+ * @return true if the clone was deleted.
+ */
+bool clone_discard(const std::string& path);
+
+#endif // ifndef CLONE_H
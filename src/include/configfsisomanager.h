@@ -2,6 +2,8 @@
 #define CONFIGFSISOMANAGER_H
 
 #include <string>
+#include <vector>
+#include "gadgetsession.h"
 #include "util.h"
 
 /**
@@ -14,6 +16,9 @@
  * 
  * ConfigFS is typically mounted at /sys/kernel/config on Linux
  * or /config on Android devices.
+ * 
+ * Operations that take a GadgetSession reuse its resolved paths; the
+ * overloads without one build a fresh session for the call.
  */
 
 /**
@@ -28,10 +33,22 @@ struct WindowsMountOptions {
     bool has_legacy;            ///< ISO has legacy BIOS boot
 };
 
+/**
+ * @struct LunMedia
+ * @brief Image and settings for one LUN of the mass storage function.
+ */
+struct LunMedia {
+    std::string path;           ///< Image file to expose
+    bool cdrom;                 ///< Present the LUN as a CD-ROM drive
+    bool ro;                    ///< Present the LUN read-only
+    bool windows;               ///< Windows image (forces cdrom/ro when Windows mode is enabled)
+};
+
 /**
  * @brief Check if ConfigFS USB gadget is supported on this system.
  * 
  * Verifies that configfs is mounted and usb_gadget is available.
+ * Equivalent to GadgetSession().supported().
  * 
  * @return true if ConfigFS USB gadget is available, false otherwise.
  */
@@ -65,20 +82,83 @@ std::string get_config_root();
  * 
  * If iso_path is empty, unmounts any currently mounted ISO.
  * 
+ * When the function is already linked (see prepare_mass_storage()) and
+ * only the medium changes, the image is swapped in place without a UDC
+ * cycle. If nothing changes at all, the gadget is left untouched.
+ * 
  * @param iso_path Path to the ISO file to mount, or empty to unmount.
  * @param cdrom If true, mount as CD-ROM device.
  * @param ro If true, mount as read-only.
  * @param win_opts Windows-specific mount options.
  * @return true if the operation succeeded, false on error.
  */
+bool mount_iso(GadgetSession& session, const std::string& iso_path, bool cdrom, bool ro, const WindowsMountOptions& win_opts);
 bool mount_iso(const std::string& iso_path, bool cdrom, bool ro, const WindowsMountOptions& win_opts);
 
+/**
+ * @brief Mount several images, one per LUN, in a single UDC cycle.
+ * 
+ * images[i] is exposed on lun.i of mass_storage.0. Missing LUNs are
+ * created and LUNs beyond the list are removed; both require unlinking
+ * the function, which happens inside the same unbind/bind. When only
+ * the media change on an already linked function, they are swapped in
+ * place as with mount_iso().
+ * 
+ * An empty list unmounts everything.
+ * 
+ * @param images Images in LUN order.
+ * @param win_opts Windows descriptor options; applied to the gadget and
+ *        to the LUNs whose image is marked windows.
+ * @return true if the operation succeeded, false on error.
+ */
+bool mount_images(GadgetSession& session, const std::vector<LunMedia>& images, const WindowsMountOptions& win_opts);
+
+/**
+ * @brief Link an empty, removable mass storage function into the config.
+ * 
+ * Performs one UDC cycle so that later mount_iso() calls can swap the
+ * medium through lun.0/forced_eject and lun.0/file without unbinding,
+ * which the host sees as a media change rather than a disconnect.
+ * 
+ * @return true if the function is linked and ready, false on error.
+ */
+bool prepare_mass_storage(GadgetSession& session);
+bool prepare_mass_storage();
+
+/**
+ * @brief Eject the current medium without re-enumerating the device.
+ * 
+ * Writes forced_eject (when supported) and clears file on every LUN
+ * with a medium, leaving the mass storage function linked.
+ * 
+ * @return true if no medium remains mounted, false on error.
+ */
+bool eject_iso(GadgetSession& session);
+bool eject_iso();
+
+/**
+ * @brief Longest time set_udc() keeps retrying a busy UDC, in milliseconds.
+ */
+constexpr int UDC_RETRY_TIMEOUT_MS = 3000;
+
+/**
+ * @brief Longest time set_udc() waits for an unbound UDC to detach, in milliseconds.
+ */
+constexpr int UDC_DETACH_TIMEOUT_MS = 500;
+
 /**
  * @brief Set the USB Device Controller for a gadget.
  * 
  * Binds or unbinds the gadget to/from the UDC. Pass empty string
  * to unbind (disable) the gadget.
  * 
+ * A write refused with EBUSY, EAGAIN or (when binding) ENODEV, as a
+ * controller still tearing down does, is retried with doubling delays
+ * for up to UDC_RETRY_TIMEOUT_MS. Each delay ends early when the UDC's
+ * state attribute changes. Other errors fail at once. After unbinding
+ * a UDC that was attached, the call waits up to UDC_DETACH_TIMEOUT_MS
+ * for it to report "not attached".
+ * 
  * @param udc The UDC name (e.g., "musb-hdrc.0"), or empty to unbind.
  * @param gadget Path to the gadget root.
  * @return true if the UDC was set successfully, false on error.
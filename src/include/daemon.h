@@ -0,0 +1,107 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "gadgetsession.h"
+#include "imageprobe.h"
+#include "mountrequest.h"
+#include "probecache.h"
+
+/**
+ * @file daemon.h
+ * @brief Resident isodrive daemon and its client.
+ *
+ * `isodrive -daemon` keeps a GadgetSession (with its open configfs
+ * directory descriptors) and recent probe results in memory and serves
+ * requests over a Unix socket, so a mount only costs the configfs
+ * writes. When the daemon is running the CLI forwards its request to
+ * it instead of doing the work itself. The wire format is described in
+ * mountrequest.h.
+ *
+ * After answering a -rw-clone request the daemon refills the clone
+ * pools, copying the image where reflinks are unavailable, so the next
+ * clone mount is a rename() without the client waiting for the copy.
+ */
+
+/**
+ * @brief Default socket path.
+ *
+ * /dev/socket/isodrived on Android (when /dev/socket exists) and
+ * /run/isodrived.sock elsewhere.
+ *
+ * @return Socket path.
+ */
+std::string daemon_socket_path();
+
+/**
+ * @class IsoDaemon
+ * @brief Request handler holding the state kept between requests.
+ */
+class IsoDaemon {
+public:
+    /**
+     * @param configfs_root configfs mount point to use instead of
+     *        discovering it (tests pass a fake tree here).
+     */
+    explicit IsoDaemon(const std::string& configfs_root = "");
+
+    /**
+     * @brief Run one encoded request.
+     *
+     * Output logged while running is captured into the response.
+     *
+     * @param request Encoded request.
+     * @return Encoded response ("log" lines then "exit <code>").
+     */
+    std::string handle(const std::string& request);
+
+    /**
+     * @brief Do the work deferred from the last handle() call.
+     *
+     * Called once the response has been sent.
+     */
+    void finish_request();
+
+    /**
+     * @brief Accept requests on a Unix socket until SIGINT/SIGTERM.
+     *
+     * Only root clients are served; the socket is created with mode 0600.
+     *
+     * @param socket_path Socket to listen on.
+     * @return true on clean shutdown, false if the socket could not be set up.
+     */
+    bool serve(const std::string& socket_path);
+
+    /**
+     * @return Number of images whose probe result is held in memory.
+     */
+    size_t cached_probes() const { return probes_.size(); }
+
+private:
+    struct CachedProbe {
+        ImageKey key;
+        ImageProbeResult result;
+    };
+
+    ImageProbeResult probe(const std::string& path);
+    void refresh_session();
+
+    std::string configfs_root_;
+    std::unique_ptr<GadgetSession> session_;
+    std::unordered_map<std::string, CachedProbe> probes_;
+    MountRequest refill_;       ///< Request whose clone pools are refilled after the response
+};
+
+/**
+ * @brief Send a request to a running daemon and replay its output.
+ *
+ * @param request Encoded request.
+ * @param socket_path Daemon socket.
+ * @param exit_code Set to the daemon's exit code when handled.
+ * @return true if a daemon handled the request, false if none is running.
+ */
+bool daemon_forward(const std::string& request, const std::string& socket_path, int& exit_code);
+
+#endif // ifndef DAEMON_H
@@ -0,0 +1,96 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @file digest.h
+ * @brief SHA-256 and MD5 message digests for image verification.
+ *
+ * SHA-256 compresses blocks with the SHA extensions on x86-64
+ * (SHA-NI) and the ARMv8 cryptography extensions on AArch64 when the
+ * CPU reports them, and with portable C++ otherwise. The choice is made
+ * once per process. MD5 is only needed for implantisomd5 checksums and
+ * is always portable C++.
+ */
+
+/**
+ * @class Sha256
+ * @brief Incremental SHA-256 (FIPS 180-4).
+ */
+class Sha256 {
+public:
+    Sha256();
+
+    /**
+     * @brief Add data to the message.
+     *
+     * @param data Message bytes.
+     * @param len Number of bytes.
+     */
+    void update(const void* data, size_t len);
+
+    /**
+     * @brief Finish the message.
+     *
+     * @return Digest as 64 lowercase hex digits; the object must not be updated afterwards.
+     */
+    std::string hex_digest();
+
+    /**
+     * @brief Name of the block function in use.
+     *
+     * @return "sha-ni", "armv8-ce" or "portable".
+     */
+    static const char* implementation();
+
+private:
+    uint32_t state_[8];
+    uint64_t length_;
+    uint8_t buffer_[64];
+    size_t buffered_;
+};
+
+/**
+ * @class Md5
+ * @brief Incremental MD5 (RFC 1321).
+ */
+class Md5 {
+public:
+    Md5();
+
+    /**
+     * @brief Add data to the message.
+     *
+     * @param data Message bytes.
+     * @param len Number of bytes.
+     */
+    void update(const void* data, size_t len);
+
+    /**
+     * @brief Finish the message.
+     *
+     * @return Digest as 32 lowercase hex digits; the object must not be updated afterwards.
+     */
+    std::string hex_digest();
+
+private:
+    uint32_t state_[4];
+    uint64_t length_;
+    uint8_t buffer_[64];
+    size_t buffered_;
+};
+
+/**
+ * @brief Use the portable SHA-256 code even where the CPU has SHA instructions.
+ *
+ * Used by tests and benchmarks to compare implementations; affects
+ * Sha256 objects created or updated afterwards.
+ *
+ * @param force true to force the portable code.
+ */
+void sha256_force_portable(bool force);
+
+#endif // ifndef DIGEST_H
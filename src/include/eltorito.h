@@ -0,0 +1,72 @@
+#ifndef ELTORITO_H
+#define ELTORITO_H
+
+#include <cstdint>
+#include <vector>
+
+class ImageProbe;
+
+/**
+ * @file eltorito.h
+ * @brief El Torito boot catalog parsing.
+ *
+ * The boot record at sector 17 names the catalog sector. The catalog
+ * starts with a checksummed validation entry and the initial/default
+ * entry, followed by sections whose headers give the platform of the
+ * entries under them. Only the first catalog sector (64 entries) is
+ * read, which covers every catalog seen in practice.
+ */
+
+/**
+ * @brief Sector holding the El Torito Boot Record Volume Descriptor.
+ */
+constexpr uint64_t ELTORITO_BOOT_RECORD_SECTOR = 17;
+
+/**
+ * @brief Platform ID of x86 BIOS boot entries.
+ */
+constexpr unsigned char ELTORITO_PLATFORM_BIOS = 0x00;
+
+/**
+ * @brief Platform ID of EFI boot entries.
+ */
+constexpr unsigned char ELTORITO_PLATFORM_EFI = 0xef;
+
+/**
+ * @struct BootEntry
+ * @brief One boot image listed in the catalog.
+ */
+struct BootEntry {
+    unsigned char platform;     ///< Platform ID of the section (0x00 BIOS, 0xEF EFI, ...)
+    bool bootable;              ///< Boot indicator is 0x88
+    unsigned char media;        ///< Emulation: 0 none, 1-3 floppy, 4 hard disk
+    uint16_t sector_count;      ///< Virtual 512-byte sectors the firmware loads
+    uint32_t load_rba;          ///< First 2048-byte sector of the image
+    uint64_t offset;            ///< Start of the image in bytes
+    uint64_t length;            ///< Bytes the firmware loads: the floppy size for floppy
+                                ///< emulation, sector_count * 512 otherwise (EFI images
+                                ///< often leave this at 0 or 512)
+};
+
+/**
+ * @struct BootCatalog
+ * @brief Parsed boot catalog.
+ */
+struct BootCatalog {
+    uint32_t lba = 0;                   ///< Sector of the catalog
+    std::vector<BootEntry> entries;     ///< Initial/default entry first, then section entries
+    bool has_bios = false;              ///< A bootable BIOS entry exists
+    bool has_uefi = false;              ///< A bootable EFI entry exists
+};
+
+/**
+ * @brief Read and validate the boot catalog of an ISO 9660 image.
+ *
+ * @param probe Open probe of the image.
+ * @param catalog Receives the catalog.
+ * @return false if there is no boot record, the catalog cannot be read,
+ *         or its validation entry is malformed.
+ */
+bool read_boot_catalog(ImageProbe& probe, BootCatalog& catalog);
+
+#endif // ifndef ELTORITO_H
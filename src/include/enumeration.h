@@ -0,0 +1,109 @@
+#ifndef ENUMERATION_H
+#define ENUMERATION_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+/**
+ * @file enumeration.h
+ * @brief Waiting for the host to enumerate the gadget after a bind.
+ *
+ * Writing the UDC name only starts enumeration; the host still has to
+ * reset the bus, read the descriptors and pick a configuration. The
+ * UDC reports its progress in /sys/class/udc/<udc>/state, which the
+ * kernel updates with sysfs_notify(), and the negotiated speed in
+ * current_speed.
+ */
+
+/**
+ * @brief Default time to wait for the host, in milliseconds.
+ */
+constexpr int ENUMERATION_DEFAULT_TIMEOUT_MS = 10000;
+
+/**
+ * @struct EnumerationResult
+ * @brief Outcome of waiting for the host.
+ */
+struct EnumerationResult {
+    bool configured = false;    ///< The host selected a configuration
+    std::string state;          ///< Last value of the UDC state attribute
+    std::string speed;          ///< current_speed (e.g. "high-speed")
+    double elapsed_ms = 0;      ///< Time from bind to configured (or to giving up)
+};
+
+/**
+ * @brief Directory holding the UDC class devices.
+ *
+ * @return /sys/class/udc unless overridden.
+ */
+std::string udc_class_root();
+
+/**
+ * @brief Override the UDC class directory (used by tests).
+ *
+ * @param dir New directory, or empty to restore the default.
+ */
+void udc_set_class_root(const std::string& dir);
+
+/**
+ * @brief Read the state attribute of a UDC.
+ *
+ * @param udc UDC name.
+ * @return The state (e.g. "not attached", "configured"), or empty if the
+ *         UDC has no readable state attribute.
+ */
+std::string udc_state(const std::string& udc);
+
+/**
+ * @brief Wait until the UDC state satisfies a condition.
+ *
+ * Uses the same poll() loop as wait_for_configured().
+ *
+ * @param udc UDC name.
+ * @param done Condition on the state value.
+ * @param timeout_ms Give up after this long.
+ * @param state Receives the last state read; empty if the attribute
+ *        cannot be opened, in which case the call returns at once.
+ * @return true if done accepted a state before the timeout.
+ */
+bool wait_for_udc_state(const std::string& udc, const std::function<bool(const std::string&)>& done,
+                        int timeout_ms, std::string& state);
+
+/**
+ * @brief Wait until the UDC reports the "configured" state.
+ *
+ * Blocks in poll() on the state attribute, re-reading it on every
+ * notification and at least every 50 ms in case one is missed.
+ *
+ * @param udc UDC name (e.g. "musb-hdrc.0").
+ * @param since When the gadget was bound; elapsed time is measured from here.
+ * @param timeout_ms Give up this long after since.
+ * @param result Filled with the final state, speed and elapsed time.
+ * @return true if the host configured the device before the timeout.
+ */
+bool wait_for_configured(const std::string& udc, std::chrono::steady_clock::time_point since,
+                         int timeout_ms, EnumerationResult& result);
+
+/**
+ * @brief Format a result as a single-line JSON object.
+ *
+ * @param udc UDC name.
+ * @param result The result.
+ * @return JSON text without a trailing newline.
+ */
+std::string enumeration_to_json(const std::string& udc, const EnumerationResult& result);
+
+/**
+ * @brief Append a result to enumeration.jsonl in the state directory.
+ *
+ * Each line also carries a timestamp and the kernel release so latency
+ * can be compared across hosts and kernels.
+ *
+ * @param udc UDC name.
+ * @param result The result.
+ * @return true if the line was written.
+ */
+bool enumeration_record(const std::string& udc, const EnumerationResult& result);
+
+#endif // ifndef ENUMERATION_H
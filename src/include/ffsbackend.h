@@ -0,0 +1,146 @@
+#ifndef FFSBACKEND_H
+#define FFSBACKEND_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "configfsisomanager.h"
+#include "gadgetsession.h"
+#include "scsi.h"
+
+/**
+ * @file ffsbackend.h
+ * @brief Userspace mass storage over a FunctionFS (ffs) gadget function.
+ *
+ * Instead of handing the image to the kernel's f_mass_storage, isodrive
+ * links an ffs function into the gadget, writes the mass storage
+ * interface descriptors to its ep0, and speaks Bulk-Only Transport on
+ * the two bulk endpoints itself:
+ *
+ *     ep0  control: descriptors, events, Get Max LUN, BOT reset
+ *     ep1  bulk IN:  data to the host and Command Status Wrappers
+ *     ep2  bulk OUT: Command Block Wrappers and data from the host
+ *
+ * Commands are executed by ScsiLun, which reads the image through an
+ * ImageReader (batched io_uring reads with readahead).
+ */
+
+/**
+ * @brief Name of the ffs function in the gadget's functions directory.
+ */
+constexpr const char* FFS_FUNCTION = "ffs.isodrive";
+
+/**
+ * @brief Default FunctionFS mount point (the Android convention).
+ */
+constexpr const char* FFS_DEFAULT_MOUNT = "/dev/usb-ffs/isodrive";
+
+/**
+ * @brief Build the FunctionFS descriptor blob written to ep0.
+ *
+ * One mass storage interface (SCSI transparent, Bulk-Only) with a bulk
+ * IN and a bulk OUT endpoint, at full, high and super speed.
+ *
+ * @return Descriptors in the FUNCTIONFS_DESCRIPTORS_MAGIC_V2 layout.
+ */
+std::vector<uint8_t> ffs_descriptors();
+
+/**
+ * @brief Build the FunctionFS strings blob written to ep0.
+ *
+ * @return Strings in the FUNCTIONFS_STRINGS_MAGIC layout.
+ */
+std::vector<uint8_t> ffs_strings();
+
+/**
+ * @struct FfsEndpoints
+ * @brief Open endpoint files of an ffs instance.
+ */
+struct FfsEndpoints {
+    int ep0 = -1;       ///< Control endpoint
+    int ep_in = -1;     ///< Bulk IN (ep1)
+    int ep_out = -1;    ///< Bulk OUT (ep2)
+};
+
+/**
+ * @brief Open ep0, write the descriptors and strings, then open the bulk endpoints.
+ *
+ * @param dir FunctionFS mount point (or a directory standing in for one).
+ * @param endpoints Filled with the open descriptors.
+ * @return true on success; nothing is left open on failure.
+ */
+bool ffs_open_endpoints(const std::string& dir, FfsEndpoints& endpoints);
+
+/**
+ * @brief Close every open endpoint.
+ *
+ * @param endpoints Endpoints to close; reset to -1.
+ */
+void ffs_close_endpoints(FfsEndpoints& endpoints);
+
+/**
+ * @class BotServer
+ * @brief Bulk-Only Transport command loop for one LUN.
+ */
+class BotServer {
+public:
+    /**
+     * @brief Serve a LUN on open endpoints (not owned).
+     *
+     * @param endpoints ep0 and the bulk endpoints.
+     * @param lun LUN to execute commands on.
+     */
+    BotServer(const FfsEndpoints& endpoints, ScsiLun& lun);
+    ~BotServer();
+
+    BotServer(const BotServer&) = delete;
+    BotServer& operator=(const BotServer&) = delete;
+
+    /**
+     * @brief Handle control requests and commands until stopped.
+     *
+     * @return true if stopped or the endpoints were closed, false on an I/O error.
+     */
+    bool serve();
+
+    /**
+     * @brief Make serve() return; safe to call from a signal handler.
+     */
+    void stop();
+
+    /**
+     * @return Number of commands executed so far.
+     */
+    uint64_t commands() const { return commands_; }
+
+private:
+    void control_loop();
+    bool handle_command(const uint8_t* cbw);
+    bool wait_for_enable();
+    size_t packet_size();
+
+    FfsEndpoints endpoints_;
+    ScsiLun& lun_;
+    int stop_fd_;
+    int enable_fd_;     ///< Signalled by the control thread on FUNCTIONFS_ENABLE
+    std::atomic<bool> stopping_;
+    std::atomic<size_t> packet_size_;
+    uint64_t commands_ = 0;
+};
+
+/**
+ * @brief Serve an image through the ffs function until interrupted.
+ *
+ * Mounts FunctionFS, links the function into the bound gadget in
+ * place of mass_storage.0 for the duration, and restores the gadget
+ * on SIGINT or SIGTERM.
+ *
+ * @param session Gadget session to operate on.
+ * @param media Image and LUN settings.
+ * @param mount_dir FunctionFS mount point.
+ * @return true if the image was served and the gadget restored.
+ */
+bool ffs_serve(GadgetSession& session, const LunMedia& media, const std::string& mount_dir = FFS_DEFAULT_MOUNT);
+
+#endif // ifndef FFSBACKEND_H
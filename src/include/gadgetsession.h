@@ -0,0 +1,205 @@
+#ifndef GADGETSESSION_H
+#define GADGETSESSION_H
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @file gadgetsession.h
+ * @brief One-time discovery of the configfs USB gadget layout.
+ *
+ * A GadgetSession locates configfs, the active gadget, its config and
+ * its functions directory once, keeps directory descriptors open for
+ * them, and remembers which optional LUN attributes the running kernel
+ * exposes. Build one per run and pass it to the configfs operations
+ * instead of rediscovering paths for every call.
+ */
+
+/**
+ * @brief statfs() magic number of configfs.
+ */
+constexpr long CONFIGFS_MAGIC_NUMBER = 0x62656570;
+
+/**
+ * @class GadgetSession
+ * @brief Resolved configfs paths and directory descriptors.
+ */
+class GadgetSession {
+public:
+    /**
+     * @brief Discover the gadget layout.
+     *
+     * @param configfs_root configfs mount point to use instead of
+     *        discovering it (tests and benchmarks pass a fake tree here).
+     */
+    explicit GadgetSession(const std::string& configfs_root = "");
+    ~GadgetSession();
+
+    GadgetSession(const GadgetSession&) = delete;
+    GadgetSession& operator=(const GadgetSession&) = delete;
+
+    /**
+     * @return true if configfs with a usb_gadget directory was found.
+     */
+    bool supported() const { return !configfs_root_.empty(); }
+
+    /**
+     * @return configfs mount point, or empty string if not found.
+     */
+    const std::string& configfs_root() const { return configfs_root_; }
+
+    /**
+     * @return Path of the gadget with an active UDC, or empty string.
+     */
+    const std::string& gadget_root() const { return gadget_root_; }
+
+    /**
+     * @return Path of the gadget's first configuration, or empty string.
+     */
+    const std::string& config_root() const { return config_root_; }
+
+    /**
+     * @return UDC the gadget was bound to when the session was created.
+     */
+    const std::string& udc() const { return udc_; }
+
+    /**
+     * @return Path of the gadget's functions directory, or empty string.
+     */
+    std::string functions_root() const;
+
+    /**
+     * @return Directory descriptor of the gadget root, or -1.
+     */
+    int gadget_fd() const { return gadget_fd_; }
+
+    /**
+     * @return Directory descriptor of the configuration, or -1.
+     */
+    int config_fd() const { return config_fd_; }
+
+    /**
+     * @return Directory descriptor of the functions directory, or -1.
+     */
+    int functions_fd() const { return functions_fd_; }
+
+    /**
+     * @brief Check whether the kernel exposes an optional LUN attribute.
+     *
+     * Looks at mass_storage.0/lun.0 the first time an attribute is
+     * queried and caches the answer (e.g. "nofua", "inquiry_string",
+     * "forced_eject").
+     *
+     * @param attribute Attribute file name.
+     * @return true if the attribute exists.
+     */
+    bool lun_supports(const std::string& attribute);
+
+    /**
+     * @brief Check whether an entry exists below the gadget root.
+     *
+     * @param relative Path relative to the gadget root.
+     * @return true if the entry exists.
+     */
+    bool gadget_has(const std::string& relative) const;
+
+    /**
+     * @brief Check whether a function is linked into the configuration.
+     *
+     * @param function Function name (e.g. "mass_storage.0").
+     * @return true if the link exists.
+     */
+    bool function_linked(const std::string& function) const;
+
+    /**
+     * @brief Create a function directory if it does not exist yet.
+     *
+     * @param function Function name (e.g. "mass_storage.0").
+     * @return true if the function exists afterwards.
+     */
+    bool ensure_function(const std::string& function);
+
+    /**
+     * @brief Link a function into the configuration.
+     *
+     * @param function Function name (e.g. "mass_storage.0").
+     * @return true on success.
+     */
+    bool link_function(const std::string& function);
+
+    /**
+     * @brief Remove a function's link from the configuration.
+     *
+     * @param function Function name (e.g. "mass_storage.0").
+     * @return true on success.
+     */
+    bool unlink_function(const std::string& function);
+
+    /**
+     * @brief Count the LUNs of a mass storage function.
+     *
+     * @param function Function name (e.g. "mass_storage.0").
+     * @return Number of consecutive lun.N directories starting at lun.0.
+     */
+    unsigned lun_count(const std::string& function) const;
+
+    /**
+     * @brief Create lun.N in a mass storage function.
+     *
+     * The kernel only accepts this while the function is not linked.
+     *
+     * @param function Function name (e.g. "mass_storage.0").
+     * @param index LUN number.
+     * @return true if the LUN exists afterwards.
+     */
+    bool create_lun(const std::string& function, unsigned index);
+
+    /**
+     * @brief Remove lun.N from a mass storage function.
+     *
+     * lun.0 belongs to the function and cannot be removed. The kernel
+     * only accepts this while the function is not linked.
+     *
+     * @param function Function name (e.g. "mass_storage.0").
+     * @param index LUN number (1 or higher).
+     * @return true on success.
+     */
+    bool remove_lun(const std::string& function, unsigned index);
+
+    /**
+     * @brief Remember that the gadget was just bound to its UDC.
+     */
+    void note_bind() { last_bind_ = std::chrono::steady_clock::now(); }
+
+    /**
+     * @return When note_bind() was last called (epoch if never).
+     */
+    std::chrono::steady_clock::time_point last_bind() const { return last_bind_; }
+
+private:
+    void discover_gadget();
+
+    std::string configfs_root_;
+    std::string gadget_root_;
+    std::string config_root_;
+    std::string udc_;
+    int gadget_fd_;
+    int config_fd_;
+    int functions_fd_;
+    std::unordered_map<std::string, bool> lun_attributes_;
+    std::chrono::steady_clock::time_point last_bind_;
+};
+
+/**
+ * @brief Locate the configfs mount point.
+ *
+ * Parses /proc/self/mountinfo for a configfs mount and confirms it with
+ * a statfs() magic check; falls back to /config (Android) and
+ * /sys/kernel/config.
+ *
+ * @return The mount point, or empty string if configfs is not mounted.
+ */
+std::string find_configfs_root();
+
+#endif // ifndef GADGETSESSION_H
@@ -0,0 +1,127 @@
+#ifndef GADGETSNAPSHOT_H
+#define GADGETSNAPSHOT_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "gadgetsession.h"
+
+/**
+ * @file gadgetsnapshot.h
+ * @brief The gadget's own configuration, saved before isodrive changes it.
+ *
+ * Mounting links mass_storage.0 into the config, and Windows mode also
+ * rewrites the device descriptors, strings and MaxPower. Before the
+ * first change, the values isodrive may touch and the config's function
+ * links are saved to a file in the state directory. Unmounting puts
+ * them back inside its UDC cycle, so the host sees the phone's original
+ * functions (adb, MTP) again as soon as it re-enumerates.
+ *
+ * There is one snapshot per gadget. It is kept across mounts and
+ * removed once unmounting has restored it. A snapshot only holds for the
+ * boot it was taken in (see gadget_snapshot_boot_id()); one left over
+ * from an earlier boot, or found while no isodrive mount is active, is
+ * replaced rather than restored.
+ */
+
+/**
+ * @struct GadgetSnapshot
+ * @brief Saved descriptor values and function links of a gadget.
+ */
+struct GadgetSnapshot {
+    std::string gadget_root;    ///< Gadget the snapshot was taken from
+    std::string boot_id;        ///< Boot the snapshot was taken in
+    std::vector<std::pair<std::string, std::string>> attributes;  ///< Path relative to the gadget root, value
+    std::vector<std::string> absent;    ///< Directories (relative) that did not exist yet
+    std::vector<std::pair<std::string, std::string>> links;       ///< Config link name, link target
+};
+
+/**
+ * @brief Identify the running boot.
+ *
+ * @return Contents of /proc/sys/kernel/random/boot_id, or empty if unreadable.
+ */
+std::string gadget_snapshot_boot_id();
+
+/**
+ * @brief Read the gadget's current configuration.
+ *
+ * Descriptor attributes are read through the session's gadget
+ * descriptor; MaxPower and the function links come from a single pass
+ * over the config directory.
+ *
+ * @param session Session with a discovered gadget.
+ * @param snapshot Receives the configuration.
+ * @return true if the gadget and its config were found.
+ */
+bool gadget_snapshot_take(const GadgetSession& session, GadgetSnapshot& snapshot);
+
+/**
+ * @brief Path of the snapshot file for a gadget.
+ *
+ * @param gadget_root Path to the gadget root.
+ * @return <state dir>/gadget-<name>.snapshot
+ */
+std::string gadget_snapshot_path(const std::string& gadget_root);
+
+/**
+ * @brief Write a snapshot through a temporary file and an atomic rename.
+ *
+ * @param snapshot Snapshot to save.
+ * @return true if the file was written.
+ */
+bool gadget_snapshot_save(const GadgetSnapshot& snapshot);
+
+/**
+ * @brief Load the saved snapshot of a gadget.
+ *
+ * @param gadget_root Path to the gadget root.
+ * @param snapshot Receives the snapshot.
+ * @return true if a snapshot of this gadget taken in this boot was found.
+ */
+bool gadget_snapshot_load(const std::string& gadget_root, GadgetSnapshot& snapshot);
+
+/**
+ * @brief Save the gadget's configuration unless a valid snapshot exists.
+ *
+ * Call before the first change. A snapshot from this boot is kept while
+ * mass_storage.0 is linked, so it holds the state from before isodrive's
+ * first mount. Otherwise the gadget is in its own configuration and the
+ * snapshot is taken again.
+ *
+ * @param session Session with a discovered gadget.
+ * @return true if a snapshot exists afterwards.
+ */
+bool gadget_snapshot_ensure(const GadgetSession& session);
+
+/**
+ * @brief Delete the saved snapshot of a gadget.
+ *
+ * @param gadget_root Path to the gadget root.
+ */
+void gadget_snapshot_discard(const std::string& gadget_root);
+
+/**
+ * @brief Check whether the config links match a snapshot.
+ *
+ * @param session Session with a discovered gadget.
+ * @param snapshot Saved configuration.
+ * @return true if the config holds the same link names.
+ */
+bool gadget_snapshot_links_match(const GadgetSession& session, const GadgetSnapshot& snapshot);
+
+/**
+ * @brief Put the config links back as saved.
+ *
+ * Removes links whose names are not in the snapshot, recreates the
+ * missing ones with their saved targets and removes the directories
+ * that did not exist. The kernel only accepts this while the gadget is
+ * unbound.
+ *
+ * @param session Session with a discovered gadget.
+ * @param snapshot Saved configuration.
+ * @return true if every link was restored.
+ */
+bool gadget_snapshot_restore_links(GadgetSession& session, const GadgetSnapshot& snapshot);
+
+#endif // ifndef GADGETSNAPSHOT_H
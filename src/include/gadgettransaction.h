@@ -0,0 +1,135 @@
+#ifndef GADGETTRANSACTION_H
+#define GADGETTRANSACTION_H
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @file gadgettransaction.h
+ * @brief Staged, diff-based writes to configfs/sysfs attributes.
+ *
+ * A GadgetTransaction collects attribute writes, reads the current
+ * value of each attribute once, and on commit writes only the
+ * attributes whose value actually changes. Writes use raw
+ * open/write/close with O_CLOEXEC. If a write fails, every attribute
+ * already written by the transaction is restored to its previous value.
+ *
+ * Writes are applied in the order they were staged. The same attribute
+ * may be staged more than once (e.g. clearing a LUN file before
+ * changing its read-only flag); each write is compared against the
+ * value left by the writes staged before it.
+ */
+
+/**
+ * @class GadgetTransaction
+ * @brief Ordered set of attribute writes applied as a unit.
+ */
+class GadgetTransaction {
+public:
+    /**
+     * @brief Stage a write.
+     *
+     * @param path Absolute path of the attribute.
+     * @param value Value to write (a trailing newline is added on write).
+     */
+    void set(const std::string& path, const std::string& value);
+
+    /**
+     * @brief Read the current value of an attribute.
+     *
+     * The value is read once and cached for the rest of the transaction.
+     *
+     * @param path Absolute path of the attribute.
+     * @return The attribute's contents without the trailing newline,
+     *         or empty string if it cannot be read.
+     */
+    const std::string& current(const std::string& path);
+
+    /**
+     * @brief Check whether an attribute currently holds a value.
+     *
+     * Numeric attributes (see numeric_attribute()) are compared
+     * numerically, so "0x58f" matches "0x058f" as the kernel reports it;
+     * all others are compared as trimmed strings.
+     *
+     * @param path Absolute path of the attribute.
+     * @param value Value to compare against.
+     * @return true if the current value is equivalent to value.
+     */
+    bool matches(const std::string& path, const std::string& value);
+
+    /**
+     * @brief Count the staged writes that would change an attribute.
+     *
+     * @return Number of writes commit() would perform.
+     */
+    size_t pending();
+
+    /**
+     * @brief Count the changing writes below a directory.
+     *
+     * @param prefix Directory path (e.g. a LUN directory).
+     * @return Number of writes commit() would perform under prefix.
+     */
+    size_t pending_under(const std::string& prefix);
+
+    /**
+     * @brief Apply every staged write that changes an attribute.
+     *
+     * On failure, attributes already written are restored in reverse
+     * order and the transaction is left uncommitted.
+     *
+     * @return true if every required write succeeded.
+     */
+    bool commit();
+
+    /**
+     * @return Number of attributes written by the last commit().
+     */
+    size_t written() const { return written_; }
+
+    /**
+     * @brief Check whether the kernel parses an attribute as a number.
+     *
+     * True for the device descriptor fields (idVendor, idProduct,
+     * bcdDevice, bcdUSB, bDevice*), MaxPower, bmAttributes and the
+     * mass storage flags (ro, cdrom, removable, nofua, stall).
+     *
+     * @param path Path or file name of the attribute.
+     * @return true if the attribute is numeric.
+     */
+    static bool numeric_attribute(const std::string& path);
+
+    /**
+     * @brief Compare two values of an attribute the way the kernel reports them.
+     *
+     * @param path Path of the attribute; decides whether the values are
+     *        compared as numbers or as strings.
+     * @param a First value.
+     * @param b Second value.
+     * @return true if the values are equivalent.
+     */
+    static bool values_equal(const std::string& path, const std::string& a, const std::string& b);
+
+private:
+    struct Write {
+        std::string path;
+        std::string value;
+    };
+
+    struct Current {
+        bool readable;
+        std::string value;
+    };
+
+    const Current& lookup(const std::string& path);
+    std::vector<size_t> plan();
+
+    std::vector<Write> writes_;
+    std::unordered_map<std::string, Current> current_;
+    size_t written_ = 0;
+};
+
+#endif // ifndef GADGETTRANSACTION_H
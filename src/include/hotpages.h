@@ -0,0 +1,151 @@
+#ifndef HOTPAGES_H
+#define HOTPAGES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "probecache.h"
+
+/**
+ * @file hotpages.h
+ * @brief Learning which parts of an image a boot reads, and prefetching them.
+ *
+ * Installer boots read the same small part of an image every time: the
+ * boot catalog, the kernel, the initrd and filesystem headers. The
+ * mass storage function reads the image through the page cache, so
+ * after a session the pages the host touched are still resident.
+ *
+ * Right after the host gets an image (UDC bind or media swap), isodrive
+ * maps it and asks mincore() which pages are resident; this baseline
+ * covers what probing, verification and warm-up read. Before the image
+ * is replaced or ejected, the pages resident since then, together with
+ * the still-resident pages of the previous map, are saved per image
+ * version under the state directory. The next time that image is
+ * mounted, the runs are handed to posix_fadvise(WILLNEED) before the
+ * UDC is bound, so the host's first reads are served from memory
+ * rather than from eMMC or an SD card.
+ *
+ * Prefetched pages are resident whether or not the host reads them,
+ * so every range carries the number of sessions since the host last
+ * faulted it in, and ranges older than HOT_PAGES_MAX_AGE are dropped.
+ * A range still in use is learned again the first boot it is missing.
+ */
+
+/**
+ * @brief Maximum number of bytes prefetched for one image.
+ */
+constexpr uint64_t HOT_PAGES_PREFETCH_BUDGET = 512ull << 20;
+
+/**
+ * @brief Resident runs separated by at most this many pages are merged.
+ */
+constexpr size_t HOT_PAGES_MERGE_GAP = 16;
+
+/**
+ * @brief Sessions a range is kept without the host faulting it in.
+ */
+constexpr uint32_t HOT_PAGES_MAX_AGE = 4;
+
+/**
+ * @struct PageRange
+ * @brief A byte range of an image, aligned to pages.
+ */
+struct PageRange {
+    uint64_t offset;    ///< Start of the range in bytes
+    uint64_t length;    ///< Length of the range in bytes
+    uint32_t age = 0;   ///< Sessions since the host last faulted the range in
+
+    bool operator==(const PageRange& other) const {
+        return offset == other.offset && length == other.length && age == other.age;
+    }
+};
+
+/**
+ * @brief Turn a mincore() residency vector into merged byte ranges.
+ *
+ * @param residency One byte per page; bit 0 set when the page is resident.
+ * @param pages Number of pages in the vector.
+ * @param page_size Page size in bytes.
+ * @param ranges Receives the ranges, in ascending order.
+ */
+void hot_pages_from_residency(const unsigned char* residency, size_t pages, size_t page_size,
+                              std::vector<PageRange>& ranges);
+
+/**
+ * @brief Snapshot which pages of a file are in the page cache.
+ *
+ * @param path Image file.
+ * @param ranges Receives the resident ranges.
+ * @param merge_gap Runs separated by at most this many pages are merged.
+ * @return true if the file could be mapped and queried.
+ */
+bool hot_pages_snapshot(const std::string& path, std::vector<PageRange>& ranges,
+                        size_t merge_gap = HOT_PAGES_MERGE_GAP);
+
+/**
+ * @brief Directory holding the saved page maps.
+ *
+ * @return probe_cache_dir() + "/hotpages".
+ */
+std::string hot_pages_dir();
+
+/**
+ * @brief Save the page map of one image version.
+ *
+ * Maps saved for older versions of the same file are removed.
+ *
+ * @param key Identity of the image.
+ * @param ranges Ranges to remember.
+ * @return true if the map was written.
+ */
+bool hot_pages_save(const ImageKey& key, const std::vector<PageRange>& ranges);
+
+/**
+ * @brief Load the page map of one image version.
+ *
+ * @param key Identity of the image.
+ * @param ranges Receives the saved ranges.
+ * @return true if a map exists for exactly this version.
+ */
+bool hot_pages_load(const ImageKey& key, std::vector<PageRange>& ranges);
+
+/**
+ * @brief Remember which pages of an image are resident as the host session starts.
+ *
+ * Call right after the host is given the image. The exact resident
+ * pages are saved next to the image's page map and consumed by the
+ * next hot_pages_record().
+ *
+ * @param path Image file.
+ * @return true if the baseline was saved.
+ */
+bool hot_pages_mark_baseline(const std::string& path);
+
+/**
+ * @brief Save the pages the host session made resident for the next mount.
+ *
+ * Records the pages resident now but not in the baseline with age 0,
+ * plus the pages of the previous map that are still resident, one
+ * session older; those past HOT_PAGES_MAX_AGE are dropped. Without a
+ * baseline only the latter are kept. The map is removed when the
+ * result is empty.
+ *
+ * @param path Image file.
+ * @return true if a map was saved.
+ */
+bool hot_pages_record(const std::string& path);
+
+/**
+ * @brief Start reading an image's saved hot ranges into the page cache.
+ *
+ * Ranges are issued in file order until the budget is used up. The
+ * reads proceed in the background; this does not wait for them.
+ *
+ * @param path Image file.
+ * @param budget Maximum number of bytes to prefetch.
+ * @return Number of bytes for which readahead was issued.
+ */
+uint64_t hot_pages_prefetch(const std::string& path, uint64_t budget = HOT_PAGES_PREFETCH_BUDGET);
+
+#endif // ifndef HOTPAGES_H
@@ -0,0 +1,179 @@
+#ifndef IMAGEPROBE_H
+#define IMAGEPROBE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "bootloader.h"
+#include "partitiontable.h"
+#include "util.h"
+
+/**
+ * @file imageprobe.h
+ * @brief Single-pass image probing over a shared sector buffer.
+ *
+ * Opens an image once, reads its leading sectors with a single read
+ * and runs every detector (hybrid MBR, ISO 9660 volume label, Windows
+ * markers, boot records) against that buffer. Sectors outside the
+ * leading window are fetched on demand and kept in a small cache so
+ * follow-up lookups never reopen or re-read the file.
+ */
+
+/**
+ * @brief ISO 9660 logical sector size in bytes.
+ */
+constexpr size_t ISO_SECTOR_SIZE = 2048;
+
+/**
+ * @brief Sector holding the ISO 9660 Primary Volume Descriptor.
+ */
+constexpr uint64_t ISO_PVD_SECTOR = 16;
+
+/**
+ * @brief Number of sectors read up front by a probe.
+ *
+ * Covers the system area (MBR/GPT) and the usual run of volume
+ * descriptors (sectors 16-19).
+ */
+constexpr size_t IMAGE_PROBE_HEAD_SECTORS = 20;
+
+/**
+ * @struct ImageProbeResult
+ * @brief Combined result of every detector run over an image.
+ */
+struct ImageProbeResult {
+    bool readable;              ///< True if the image could be opened and read
+    bool is_hybrid;             ///< True if the MBR boot signature is present
+    bool is_iso9660;            ///< True if a Primary Volume Descriptor was found
+    uint64_t size;              ///< Image size in bytes
+    PartitionScheme partitions; ///< Partition table in the system area
+    bool has_esp;               ///< True if the partition table has an EFI system partition
+    uint64_t declared_size;     ///< Size the ISO 9660 volume and partition tables require
+    bool truncated;             ///< True if the file is shorter than declared_size
+    BootFingerprint bootloaders;///< Boot loaders in the system area and boot images
+    bool boot_uefi;             ///< True if the ISO boots on UEFI (El Torito catalog, Windows heuristics)
+    bool boot_legacy;           ///< True if the ISO boots on legacy BIOS
+    WindowsIsoInfo windows;     ///< Windows detection results
+};
+
+/**
+ * @class ImageProbe
+ * @brief Read-only view of an image file backed by one descriptor.
+ *
+ * The first IMAGE_PROBE_HEAD_SECTORS sectors are loaded by the
+ * constructor. Any other sector requested through sector() is read
+ * with pread() and cached for the lifetime of the probe.
+ */
+class ImageProbe {
+public:
+    /**
+     * @brief Open an image and load its leading sectors.
+     *
+     * @param path Path to the image file.
+     * @param head_sectors Number of 2048-byte sectors to read up front.
+     */
+    explicit ImageProbe(const std::string& path, size_t head_sectors = IMAGE_PROBE_HEAD_SECTORS);
+    ~ImageProbe();
+
+    ImageProbe(const ImageProbe&) = delete;
+    ImageProbe& operator=(const ImageProbe&) = delete;
+
+    /**
+     * @return true if the image was opened successfully.
+     */
+    bool is_open() const { return fd_ >= 0; }
+
+    /**
+     * @return Path the probe was created with.
+     */
+    const std::string& path() const { return path_; }
+
+    /**
+     * @return Size of the image in bytes.
+     */
+    uint64_t size() const { return size_; }
+
+    /**
+     * @brief Access raw bytes from the leading window.
+     *
+     * @param offset Byte offset into the image.
+     * @param len Number of bytes required.
+     * @return Pointer into the head buffer, or nullptr if the range
+     *         is not covered by it.
+     */
+    const unsigned char* head(uint64_t offset, size_t len) const;
+
+    /**
+     * @brief Get a full 2048-byte sector.
+     *
+     * @param lba Logical sector number.
+     * @return Pointer to ISO_SECTOR_SIZE bytes, or nullptr if the sector
+     *         lies beyond the end of the image or cannot be read.
+     */
+    const unsigned char* sector(uint64_t lba);
+
+    /**
+     * @brief Read an arbitrary byte range directly from the image.
+     *
+     * @param offset Byte offset into the image.
+     * @param buf Destination buffer.
+     * @param len Number of bytes to read.
+     * @return true if exactly len bytes were read.
+     */
+    bool read(uint64_t offset, void* buf, size_t len) const;
+
+    /**
+     * @brief Run every detector over the image.
+     *
+     * @return Combined detection results.
+     */
+    ImageProbeResult run();
+
+private:
+    std::string path_;
+    int fd_;
+    uint64_t size_;
+    std::vector<unsigned char> head_;
+    std::unordered_map<uint64_t, std::vector<unsigned char>> sectors_;
+};
+
+/**
+ * @brief Probe an image in a single pass.
+ *
+ * Convenience wrapper that opens the image once and runs every
+ * detector over it.
+ *
+ * @param path Path to the image file.
+ * @return Combined detection results. If the image cannot be read,
+ *         readable is false and every other field is cleared.
+ */
+ImageProbeResult probe_image(const std::string& path);
+
+/**
+ * @brief Write the detection fields of a probe result as space-separated numbers.
+ *
+ * Used by the probe cache and the library index, whose format versions
+ * must both be bumped when the fields change. readable, size and the
+ * volume label are left to the caller, which stores them in its own way.
+ *
+ * @param out Stream to write to.
+ * @param result Result to write.
+ */
+void probe_result_write(std::ostream& out, const ImageProbeResult& result);
+
+/**
+ * @brief Read the fields written by probe_result_write().
+ *
+ * Fields derived from others (the Windows firmware flags) are filled
+ * in; readable, size and the volume label are left untouched.
+ *
+ * @param in Stream to read from.
+ * @param result Receives the fields.
+ * @return true if every field could be parsed.
+ */
+bool probe_result_read(std::istream& in, ImageProbeResult& result);
+
+#endif // ifndef IMAGEPROBE_H
@@ -0,0 +1,113 @@
+#ifndef IMAGEREADER_H
+#define IMAGEREADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "uring.h"
+
+/**
+ * @file imagereader.h
+ * @brief Chunk cache with readahead in front of an image file.
+ *
+ * The userspace mass storage backend reads the image through this
+ * cache. Misses and readahead are queued together and submitted with a
+ * single io_uring_enter() call, so while one chunk is being sent to the
+ * host the following ones are already being read. Sequential access
+ * (the common case when a host boots or copies from the drive) keeps
+ * READAHEAD_CHUNKS chunks in flight ahead of the reader.
+ *
+ * Without io_uring, chunks are read with pread() and readahead is left
+ * to the page cache through posix_fadvise().
+ */
+
+/**
+ * @class ImageReader
+ * @brief Cached, prefetching reads and write-through writes of an image.
+ */
+class ImageReader {
+public:
+    static constexpr size_t CHUNK_SIZE = 128 * 1024;    ///< Cache granularity
+    static constexpr size_t SLOT_COUNT = 32;            ///< Chunks held in memory
+    static constexpr size_t READAHEAD_CHUNKS = 8;       ///< Chunks prefetched on sequential access
+
+    /**
+     * @brief Wrap an open image.
+     *
+     * @param fd Image descriptor (not owned).
+     * @param size Image size in bytes.
+     */
+    ImageReader(int fd, uint64_t size);
+    ~ImageReader();
+
+    ImageReader(const ImageReader&) = delete;
+    ImageReader& operator=(const ImageReader&) = delete;
+
+    /**
+     * @return Image size in bytes.
+     */
+    uint64_t size() const { return size_; }
+
+    /**
+     * @return true if reads go through io_uring.
+     */
+    bool using_uring() const { return ring_.ready(); }
+
+    /**
+     * @brief Get the data at an offset.
+     *
+     * Returns at most up to the end of the chunk containing offset; call
+     * again for the rest.
+     *
+     * @param offset Image offset.
+     * @param max Bytes wanted.
+     * @param len Receives the bytes available at the returned pointer.
+     * @return Pointer valid until the next call, or nullptr on a read
+     *         error or past the end of the image.
+     */
+    const uint8_t* read(uint64_t offset, size_t max, size_t& len);
+
+    /**
+     * @brief Write data to the image, dropping overlapping cached chunks.
+     *
+     * @param offset Image offset.
+     * @param data Data to write.
+     * @param len Bytes to write.
+     * @return true on success.
+     */
+    bool write(uint64_t offset, const uint8_t* data, size_t len);
+
+    /**
+     * @brief Flush written data to stable storage.
+     *
+     * @return true on success.
+     */
+    bool flush();
+
+private:
+    enum class SlotState { EMPTY, PENDING, READY, FAILED };
+
+    struct Slot {
+        uint64_t chunk = 0;
+        SlotState state = SlotState::EMPTY;
+        size_t length = 0;
+        uint64_t last_used = 0;
+        std::vector<uint8_t> data;
+    };
+
+    int find(uint64_t chunk) const;
+    int allocate(uint64_t chunk);
+    void fetch(int slot);
+    void complete(uint64_t slot, int result);
+    void reap_ready();
+    void drain();
+
+    int fd_;
+    uint64_t size_;
+    IoUring ring_;
+    std::vector<Slot> slots_;
+    uint64_t clock_ = 0;
+    uint64_t last_chunk_ = UINT64_MAX;
+};
+
+#endif // ifndef IMAGEREADER_H
@@ -0,0 +1,109 @@
+#ifndef ISO9660_H
+#define ISO9660_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "imageprobe.h"
+
+/**
+ * @file iso9660.h
+ * @brief Minimal ISO 9660 directory reader with Joliet and Rock Ridge names.
+ *
+ * Resolves absolute paths inside an ISO image using the path table to
+ * locate directories and reading only the directory extents a lookup
+ * needs. File data is never copied; lookups return the on-disc extents.
+ */
+
+/**
+ * @struct IsoExtent
+ * @brief A contiguous run of sectors belonging to a file.
+ */
+struct IsoExtent {
+    uint64_t lba;       ///< First logical sector of the extent
+    uint64_t length;    ///< Length of the extent in bytes
+};
+
+/**
+ * @struct IsoFileInfo
+ * @brief Location and size of a file or directory inside the image.
+ */
+struct IsoFileInfo {
+    std::string name;                 ///< Name as recorded on disc (Rock Ridge/Joliet if present)
+    bool is_dir;                      ///< True for directories
+    uint64_t size;                    ///< Total size in bytes (sum of all extents)
+    std::vector<IsoExtent> extents;   ///< Extents in file order (several for files over 4 GB)
+};
+
+/**
+ * @class Iso9660Reader
+ * @brief Path lookups over an ISO 9660 volume.
+ *
+ * The constructor scans the volume descriptor set and loads the path
+ * table of the preferred tree: the primary tree when it carries Rock
+ * Ridge names, otherwise the Joliet tree when present, otherwise the
+ * plain primary tree. Name comparisons are case-insensitive and ignore
+ * ISO 9660 version suffixes (";1").
+ */
+class Iso9660Reader {
+public:
+    /**
+     * @brief Load the volume descriptors and path table.
+     *
+     * @param probe Sector source for the image. Must outlive the reader.
+     */
+    explicit Iso9660Reader(ImageProbe& probe);
+
+    /**
+     * @return true if a usable ISO 9660 directory tree was found.
+     */
+    bool valid() const { return root_.lba != 0; }
+
+    /**
+     * @return true if the reader resolves names through the Joliet tree.
+     */
+    bool joliet() const { return joliet_; }
+
+    /**
+     * @return true if the primary tree carries Rock Ridge names.
+     */
+    bool rock_ridge() const { return rock_ridge_; }
+
+    /**
+     * @brief Look up an absolute path such as "/efi/boot/bootx64.efi".
+     *
+     * @param path Absolute path inside the image.
+     * @param info Receives the file's name, size and extents.
+     * @return true if the path exists.
+     */
+    bool lookup(const std::string& path, IsoFileInfo& info);
+
+    /**
+     * @brief Check whether a path exists inside the image.
+     *
+     * @param path Absolute path inside the image.
+     * @return true if the path exists.
+     */
+    bool exists(const std::string& path);
+
+private:
+    struct PathTableEntry {
+        uint32_t lba;       ///< Directory extent
+        uint16_t parent;    ///< 1-based index of the parent entry
+        std::string name;   ///< Folded directory identifier
+    };
+
+    bool load_path_table(const unsigned char* descriptor);
+    bool find_in_directory(const IsoExtent& dir, const std::string& name, IsoFileInfo& info);
+    std::string record_name(const unsigned char* record);
+    bool rock_ridge_name(const unsigned char* record, std::string& name);
+
+    ImageProbe& probe_;
+    IsoExtent root_;
+    bool joliet_;
+    bool rock_ridge_;
+    size_t susp_skip_;
+    std::vector<PathTableEntry> path_table_;
+};
+
+#endif // ifndef ISO9660_H
@@ -0,0 +1,83 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "imageprobe.h"
+#include "probecache.h"
+
+/**
+ * @file library.h
+ * @brief Scanning a directory of images for -list.
+ *
+ * Every image in the directory is probed with the same detectors a
+ * mount uses, on a pool of worker threads. Results are kept in a
+ * persistent index keyed by ImageKey; a rescan only probes files whose
+ * identity, size or modification time changed, and leaves the index
+ * untouched when nothing did.
+ */
+
+/**
+ * @brief Upper bound on the number of probing threads.
+ */
+constexpr unsigned LIBRARY_MAX_THREADS = 8;
+
+/**
+ * @struct LibraryEntry
+ * @brief One image of a library and its detection results.
+ */
+struct LibraryEntry {
+    std::string path;           ///< Path of the image
+    ImageKey key;               ///< Identity the result belongs to
+    ImageProbeResult result;    ///< Detection results
+};
+
+/**
+ * @struct LibraryScanStats
+ * @brief What a scan had to do.
+ */
+struct LibraryScanStats {
+    size_t probed = 0;          ///< Images probed
+    size_t indexed = 0;         ///< Images answered from the index
+    double seconds = 0;         ///< Wall time of the scan
+};
+
+/**
+ * @brief Check whether a file name looks like a mountable raw image.
+ *
+ * @param name File name.
+ * @return true for .iso, .img, .raw, .bin and .ima files (any case).
+ */
+bool library_is_image(const std::string& name);
+
+/**
+ * @brief Scan a directory and probe its images.
+ *
+ * @param dir Directory to scan (not recursive).
+ * @param entries Receives one entry per image, sorted by path.
+ * @param stats Receives scan statistics.
+ * @param threads Number of probing threads; 0 picks one per CPU,
+ *        up to LIBRARY_MAX_THREADS.
+ * @return false if the directory cannot be read.
+ */
+bool scan_library(const std::string& dir, std::vector<LibraryEntry>& entries, LibraryScanStats& stats,
+                  unsigned threads = 0);
+
+/**
+ * @brief Format entries as an aligned text table.
+ *
+ * @param entries Entries to format.
+ * @return Table with a header line.
+ */
+std::string library_to_table(const std::vector<LibraryEntry>& entries);
+
+/**
+ * @brief Format entries as a JSON array.
+ *
+ * @param entries Entries to format.
+ * @return JSON text ending in a newline.
+ */
+std::string library_to_json(const std::vector<LibraryEntry>& entries);
+
+#endif // ifndef LIBRARY_H
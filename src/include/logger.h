@@ -1,6 +1,8 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <atomic>
+#include <functional>
 #include <string>
 
 /**
@@ -9,6 +11,12 @@
  * 
  * Provides a simple logging interface with multiple verbosity levels,
  * allowing users to control output via command-line flags.
+ *
+ * Call sites use the LOG_* macros, which check the level before the
+ * message expression is evaluated, so a disabled message costs one
+ * relaxed atomic load. Building with ISODRIVE_NO_DEBUG_LOG removes
+ * LOG_DEBUG messages from the binary altogether. Output is serialised
+ * by a mutex, so any thread may log.
  */
 
 /**
@@ -26,6 +34,26 @@ enum class LogLevel {
     DEBUG = 4    ///< All messages including debug details
 };
 
+/**
+ * @brief Most verbose level any output currently accepts.
+ *
+ * Maintained by the logger; read it through log_enabled().
+ */
+extern std::atomic<LogLevel> g_log_threshold;
+
+/**
+ * @brief Check whether a message at a level would be written anywhere.
+ *
+ * @param level Level of the message.
+ * @return true if the console, the sink or the JSON log takes it.
+ */
+inline bool log_enabled(LogLevel level) {
+#ifdef ISODRIVE_NO_DEBUG_LOG
+    if (level == LogLevel::DEBUG) return false;
+#endif
+    return g_log_threshold.load(std::memory_order_relaxed) >= level;
+}
+
 /**
  * @brief Set the global logging verbosity level.
  * @param level The desired log level.
@@ -38,6 +66,42 @@ void log_set_level(LogLevel level);
  */
 LogLevel log_get_level();
 
+/**
+ * @brief Receiver for log messages in place of the console.
+ */
+using LogSink = std::function<void(LogLevel level, const std::string& message)>;
+
+/**
+ * @brief Route log messages to a sink instead of stdout/stderr.
+ * 
+ * Messages are still filtered by the current log level first. The
+ * daemon uses this to send a request's output back to its client.
+ * The sink is called with the logger's mutex held and must not log.
+ * 
+ * @param sink Receiver, or nullptr to restore console output.
+ */
+void log_set_sink(LogSink sink);
+
+/**
+ * @brief Also append messages to a file as JSON lines.
+ *
+ * Each line is an object with the monotonic clock time in microseconds
+ * ("mono_us"), the level name, the thread ID and the message. Lines are
+ * written with one append-mode write() each, so concurrent writers do
+ * not interleave. The JSON log has its own level, independent of the
+ * console's.
+ *
+ * @param path File to append to; created if missing.
+ * @param level Most verbose level recorded.
+ * @return true if the file could be opened.
+ */
+bool log_open_json(const std::string& path, LogLevel level = LogLevel::DEBUG);
+
+/**
+ * @brief Stop writing the JSON log and close its file.
+ */
+void log_close_json();
+
 /**
  * @brief Log an error message.
  * 
@@ -78,4 +142,20 @@ void log_info(const std::string& message);
  */
 void log_debug(const std::string& message);
 
+/**
+ * @brief Log messages whose text is only built when the level is enabled.
+ *
+ * Use these instead of calling log_*() with a concatenated message.
+ */
+#define LOG_ERROR(...) do { if (log_enabled(LogLevel::ERROR)) log_error(__VA_ARGS__); } while (0)
+#define LOG_WARN(...) do { if (log_enabled(LogLevel::WARN)) log_warn(__VA_ARGS__); } while (0)
+#define LOG_INFO(...) do { if (log_enabled(LogLevel::INFO)) log_info(__VA_ARGS__); } while (0)
+
+#ifdef ISODRIVE_NO_DEBUG_LOG
+// Still type-checked, but never evaluated or emitted
+#define LOG_DEBUG(...) do { if (false) log_debug(__VA_ARGS__); } while (0)
+#else
+#define LOG_DEBUG(...) do { if (log_enabled(LogLevel::DEBUG)) log_debug(__VA_ARGS__); } while (0)
+#endif
+
 #endif // ifndef LOGGER_H
@@ -0,0 +1,177 @@
+#ifndef MOUNTREQUEST_H
+#define MOUNTREQUEST_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "configfsisomanager.h"
+#include "imageprobe.h"
+#include "logger.h"
+
+/**
+ * @file mountrequest.h
+ * @brief A parsed isodrive command and its configfs execution.
+ *
+ * The CLI and the daemon share this layer: the CLI turns argv into a
+ * MountRequest and either runs it locally or sends it to isodrive
+ * -daemon using the line protocol below, which runs the same code
+ * against its long-lived GadgetSession.
+ *
+ * Wire format (one field per line, request ends with an empty line):
+ *
+ *     isodrive 1
+ *     verbosity <0-4>
+ *     command mount|prepare|eject|status
+ *     option win10|win11|usb3|verify|noprobe-cache|wait <ms>
+ *     image <flags> <absolute path>
+ *
+ * where flags are any of c (cdrom), w (read-write), k (writable
+ * clone), h (hdd), W (windows), or "-" for none. Responses are "log <level> <message>"
+ * lines followed by "exit <code>".
+ */
+
+/**
+ * @brief Protocol version sent in the first request line.
+ */
+constexpr int MOUNT_REQUEST_VERSION = 1;
+
+/**
+ * @struct ImageRequest
+ * @brief One image with the options that follow it on the command line.
+ */
+struct ImageRequest {
+    std::string path;           ///< Image file
+    bool cdrom = false;         ///< -cdrom
+    bool ro = true;             ///< false with -rw and -rw-clone
+    bool clone = false;         ///< -rw-clone (writes go to a disposable clone)
+    bool force_hdd = false;     ///< -hdd (disables auto-detect)
+    bool windows = false;       ///< -windows / -win10 / -win11
+};
+
+/**
+ * @enum RequestCommand
+ * @brief What a request asks for.
+ */
+enum class RequestCommand {
+    MOUNT,      ///< Mount the images (none: unmount)
+    PREPARE,    ///< Link an empty function, then mount any images
+    EJECT,      ///< Eject media without re-enumerating
+    STATUS      ///< Report what is mounted
+};
+
+/**
+ * @struct MountRequest
+ * @brief A complete isodrive command.
+ */
+struct MountRequest {
+    RequestCommand command = RequestCommand::MOUNT;
+    std::vector<ImageRequest> images;
+    bool force_win10 = false;
+    bool force_win11 = false;
+    bool use_usb3 = false;
+    bool verify = false;        ///< -verify: check images against their checksums first
+    bool no_probe_cache = false;    ///< -noprobe-cache: probe the images again instead of using cached results
+    int wait_timeout_ms = 0;    ///< Wait this long for the host to configure the device (0: don't wait)
+};
+
+/**
+ * @brief Probe function used to resolve images (defaults to probe_image_cached).
+ */
+using ImageProber = std::function<ImageProbeResult(const std::string& path)>;
+
+/**
+ * @brief Check a request for incompatible options and missing files.
+ *
+ * @param request The request.
+ * @return true if the request can run; errors are logged otherwise.
+ */
+bool validate_request(const MountRequest& request);
+
+/**
+ * @brief Probe the images and derive per-LUN media and Windows options.
+ *
+ * With verify set, every image is first checked against its checksum
+ * (see verify.h) and a mismatch fails the request.
+ *
+ * Compressed images are staged first, and their media entries point
+ * at the decompressed copies. Images marked clone are then cloned, and
+ * their media entries point at the clones. If the request fails, the
+ * clones made for it are deleted again.
+ *
+ * @param request The request.
+ * @param probe Probe function.
+ * @param media Filled with one entry per image.
+ * @param win_opts Filled with the gadget's Windows options.
+ * @param mounted Files currently set on a LUN; their staged copies are not evicted.
+ * @return false if an image failed verification or could not be staged or cloned.
+ */
+bool resolve_images(const MountRequest& request, const ImageProber& probe,
+                    std::vector<LunMedia>& media, WindowsMountOptions& win_opts,
+                    const std::vector<std::string>& mounted = {});
+
+/**
+ * @brief Run a request against the configfs backend.
+ *
+ * When the request asks to wait and the mount re-enumerated the
+ * device, also waits for the host to configure it and records the
+ * enumeration latency; a timeout fails the request.
+ *
+ * Clones that are no longer mounted afterwards are deleted, and the
+ * clone pool of every -rw-clone image is refilled where that takes a
+ * reflink rather than a copy.
+ *
+ * @param session Gadget session to operate on.
+ * @param request The request.
+ * @param probe Probe function.
+ * @return true on success.
+ */
+bool run_request(GadgetSession& session, const MountRequest& request, const ImageProber& probe);
+
+/**
+ * @brief Put a ready-made clone of every -rw-clone image in its pool.
+ *
+ * @param request The request whose images to refill.
+ * @param allow_copy Copy images that cannot be reflinked.
+ */
+void refill_clone_pools(const MountRequest& request, bool allow_copy);
+
+/**
+ * @brief Wait for the host to configure the device after the last bind.
+ *
+ * Logs the bind-to-configured latency and negotiated speed and appends
+ * the result to enumeration.jsonl in the state directory.
+ *
+ * @param session Gadget session that performed the bind.
+ * @param timeout_ms Time to wait, measured from the bind.
+ * @return true if the host configured the device in time.
+ */
+bool report_enumeration(GadgetSession& session, int timeout_ms);
+
+/**
+ * @brief Log the mounted images of every LUN.
+ *
+ * @param session Gadget session to inspect.
+ * @return true if the gadget could be inspected.
+ */
+bool report_status(GadgetSession& session);
+
+/**
+ * @brief Serialize a request for the daemon.
+ *
+ * @param request The request; image paths should be absolute.
+ * @param verbosity Log level the client wants output at.
+ * @return Encoded request including the terminating empty line.
+ */
+std::string encode_request(const MountRequest& request, LogLevel verbosity);
+
+/**
+ * @brief Parse a request received by the daemon.
+ *
+ * @param text Encoded request.
+ * @param request Filled on success.
+ * @param verbosity Filled with the requested log level.
+ * @return true if the request is well formed.
+ */
+bool decode_request(const std::string& text, MountRequest& request, LogLevel& verbosity);
+
+#endif // ifndef MOUNTREQUEST_H
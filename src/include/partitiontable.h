@@ -0,0 +1,93 @@
+#ifndef PARTITIONTABLE_H
+#define PARTITIONTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ImageProbe;
+
+/**
+ * @file partitiontable.h
+ * @brief MBR and GPT parsing for hybrid images, and the truncation check.
+ *
+ * The MBR and the primary GPT are parsed in place from the probe's head
+ * buffer; only the backup GPT header costs an extra sector read. Next
+ * to the partitions, the parser works out how large the image claims
+ * to be: the ISO 9660 volume space, the backup GPT header position and
+ * the partition ends. An image shorter than that is a truncated copy
+ * that would fail part way through booting.
+ */
+
+/**
+ * @brief Logical block size of MBR and GPT structures in hybrid images.
+ */
+constexpr uint64_t DISK_SECTOR_SIZE = 512;
+
+/**
+ * @enum PartitionScheme
+ * @brief Kind of partition table found in the system area.
+ */
+enum class PartitionScheme {
+    NONE,   ///< No MBR signature, or no partitions in it
+    MBR,    ///< MBR partitions (including isohybrid layouts)
+    GPT     ///< GPT behind a protective MBR
+};
+
+/**
+ * @struct Partition
+ * @brief One entry of a partition table.
+ */
+struct Partition {
+    uint64_t offset;            ///< Start in bytes
+    uint64_t length;            ///< Length in bytes
+    unsigned char mbr_type;     ///< MBR partition type (0 for GPT entries)
+    bool bootable;              ///< MBR active flag
+    bool esp;                   ///< EFI system partition
+};
+
+/**
+ * @struct PartitionTable
+ * @brief Partitions of an image and the size the image declares.
+ */
+struct PartitionTable {
+    PartitionScheme scheme = PartitionScheme::NONE;  ///< Table found
+    std::vector<Partition> partitions;               ///< Partitions in table order
+    int esp = -1;                                    ///< Index of the first ESP, or -1
+    bool backup_gpt = false;                         ///< Backup GPT header present and valid
+    uint64_t volume_size = 0;                        ///< ISO 9660 volume space in bytes (0: none)
+    uint64_t declared_size = 0;                      ///< Largest size any structure requires
+    bool truncated = false;                          ///< File is shorter than declared_size
+};
+
+/**
+ * @brief Parse the partition table and check the image for truncation.
+ *
+ * The primary GPT is used when its header and entry CRCs match;
+ * otherwise the backup GPT at the last sector is tried.
+ *
+ * @param probe Open probe of the image.
+ * @param table Receives the table.
+ * @return false if the probe is not open.
+ */
+bool read_partition_table(ImageProbe& probe, PartitionTable& table);
+
+/**
+ * @brief Name of a partition scheme for logs and -list output.
+ *
+ * @param scheme Scheme to name.
+ * @return "none", "mbr" or "gpt".
+ */
+const char* partition_scheme_name(PartitionScheme scheme);
+
+/**
+ * @brief CRC-32 as used by GPT (IEEE 802.3, reflected).
+ *
+ * @param crc CRC of the preceding data (0 to start).
+ * @param data Bytes to add.
+ * @param len Number of bytes.
+ * @return Updated CRC.
+ */
+uint32_t crc32_update(uint32_t crc, const void* data, size_t len);
+
+#endif // ifndef PARTITIONTABLE_H
@@ -0,0 +1,88 @@
+#ifndef PATTERNSCAN_H
+#define PATTERNSCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @file patternscan.h
+ * @brief Multi-pattern byte string search in a single pass.
+ *
+ * Every pattern is reduced to its first two bytes. A block of input is
+ * compared against all distinct two-byte prefixes at once (AVX2 on
+ * x86-64 CPUs that report it, SSE2 on other x86-64 CPUs, NEON on
+ * AArch64) and only positions where a prefix matches are checked in
+ * full. Portable C++ handles the block tails and other architectures.
+ * The choice is made once per process.
+ */
+
+/**
+ * @brief Most distinct two-byte prefixes the vector code compares per block.
+ *
+ * Scanners with more prefixes use the portable code.
+ */
+constexpr size_t PATTERN_SCAN_MAX_PREFIXES = 16;
+
+/**
+ * @struct ScanPattern
+ * @brief A byte string to look for and the bits it reports.
+ */
+struct ScanPattern {
+    std::string text;   ///< Bytes to match exactly (at least two)
+    uint32_t tag;       ///< Bits set in the scan result when text is found
+};
+
+/**
+ * @class PatternScanner
+ * @brief Reports which of a fixed set of patterns occur in a buffer.
+ */
+class PatternScanner {
+public:
+    /**
+     * @brief Build the prefix tables for a set of patterns.
+     *
+     * @param patterns Patterns to look for; those shorter than two bytes are ignored.
+     */
+    explicit PatternScanner(const std::vector<ScanPattern>& patterns);
+
+    /**
+     * @brief Scan a buffer.
+     *
+     * Stops early once every tag has been seen.
+     *
+     * @param data Buffer to scan.
+     * @param len Buffer length in bytes.
+     * @return OR of the tags of every pattern found.
+     */
+    uint32_t scan(const void* data, size_t len) const;
+
+private:
+    friend struct PatternKernels;
+
+    uint32_t verify(const unsigned char* data, size_t len, size_t pos) const;
+
+    std::vector<ScanPattern> patterns_;
+    std::vector<uint8_t> by_first_[256];    ///< Pattern indexes by first byte
+    unsigned char prefix_first_[PATTERN_SCAN_MAX_PREFIXES];
+    unsigned char prefix_second_[PATTERN_SCAN_MAX_PREFIXES];
+    size_t prefixes_;                       ///< Distinct prefixes, or 0 for portable only
+    uint32_t all_tags_;
+};
+
+/**
+ * @brief Name of the block compare in use.
+ *
+ * @return "avx2", "sse2", "neon" or "portable".
+ */
+const char* pattern_scan_implementation();
+
+/**
+ * @brief Use the portable scan even where the CPU has vector instructions.
+ *
+ * @param force true to force the portable code.
+ */
+void pattern_scan_force_portable(bool force);
+
+#endif // ifndef PATTERNSCAN_H
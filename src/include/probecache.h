@@ -0,0 +1,148 @@
+#ifndef PROBECACHE_H
+#define PROBECACHE_H
+
+#include <cstdint>
+#include <string>
+#include "imageprobe.h"
+
+/**
+ * @file probecache.h
+ * @brief Persistent on-disk cache of image probe results.
+ *
+ * Probe results are keyed by the image's device, inode, size and
+ * modification time, so a repeat mount of an unchanged image is
+ * answered from the cache without touching the image itself.
+ *
+ * The cache lives in a single small file that is rewritten through a
+ * temporary file and an atomic rename. Readers and writers serialise
+ * on flock() of a lock file next to it, so concurrent CLI invocations
+ * and the daemon never drop each other's entries. The least recently
+ * used entries are evicted once PROBE_CACHE_MAX_ENTRIES is exceeded.
+ */
+
+/**
+ * @brief Maximum number of images remembered by the cache.
+ */
+constexpr size_t PROBE_CACHE_MAX_ENTRIES = 64;
+
+/**
+ * @struct ImageKey
+ * @brief Identity of an image file as seen by stat().
+ */
+struct ImageKey {
+    uint64_t dev;           ///< st_dev of the file
+    uint64_t ino;           ///< st_ino of the file
+    uint64_t size;          ///< st_size of the file
+    int64_t mtime_sec;      ///< Modification time, seconds
+    int64_t mtime_nsec;     ///< Modification time, nanoseconds
+
+    bool operator==(const ImageKey& other) const {
+        return dev == other.dev && ino == other.ino && size == other.size &&
+               mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+    }
+};
+
+/**
+ * @brief Build the cache key for an image.
+ *
+ * @param path Path to the image file.
+ * @param key Receives the key.
+ * @return true if the file could be stat()ed.
+ */
+bool image_key(const std::string& path, ImageKey& key);
+
+/**
+ * @brief File name stem identifying one version of an image.
+ *
+ * Formatted as "<dev>-<ino>-<size>-<mtime>.<nsec>" in hex; the name
+ * starts with image_key_prefix(), which is shared by every version of
+ * the same file.
+ *
+ * @param key Identity of the image.
+ * @return Name stem, without extension.
+ */
+std::string image_key_name(const ImageKey& key);
+
+/**
+ * @brief File name prefix shared by every version of an image ("<dev>-<ino>-").
+ *
+ * @param key Identity of the image.
+ * @return Name prefix.
+ */
+std::string image_key_prefix(const ImageKey& key);
+
+/**
+ * @brief Directory holding isodrive's persistent state.
+ *
+ * Defaults to /data/adb/isodrive on Android (when /data/adb exists)
+ * and /var/cache/isodrive elsewhere.
+ *
+ * @return Absolute path of the state directory.
+ */
+std::string probe_cache_dir();
+
+/**
+ * @brief Override the state directory (used by tests and benchmarks).
+ *
+ * @param dir New directory, or empty to restore the default.
+ */
+void probe_cache_set_dir(const std::string& dir);
+
+/**
+ * @brief Enable or disable the probe cache for this process.
+ *
+ * @param enabled false to bypass the cache (the -noprobe-cache flag).
+ */
+void probe_cache_set_enabled(bool enabled);
+
+/**
+ * @brief Check whether the probe cache is enabled.
+ *
+ * @return true unless disabled with probe_cache_set_enabled(false).
+ */
+bool probe_cache_enabled();
+
+/**
+ * @brief Look up a cached probe result.
+ *
+ * A hit does not rewrite the cache file; the use is remembered in
+ * memory and written back with the next probe_cache_store() or
+ * probe_cache_flush().
+ *
+ * @param key Identity of the image.
+ * @param result Receives the cached result on a hit.
+ * @return true on a cache hit.
+ */
+bool probe_cache_lookup(const ImageKey& key, ImageProbeResult& result);
+
+/**
+ * @brief Store a probe result, evicting old entries if needed.
+ *
+ * @param key Identity of the image.
+ * @param result Result to remember.
+ * @return true if the cache file was updated.
+ */
+bool probe_cache_store(const ImageKey& key, const ImageProbeResult& result);
+
+/**
+ * @brief Write back the uses of cache hits not yet in the cache file.
+ *
+ * Does nothing when there are none, so a run that only hit the cache
+ * still refreshes the LRU order at the cost of one rewrite.
+ *
+ * @return true if nothing was pending or the cache file was updated.
+ */
+bool probe_cache_flush();
+
+/**
+ * @brief Probe an image, consulting the persistent cache first.
+ *
+ * On a hit no image I/O is performed. On a miss the image is probed
+ * with probe_image() and the result stored for next time.
+ *
+ * @param path Path to the image file.
+ * @return Combined detection results.
+ */
+ImageProbeResult probe_image_cached(const std::string& path);
+
+#endif // ifndef PROBECACHE_H
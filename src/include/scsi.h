@@ -0,0 +1,117 @@
+#ifndef SCSI_H
+#define SCSI_H
+
+#include <cstddef>
+#include <cstdint>
+#include "imagereader.h"
+
+/**
+ * @file scsi.h
+ * @brief SCSI block and CD-ROM command set for the userspace backend.
+ *
+ * Implements the commands hosts send to a USB mass storage LUN: the
+ * SPC basics (INQUIRY, REQUEST SENSE, MODE SENSE, TEST UNIT READY), the
+ * SBC reads and writes, and the MMC queries operating systems and
+ * firmware issue to CD-ROM drives (READ TOC, GET CONFIGURATION, GET
+ * EVENT STATUS NOTIFICATION). The transport is abstracted behind
+ * ScsiTransfer so the command set can be exercised without USB.
+ */
+
+/**
+ * @enum ScsiStatus
+ * @brief Outcome of a command, as reported in the Command Status Wrapper.
+ */
+enum class ScsiStatus {
+    GOOD,               ///< Command passed
+    CHECK_CONDITION,    ///< Command failed; sense data describes why
+    PHASE_ERROR         ///< Host and device disagree on the data transfer
+};
+
+/**
+ * @class ScsiTransfer
+ * @brief Data phase of one command.
+ */
+class ScsiTransfer {
+public:
+    virtual ~ScsiTransfer() = default;
+
+    /**
+     * @brief Send data to the host.
+     *
+     * @param data Data to send.
+     * @param len Bytes to send.
+     * @return true on success.
+     */
+    virtual bool send(const uint8_t* data, size_t len) = 0;
+
+    /**
+     * @brief Receive data from the host.
+     *
+     * @param data Destination.
+     * @param len Bytes to receive.
+     * @return true if exactly len bytes were received.
+     */
+    virtual bool receive(uint8_t* data, size_t len) = 0;
+};
+
+/**
+ * @class ScsiLun
+ * @brief One logical unit backed by an ImageReader.
+ */
+class ScsiLun {
+public:
+    /**
+     * @brief Expose an image as a LUN.
+     *
+     * @param reader Image to serve.
+     * @param cdrom Present a CD-ROM drive with 2048-byte blocks.
+     * @param ro Reject writes.
+     */
+    ScsiLun(ImageReader& reader, bool cdrom, bool ro);
+
+    /**
+     * @brief Execute one command.
+     *
+     * @param cdb Command descriptor block.
+     * @param cdb_len Length of the CDB.
+     * @param host_length Data phase length the host expects.
+     * @param host_in true if the host expects data from the device.
+     * @param io Data phase transport.
+     * @param transferred Receives the bytes actually moved.
+     * @return Command status.
+     */
+    ScsiStatus execute(const uint8_t* cdb, size_t cdb_len, size_t host_length, bool host_in,
+                       ScsiTransfer& io, size_t& transferred);
+
+    /**
+     * @return Logical block size in bytes.
+     */
+    uint32_t block_size() const { return block_size_; }
+
+    /**
+     * @return Number of logical blocks.
+     */
+    uint64_t block_count() const { return block_count_; }
+
+private:
+    ScsiStatus fail(uint8_t key, uint8_t asc, uint8_t ascq = 0);
+    ScsiStatus respond(const uint8_t* data, size_t len, size_t allocation, size_t host_length,
+                       bool host_in, ScsiTransfer& io, size_t& transferred);
+    ScsiStatus read_blocks(uint64_t lba, uint32_t blocks, size_t host_length, bool host_in,
+                           ScsiTransfer& io, size_t& transferred);
+    ScsiStatus write_blocks(uint64_t lba, uint32_t blocks, size_t host_length, bool host_in,
+                            ScsiTransfer& io, size_t& transferred);
+
+    ImageReader& reader_;
+    bool cdrom_;
+    bool ro_;
+    uint32_t block_size_;
+    uint64_t block_count_;
+    bool loaded_ = true;
+    bool prevent_removal_ = false;
+    uint8_t sense_key_ = 0;
+    uint8_t sense_asc_ = 0;
+    uint8_t sense_ascq_ = 0;
+};
+
+#endif // ifndef SCSI_H
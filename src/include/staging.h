@@ -0,0 +1,96 @@
+#ifndef STAGING_H
+#define STAGING_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * @file staging.h
+ * @brief Mounting compressed images through a decompressed staging copy.
+ *
+ * The mass storage function needs random access to a plain file, so a
+ * compressed image is decompressed once into a sparse file under the
+ * staging directory and that file is mounted instead. Runs of zero
+ * blocks are skipped rather than written, which keeps mostly-empty
+ * disk images small on flash.
+ *
+ * Staged files are named after the source's ImageKey, so they are
+ * reused until the source is modified or replaced. Staging a new
+ * version of a source removes the copies of its older versions, and
+ * beyond STAGING_MAX_IMAGES the least recently used copies that are not
+ * in use. Partial copies still being written by another process are
+ * left alone.
+ *
+ * Formats are detected by magic bytes, not by file extension:
+ *   - zstd: independent frames are decompressed in parallel when every
+ *     frame records its content size (as seekable zstd files do).
+ *   - xz: blocks are decompressed by liblzma's multithreaded decoder.
+ *   - gzip: decompressed by a single thread (deflate streams have no
+ *     independent blocks).
+ */
+
+/**
+ * @brief Maximum number of staged images kept in the staging directory.
+ */
+constexpr size_t STAGING_MAX_IMAGES = 4;
+
+/**
+ * @enum Compression
+ * @brief Container format of an image file.
+ */
+enum class Compression {
+    NONE,       ///< Plain image
+    GZIP,       ///< gzip (1f 8b)
+    XZ,         ///< xz (fd 37 7a 58 5a 00)
+    ZSTD        ///< zstd frame or skippable frame
+};
+
+/**
+ * @brief Detect the compression format of a file from its magic bytes.
+ *
+ * @param path Path to the file.
+ * @return Compression::NONE for plain or unreadable files.
+ */
+Compression detect_compression(const std::string& path);
+
+/**
+ * @brief Human-readable name of a format.
+ *
+ * @param compression The format.
+ * @return "gzip", "xz", "zstd" or "none".
+ */
+const char* compression_name(Compression compression);
+
+/**
+ * @brief Check whether this build can decompress a format.
+ *
+ * @param compression The format.
+ * @return true if the codec library was available at build time.
+ */
+bool compression_supported(Compression compression);
+
+/**
+ * @brief Directory holding staged images.
+ *
+ * @return The staging subdirectory of probe_cache_dir().
+ */
+std::string staging_dir();
+
+/**
+ * @brief Get a mountable path for an image, decompressing it if needed.
+ *
+ * Plain images are returned unchanged. Compressed images are
+ * decompressed into the staging directory unless an up-to-date copy
+ * already exists.
+ *
+ * @param path Path to the image.
+ * @param staged_path Receives the path to mount.
+ * @param in_use Staged copies that must not be evicted (set on a LUN,
+ *        or staged earlier for the same request).
+ * @return true on success; errors are logged otherwise.
+ */
+bool stage_image(const std::string& path, std::string& staged_path,
+                 const std::vector<std::string>& in_use = {});
+
+#endif // ifndef STAGING_H
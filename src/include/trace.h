@@ -0,0 +1,79 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <string>
+
+/**
+ * @file trace.h
+ * @brief Lightweight timing spans exported as Chrome trace-event JSON.
+ *
+ * Wrap a phase in TRACE_SPAN("name") to record how long it took. Spans
+ * are only recorded after trace_enable(); otherwise a span costs one
+ * flag check on entry and exit. trace_write() saves the recorded spans
+ * in the format read by chrome://tracing and Perfetto.
+ */
+
+/**
+ * @brief Start recording spans.
+ */
+void trace_enable();
+
+/**
+ * @return true if spans are being recorded.
+ */
+bool trace_enabled();
+
+/**
+ * @brief Write recorded spans as Chrome trace-event JSON.
+ *
+ * @param path Output file.
+ * @return true on success.
+ */
+bool trace_write(const std::string& path);
+
+/**
+ * @brief Discard recorded spans and stop recording (used by tests).
+ */
+void trace_reset();
+
+/**
+ * @class TraceSpan
+ * @brief Records the time between construction and destruction.
+ */
+class TraceSpan {
+public:
+    /**
+     * @param name Span name; must outlive the span (use a string literal).
+     */
+    explicit TraceSpan(const char* name);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    /**
+     * @brief Attach a detail (e.g. an image path) shown with the span.
+     *
+     * Ignored when tracing is off.
+     *
+     * @param detail Free-form text.
+     */
+    void detail(const std::string& detail);
+
+private:
+    const char* name_;
+    bool active_;
+    std::chrono::steady_clock::time_point start_;
+    std::string detail_;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+/**
+ * @brief Record a span covering the rest of the enclosing scope.
+ */
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+#endif // ifndef TRACE_H
@@ -0,0 +1,97 @@
+#ifndef UDF_H
+#define UDF_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "imageprobe.h"
+#include "iso9660.h"
+
+/**
+ * @file udf.h
+ * @brief Minimal UDF directory reader for UDF bridge images.
+ *
+ * Windows installer ISOs keep their real tree on the UDF side; the
+ * ISO 9660 side may hold nothing but a README. The reader follows the
+ * Anchor Volume Descriptor Pointer at sector 256 to the Partition and
+ * Logical Volume Descriptors, then the File Set Descriptor to the root
+ * directory, and resolves paths by reading only the File Entries and
+ * directory data along the way. File data is never read.
+ *
+ * Supports 2048-byte logical blocks and a single type 1 partition map,
+ * which covers UDF 1.02-2.01 media such as those made by oscdimg.
+ */
+
+/**
+ * @brief Sector holding the Anchor Volume Descriptor Pointer.
+ */
+constexpr uint64_t UDF_ANCHOR_SECTOR = 256;
+
+/**
+ * @class UdfReader
+ * @brief Path lookups over a UDF volume.
+ *
+ * Lookups return the same IsoFileInfo as Iso9660Reader, with extents
+ * given as absolute 2048-byte sectors. Name comparisons are
+ * case-insensitive for ASCII.
+ */
+class UdfReader {
+public:
+    /**
+     * @brief Locate the partition and the root directory.
+     *
+     * @param probe Sector source for the image. Must outlive the reader.
+     */
+    explicit UdfReader(ImageProbe& probe);
+
+    /**
+     * @return true if a usable UDF volume was found.
+     */
+    bool valid() const { return valid_; }
+
+    /**
+     * @return Logical volume identifier (the UDF volume label).
+     */
+    const std::string& volume_id() const { return volume_id_; }
+
+    /**
+     * @brief Look up an absolute path such as "/sources/install.wim".
+     *
+     * @param path Absolute path inside the image.
+     * @param info Receives the file's name, size and extents.
+     * @return true if the path exists.
+     */
+    bool lookup(const std::string& path, IsoFileInfo& info);
+
+    /**
+     * @brief Check whether a path exists inside the image.
+     *
+     * @param path Absolute path inside the image.
+     * @return true if the path exists.
+     */
+    bool exists(const std::string& path);
+
+private:
+    struct Entry {
+        bool is_dir;                        ///< File type is a directory
+        uint64_t size;                      ///< Information length
+        std::vector<IsoExtent> extents;     ///< Recorded extents
+        std::vector<unsigned char> inline_data;  ///< Data embedded in the entry
+    };
+
+    bool read_volume_descriptors(uint32_t location, uint32_t length);
+    bool read_allocation(const unsigned char* ads, size_t length, bool long_ad, Entry& entry);
+    bool read_entry(uint32_t lbn, Entry& entry);
+    bool find_in_directory(const Entry& dir, const std::string& name, uint32_t& icb, std::string& recorded);
+
+    ImageProbe& probe_;
+    bool valid_;
+    uint32_t partition_number_;
+    uint32_t partition_start_;
+    uint32_t partition_length_;
+    uint32_t fsd_lbn_;
+    uint32_t root_icb_;
+    std::string volume_id_;
+};
+
+#endif // ifndef UDF_H
@@ -0,0 +1,103 @@
+#ifndef URING_H
+#define URING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/uio.h>
+
+/**
+ * @file uring.h
+ * @brief Minimal io_uring wrapper built on the raw system calls.
+ *
+ * Only what the userspace mass storage backend needs: queue a batch of
+ * positioned reads, submit them with one io_uring_enter() call and reap
+ * the completions. Reads use IORING_OP_READV so kernels from 5.1 on
+ * work. Where io_uring is missing or blocked (older kernels, seccomp),
+ * init() fails and callers fall back to pread().
+ */
+
+/**
+ * @class IoUring
+ * @brief One submission/completion queue pair.
+ */
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /**
+     * @brief Create the ring and map its queues.
+     *
+     * @param entries Submission queue size (rounded up by the kernel).
+     * @return true if io_uring is usable.
+     */
+    bool init(unsigned entries);
+
+    /**
+     * @return true after a successful init().
+     */
+    bool ready() const { return ring_fd_ >= 0; }
+
+    /**
+     * @brief Queue a positioned read; nothing is sent until submit().
+     *
+     * @param fd File to read.
+     * @param buf Destination; must stay valid until the read completes.
+     * @param len Bytes to read.
+     * @param offset File offset.
+     * @param user_data Returned with the completion.
+     * @return false if the submission queue is full.
+     */
+    bool queue_read(int fd, void* buf, size_t len, uint64_t offset, uint64_t user_data);
+
+    /**
+     * @brief Hand every queued read to the kernel.
+     *
+     * @return true on success.
+     */
+    bool submit();
+
+    /**
+     * @brief Reap one completion.
+     *
+     * @param user_data Receives the value passed to queue_read().
+     * @param result Receives the byte count or a negative errno.
+     * @param block Wait for a completion if none is available.
+     * @return true if a completion was reaped.
+     */
+    bool reap(uint64_t& user_data, int& result, bool block);
+
+    /**
+     * @return Number of reads submitted and not yet reaped.
+     */
+    unsigned in_flight() const { return in_flight_; }
+
+private:
+    int ring_fd_ = -1;
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    void* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_entries_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    void* cqes_ = nullptr;
+
+    std::vector<struct iovec> iovecs_;
+    unsigned to_submit_ = 0;
+    unsigned in_flight_ = 0;
+};
+
+#endif // ifndef URING_H
@@ -1,6 +1,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <cstdint>
 #include <string>
 
 /**
@@ -11,6 +12,50 @@
  * including mount point discovery, path type checks, and kernel sysfs operations.
  */
 
+/**
+ * @brief Load a little-endian 16-bit value from on-disk or on-wire data.
+ *
+ * @param p First byte of the value; no alignment is required.
+ * @return The value in host byte order.
+ */
+inline uint16_t le16(const unsigned char* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+/**
+ * @brief Load a little-endian 32-bit value.
+ *
+ * @param p First byte of the value.
+ * @return The value in host byte order.
+ */
+inline uint32_t le32(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+/**
+ * @brief Load a little-endian 64-bit value.
+ *
+ * @param p First byte of the value.
+ * @return The value in host byte order.
+ */
+inline uint64_t le64(const unsigned char* p) {
+    return static_cast<uint64_t>(le32(p)) | (static_cast<uint64_t>(le32(p + 4)) << 32);
+}
+
+/**
+ * @brief Store a 32-bit value in little-endian byte order.
+ *
+ * @param p First byte of the destination.
+ * @param v The value to store.
+ */
+inline void put_le32(unsigned char* p, uint32_t v) {
+    p[0] = static_cast<unsigned char>(v);
+    p[1] = static_cast<unsigned char>(v >> 8);
+    p[2] = static_cast<unsigned char>(v >> 16);
+    p[3] = static_cast<unsigned char>(v >> 24);
+}
+
 /**
  * @enum WindowsVersion
  * @brief Detected Windows version from an ISO file.
@@ -73,6 +118,9 @@ bool isfile(const std::string& path);
  * Hybrid ISOs can be booted from USB as a hard drive.
  * Non-hybrid ISOs (like Windows installers) should be mounted as CD-ROM.
  * 
+ * Each call opens and probes the image; use probe_image() from
+ * imageprobe.h to run every detector in a single pass.
+ * 
  * @param path Path to the ISO file.
  * @return true if the ISO has a valid MBR boot signature (hybrid),
  *         false if not present or file cannot be read.
@@ -85,7 +133,6 @@ bool is_hybrid_iso(const std::string& path);
  * Checks for Windows-specific markers in the ISO structure:
  * - Volume label containing "WINDOWS" or "WIN"
  * - Presence of /sources/install.wim or /sources/install.esd
- * - Windows boot files structure
  * 
  * @param path Path to the ISO file.
  * @return true if this appears to be a Windows ISO, false otherwise.
@@ -97,6 +144,7 @@ bool is_windows_iso(const std::string& path);
  * 
  * Analyzes the ISO to determine Windows version, UEFI support,
  * and other characteristics useful for USB mounting.
+ * Equivalent to probe_image(path).windows.
  * 
  * @param path Path to the ISO file.
  * @return WindowsIsoInfo struct with detection results.
@@ -138,8 +186,61 @@ std::string sysfs_read(const std::string& path);
  * 
  * @param path Absolute path to the sysfs/configfs file.
  * @param content The value to write.
- * @return true if the write succeeded, false if the file could not be opened.
+ * @return true if the write succeeded, false if the file could not be
+ *         opened or the kernel rejected the value.
  */
 bool sysfs_write(const std::string& path, const std::string& content);
 
+/**
+ * @brief Write a value to an attribute with a single write() call.
+ * 
+ * Opens the file with O_CLOEXEC, writes the value followed by a
+ * newline and closes it again. Does not log.
+ * 
+ * @param path Absolute path to the sysfs/configfs file.
+ * @param value The value to write.
+ * @param err Receives errno on failure (optional).
+ * @return true if the full value was written.
+ */
+bool attribute_write(const std::string& path, const std::string& value, int* err = nullptr);
+
+/**
+ * @brief Read the full contents of a sysfs/configfs file.
+ * 
+ * Unlike sysfs_read(), embedded whitespace is preserved; only the
+ * trailing newline is removed. Does not log.
+ * 
+ * @param path Absolute path to the sysfs/configfs file.
+ * @param value Receives the contents.
+ * @return true if the file could be read.
+ */
+bool attribute_read(const std::string& path, std::string& value);
+
+/**
+ * @brief Replace a file's contents through a temporary file and a rename.
+ * 
+ * Readers see the old or the new contents, never a partial file. The
+ * data goes to "<path>.tmp.<pid>" (mode 0600), which is renamed over
+ * path, or removed on failure. The directory must exist. Does not log.
+ * 
+ * @param path Destination file.
+ * @param data New contents.
+ * @param durable fsync() the data before the rename, for state that
+ *        cannot be rebuilt; otherwise a crash may leave a torn file.
+ * @param err Receives errno on failure (optional).
+ * @return true if the file was replaced.
+ */
+bool write_file_atomic(const std::string& path, const std::string& data, bool durable, int* err = nullptr);
+
+/**
+ * @brief Escape a string for use inside a JSON string literal.
+ * 
+ * Quotes, backslashes and control characters are escaped; other bytes,
+ * including UTF-8 sequences, are copied unchanged.
+ * 
+ * @param s The string to escape.
+ * @return The escaped string, without surrounding quotes.
+ */
+std::string json_escape(const std::string& s);
+
 #endif // ifndef UTIL_H
\ No newline at end of file
@@ -0,0 +1,145 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "probecache.h"
+
+/**
+ * @file verify.h
+ * @brief Image integrity checks for -verify.
+ *
+ * An image is checked against the first expected checksum found:
+ *   - a sidecar next to it: IMAGE.sha256, IMAGE.sha256sum, or a
+ *     SHA256SUMS file in the same directory listing it (GNU or BSD
+ *     format);
+ *   - the MD5 that implantisomd5 embeds in the application-use area of
+ *     the Primary Volume Descriptor. It covers the image up to its last
+ *     SKIPSECTORS sectors, with the application-use area read as spaces.
+ *
+ * The image is hashed over a read-only mapping while a second thread
+ * faults the pages ahead of the hasher, so reading and hashing overlap.
+ * Several images are verified in parallel. Verdicts are cached by
+ * ImageKey and expected digest, so an unchanged image is not hashed
+ * again.
+ */
+
+/**
+ * @brief Maximum number of verdicts remembered by the cache.
+ */
+constexpr size_t VERIFY_CACHE_MAX_ENTRIES = 64;
+
+/**
+ * @brief Byte offset of the application-use area within a volume descriptor.
+ */
+constexpr uint64_t ISO_APPLICATION_USE_OFFSET = 883;
+
+/**
+ * @brief Size of the application-use area.
+ */
+constexpr uint64_t ISO_APPLICATION_USE_SIZE = 512;
+
+/**
+ * @struct ExpectedChecksum
+ * @brief A checksum an image should match, and what it covers.
+ */
+struct ExpectedChecksum {
+    std::string algorithm;      ///< "sha256" or "md5"
+    std::string digest;         ///< Expected digest, lowercase hex
+    std::string origin;         ///< Sidecar path, or "implantisomd5"
+    uint64_t length = 0;        ///< Bytes covered, from the start of the image
+    uint64_t blank_offset = 0;  ///< Start of a range hashed as spaces
+    uint64_t blank_length = 0;  ///< Length of that range (0: none)
+};
+
+/**
+ * @struct VerifyResult
+ * @brief Outcome of verifying one image.
+ */
+struct VerifyResult {
+    bool passed = false;        ///< Digest matched
+    bool cached = false;        ///< Verdict came from the cache
+    std::string actual;         ///< Computed digest (empty when cached)
+    uint64_t bytes = 0;         ///< Bytes hashed
+    double seconds = 0;         ///< Time spent hashing
+};
+
+/**
+ * @brief Look for a sidecar SHA-256 file for an image.
+ *
+ * @param path Image file.
+ * @param expected Filled on success.
+ * @return true if a sidecar names a digest for this image.
+ */
+bool find_sidecar_checksum(const std::string& path, ExpectedChecksum& expected);
+
+/**
+ * @brief Read the MD5 implanted by implantisomd5.
+ *
+ * @param path Image file.
+ * @param expected Filled on success.
+ * @return true if the Primary Volume Descriptor carries an ISO MD5SUM.
+ */
+bool read_implanted_md5(const std::string& path, ExpectedChecksum& expected);
+
+/**
+ * @brief Find the checksum an image should be verified against.
+ *
+ * Sidecars take precedence over an implanted MD5.
+ *
+ * @param path Image file.
+ * @param expected Filled on success.
+ * @return true if a checksum was found.
+ */
+bool find_expected_checksum(const std::string& path, ExpectedChecksum& expected);
+
+/**
+ * @brief Hash the part of an image an expected checksum covers.
+ *
+ * @param path Image file.
+ * @param expected Algorithm, length and blanked range to use.
+ * @param digest Receives the digest in lowercase hex.
+ * @return false if the image could not be read or is shorter than expected.
+ */
+bool hash_image(const std::string& path, const ExpectedChecksum& expected, std::string& digest);
+
+/**
+ * @brief Verify one image, consulting the verdict cache first.
+ *
+ * @param path Image file.
+ * @param expected Checksum to verify against.
+ * @param result Filled with the outcome.
+ * @return false if the image could not be read.
+ */
+bool verify_image(const std::string& path, const ExpectedChecksum& expected, VerifyResult& result);
+
+/**
+ * @brief Verify images in parallel and log a verdict and throughput for each.
+ *
+ * @param paths Image files.
+ * @return true if every image has a checksum and matches it.
+ */
+bool verify_images(const std::vector<std::string>& paths);
+
+/**
+ * @brief Look up a cached verdict.
+ *
+ * @param key Identity of the image.
+ * @param digest Expected digest the verdict was reached against.
+ * @param passed Receives the verdict on a hit.
+ * @return true on a cache hit.
+ */
+bool verify_cache_lookup(const ImageKey& key, const std::string& digest, bool& passed);
+
+/**
+ * @brief Remember a verdict, evicting the oldest ones if needed.
+ *
+ * @param key Identity of the image.
+ * @param digest Expected digest.
+ * @param passed Verdict.
+ * @return true if the cache file was updated.
+ */
+bool verify_cache_store(const ImageKey& key, const std::string& digest, bool passed);
+
+#endif // ifndef VERIFY_H
@@ -0,0 +1,315 @@
+#include "iso9660.h"
+#include "logger.h"
+#include "util.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+// Volume descriptor types
+constexpr unsigned char ISO_VD_PRIMARY = 1;
+constexpr unsigned char ISO_VD_SUPPLEMENTARY = 2;
+constexpr unsigned char ISO_VD_TERMINATOR = 255;
+
+// Upper bound on descriptors scanned before giving up on a terminator
+constexpr uint64_t ISO_MAX_DESCRIPTORS = 32;
+
+// Upper bound on path table size; real tables are a few kilobytes
+constexpr uint32_t ISO_MAX_PATH_TABLE = 4 * 1024 * 1024;
+
+// Directory record flags
+constexpr unsigned char ISO_FLAG_DIRECTORY = 0x02;
+constexpr unsigned char ISO_FLAG_MULTI_EXTENT = 0x80;
+
+// Rock Ridge continuation areas followed per record
+constexpr int RR_MAX_CONTINUATIONS = 8;
+
+// Helper: Lowercase ASCII and drop the ";1" version suffix and a trailing dot
+static std::string fold_name(std::string name) {
+  size_t semi = name.find(';');
+  if (semi != std::string::npos) {
+    name.resize(semi);
+  }
+  if (!name.empty() && name.back() == '.') {
+    name.pop_back();
+  }
+  for (char& c : name) {
+    if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+  }
+  return name;
+}
+
+// Helper: Convert a Joliet UCS-2 big-endian identifier to UTF-8
+static std::string ucs2be_to_utf8(const unsigned char* p, size_t len) {
+  std::string out;
+  for (size_t i = 0; i + 1 < len; i += 2) {
+    unsigned int c = (static_cast<unsigned int>(p[i]) << 8) | p[i + 1];
+    if (c < 0x80) {
+      out += static_cast<char>(c);
+    } else if (c < 0x800) {
+      out += static_cast<char>(0xC0 | (c >> 6));
+      out += static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+      out += static_cast<char>(0xE0 | (c >> 12));
+      out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+  }
+  return out;
+}
+
+// Helper: Check a Supplementary Volume Descriptor for Joliet escape sequences
+static bool is_joliet_descriptor(const unsigned char* vd) {
+  const unsigned char* esc = vd + 88;
+  return esc[0] == '%' && esc[1] == '/' &&
+         (esc[2] == '@' || esc[2] == 'C' || esc[2] == 'E');
+}
+
+// Helper: Offset of the System Use area inside a directory record, at most its length
+static size_t system_use_offset(const unsigned char* record) {
+  size_t name_len = record[32];
+  return std::min<size_t>(record[0], 33 + name_len + ((name_len % 2 == 0) ? 1 : 0));
+}
+
+Iso9660Reader::Iso9660Reader(ImageProbe& probe)
+    : probe_(probe), root_{0, 0}, joliet_(false), rock_ridge_(false), susp_skip_(0) {
+  const unsigned char* primary = nullptr;
+  const unsigned char* joliet = nullptr;
+
+  for (uint64_t lba = ISO_PVD_SECTOR; lba < ISO_PVD_SECTOR + ISO_MAX_DESCRIPTORS; lba++) {
+    const unsigned char* vd = probe_.sector(lba);
+    if (!vd || std::memcmp(vd + 1, "CD001", 5) != 0) break;
+    if (vd[0] == ISO_VD_TERMINATOR) break;
+
+    if (vd[0] == ISO_VD_PRIMARY && !primary) {
+      primary = vd;
+    } else if (vd[0] == ISO_VD_SUPPLEMENTARY && !joliet && is_joliet_descriptor(vd)) {
+      joliet = vd;
+    }
+  }
+
+  if (!primary) {
+    LOG_DEBUG("No ISO 9660 Primary Volume Descriptor in " + probe_.path());
+    return;
+  }
+
+  // Rock Ridge is announced by a SUSP "SP" entry in the root's "." record
+  const unsigned char* root_record = primary + 156;
+  const unsigned char* root_dir = probe_.sector(le32(root_record + 2));
+  if (root_dir && root_dir[0] >= 34) {
+    size_t su = system_use_offset(root_dir);
+    if (su + 7 <= root_dir[0] && root_dir[su] == 'S' && root_dir[su + 1] == 'P' &&
+        root_dir[su + 4] == 0xBE && root_dir[su + 5] == 0xEF) {
+      rock_ridge_ = true;
+      susp_skip_ = root_dir[su + 6];
+    }
+  }
+
+  const unsigned char* descriptor = primary;
+  if (!rock_ridge_ && joliet) {
+    descriptor = joliet;
+    joliet_ = true;
+  }
+
+  root_record = descriptor + 156;
+  if (root_record[0] < 34 || !(root_record[25] & ISO_FLAG_DIRECTORY)) {
+    LOG_DEBUG("Invalid root directory record in " + probe_.path());
+    return;
+  }
+
+  if (!load_path_table(descriptor)) {
+    LOG_DEBUG("Failed to load ISO 9660 path table from " + probe_.path());
+    return;
+  }
+
+  root_.lba = le32(root_record + 2);
+  root_.length = le32(root_record + 10);
+  LOG_DEBUG(std::string("ISO 9660 tree: ") + (rock_ridge_ ? "Rock Ridge" : joliet_ ? "Joliet" : "plain") +
+            ", " + std::to_string(path_table_.size()) + " directories");
+}
+
+bool Iso9660Reader::load_path_table(const unsigned char* descriptor) {
+  uint32_t size = le32(descriptor + 132);
+  uint32_t lba = le32(descriptor + 140);  // Type L (little-endian) table
+  if (size == 0 || size > ISO_MAX_PATH_TABLE || lba == 0) {
+    return false;
+  }
+
+  std::vector<unsigned char> table(size);
+  for (uint32_t done = 0; done < size; done += ISO_SECTOR_SIZE) {
+    const unsigned char* data = probe_.sector(lba + done / ISO_SECTOR_SIZE);
+    if (!data) return false;
+    std::memcpy(table.data() + done, data, std::min<size_t>(ISO_SECTOR_SIZE, size - done));
+  }
+
+  size_t pos = 0;
+  while (pos + 8 <= size) {
+    size_t name_len = table[pos];
+    if (name_len == 0 || pos + 8 + name_len > size) break;
+
+    PathTableEntry entry;
+    entry.lba = le32(&table[pos + 2]);
+    entry.parent = le16(&table[pos + 6]);
+    const unsigned char* id = &table[pos + 8];
+    entry.name = fold_name(joliet_ ? ucs2be_to_utf8(id, name_len)
+                                   : std::string(reinterpret_cast<const char*>(id), name_len));
+    path_table_.push_back(std::move(entry));
+
+    pos += 8 + name_len + (name_len % 2);
+  }
+  return !path_table_.empty();
+}
+
+bool Iso9660Reader::rock_ridge_name(const unsigned char* record, std::string& name) {
+  size_t offset = system_use_offset(record) + susp_skip_;
+  const unsigned char* area = record + offset;
+  size_t len = record[0] > offset ? record[0] - offset : 0;
+  bool found = false;
+
+  for (int continuation = 0; continuation <= RR_MAX_CONTINUATIONS && area; continuation++) {
+    const unsigned char* next_area = nullptr;
+    size_t next_len = 0;
+
+    size_t pos = 0;
+    while (pos + 4 <= len) {
+      const unsigned char* entry = area + pos;
+      size_t entry_len = entry[2];
+      if (entry_len < 4 || pos + entry_len > len) break;
+
+      if (entry[0] == 'N' && entry[1] == 'M' && entry_len >= 5) {
+        unsigned char flags = entry[4];
+        if (flags & 0x06) return false;  // "." and ".." aliases
+        name.append(reinterpret_cast<const char*>(entry + 5), entry_len - 5);
+        found = true;
+      } else if (entry[0] == 'C' && entry[1] == 'E' && entry_len >= 28) {
+        uint32_t block = le32(entry + 4);
+        uint32_t ce_offset = le32(entry + 12);
+        uint32_t ce_len = le32(entry + 20);
+        const unsigned char* data = probe_.sector(block);
+        if (data && ce_offset < ISO_SECTOR_SIZE) {
+          next_area = data + ce_offset;
+          next_len = std::min<size_t>(ce_len, ISO_SECTOR_SIZE - ce_offset);
+        }
+      } else if (entry[0] == 'S' && entry[1] == 'T') {
+        break;
+      }
+      pos += entry_len;
+    }
+
+    area = next_area;
+    len = next_len;
+  }
+  return found;
+}
+
+std::string Iso9660Reader::record_name(const unsigned char* record) {
+  std::string name;
+  if (rock_ridge_ && rock_ridge_name(record, name)) {
+    return fold_name(name);
+  }
+  const unsigned char* id = record + 33;
+  size_t id_len = record[32];
+  if (joliet_) {
+    return fold_name(ucs2be_to_utf8(id, id_len));
+  }
+  return fold_name(std::string(reinterpret_cast<const char*>(id), id_len));
+}
+
+bool Iso9660Reader::find_in_directory(const IsoExtent& dir, const std::string& name, IsoFileInfo& info) {
+  bool collecting = false;
+  uint64_t sectors = (dir.length + ISO_SECTOR_SIZE - 1) / ISO_SECTOR_SIZE;
+
+  for (uint64_t s = 0; s < sectors; s++) {
+    const unsigned char* data = probe_.sector(dir.lba + s);
+    if (!data) return false;
+
+    size_t pos = 0;
+    while (pos < ISO_SECTOR_SIZE) {
+      const unsigned char* record = data + pos;
+      size_t record_len = record[0];
+      // Records never span sectors; a zero length pads to the next one
+      if (record_len == 0) break;
+      if (record_len < 34 || pos + record_len > ISO_SECTOR_SIZE) return false;
+      // The name must lie inside the record, or reading it runs past the sector
+      if (33 + static_cast<size_t>(record[32]) > record_len) return false;
+      pos += record_len;
+
+      // Skip the "." and ".." entries
+      if (record[32] == 1 && (record[33] == 0 || record[33] == 1)) continue;
+
+      if (!collecting) {
+        if (record_name(record) != name) continue;
+        info.name = name;
+        info.is_dir = (record[25] & ISO_FLAG_DIRECTORY) != 0;
+        info.size = 0;
+        info.extents.clear();
+        collecting = true;
+      }
+
+      // Multi-extent files repeat the record once per extent
+      uint32_t length = le32(record + 10);
+      info.extents.push_back({le32(record + 2), length});
+      info.size += length;
+      if (!(record[25] & ISO_FLAG_MULTI_EXTENT)) {
+        return true;
+      }
+    }
+  }
+  return collecting;
+}
+
+bool Iso9660Reader::lookup(const std::string& path, IsoFileInfo& info) {
+  if (!valid()) return false;
+
+  std::vector<std::string> components;
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) end = path.size();
+    if (end > start) {
+      components.push_back(fold_name(path.substr(start, end - start)));
+    }
+    start = end + 1;
+  }
+
+  IsoExtent dir = root_;
+  info = {"", true, root_.length, {root_}};
+  if (components.empty()) return true;
+
+  // Resolve leading directories through the path table without reading
+  // their parents; fall back to a directory walk once a name does not
+  // appear there (e.g. Rock Ridge names longer than the ISO identifier)
+  size_t index = 1;
+  size_t i = 0;
+  for (; i + 1 < components.size() && index != 0; i++) {
+    size_t found = 0;
+    for (size_t e = 0; e < path_table_.size(); e++) {
+      if (path_table_[e].parent == index && e + 1 != index && path_table_[e].name == components[i]) {
+        found = e + 1;
+        break;
+      }
+    }
+    if (!found) break;
+
+    // The "." record at the start of the extent carries the directory length
+    const unsigned char* self = probe_.sector(path_table_[found - 1].lba);
+    if (!self || self[0] < 34) return false;
+    dir = {path_table_[found - 1].lba, le32(self + 10)};
+    index = found;
+  }
+
+  for (; i < components.size(); i++) {
+    if (!find_in_directory(dir, components[i], info)) {
+      return false;
+    }
+    if (i + 1 < components.size()) {
+      if (!info.is_dir || info.extents.empty()) return false;
+      dir = info.extents.front();
+    }
+  }
+  return true;
+}
+
+bool Iso9660Reader::exists(const std::string& path) {
+  IsoFileInfo info;
+  return lookup(path, info);
+}
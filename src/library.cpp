@@ -0,0 +1,275 @@
+#include "library.h"
+#include "logger.h"
+#include "trace.h"
+#include "util.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+    // The header also changes when detection changes its answers
+    const char* const INDEX_FILE = "library.index";
+    const char* const INDEX_HEADER = "isodrive-library-index 6";
+
+    const char* const IMAGE_EXTENSIONS[] = {".iso", ".img", ".raw", ".bin", ".ima"};
+}
+
+bool library_is_image(const std::string& name) {
+  if (name.empty() || name[0] == '.') return false;
+  std::string ext = fs::path(name).extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+  return std::find(std::begin(IMAGE_EXTENSIONS), std::end(IMAGE_EXTENSIONS), ext) != std::end(IMAGE_EXTENSIONS);
+}
+
+// Helper: Load the index as a map from image path to entry
+static std::map<std::string, LibraryEntry> load_index() {
+  std::map<std::string, LibraryEntry> index;
+  std::ifstream file((fs::path(probe_cache_dir()) / INDEX_FILE).string());
+  std::string line;
+  if (!file || !std::getline(file, line) || line != INDEX_HEADER) {
+    return index;
+  }
+
+  while (std::getline(file, line)) {
+    // Numeric fields, then the label and the path, each after a tab
+    size_t label_tab = line.find('\t');
+    size_t path_tab = label_tab == std::string::npos ? label_tab : line.find('\t', label_tab + 1);
+    if (path_tab == std::string::npos) continue;
+
+    std::istringstream in(line.substr(0, label_tab));
+    LibraryEntry entry = {};
+    if (!(in >> entry.key.dev >> entry.key.ino >> entry.key.size >> entry.key.mtime_sec >>
+          entry.key.mtime_nsec) || !probe_result_read(in, entry.result)) {
+      continue;
+    }
+    ImageProbeResult& r = entry.result;
+    r.readable = true;
+    r.size = entry.key.size;
+    r.windows.volume_label = line.substr(label_tab + 1, path_tab - label_tab - 1);
+    entry.path = line.substr(path_tab + 1);
+    index[entry.path] = std::move(entry);
+  }
+  return index;
+}
+
+// Helper: Write the index file
+static bool save_index(const std::map<std::string, LibraryEntry>& index) {
+  std::string dir = probe_cache_dir();
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    LOG_DEBUG("Cannot create state directory " + dir + ": " + ec.message());
+    return false;
+  }
+
+  std::ostringstream out;
+  out << INDEX_HEADER << "\n";
+  for (const auto& item : index) {
+    const LibraryEntry& entry = item.second;
+    const ImageProbeResult& r = entry.result;
+    std::string label = r.windows.volume_label;
+    std::replace_if(label.begin(), label.end(), [](char c) { return c == '\n' || c == '\t'; }, ' ');
+    out << entry.key.dev << ' ' << entry.key.ino << ' ' << entry.key.size << ' '
+        << entry.key.mtime_sec << ' ' << entry.key.mtime_nsec << ' ';
+    probe_result_write(out, r);
+    out << '\t' << label << '\t' << entry.path << "\n";
+  }
+  std::string data = out.str();
+
+  // The index only saves probing time, so it is not fsync()ed
+  std::string path = (fs::path(dir) / INDEX_FILE).string();
+  int err = 0;
+  if (!write_file_atomic(path, data, false, &err)) {
+    LOG_DEBUG("Failed to update library index " + path + ": " + std::strerror(err));
+    return false;
+  }
+  return true;
+}
+
+bool scan_library(const std::string& dir, std::vector<LibraryEntry>& entries, LibraryScanStats& stats,
+                  unsigned threads) {
+  TraceSpan span("scan_library");
+  span.detail(dir);
+  auto start = std::chrono::steady_clock::now();
+  entries.clear();
+  stats = LibraryScanStats();
+
+  std::error_code ec;
+  fs::path root = fs::absolute(dir, ec).lexically_normal();
+  fs::directory_iterator it(root, ec);
+  if (ec) {
+    log_error("Cannot read directory " + dir + ": " + ec.message());
+    return false;
+  }
+  for (const fs::directory_entry& file : it) {
+    std::string name = file.path().filename().string();
+    if (!library_is_image(name) || !file.is_regular_file(ec)) continue;
+    LibraryEntry entry = {};
+    entry.path = file.path().string();
+    if (image_key(entry.path, entry.key)) {
+      entries.push_back(std::move(entry));
+    }
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const LibraryEntry& a, const LibraryEntry& b) { return a.path < b.path; });
+
+  // Answer unchanged images from the index
+  std::map<std::string, LibraryEntry> index = load_index();
+  std::vector<size_t> misses;
+  for (size_t i = 0; i < entries.size(); i++) {
+    auto hit = index.find(entries[i].path);
+    if (hit != index.end() && hit->second.key == entries[i].key) {
+      entries[i].result = hit->second.result;
+      stats.indexed++;
+    } else {
+      misses.push_back(i);
+    }
+  }
+
+  // Probe the rest in parallel; each probe owns its descriptor and buffers
+  if (!misses.empty()) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>({threads, LIBRARY_MAX_THREADS, misses.size()}));
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+      workers.emplace_back([&] {
+        for (size_t m; (m = next.fetch_add(1)) < misses.size();) {
+          LibraryEntry& entry = entries[misses[m]];
+          entry.result = probe_image(entry.path);
+        }
+      });
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+    stats.probed = misses.size();
+  }
+
+  // Replace this directory's part of the index; other libraries are kept
+  bool changed = stats.probed > 0;
+  for (auto item = index.begin(); item != index.end();) {
+    if (fs::path(item->first).parent_path() == root) {
+      bool present = std::any_of(entries.begin(), entries.end(),
+                                 [&item](const LibraryEntry& e) { return e.path == item->first; });
+      changed |= !present;
+      item = present ? std::next(item) : index.erase(item);
+    } else {
+      ++item;
+    }
+  }
+  if (changed) {
+    for (size_t i : misses) {
+      const LibraryEntry& entry = entries[i];
+      if (entry.result.readable && entry.path.find_first_of("\t\n") == std::string::npos) {
+        index[entry.path] = entry;
+      } else {
+        index.erase(entry.path);
+      }
+    }
+    save_index(index);
+  }
+
+  stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  LOG_DEBUG("Scanned " + std::to_string(entries.size()) + " images in " + dir + ": " +
+            std::to_string(stats.probed) + " probed, " + std::to_string(stats.indexed) + " from the index");
+  return true;
+}
+
+// Helper: Short Windows version name for the table
+static std::string windows_column(const ImageProbeResult& r) {
+  if (!r.windows.is_windows) return "-";
+  switch (r.windows.version) {
+    case WindowsVersion::WIN10: return "10";
+    case WindowsVersion::WIN11: return "11";
+    default: return "unknown";
+  }
+}
+
+// Helper: Firmware the image boots on, as far as detection knows
+static std::string boot_column(const ImageProbeResult& r) {
+  if (r.boot_uefi && r.boot_legacy) return "UEFI+legacy";
+  if (r.boot_uefi) return "UEFI";
+  if (r.boot_legacy) return "legacy";
+  return "-";
+}
+
+// Helper: Human-readable size
+static std::string size_column(uint64_t size) {
+  static const char* const units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+  double value = static_cast<double>(size);
+  size_t unit = 0;
+  while (value >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+    value /= 1024;
+    unit++;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+  return buf;
+}
+
+std::string library_to_table(const std::vector<LibraryEntry>& entries) {
+  std::vector<std::vector<std::string>> rows;
+  rows.push_back({"FILE", "LABEL", "WINDOWS", "BOOT", "HYBRID", "SIZE"});
+  for (const LibraryEntry& entry : entries) {
+    const ImageProbeResult& r = entry.result;
+    std::string label = !r.readable ? "(unreadable)" : r.truncated ? "(truncated)"
+                        : r.windows.volume_label.empty() ? "-" : r.windows.volume_label;
+    rows.push_back({fs::path(entry.path).filename().string(), label, windows_column(r), boot_column(r),
+                    r.is_hybrid ? "yes" : "no", size_column(entry.key.size)});
+  }
+
+  std::vector<size_t> widths(rows[0].size(), 0);
+  for (const auto& row : rows) {
+    for (size_t c = 0; c < row.size(); c++) widths[c] = std::max(widths[c], row[c].size());
+  }
+  std::string out;
+  for (const auto& row : rows) {
+    std::string line;
+    for (size_t c = 0; c < row.size(); c++) {
+      line += row[c];
+      if (c + 1 < row.size()) line += std::string(widths[c] - row[c].size() + 2, ' ');
+    }
+    out += line + "\n";
+  }
+  return out;
+}
+
+std::string library_to_json(const std::vector<LibraryEntry>& entries) {
+  auto flag = [](bool value) { return value ? "true" : "false"; };
+  std::string out = "[";
+  for (size_t i = 0; i < entries.size(); i++) {
+    const ImageProbeResult& r = entries[i].result;
+    out += i ? ",\n " : "\n ";
+    out += std::string("{\"path\":\"") + json_escape(entries[i].path) + "\"" +
+           ",\"readable\":" + flag(r.readable) +
+           ",\"label\":\"" + json_escape(r.windows.volume_label) + "\"" +
+           ",\"iso9660\":" + flag(r.is_iso9660) +
+           ",\"windows\":" + flag(r.windows.is_windows) +
+           ",\"windows_version\":" + (r.windows.is_windows ? "\"" + windows_column(r) + "\"" : "null") +
+           ",\"uefi\":" + flag(r.boot_uefi) +
+           ",\"legacy\":" + flag(r.boot_legacy) +
+           ",\"hybrid\":" + flag(r.is_hybrid) +
+           ",\"partitions\":\"" + partition_scheme_name(r.partitions) + "\"" +
+           ",\"esp\":" + flag(r.has_esp) +
+           ",\"truncated\":" + flag(r.truncated) +
+           ",\"system_area_loaders\":\"" + bootloader_names(r.bootloaders.system_area) + "\"" +
+           ",\"boot_image_loaders\":\"" + bootloader_names(r.bootloaders.boot_images) + "\"" +
+           ",\"size\":" + std::to_string(entries[i].key.size) + "}";
+  }
+  out += entries.empty() ? "]\n" : "\n]\n";
+  return out;
+}
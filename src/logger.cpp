@@ -1,39 +1,130 @@
 #include "logger.h"
+#include "util.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<LogLevel> g_log_threshold{LogLevel::INFO};
 
 namespace {
     // Global log level, default to INFO
     LogLevel g_log_level = LogLevel::INFO;
+
+    // Optional receiver replacing console output
+    LogSink g_log_sink;
+
+    // JSON lines log and the most verbose level it records
+    int g_json_fd = -1;
+    LogLevel g_json_level = LogLevel::SILENT;
+
+    // Guards everything above and the console streams
+    std::mutex g_log_mutex;
+
+    const char* const LEVEL_NAMES[] = {"silent", "error", "warn", "info", "debug"};
+}
+
+// Helper: Recompute the level log_enabled() compares against; caller holds g_log_mutex
+static void update_threshold() {
+    LogLevel threshold = g_log_level;
+    if (g_json_fd >= 0 && g_json_level > threshold) {
+        threshold = g_json_level;
+    }
+    g_log_threshold.store(threshold, std::memory_order_relaxed);
+}
+
+// Helper: Append one JSON line; caller holds g_log_mutex
+static void write_json(LogLevel level, const std::string& message) {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    long long mono_us = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+    std::string line = "{\"mono_us\":" + std::to_string(mono_us) +
+                       ",\"level\":\"" + LEVEL_NAMES[static_cast<int>(level)] + "\"" +
+                       ",\"tid\":" + std::to_string(static_cast<long>(syscall(SYS_gettid))) +
+                       ",\"msg\":\"" + json_escape(message) + "\"}\n";
+    ssize_t n;
+    do {
+        n = write(g_json_fd, line.data(), line.size());
+    } while (n < 0 && errno == EINTR);
+}
+
+// Helper: Send a message to the JSON log and to the sink or console
+static void log_write(LogLevel level, const char* prefix, std::ostream& console, const std::string& message) {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (g_json_fd >= 0 && g_json_level >= level) {
+        write_json(level, message);
+    }
+    if (g_log_level >= level) {
+        if (g_log_sink) {
+            g_log_sink(level, message);
+            return;
+        }
+        console << prefix << message << std::endl;
+    }
 }
 
 void log_set_level(LogLevel level) {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
     g_log_level = level;
+    update_threshold();
 }
 
 LogLevel log_get_level() {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
     return g_log_level;
 }
 
-void log_error(const std::string& message) {
-    if (g_log_level >= LogLevel::ERROR) {
-        std::cerr << "[ERROR] " << message << std::endl;
+void log_set_sink(LogSink sink) {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    g_log_sink = std::move(sink);
+}
+
+bool log_open_json(const std::string& path, LogLevel level) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_error("Cannot open log file " + path + ": " + std::strerror(errno));
+        return false;
     }
+
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (g_json_fd >= 0) {
+        close(g_json_fd);
+    }
+    g_json_fd = fd;
+    g_json_level = level;
+    update_threshold();
+    return true;
 }
 
-void log_warn(const std::string& message) {
-    if (g_log_level >= LogLevel::WARN) {
-        std::cerr << "[WARN] " << message << std::endl;
+void log_close_json() {
+    std::lock_guard<std::mutex> lock(g_log_mutex);
+    if (g_json_fd >= 0) {
+        close(g_json_fd);
+        g_json_fd = -1;
     }
+    update_threshold();
+}
+
+void log_error(const std::string& message) {
+    log_write(LogLevel::ERROR, "[ERROR] ", std::cerr, message);
+}
+
+void log_warn(const std::string& message) {
+    log_write(LogLevel::WARN, "[WARN] ", std::cerr, message);
 }
 
 void log_info(const std::string& message) {
-    if (g_log_level >= LogLevel::INFO) {
-        std::cout << message << std::endl;
-    }
+    log_write(LogLevel::INFO, "", std::cout, message);
 }
 
 void log_debug(const std::string& message) {
-    if (g_log_level >= LogLevel::DEBUG) {
-        std::cout << "[DEBUG] " << message << std::endl;
-    }
+#ifndef ISODRIVE_NO_DEBUG_LOG
+    log_write(LogLevel::DEBUG, "[DEBUG] ", std::cout, message);
+#else
+    (void)message;
+#endif
 }
@@ -1,61 +1,137 @@
 #include "androidusbisomanager.h"
+#include "clone.h"
 #include "configfsisomanager.h"
+#include "daemon.h"
+#include "enumeration.h"
+#include "ffsbackend.h"
+#include "imageprobe.h"
+#include "library.h"
 #include "logger.h"
+#include "mountrequest.h"
+#include "probecache.h"
+#include "trace.h"
 #include "util.h"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
 #include <string>
 #include <unistd.h>
+#include <vector>
 
 void print_help() {
   std::cout << "Usage:\n"
-            << "isodrive [FILE]... [OPTION]...\n"
-            << "Mounts the given FILE as a bootable device using configfs.\n"
+            << "isodrive [FILE [OPTION]...]... [OPTION]...\n"
+            << "Mounts the given FILEs as a bootable device using configfs, one LUN per FILE.\n"
             << "Run without any arguments to unmount any mounted files and display "
-               "this help message.\n\n"
-            << "Optional arguments:\n"
+               "this help message.\n"
+            << "Compressed FILEs (gzip, xz, zstd) are decompressed into a cached staging copy\n"
+            << "and mounted read-only.\n\n"
+            << "Per-file options (apply to the FILE they follow):\n"
             << "-rw\t\t Mounts the file in read write mode.\n"
+            << "-rw-clone\t Mounts a writable copy-on-write clone of the file; the file\n"
+            << "\t\t itself is never modified.\n"
             << "-cdrom\t\t Mounts the file as a cdrom.\n"
-            << "-hdd\t\t Forces the file to be mounted as a hard disk (disables auto-detect).\n\n"
+            << "-hdd\t\t Forces the file to be mounted as a hard disk (disables auto-detect).\n"
+            << "-windows\t Enables Windows ISO mode (auto-detects if not specified).\n\n"
+            << "Optional arguments:\n"
+            << "-noprobe-cache\t Re-probes the file instead of using cached detection results.\n"
+            << "-verify\t\t Checks each FILE against FILE.sha256, FILE.sha256sum, a SHA256SUMS\n"
+            << "\t\t entry or its implantisomd5 checksum before mounting.\n\n"
             << "Windows ISO options:\n"
-            << "-windows\t Enables Windows ISO mode (auto-detects if not specified).\n"
             << "-win10\t\t Forces Windows 10 mode.\n"
             << "-win11\t\t Forces Windows 11 mode.\n"
             << "-usb3\t\t Uses USB 3.0 (SuperSpeed) descriptors.\n\n"
+            << "Media options:\n"
+            << "-prepare\t Links an empty mass storage function so later mounts swap media\n"
+            << "\t\t without re-enumerating the USB device (configfs only).\n"
+            << "-eject\t\t Ejects the mounted file without disconnecting the USB device.\n"
+            << "-status\t\t Shows the files mounted on each LUN.\n"
+            << "-list DIR\t Lists the images in DIR with their label, Windows version,\n"
+            << "\t\t boot support, hybrid layout and size.\n"
+            << "-json\t\t Prints -list output as JSON.\n"
+            << "-wait\t\t Waits until the host has enumerated the device and reports\n"
+            << "\t\t the latency and USB speed (configfs only).\n"
+            << "-wait-timeout SECONDS\n"
+            << "\t\t Gives up waiting after SECONDS (default 10); implies -wait.\n\n"
+            << "Daemon options:\n"
+            << "-daemon\t\t Runs as a resident daemon serving requests on a Unix socket.\n"
+            << "-nodaemon\t Does the work in this process even if the daemon is running.\n\n"
             << "Backend options:\n"
             << "-configfs\t Forces the app to use configfs.\n"
-            << "-usbgadget\t Forces the app to use sysfs.\n\n"
+            << "-usbgadget\t Forces the app to use sysfs.\n"
+            << "-ffs\t\t Serves the FILE from userspace over FunctionFS until interrupted\n"
+            << "\t\t (configfs only).\n\n"
             << "Output options:\n"
             << "-v, -verbose\t Enables verbose/debug output.\n"
-            << "-q, -quiet\t Suppresses all output except errors.\n\n";
+            << "-q, -quiet\t Suppresses all output except errors.\n"
+            << "-trace FILE\t Writes per-phase timings to FILE as Chrome trace JSON.\n"
+            << "-log-json FILE\t Appends every message, including debug, to FILE as JSON lines.\n\n";
 }
 
-bool configs(const std::string& iso_target, bool cdrom, bool ro, const WindowsMountOptions& win_opts) {
-  log_info("Using configfs!");
-
-  if (!supported())
-  {
-    log_error("usb_gadget is not supported!");
-    return false;
-  }
-  
-  return mount_iso(iso_target, cdrom, ro, win_opts);
-}
 
-bool usb(const std::string& iso_target, bool cdrom, bool ro) {
+bool usb(const std::vector<LunMedia>& images) {
   log_info("Using sysfs!");
   if (!usb_supported())
   {
     log_error("usb_gadget is not supported!");
     return false;
   }
-  if (cdrom || !ro)
+  if (images.size() > 1)
+  {
+    log_warn("sysfs backend supports a single image; mounting " + images[0].path + " only");
+  }
+  if (!images.empty() && (images[0].cdrom || !images[0].ro))
   {
     log_warn("cdrom/ro flags ignored. (this is expected for sysfs backend)");
   }
-  if (iso_target.empty())
+  if (images.empty())
     return usb_reset_iso();
   else
-    return usb_mount_iso(iso_target);
+    return usb_mount_iso(images[0].path);
+}
+
+bool usb(const MountRequest& request) {
+  // The sysfs mount outlives this process, so nothing could discard a clone
+  for (const ImageRequest& image : request.images) {
+    if (image.clone) {
+      log_error("-rw-clone requires the configfs backend");
+      return false;
+    }
+  }
+  std::vector<LunMedia> media;
+  WindowsMountOptions win_opts;
+  if (!resolve_images(request, probe_image_cached, media, win_opts)) {
+    return false;
+  }
+  if (win_opts.enabled) {
+     log_warn("Windows mode is only supported with configfs backend");
+  }
+  return usb(media);
+}
+
+// Helper: Take the argument of an option that requires one; another option does not count
+static bool option_argument(int argc, char *argv[], int& i, std::string& value) {
+  if (i + 1 >= argc || argv[i + 1][0] == '-') {
+    log_error(std::string("Option ") + argv[i] + " requires an argument");
+    return false;
+  }
+  value = argv[++i];
+  return true;
+}
+
+// Helper: Parse a positive number of seconds
+static bool parse_seconds(const std::string& text, int& seconds) {
+  char* end = nullptr;
+  errno = 0;
+  long value = std::strtol(text.c_str(), &end, 10);
+  if (errno != 0 || end == text.c_str() || *end != '\0' || value <= 0 || value > INT_MAX / 1000) {
+    log_error("Not a positive number of seconds: " + text);
+    return false;
+  }
+  seconds = static_cast<int>(value);
+  return true;
 }
 
 int main(int argc, char *argv[]) {
@@ -64,136 +140,208 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  std::string iso_target = "";
-  bool cdrom = false;
-  bool ro = true;
+  // Per-image options apply to the image they follow; options given
+  // before the first image apply to that image
+  MountRequest request;
+  ImageRequest leading;
+  auto current = [&]() -> ImageRequest& {
+    return request.images.empty() ? leading : request.images.back();
+  };
+
   bool force_configfs = false;
   bool force_usbgadget = false;
-  bool force_hdd = false;
-  
-  // Windows options
-  bool windows_mode = false;
-  bool force_win10 = false;
-  bool force_win11 = false;
-  bool use_usb3 = false;
+  bool use_ffs = false;
+  bool run_daemon = false;
+  bool use_daemon = true;
+  std::string trace_path;
+  std::string list_dir;
+  bool list_json = false;
 
   for (int i = 1; i < argc; i++) {
     std::string arg = argv[i];
+    std::string value;
     if (arg == "-rw") {
-      ro = false;
+      current().ro = false;
+    } else if (arg == "-rw-clone") {
+      current().ro = false;
+      current().clone = true;
     } else if (arg == "-cdrom") {
-      cdrom = true;
+      current().cdrom = true;
     } else if (arg == "-windows") {
-      windows_mode = true;
+      current().windows = true;
     } else if (arg == "-win10") {
-      windows_mode = true;
-      force_win10 = true;
+      current().windows = true;
+      request.force_win10 = true;
     } else if (arg == "-win11") {
-      windows_mode = true;
-      force_win11 = true;
+      current().windows = true;
+      request.force_win11 = true;
     } else if (arg == "-usb3") {
-      use_usb3 = true;
+      request.use_usb3 = true;
     } else if (arg == "-hdd") {
-      force_hdd = true;
+      current().force_hdd = true;
+    } else if (arg == "-prepare") {
+      request.command = RequestCommand::PREPARE;
+    } else if (arg == "-eject") {
+      request.command = RequestCommand::EJECT;
+    } else if (arg == "-status") {
+      request.command = RequestCommand::STATUS;
+    } else if (arg == "-list") {
+      if (!option_argument(argc, argv, i, list_dir)) {
+        print_help();
+        return 1;
+      }
+    } else if (arg == "-json") {
+      list_json = true;
+    } else if (arg == "-wait") {
+      request.wait_timeout_ms = ENUMERATION_DEFAULT_TIMEOUT_MS;
+    } else if (arg == "-wait-timeout") {
+      int seconds;
+      if (!option_argument(argc, argv, i, value) || !parse_seconds(value, seconds)) {
+        print_help();
+        return 1;
+      }
+      request.wait_timeout_ms = seconds * 1000;
+    } else if (arg == "-verify") {
+      request.verify = true;
+    } else if (arg == "-noprobe-cache") {
+      request.no_probe_cache = true;
+      probe_cache_set_enabled(false);
+    } else if (arg == "-daemon") {
+      run_daemon = true;
+    } else if (arg == "-nodaemon") {
+      use_daemon = false;
     } else if (arg == "-configfs") {
       force_configfs = true;
     } else if (arg == "-usbgadget") {
       force_usbgadget = true;
+    } else if (arg == "-ffs") {
+      use_ffs = true;
     } else if (arg == "-v" || arg == "-verbose") {
       log_set_level(LogLevel::DEBUG);
     } else if (arg == "-q" || arg == "-quiet") {
       log_set_level(LogLevel::ERROR);
-    } else if (iso_target.empty() && arg[0] != '-') {
-      iso_target = arg;
+    } else if (arg == "-trace") {
+      if (!option_argument(argc, argv, i, trace_path)) {
+        print_help();
+        return 1;
+      }
+    } else if (arg == "-log-json") {
+      if (!option_argument(argc, argv, i, value)) {
+        print_help();
+        return 1;
+      }
+      if (!log_open_json(value)) {
+        return 1;
+      }
+    } else if (arg[0] != '-') {
+      if (request.images.empty()) {
+        leading.path = arg;
+        request.images.push_back(leading);
+      } else {
+        ImageRequest image;
+        image.path = arg;
+        request.images.push_back(image);
+      }
+    }
+  }
+
+  // Written on every exit path, after the spans below have closed
+  struct TraceFlush {
+    std::string path;
+    ~TraceFlush() {
+      if (!path.empty()) trace_write(path);
     }
+  } trace_flush{trace_path};
+  if (!trace_path.empty()) {
+    trace_enable();
+  }
+  TRACE_SPAN("main");
+
+  // Listing only reads images, so it never involves the gadget or the daemon
+  if (!list_dir.empty()) {
+    std::vector<LibraryEntry> entries;
+    LibraryScanStats stats;
+    if (!scan_library(list_dir, entries, stats)) {
+      return 1;
+    }
+    std::cout << (list_json ? library_to_json(entries) : library_to_table(entries));
+    return 0;
+  }
+
+  if (run_daemon) {
+    IsoDaemon daemon;
+    return daemon.serve(daemon_socket_path()) ? 0 : 1;
   }
 
   if (argc == 1) {
     print_help();
   }
 
-  // Check for incompatible flags
-  if (cdrom && !ro && !windows_mode) {
-    log_error("Incompatible arguments -cdrom and -rw");
-    return 1;
+  {
+    TRACE_SPAN("validate_request");
+    if (!validate_request(request)) {
+      return 1;
+    }
   }
 
-  if (cdrom && force_hdd) {
-    log_error("Incompatible arguments -cdrom and -hdd");
-    return 1;
+  // Hand the request to a running daemon. It resolves paths from its
+  // own working directory, so send absolute ones.
+  bool forwardable = use_daemon && !force_usbgadget && !use_ffs;
+  for (ImageRequest& image : request.images) {
+    std::error_code ec;
+    std::string absolute = std::filesystem::absolute(image.path, ec).string();
+    if (ec || absolute.find('\n') != std::string::npos) {
+      forwardable = false;
+    } else {
+      image.path = absolute;
+    }
   }
-
-  if (force_win10 && force_win11) {
-    log_error("Incompatible arguments -win10 and -win11");
-    return 1;
+  if (forwardable) {
+    int exit_code = 1;
+    if (daemon_forward(encode_request(request, log_get_level()), daemon_socket_path(), exit_code)) {
+      return exit_code;
+    }
   }
 
-  if (!iso_target.empty() && !isfile(iso_target)) {
-    log_error("File not found: " + iso_target);
+  // Resolve the configfs gadget layout once for the whole run
+  GadgetSession session;
+
+  if (request.command != RequestCommand::MOUNT && (force_usbgadget || !session.supported())) {
+    log_error("-prepare, -eject and -status require the configfs backend");
     return 1;
   }
 
-  // Build Windows mount options
-  WindowsMountOptions win_opts = {};
-  win_opts.enabled = false;
-  win_opts.version = WindowsVersion::NONE;
-  win_opts.use_usb3 = use_usb3;
-  win_opts.has_uefi = false;
-  win_opts.has_legacy = false;
-
-  // Auto-detect Windows ISO if not forcing HDD mode
-  if (!iso_target.empty() && !force_hdd) {
-    // Check if it's a Windows ISO
-    WindowsIsoInfo iso_info = get_windows_iso_info(iso_target);
-    
-    if (iso_info.is_windows || windows_mode) {
-      win_opts.enabled = true;
-      
-      // Use detected info unless overridden
-      if (force_win11) {
-        win_opts.version = WindowsVersion::WIN11;
-      } else if (force_win10) {
-        win_opts.version = WindowsVersion::WIN10;
-      } else if (iso_info.is_windows) {
-        win_opts.version = iso_info.version;
-      } else {
-        win_opts.version = WindowsVersion::WIN_UNKNOWN;
-      }
-      
-      win_opts.has_uefi = iso_info.has_uefi;
-      win_opts.has_legacy = iso_info.has_legacy;
-      
-      // If we detected Windows, show info
-      if (iso_info.is_windows && !windows_mode) {
-        log_info("Windows ISO detected: " + iso_info.volume_label);
-        log_info("Auto-enabling Windows mode.");
-      }
-    } else if (!is_hybrid_iso(iso_target) && !cdrom) {
-      // Non-hybrid, non-Windows ISO - still use CD-ROM mode
-      log_info("Non-hybrid ISO detected. Mounting as CD-ROM.");
-      cdrom = true;
+  if (use_ffs) {
+    if (!session.supported() || request.command != RequestCommand::MOUNT || request.images.size() != 1) {
+      log_error("-ffs serves exactly one FILE and requires the configfs backend");
+      return 1;
     }
+    std::vector<LunMedia> media;
+    WindowsMountOptions win_opts;
+    if (!resolve_images(request, probe_image_cached, media, win_opts)) {
+      return 1;
+    }
+    if (win_opts.enabled) {
+      log_warn("Windows descriptors are not applied with -ffs");
+    }
+    bool served = ffs_serve(session, media[0]);
+    clone_discard(media[0].path);
+    return served ? 0 : 1;
   }
 
   bool success = false;
 
   if (force_configfs) {
-    success = configs(iso_target, cdrom, ro, win_opts);
+    success = run_request(session, request, probe_image_cached);
   }
   else if (force_usbgadget) {
-    if (win_opts.enabled) {
-       log_warn("Windows mode is only supported with configfs backend");
-    }
-    success = usb(iso_target, cdrom, ro);
+    success = usb(request);
   }
-  else if (supported()) {
-    success = configs(iso_target, cdrom, ro, win_opts);
+  else if (session.supported()) {
+    success = run_request(session, request, probe_image_cached);
   }
   else if (usb_supported()) {
-    if (win_opts.enabled) {
-       log_warn("Windows mode is only supported with configfs backend");
-    }
-    success = usb(iso_target, cdrom, ro);
+    success = usb(request);
   }
   else {
     log_error("Device does not support isodrive");
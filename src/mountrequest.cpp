@@ -0,0 +1,419 @@
+#include "mountrequest.h"
+#include "clone.h"
+#include "enumeration.h"
+#include "logger.h"
+#include "probecache.h"
+#include "staging.h"
+#include "trace.h"
+#include "util.h"
+#include "verify.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+bool validate_request(const MountRequest& request) {
+  // Check for incompatible flags
+  for (const ImageRequest& image : request.images) {
+    if (image.cdrom && !image.ro && !image.windows) {
+      log_error(std::string("Incompatible arguments -cdrom and ") + (image.clone ? "-rw-clone" : "-rw") +
+                " for " + image.path);
+      return false;
+    }
+
+    if (image.cdrom && image.force_hdd) {
+      log_error("Incompatible arguments -cdrom and -hdd for " + image.path);
+      return false;
+    }
+  }
+
+  if (request.force_win10 && request.force_win11) {
+    log_error("Incompatible arguments -win10 and -win11");
+    return false;
+  }
+
+  if (request.command == RequestCommand::EJECT && !request.images.empty()) {
+    log_error("Incompatible arguments -eject and FILE");
+    return false;
+  }
+
+  for (const ImageRequest& image : request.images) {
+    if (!isfile(image.path)) {
+      log_error("File not found: " + image.path);
+      return false;
+    }
+
+    // Writes would land in the staging copy and be lost
+    if (!image.ro && !image.clone && detect_compression(image.path) != Compression::NONE) {
+      log_error("Compressed images can only be mounted read-only: " + image.path);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool resolve_images(const MountRequest& request, const ImageProber& probe,
+                    std::vector<LunMedia>& media, WindowsMountOptions& win_opts,
+                    const std::vector<std::string>& mounted) {
+  win_opts = {};
+  win_opts.enabled = false;
+  win_opts.version = WindowsVersion::NONE;
+  win_opts.use_usb3 = request.use_usb3;
+  win_opts.has_uefi = false;
+  win_opts.has_legacy = false;
+
+  TRACE_SPAN("resolve_images");
+  media.clear();
+
+  // Sidecar checksums describe the file as downloaded, so verify before staging
+  if (request.verify) {
+    std::vector<std::string> paths;
+    for (const ImageRequest& image : request.images) {
+      paths.push_back(image.path);
+    }
+    if (!verify_images(paths)) {
+      return false;
+    }
+  }
+
+  // Clones made so far are the caller's only once every image resolved
+  std::vector<std::string> clones;
+  // Staged copies on a LUN or needed by this request must survive eviction
+  std::vector<std::string> in_use = mounted;
+  auto fail = [&clones, &media]() {
+    for (const std::string& clone : clones) {
+      clone_discard(clone);
+    }
+    media.clear();
+    probe_cache_flush();
+    return false;
+  };
+
+  for (ImageRequest image : request.images) {
+    // Compressed images are mounted through a decompressed copy
+    std::string staged;
+    if (!stage_image(image.path, staged, in_use)) {
+      return fail();
+    }
+    in_use.push_back(staged);
+    image.path = staged;
+
+    // The clone is probed below; it has the same contents as its source
+    if (image.clone) {
+      std::string cloned;
+      CloneMethod method;
+      if (!clone_image(image.path, cloned, method)) {
+        return fail();
+      }
+      clones.push_back(cloned);
+      image.path = cloned;
+    }
+
+    // Auto-detect Windows ISO if not forcing HDD mode
+    if (!image.force_hdd) {
+      // Run every detector over the image in a single pass, or reuse the
+      // cached result if the image has not changed since it was last probed
+      ImageProbeResult result = probe(image.path);
+      const WindowsIsoInfo& iso_info = result.windows;
+
+      // A short copy would boot and then fail wherever the missing part starts
+      if (result.truncated) {
+        log_error("Image is truncated: " + image.path + " has " + std::to_string(result.size) +
+                  " bytes but its volume and partition tables need " + std::to_string(result.declared_size));
+        return fail();
+      }
+
+      if (iso_info.is_windows || image.windows) {
+        // Descriptors are per gadget: the first Windows image decides them
+        if (!win_opts.enabled) {
+          win_opts.enabled = true;
+
+          // Use detected info unless overridden
+          if (request.force_win11) {
+            win_opts.version = WindowsVersion::WIN11;
+          } else if (request.force_win10) {
+            win_opts.version = WindowsVersion::WIN10;
+          } else if (iso_info.is_windows) {
+            win_opts.version = iso_info.version;
+          } else {
+            win_opts.version = WindowsVersion::WIN_UNKNOWN;
+          }
+
+          win_opts.has_uefi = iso_info.has_uefi;
+          win_opts.has_legacy = iso_info.has_legacy;
+        }
+
+        // If we detected Windows, show info
+        if (iso_info.is_windows && !image.windows) {
+          log_info("Windows ISO detected: " + iso_info.volume_label);
+          log_info("Auto-enabling Windows mode.");
+        }
+        image.windows = true;
+      } else if (!result.is_hybrid && !image.cdrom) {
+        // Non-hybrid, non-Windows ISO - still use CD-ROM mode
+        log_info("Non-hybrid ISO detected. Mounting " + image.path + " as CD-ROM.");
+        image.cdrom = true;
+      } else if (result.is_iso9660 && result.partitions == PartitionScheme::NONE && !image.cdrom) {
+        // Boot code without a partition table gives a firmware nothing to boot from a disk
+        log_info("ISO has an MBR signature but no partition table. Mounting " + image.path + " as CD-ROM.");
+        image.cdrom = true;
+      } else if (result.is_iso9660 && !result.has_esp && !image.cdrom && result.bootloaders.system_area == 0 &&
+                 result.bootloaders.boot_images != 0) {
+        // Partitions without known boot code or an ESP leave only the El Torito loaders to boot
+        log_info("No boot loader in the system area, El Torito boots " +
+                 bootloader_names(result.bootloaders.boot_images) + ". Mounting " + image.path + " as CD-ROM.");
+        image.cdrom = true;
+      }
+    }
+    media.push_back({image.path, image.cdrom, image.ro, image.windows});
+  }
+  // A run that only hit the probe cache has no store to carry its uses
+  probe_cache_flush();
+  return true;
+}
+
+// Helper: Image files currently set on the mass storage LUNs
+static std::vector<std::string> mounted_files(GadgetSession& session) {
+  std::vector<std::string> files;
+  if (session.gadget_root().empty()) {
+    return files;
+  }
+  std::string massStorageRoot = session.functions_root() + "/mass_storage.0";
+  unsigned luns = session.lun_count("mass_storage.0");
+  for (unsigned i = 0; i < luns; i++) {
+    std::string file;
+    if (attribute_read(massStorageRoot + "/lun." + std::to_string(i) + "/file", file) && !file.empty()) {
+      files.push_back(file);
+    }
+  }
+  return files;
+}
+
+// Helper: Delete the clones among files that are not in keep
+static void discard_clones(const std::vector<std::string>& files, const std::vector<std::string>& keep) {
+  for (const std::string& file : files) {
+    if (std::find(keep.begin(), keep.end(), file) == keep.end()) {
+      clone_discard(file);
+    }
+  }
+}
+
+void refill_clone_pools(const MountRequest& request, bool allow_copy) {
+  for (const ImageRequest& image : request.images) {
+    std::string staged;
+    if (image.clone && stage_image(image.path, staged)) {
+      clone_pool_fill(staged, allow_copy);
+    }
+  }
+}
+
+bool run_request(GadgetSession& session, const MountRequest& request, const ImageProber& probe) {
+  TRACE_SPAN("run_request");
+  if (!session.supported()) {
+    log_error("usb_gadget is not supported!");
+    return false;
+  }
+
+  switch (request.command) {
+    case RequestCommand::STATUS:
+      return report_status(session);
+    case RequestCommand::EJECT: {
+      std::vector<std::string> previous = mounted_files(session);
+      if (!eject_iso(session)) {
+        return false;
+      }
+      discard_clones(previous, {});
+      return true;
+    }
+    case RequestCommand::PREPARE:
+      // Link the mass storage function up front; images given alongside
+      // -prepare are then mounted by swapping media in place
+      if (!prepare_mass_storage(session)) {
+        return false;
+      }
+      if (request.images.empty()) {
+        return true;
+      }
+      break;
+    case RequestCommand::MOUNT:
+      break;
+  }
+
+  std::vector<std::string> previous = mounted_files(session);
+  std::vector<LunMedia> media;
+  WindowsMountOptions win_opts;
+  if (!resolve_images(request, probe, media, win_opts, previous)) {
+    return false;
+  }
+
+  log_info("Using configfs!");
+  std::vector<std::string> requested;
+  for (const LunMedia& image : media) {
+    requested.push_back(image.path);
+  }
+  auto bound_before = session.last_bind();
+  if (!mount_images(session, media, win_opts)) {
+    discard_clones(requested, previous);
+    return false;
+  }
+  discard_clones(previous, requested);
+
+  bool ok = true;
+  if (request.wait_timeout_ms > 0 && !media.empty()) {
+    if (session.last_bind() == bound_before) {
+      log_info("Device was not re-enumerated; host connection unchanged");
+    } else {
+      ok = report_enumeration(session, request.wait_timeout_ms);
+    }
+  }
+
+  // Done after the host has the device, and only where a reflink makes
+  // it O(1); copying a whole image would hold up the caller
+  refill_clone_pools(request, false);
+  return ok;
+}
+
+bool report_enumeration(GadgetSession& session, int timeout_ms) {
+  EnumerationResult result;
+  bool configured = wait_for_configured(session.udc(), session.last_bind(), timeout_ms, result);
+
+  char elapsed[32];
+  snprintf(elapsed, sizeof(elapsed), "%.0f ms", result.elapsed_ms);
+  if (configured) {
+    log_info(std::string("Host configured the device in ") + elapsed +
+             (result.speed.empty() ? "" : " (" + result.speed + ")"));
+  } else {
+    log_error(std::string("Host did not configure the device within ") + elapsed +
+              (result.state.empty() ? "" : " (UDC state: " + result.state + ")"));
+  }
+  LOG_DEBUG("Enumeration result: " + enumeration_to_json(session.udc(), result));
+  enumeration_record(session.udc(), result);
+  return configured;
+}
+
+bool report_status(GadgetSession& session) {
+  if (session.gadget_root().empty()) {
+    log_error("No active gadget found!");
+    return false;
+  }
+  log_info("Gadget: " + session.gadget_root() + " (UDC " + session.udc() + ")");
+
+  if (!session.function_linked("mass_storage.0")) {
+    log_info("Mass storage function not linked; nothing mounted");
+    return true;
+  }
+
+  std::string massStorageRoot = session.functions_root() + "/mass_storage.0";
+  unsigned luns = session.lun_count("mass_storage.0");
+  for (unsigned i = 0; i < luns; i++) {
+    std::string lunRoot = massStorageRoot + "/lun." + std::to_string(i);
+    std::string file, cdrom, ro;
+    attribute_read(lunRoot + "/file", file);
+    attribute_read(lunRoot + "/cdrom", cdrom);
+    attribute_read(lunRoot + "/ro", ro);
+
+    std::string line = "LUN " + std::to_string(i) + ": ";
+    if (file.empty()) {
+      line += "(no medium)";
+    } else {
+      line += file + (cdrom == "1" ? " [cdrom" : " [disk") + (ro == "1" ? ", ro]" : ", rw]");
+    }
+    log_info(line);
+  }
+  return true;
+}
+
+// Helper: Protocol name of a command
+static const char* command_name(RequestCommand command) {
+  switch (command) {
+    case RequestCommand::PREPARE: return "prepare";
+    case RequestCommand::EJECT: return "eject";
+    case RequestCommand::STATUS: return "status";
+    case RequestCommand::MOUNT: break;
+  }
+  return "mount";
+}
+
+std::string encode_request(const MountRequest& request, LogLevel verbosity) {
+  std::ostringstream out;
+  out << "isodrive " << MOUNT_REQUEST_VERSION << "\n";
+  out << "verbosity " << static_cast<int>(verbosity) << "\n";
+  out << "command " << command_name(request.command) << "\n";
+  if (request.force_win10) out << "option win10\n";
+  if (request.force_win11) out << "option win11\n";
+  if (request.use_usb3) out << "option usb3\n";
+  if (request.verify) out << "option verify\n";
+  if (request.no_probe_cache) out << "option noprobe-cache\n";
+  if (request.wait_timeout_ms > 0) out << "option wait " << request.wait_timeout_ms << "\n";
+
+  for (const ImageRequest& image : request.images) {
+    std::string flags;
+    if (image.cdrom) flags += 'c';
+    if (!image.ro) flags += 'w';
+    if (image.clone) flags += 'k';
+    if (image.force_hdd) flags += 'h';
+    if (image.windows) flags += 'W';
+    out << "image " << (flags.empty() ? "-" : flags) << " " << image.path << "\n";
+  }
+  out << "\n";
+  return out.str();
+}
+
+bool decode_request(const std::string& text, MountRequest& request, LogLevel& verbosity) {
+  request = MountRequest();
+  verbosity = LogLevel::INFO;
+
+  std::istringstream in(text);
+  std::string line;
+  bool header = false;
+  while (std::getline(in, line)) {
+    if (line.empty()) break;
+
+    size_t space = line.find(' ');
+    std::string key = line.substr(0, space);
+    std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+
+    if (!header) {
+      if (key != "isodrive" || std::atoi(value.c_str()) != MOUNT_REQUEST_VERSION) return false;
+      header = true;
+    } else if (key == "verbosity") {
+      int level = std::atoi(value.c_str());
+      if (level < 0 || level > static_cast<int>(LogLevel::DEBUG)) return false;
+      verbosity = static_cast<LogLevel>(level);
+    } else if (key == "command") {
+      if (value == "mount") request.command = RequestCommand::MOUNT;
+      else if (value == "prepare") request.command = RequestCommand::PREPARE;
+      else if (value == "eject") request.command = RequestCommand::EJECT;
+      else if (value == "status") request.command = RequestCommand::STATUS;
+      else return false;
+    } else if (key == "option") {
+      if (value == "win10") request.force_win10 = true;
+      else if (value == "win11") request.force_win11 = true;
+      else if (value == "usb3") request.use_usb3 = true;
+      else if (value == "verify") request.verify = true;
+      else if (value == "noprobe-cache") request.no_probe_cache = true;
+      else if (value.compare(0, 5, "wait ") == 0) request.wait_timeout_ms = std::atoi(value.c_str() + 5);
+      else return false;
+    } else if (key == "image") {
+      size_t sep = value.find(' ');
+      if (sep == std::string::npos || sep + 1 >= value.size()) return false;
+
+      ImageRequest image;
+      for (char flag : value.substr(0, sep)) {
+        if (flag == 'c') image.cdrom = true;
+        else if (flag == 'w') image.ro = false;
+        else if (flag == 'k') image.clone = true;
+        else if (flag == 'h') image.force_hdd = true;
+        else if (flag == 'W') image.windows = true;
+        else if (flag != '-') return false;
+      }
+      image.path = value.substr(sep + 1);
+      if (image.path[0] != '/') return false;
+      request.images.push_back(image);
+    } else {
+      return false;
+    }
+  }
+  return header;
+}
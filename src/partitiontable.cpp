@@ -0,0 +1,216 @@
+#include "partitiontable.h"
+#include "imageprobe.h"
+#include "logger.h"
+#include "util.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+    // Partition types in an MBR
+    const unsigned char MBR_TYPE_GPT = 0xee;
+    const unsigned char MBR_TYPE_EFI = 0xef;
+
+    // GPT header fields are validated up to this many bytes
+    const uint32_t GPT_HEADER_MIN = 92;
+
+    // Entry arrays are 16 KiB in practice; anything much larger is corrupt
+    const uint64_t GPT_ENTRIES_MAX = 1 << 20;
+
+    // EFI system partition type GUID as stored on disk
+    const unsigned char ESP_GUID[16] = {
+        0x28, 0x73, 0x2a, 0xc1, 0x1f, 0xf8, 0xd2, 0x11,
+        0xba, 0x4b, 0x00, 0xa0, 0xc9, 0x3e, 0xc9, 0x3b,
+    };
+
+    struct Crc32Table {
+        uint32_t entries[256];
+        Crc32Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+    };
+}
+
+uint32_t crc32_update(uint32_t crc, const void* data, size_t len) {
+  static const Crc32Table table;
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+const char* partition_scheme_name(PartitionScheme scheme) {
+  switch (scheme) {
+    case PartitionScheme::MBR: return "mbr";
+    case PartitionScheme::GPT: return "gpt";
+    case PartitionScheme::NONE:
+    default: return "none";
+  }
+}
+
+// Helper: Check a GPT header's signature, CRC and own position
+static bool gpt_header_valid(const unsigned char* header, uint64_t lba) {
+  if (std::memcmp(header, "EFI PART", 8) != 0) return false;
+  uint32_t size = le32(header + 12);
+  if (size < GPT_HEADER_MIN || size > DISK_SECTOR_SIZE) return false;
+
+  // The CRC covers the header with its own CRC field read as zero
+  static const unsigned char zero[4] = {};
+  uint32_t crc = crc32_update(0, header, 16);
+  crc = crc32_update(crc, zero, sizeof(zero));
+  crc = crc32_update(crc, header + 20, size - 20);
+  return crc == le32(header + 16) && le64(header + 24) == lba;
+}
+
+// Helper: Read a sector that may lie beyond the head buffer
+static const unsigned char* disk_sector(ImageProbe& probe, uint64_t lba, std::vector<unsigned char>& storage) {
+  const unsigned char* data = probe.head(lba * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE);
+  if (data) return data;
+  storage.resize(DISK_SECTOR_SIZE);
+  return probe.read(lba * DISK_SECTOR_SIZE, storage.data(), storage.size()) ? storage.data() : nullptr;
+}
+
+// Helper: Parse the partition entries a valid GPT header points to
+static bool read_gpt_entries(ImageProbe& probe, const unsigned char* header, PartitionTable& table) {
+  uint64_t entries_lba = le64(header + 72);
+  uint64_t count = le32(header + 80);
+  uint64_t entry_size = le32(header + 84);
+  uint64_t bytes = count * entry_size;
+  if (entry_size < 128 || entry_size % 8 != 0 || bytes == 0 || bytes > GPT_ENTRIES_MAX) {
+    return false;
+  }
+
+  // The primary array sits right after its header, inside the head buffer
+  std::vector<unsigned char> storage;
+  const unsigned char* entries = probe.head(entries_lba * DISK_SECTOR_SIZE, bytes);
+  if (!entries) {
+    storage.resize(bytes);
+    if (!probe.read(entries_lba * DISK_SECTOR_SIZE, storage.data(), storage.size())) return false;
+    entries = storage.data();
+  }
+  if (crc32_update(0, entries, bytes) != le32(header + 88)) {
+    return false;
+  }
+
+  static const unsigned char unused[16] = {};
+  for (uint64_t pos = 0; pos < bytes; pos += entry_size) {
+    const unsigned char* entry = entries + pos;
+    if (std::memcmp(entry, unused, 16) == 0) continue;
+    uint64_t first = le64(entry + 32);
+    uint64_t last = le64(entry + 40);
+    if (last < first) continue;
+    bool esp = std::memcmp(entry, ESP_GUID, 16) == 0;
+    if (esp && table.esp < 0) table.esp = static_cast<int>(table.partitions.size());
+    table.partitions.push_back({first * DISK_SECTOR_SIZE, (last - first + 1) * DISK_SECTOR_SIZE, 0, false, esp});
+  }
+  return true;
+}
+
+// Helper: Primary GPT, falling back to the backup at the last sector
+static bool read_gpt(ImageProbe& probe, PartitionTable& table) {
+  std::vector<unsigned char> storage;
+  const unsigned char* primary = probe.head(DISK_SECTOR_SIZE, DISK_SECTOR_SIZE);
+  if (primary && gpt_header_valid(primary, 1)) {
+    // The backup header marks the end of the disk the GPT was made for
+    uint64_t alternate = le64(primary + 32);
+    table.declared_size = std::max(table.declared_size, (alternate + 1) * DISK_SECTOR_SIZE);
+    if ((alternate + 1) * DISK_SECTOR_SIZE <= probe.size()) {
+      const unsigned char* backup = disk_sector(probe, alternate, storage);
+      table.backup_gpt = backup && gpt_header_valid(backup, alternate);
+    }
+    if (read_gpt_entries(probe, primary, table)) {
+      return true;
+    }
+    table.partitions.clear();
+    table.esp = -1;
+  }
+
+  if (probe.size() < 2 * DISK_SECTOR_SIZE) return false;
+  uint64_t last = probe.size() / DISK_SECTOR_SIZE - 1;
+  const unsigned char* backup = disk_sector(probe, last, storage);
+  if (!backup || !gpt_header_valid(backup, last)) return false;
+  LOG_DEBUG("Primary GPT of " + probe.path() + " is damaged; using the backup");
+  table.backup_gpt = true;
+  return read_gpt_entries(probe, backup, table);
+}
+
+// Helper: MBR partitions; false if the sector holds no usable table
+static bool read_mbr(ImageProbe& probe, PartitionTable& table, bool& protective) {
+  const unsigned char* mbr = probe.head(0, DISK_SECTOR_SIZE);
+  if (!mbr || mbr[510] != 0x55 || mbr[511] != 0xaa) return false;
+
+  // Boot code without a table leaves garbage in the status bytes
+  for (int i = 0; i < 4; i++) {
+    unsigned char status = mbr[446 + 16 * i];
+    if (status != 0x00 && status != 0x80) return false;
+  }
+
+  protective = false;
+  for (int i = 0; i < 4; i++) {
+    const unsigned char* entry = mbr + 446 + 16 * i;
+    unsigned char type = entry[4];
+    uint64_t first = le32(entry + 8);
+    uint64_t sectors = le32(entry + 12);
+    if (type == 0 || sectors == 0) continue;
+    if (type == MBR_TYPE_GPT) {
+      // Protective entries are often clamped to 2 TiB; they declare nothing
+      protective = true;
+      continue;
+    }
+    Partition partition = {first * DISK_SECTOR_SIZE, sectors * DISK_SECTOR_SIZE, type, entry[0] == 0x80,
+                           type == MBR_TYPE_EFI};
+    table.declared_size = std::max(table.declared_size, partition.offset + partition.length);
+    if (partition.esp && table.esp < 0) table.esp = static_cast<int>(table.partitions.size());
+    table.partitions.push_back(partition);
+  }
+  return protective || !table.partitions.empty();
+}
+
+// Helper: Volume space size from the ISO 9660 Primary Volume Descriptor
+static uint64_t iso_volume_size(ImageProbe& probe) {
+  const unsigned char* pvd = probe.sector(ISO_PVD_SECTOR);
+  if (!pvd || pvd[0] != 1 || std::memcmp(pvd + 1, "CD001", 5) != 0) return 0;
+  uint64_t block_size = le16(pvd + 128) ? le16(pvd + 128) : ISO_SECTOR_SIZE;
+  return static_cast<uint64_t>(le32(pvd + 80)) * block_size;
+}
+
+bool read_partition_table(ImageProbe& probe, PartitionTable& table) {
+  table = PartitionTable();
+  if (!probe.is_open()) {
+    return false;
+  }
+
+  table.volume_size = iso_volume_size(probe);
+  table.declared_size = table.volume_size;
+
+  bool protective = false;
+  if (read_mbr(probe, table, protective)) {
+    table.scheme = PartitionScheme::MBR;
+  }
+
+  // Hybrid layouts may carry a GPT next to real MBR entries; the GPT wins
+  PartitionTable gpt;
+  gpt.declared_size = table.declared_size;
+  if (table.scheme == PartitionScheme::MBR && read_gpt(probe, gpt)) {
+    gpt.scheme = PartitionScheme::GPT;
+    gpt.volume_size = table.volume_size;
+    table = gpt;
+  } else if (protective) {
+    LOG_DEBUG("Protective MBR without a valid GPT in " + probe.path());
+    table.declared_size = std::max(table.declared_size, gpt.declared_size);
+  }
+
+  table.truncated = table.declared_size > probe.size();
+  if (table.truncated) {
+    LOG_DEBUG("Image " + probe.path() + " declares " + std::to_string(table.declared_size) +
+              " bytes but has " + std::to_string(probe.size()));
+  }
+  return true;
+}
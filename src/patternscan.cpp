@@ -0,0 +1,221 @@
+#include "patternscan.h"
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define ISODRIVE_SCAN_X86 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define ISODRIVE_SCAN_NEON 1
+#endif
+
+namespace {
+    // Pattern indexes are stored as bytes
+    const size_t MAX_PATTERNS = 255;
+
+    std::atomic<bool> g_force_portable{false};
+}
+
+/**
+ * @brief Scan loops for each instruction set.
+ *
+ * Each takes the position to start at and the tags found so far, and
+ * returns the tags found by the end of the buffer. The vector loops
+ * stop one block short of the end, since they also load the byte after
+ * each block, and leave the rest to the portable loop.
+ */
+struct PatternKernels {
+  using ScanFunction = uint32_t (*)(const PatternScanner& s, const unsigned char* data, size_t len);
+
+  static uint32_t portable_from(const PatternScanner& s, const unsigned char* data, size_t len, size_t start,
+                                uint32_t found) {
+    for (size_t i = start; i < len && found != s.all_tags_; i++) {
+      if (!s.by_first_[data[i]].empty()) {
+        found |= s.verify(data, len, i);
+      }
+    }
+    return found;
+  }
+
+  static uint32_t portable(const PatternScanner& s, const unsigned char* data, size_t len) {
+    return portable_from(s, data, len, 0, 0);
+  }
+
+#ifdef ISODRIVE_SCAN_X86
+  static uint32_t sse2(const PatternScanner& s, const unsigned char* data, size_t len) {
+    __m128i first[PATTERN_SCAN_MAX_PREFIXES];
+    __m128i second[PATTERN_SCAN_MAX_PREFIXES];
+    for (size_t k = 0; k < s.prefixes_; k++) {
+      first[k] = _mm_set1_epi8(static_cast<char>(s.prefix_first_[k]));
+      second[k] = _mm_set1_epi8(static_cast<char>(s.prefix_second_[k]));
+    }
+
+    uint32_t found = 0;
+    size_t i = 0;
+    for (; i + 17 <= len; i += 16) {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+      __m128i hit = _mm_setzero_si128();
+      for (size_t k = 0; k < s.prefixes_; k++) {
+        hit = _mm_or_si128(hit, _mm_and_si128(_mm_cmpeq_epi8(a, first[k]), _mm_cmpeq_epi8(b, second[k])));
+      }
+      unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hit));
+      while (mask) {
+        found |= s.verify(data, len, i + __builtin_ctz(mask));
+        mask &= mask - 1;
+      }
+      if (found == s.all_tags_) return found;
+    }
+    return portable_from(s, data, len, i, found);
+  }
+
+  __attribute__((target("avx2")))
+  static uint32_t avx2(const PatternScanner& s, const unsigned char* data, size_t len) {
+    __m256i first[PATTERN_SCAN_MAX_PREFIXES];
+    __m256i second[PATTERN_SCAN_MAX_PREFIXES];
+    for (size_t k = 0; k < s.prefixes_; k++) {
+      first[k] = _mm256_set1_epi8(static_cast<char>(s.prefix_first_[k]));
+      second[k] = _mm256_set1_epi8(static_cast<char>(s.prefix_second_[k]));
+    }
+
+    uint32_t found = 0;
+    size_t i = 0;
+    for (; i + 33 <= len; i += 32) {
+      __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+      __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 1));
+      __m256i hit = _mm256_setzero_si256();
+      for (size_t k = 0; k < s.prefixes_; k++) {
+        hit = _mm256_or_si256(hit, _mm256_and_si256(_mm256_cmpeq_epi8(a, first[k]),
+                                                     _mm256_cmpeq_epi8(b, second[k])));
+      }
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+      while (mask) {
+        found |= s.verify(data, len, i + __builtin_ctz(mask));
+        mask &= mask - 1;
+      }
+      if (found == s.all_tags_) return found;
+    }
+    return portable_from(s, data, len, i, found);
+  }
+#endif
+
+#ifdef ISODRIVE_SCAN_NEON
+  static uint32_t neon(const PatternScanner& s, const unsigned char* data, size_t len) {
+    uint8x16_t first[PATTERN_SCAN_MAX_PREFIXES];
+    uint8x16_t second[PATTERN_SCAN_MAX_PREFIXES];
+    for (size_t k = 0; k < s.prefixes_; k++) {
+      first[k] = vdupq_n_u8(s.prefix_first_[k]);
+      second[k] = vdupq_n_u8(s.prefix_second_[k]);
+    }
+
+    uint32_t found = 0;
+    size_t i = 0;
+    for (; i + 17 <= len; i += 16) {
+      uint8x16_t a = vld1q_u8(data + i);
+      uint8x16_t b = vld1q_u8(data + i + 1);
+      uint8x16_t hit = vdupq_n_u8(0);
+      for (size_t k = 0; k < s.prefixes_; k++) {
+        hit = vorrq_u8(hit, vandq_u8(vceqq_u8(a, first[k]), vceqq_u8(b, second[k])));
+      }
+      if (vmaxvq_u8(hit) == 0) continue;
+
+      // NEON has no byte movemask; matches are rare, so check lanes one by one
+      uint8_t lanes[16];
+      vst1q_u8(lanes, hit);
+      for (size_t j = 0; j < 16; j++) {
+        if (lanes[j]) found |= s.verify(data, len, i + j);
+      }
+      if (found == s.all_tags_) return found;
+    }
+    return portable_from(s, data, len, i, found);
+  }
+#endif
+};
+
+namespace {
+    struct ScanBackend {
+        PatternKernels::ScanFunction scan;
+        const char* name;
+    };
+}
+
+// Helper: Pick the widest block compare this CPU supports
+static ScanBackend select_scan_backend() {
+#ifdef ISODRIVE_SCAN_X86
+  if (__builtin_cpu_supports("avx2")) {
+    return {PatternKernels::avx2, "avx2"};
+  }
+  return {PatternKernels::sse2, "sse2"};
+#elif defined(ISODRIVE_SCAN_NEON)
+  return {PatternKernels::neon, "neon"};
+#else
+  return {PatternKernels::portable, "portable"};
+#endif
+}
+
+// Helper: The block compare chosen for this process
+static const ScanBackend& scan_backend() {
+  static const ScanBackend backend = select_scan_backend();
+  static const ScanBackend portable = {PatternKernels::portable, "portable"};
+  return g_force_portable.load(std::memory_order_relaxed) ? portable : backend;
+}
+
+PatternScanner::PatternScanner(const std::vector<ScanPattern>& patterns)
+    : prefix_first_(), prefix_second_(), prefixes_(0), all_tags_(0) {
+  for (const ScanPattern& pattern : patterns) {
+    if (pattern.text.size() < 2 || patterns_.size() >= MAX_PATTERNS) continue;
+    by_first_[static_cast<unsigned char>(pattern.text[0])].push_back(static_cast<uint8_t>(patterns_.size()));
+    patterns_.push_back(pattern);
+    all_tags_ |= pattern.tag;
+  }
+
+  for (const ScanPattern& pattern : patterns_) {
+    unsigned char a = static_cast<unsigned char>(pattern.text[0]);
+    unsigned char b = static_cast<unsigned char>(pattern.text[1]);
+    bool seen = false;
+    for (size_t k = 0; k < prefixes_ && !seen; k++) {
+      seen = prefix_first_[k] == a && prefix_second_[k] == b;
+    }
+    if (seen) continue;
+    if (prefixes_ == PATTERN_SCAN_MAX_PREFIXES) {
+      prefixes_ = 0;
+      break;
+    }
+    prefix_first_[prefixes_] = a;
+    prefix_second_[prefixes_] = b;
+    prefixes_++;
+  }
+}
+
+uint32_t PatternScanner::verify(const unsigned char* data, size_t len, size_t pos) const {
+  uint32_t tags = 0;
+  for (uint8_t index : by_first_[data[pos]]) {
+    const std::string& text = patterns_[index].text;
+    if (text.size() <= len - pos && std::memcmp(data + pos, text.data(), text.size()) == 0) {
+      tags |= patterns_[index].tag;
+    }
+  }
+  return tags;
+}
+
+uint32_t PatternScanner::scan(const void* data, size_t len) const {
+  if (patterns_.empty() || len == 0) return 0;
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  if (prefixes_ == 0) {
+    return PatternKernels::portable(*this, bytes, len);
+  }
+  return scan_backend().scan(*this, bytes, len);
+}
+
+const char* pattern_scan_implementation() {
+  return scan_backend().name;
+}
+
+void pattern_scan_force_portable(bool force) {
+  g_force_portable = force;
+}
@@ -0,0 +1,282 @@
+#include "probecache.h"
+#include "logger.h"
+#include "trace.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+    // The header also changes when detection changes its answers
+    const char* const CACHE_FILE = "probe.cache";
+    const char* const CACHE_HEADER = "isodrive-probe-cache 6";
+    const char* const LOCK_FILE = "probe.cache.lock";
+
+    std::string g_cache_dir;
+    bool g_cache_enabled = true;
+
+    struct CacheEntry {
+        ImageKey key;
+        int64_t last_used;
+        ImageProbeResult result;
+    };
+
+    // Hits in this process that the cache file does not reflect yet
+    std::vector<std::pair<ImageKey, int64_t>> g_pending_uses;
+
+    // flock() on the lock file for the lifetime of the object
+    class CacheLock {
+    public:
+        explicit CacheLock(int operation) {
+            std::string path = (fs::path(probe_cache_dir()) / LOCK_FILE).string();
+            fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+            while (fd_ >= 0 && flock(fd_, operation) != 0 && errno == EINTR) {}
+        }
+        ~CacheLock() {
+            if (fd_ >= 0) close(fd_);
+        }
+        CacheLock(const CacheLock&) = delete;
+        CacheLock& operator=(const CacheLock&) = delete;
+
+    private:
+        int fd_;
+    };
+}
+
+bool image_key(const std::string& path, ImageKey& key) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  key.dev = static_cast<uint64_t>(st.st_dev);
+  key.ino = static_cast<uint64_t>(st.st_ino);
+  key.size = static_cast<uint64_t>(st.st_size);
+  key.mtime_sec = static_cast<int64_t>(st.st_mtim.tv_sec);
+  key.mtime_nsec = static_cast<int64_t>(st.st_mtim.tv_nsec);
+  return true;
+}
+
+// Helper: Format a number as lowercase hex
+static std::string hex(uint64_t value) {
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%llx", static_cast<unsigned long long>(value));
+  return buf;
+}
+
+std::string image_key_prefix(const ImageKey& key) {
+  return hex(key.dev) + "-" + hex(key.ino) + "-";
+}
+
+std::string image_key_name(const ImageKey& key) {
+  return image_key_prefix(key) + hex(key.size) + "-" +
+         hex(static_cast<uint64_t>(key.mtime_sec)) + "." + hex(static_cast<uint64_t>(key.mtime_nsec));
+}
+
+std::string probe_cache_dir() {
+  if (!g_cache_dir.empty()) return g_cache_dir;
+  if (isdir("/data/adb")) return "/data/adb/isodrive";
+  return "/var/cache/isodrive";
+}
+
+void probe_cache_set_dir(const std::string& dir) {
+  g_cache_dir = dir;
+}
+
+void probe_cache_set_enabled(bool enabled) {
+  g_cache_enabled = enabled;
+}
+
+bool probe_cache_enabled() {
+  return g_cache_enabled;
+}
+
+// Helper: Load every entry from the cache file
+static std::vector<CacheEntry> load_entries() {
+  std::vector<CacheEntry> entries;
+  std::ifstream file((fs::path(probe_cache_dir()) / CACHE_FILE).string());
+  if (!file) return entries;
+
+  std::string line;
+  if (!std::getline(file, line) || line != CACHE_HEADER) {
+    LOG_DEBUG("Ignoring probe cache with unknown format");
+    return entries;
+  }
+
+  while (std::getline(file, line)) {
+    std::istringstream in(line);
+    CacheEntry entry = {};
+    int readable;
+    if (!(in >> entry.key.dev >> entry.key.ino >> entry.key.size >> entry.key.mtime_sec >>
+          entry.key.mtime_nsec >> entry.last_used >> readable) || !probe_result_read(in, entry.result)) {
+      continue;
+    }
+
+    ImageProbeResult& r = entry.result;
+    r.readable = readable != 0;
+    r.size = entry.key.size;
+
+    // The volume label is the remainder of the line after one separator
+    std::getline(in, r.windows.volume_label);
+    if (!r.windows.volume_label.empty() && r.windows.volume_label[0] == ' ') {
+      r.windows.volume_label.erase(0, 1);
+    }
+    entries.push_back(std::move(entry));
+  }
+  return entries;
+}
+
+// Helper: Write every entry to the cache file
+static bool save_entries(const std::vector<CacheEntry>& entries) {
+  std::string dir = probe_cache_dir();
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    LOG_DEBUG("Cannot create probe cache directory " + dir + ": " + ec.message());
+    return false;
+  }
+
+  std::ostringstream out;
+  out << CACHE_HEADER << "\n";
+  for (const CacheEntry& entry : entries) {
+    const ImageProbeResult& r = entry.result;
+    std::string label = r.windows.volume_label;
+    std::replace(label.begin(), label.end(), '\n', ' ');
+    out << entry.key.dev << ' ' << entry.key.ino << ' ' << entry.key.size << ' '
+        << entry.key.mtime_sec << ' ' << entry.key.mtime_nsec << ' ' << entry.last_used << ' '
+        << r.readable << ' ';
+    probe_result_write(out, r);
+    out << ' ' << label << "\n";
+  }
+  std::string data = out.str();
+
+  std::string path = (fs::path(dir) / CACHE_FILE).string();
+  int err = 0;
+  if (!write_file_atomic(path, data, true, &err)) {
+    LOG_DEBUG("Failed to update probe cache " + path + ": " + std::strerror(err));
+    return false;
+  }
+  return true;
+}
+
+// Helper: Apply the hits since the last write; on equal timestamps the
+// used entries rank before the others
+static void apply_pending_uses(std::vector<CacheEntry>& entries) {
+  for (const auto& use : g_pending_uses) {
+    for (CacheEntry& entry : entries) {
+      if (entry.key == use.first) {
+        entry.last_used = std::max(entry.last_used, use.second);
+      }
+    }
+  }
+  std::stable_partition(entries.begin(), entries.end(), [](const CacheEntry& e) {
+    return std::any_of(g_pending_uses.begin(), g_pending_uses.end(),
+                       [&e](const std::pair<ImageKey, int64_t>& use) { return use.first == e.key; });
+  });
+}
+
+bool probe_cache_lookup(const ImageKey& key, ImageProbeResult& result) {
+  if (!g_cache_enabled) return false;
+
+  std::vector<CacheEntry> entries;
+  {
+    CacheLock lock(LOCK_SH);
+    entries = load_entries();
+  }
+  for (const CacheEntry& entry : entries) {
+    if (entry.key == key) {
+      result = entry.result;
+      // Refresh the LRU timestamp with the next store instead of
+      // rewriting the file on every hit
+      g_pending_uses.erase(std::remove_if(g_pending_uses.begin(), g_pending_uses.end(),
+                                          [&key](const std::pair<ImageKey, int64_t>& use) {
+                                            return use.first == key;
+                                          }),
+                           g_pending_uses.end());
+      if (g_pending_uses.size() >= PROBE_CACHE_MAX_ENTRIES) {
+        g_pending_uses.erase(g_pending_uses.begin());
+      }
+      g_pending_uses.push_back({key, static_cast<int64_t>(time(nullptr))});
+      return true;
+    }
+  }
+  return false;
+}
+
+bool probe_cache_store(const ImageKey& key, const ImageProbeResult& result) {
+  if (!g_cache_enabled || !result.readable) return false;
+
+  std::string dir = probe_cache_dir();
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  CacheLock lock(LOCK_EX);
+  std::vector<CacheEntry> entries = load_entries();
+
+  apply_pending_uses(entries);
+
+  entries.erase(std::remove_if(entries.begin(), entries.end(),
+                               [&key](const CacheEntry& e) {
+                                 // Drop stale entries for the same file as well
+                                 return e.key.dev == key.dev && e.key.ino == key.ino;
+                               }),
+                entries.end());
+  entries.insert(entries.begin(), {key, static_cast<int64_t>(time(nullptr)), result});
+
+  // Evict the least recently used entries
+  if (entries.size() > PROBE_CACHE_MAX_ENTRIES) {
+    std::stable_sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b) {
+      return a.last_used > b.last_used;
+    });
+    entries.resize(PROBE_CACHE_MAX_ENTRIES);
+  }
+  if (!save_entries(entries)) {
+    return false;
+  }
+  g_pending_uses.clear();
+  return true;
+}
+
+bool probe_cache_flush() {
+  if (!g_cache_enabled || g_pending_uses.empty()) return true;
+
+  CacheLock lock(LOCK_EX);
+  std::vector<CacheEntry> entries = load_entries();
+  apply_pending_uses(entries);
+  if (!save_entries(entries)) {
+    return false;
+  }
+  g_pending_uses.clear();
+  return true;
+}
+
+ImageProbeResult probe_image_cached(const std::string& path) {
+  TraceSpan span("probe_image_cached");
+  span.detail(path);
+  ImageKey key;
+  if (!g_cache_enabled || !image_key(path, key)) {
+    return probe_image(path);
+  }
+
+  ImageProbeResult result;
+  if (probe_cache_lookup(key, result)) {
+    LOG_DEBUG("Probe cache hit: " + path);
+    return result;
+  }
+
+  LOG_DEBUG("Probe cache miss: " + path);
+  result = probe_image(path);
+  probe_cache_store(key, result);
+  return result;
+}
@@ -0,0 +1,400 @@
+#include "scsi.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+    // Operation codes
+    const uint8_t TEST_UNIT_READY = 0x00;
+    const uint8_t REQUEST_SENSE = 0x03;
+    const uint8_t READ_6 = 0x08;
+    const uint8_t WRITE_6 = 0x0a;
+    const uint8_t INQUIRY = 0x12;
+    const uint8_t MODE_SENSE_6 = 0x1a;
+    const uint8_t START_STOP_UNIT = 0x1b;
+    const uint8_t PREVENT_ALLOW_MEDIUM_REMOVAL = 0x1e;
+    const uint8_t READ_FORMAT_CAPACITIES = 0x23;
+    const uint8_t READ_CAPACITY_10 = 0x25;
+    const uint8_t READ_10 = 0x28;
+    const uint8_t WRITE_10 = 0x2a;
+    const uint8_t VERIFY_10 = 0x2f;
+    const uint8_t SYNCHRONIZE_CACHE_10 = 0x35;
+    const uint8_t READ_TOC = 0x43;
+    const uint8_t GET_CONFIGURATION = 0x46;
+    const uint8_t GET_EVENT_STATUS_NOTIFICATION = 0x4a;
+    const uint8_t MODE_SENSE_10 = 0x5a;
+    const uint8_t READ_16 = 0x88;
+    const uint8_t WRITE_16 = 0x8a;
+    const uint8_t SERVICE_ACTION_IN_16 = 0x9e;
+    const uint8_t READ_12 = 0xa8;
+    const uint8_t WRITE_12 = 0xaa;
+
+    // Sense keys
+    const uint8_t NOT_READY = 0x02;
+    const uint8_t MEDIUM_ERROR = 0x03;
+    const uint8_t ILLEGAL_REQUEST = 0x05;
+    const uint8_t DATA_PROTECT = 0x07;
+    const uint8_t ABORTED_COMMAND = 0x0b;
+
+    // Additional sense codes
+    const uint8_t ASC_WRITE_ERROR = 0x0c;
+    const uint8_t ASC_UNRECOVERED_READ_ERROR = 0x11;
+    const uint8_t ASC_INVALID_COMMAND = 0x20;
+    const uint8_t ASC_LBA_OUT_OF_RANGE = 0x21;
+    const uint8_t ASC_INVALID_FIELD_IN_CDB = 0x24;
+    const uint8_t ASC_WRITE_PROTECTED = 0x27;
+    const uint8_t ASC_MEDIUM_NOT_PRESENT = 0x3a;
+    const uint8_t ASC_MEDIUM_REMOVAL_PREVENTED = 0x53;
+
+    // MMC profiles
+    const uint16_t PROFILE_CD_ROM = 0x0008;
+    const uint16_t PROFILE_DVD_ROM = 0x0010;
+
+    // Largest image still reported as a CD rather than a DVD
+    const uint64_t CD_MAX_BYTES = 900ull * 1024 * 1024;
+}
+
+// Helper: Big-endian field accessors
+static uint16_t get_be16(const uint8_t* p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static uint32_t get_be32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+static uint64_t get_be64(const uint8_t* p) {
+  return (static_cast<uint64_t>(get_be32(p)) << 32) | get_be32(p + 4);
+}
+
+static void put_be16(uint8_t* p, uint16_t v) {
+  p[0] = static_cast<uint8_t>(v >> 8);
+  p[1] = static_cast<uint8_t>(v);
+}
+
+static void put_be32(uint8_t* p, uint32_t v) {
+  put_be16(p, static_cast<uint16_t>(v >> 16));
+  put_be16(p + 2, static_cast<uint16_t>(v));
+}
+
+static void put_be64(uint8_t* p, uint64_t v) {
+  put_be32(p, static_cast<uint32_t>(v >> 32));
+  put_be32(p + 4, static_cast<uint32_t>(v));
+}
+
+// Helper: Write a TOC address as an LBA or as minutes/seconds/frames
+static void put_toc_address(uint8_t* p, uint32_t lba, bool msf) {
+  if (!msf) {
+    put_be32(p, lba);
+    return;
+  }
+  uint32_t frames = lba + 150;  // MSF addresses include the 2 second pregap
+  p[0] = 0;
+  p[1] = static_cast<uint8_t>(frames / (75 * 60));
+  p[2] = static_cast<uint8_t>((frames / 75) % 60);
+  p[3] = static_cast<uint8_t>(frames % 75);
+}
+
+// Helper: Copy a string into a space-padded SCSI field
+static void put_padded(uint8_t* p, size_t len, const char* s) {
+  std::memset(p, ' ', len);
+  std::memcpy(p, s, std::min(len, std::strlen(s)));
+}
+
+ScsiLun::ScsiLun(ImageReader& reader, bool cdrom, bool ro)
+    : reader_(reader), cdrom_(cdrom), ro_(ro || cdrom), block_size_(cdrom ? 2048 : 512) {
+  block_count_ = reader.size() / block_size_;
+}
+
+ScsiStatus ScsiLun::fail(uint8_t key, uint8_t asc, uint8_t ascq) {
+  sense_key_ = key;
+  sense_asc_ = asc;
+  sense_ascq_ = ascq;
+  return ScsiStatus::CHECK_CONDITION;
+}
+
+ScsiStatus ScsiLun::respond(const uint8_t* data, size_t len, size_t allocation, size_t host_length,
+                            bool host_in, ScsiTransfer& io, size_t& transferred) {
+  if (host_length == 0) return ScsiStatus::GOOD;
+  if (!host_in) return ScsiStatus::PHASE_ERROR;
+
+  size_t n = std::min(len, std::min(allocation, host_length));
+  if (n > 0 && !io.send(data, n)) {
+    return fail(ABORTED_COMMAND, 0);
+  }
+  transferred = n;
+  return ScsiStatus::GOOD;
+}
+
+ScsiStatus ScsiLun::read_blocks(uint64_t lba, uint32_t blocks, size_t host_length, bool host_in,
+                                ScsiTransfer& io, size_t& transferred) {
+  if (!loaded_) return fail(NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+  if (lba > block_count_ || blocks > block_count_ - lba) {
+    return fail(ILLEGAL_REQUEST, ASC_LBA_OUT_OF_RANGE);
+  }
+
+  uint64_t bytes = static_cast<uint64_t>(blocks) * block_size_;
+  if (bytes == 0) return ScsiStatus::GOOD;
+  if (!host_in || bytes > host_length) return ScsiStatus::PHASE_ERROR;
+
+  uint64_t offset = lba * block_size_;
+  while (transferred < bytes) {
+    size_t len = 0;
+    const uint8_t* data = reader_.read(offset + transferred, static_cast<size_t>(bytes - transferred), len);
+    if (!data) {
+      return fail(MEDIUM_ERROR, ASC_UNRECOVERED_READ_ERROR);
+    }
+    if (!io.send(data, len)) {
+      return fail(ABORTED_COMMAND, 0);
+    }
+    transferred += len;
+  }
+  return ScsiStatus::GOOD;
+}
+
+ScsiStatus ScsiLun::write_blocks(uint64_t lba, uint32_t blocks, size_t host_length, bool host_in,
+                                 ScsiTransfer& io, size_t& transferred) {
+  if (!loaded_) return fail(NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+  if (ro_) return fail(DATA_PROTECT, ASC_WRITE_PROTECTED);
+  if (lba > block_count_ || blocks > block_count_ - lba) {
+    return fail(ILLEGAL_REQUEST, ASC_LBA_OUT_OF_RANGE);
+  }
+
+  uint64_t bytes = static_cast<uint64_t>(blocks) * block_size_;
+  if (bytes == 0) return ScsiStatus::GOOD;
+  if (host_in || bytes > host_length) return ScsiStatus::PHASE_ERROR;
+
+  std::vector<uint8_t> buf(std::min<uint64_t>(bytes, ImageReader::CHUNK_SIZE));
+  uint64_t offset = lba * block_size_;
+  while (transferred < bytes) {
+    size_t len = static_cast<size_t>(std::min<uint64_t>(buf.size(), bytes - transferred));
+    if (!io.receive(buf.data(), len)) {
+      return fail(ABORTED_COMMAND, 0);
+    }
+    transferred += len;
+    if (!reader_.write(offset + transferred - len, buf.data(), len)) {
+      return fail(MEDIUM_ERROR, ASC_WRITE_ERROR);
+    }
+  }
+  return ScsiStatus::GOOD;
+}
+
+ScsiStatus ScsiLun::execute(const uint8_t* cdb, size_t cdb_len, size_t host_length, bool host_in,
+                            ScsiTransfer& io, size_t& transferred) {
+  transferred = 0;
+  if (cdb_len < 6) return fail(ILLEGAL_REQUEST, ASC_INVALID_COMMAND);
+
+  uint8_t op = cdb[0];
+  if (op != REQUEST_SENSE) {
+    sense_key_ = sense_asc_ = sense_ascq_ = 0;
+  }
+
+  switch (op) {
+    case TEST_UNIT_READY:
+      return loaded_ ? ScsiStatus::GOOD : fail(NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+
+    case REQUEST_SENSE: {
+      uint8_t sense[18] = {};
+      sense[0] = 0x70;  // Current error, fixed format
+      sense[2] = sense_key_;
+      sense[7] = 10;
+      sense[12] = sense_asc_;
+      sense[13] = sense_ascq_;
+      sense_key_ = sense_asc_ = sense_ascq_ = 0;
+      return respond(sense, sizeof(sense), cdb[4], host_length, host_in, io, transferred);
+    }
+
+    case INQUIRY: {
+      if (cdb[1] & 0x01) return fail(ILLEGAL_REQUEST, ASC_INVALID_FIELD_IN_CDB);
+      uint8_t inquiry[36] = {};
+      inquiry[0] = cdrom_ ? 0x05 : 0x00;
+      inquiry[1] = 0x80;  // Removable
+      inquiry[2] = 0x02;
+      inquiry[3] = 0x02;
+      inquiry[4] = sizeof(inquiry) - 5;
+      put_padded(inquiry + 8, 8, "isodrive");
+      put_padded(inquiry + 16, 16, cdrom_ ? "Userspace CD-ROM" : "Userspace Disk");
+      put_padded(inquiry + 32, 4, "1.00");
+      return respond(inquiry, sizeof(inquiry), get_be16(cdb + 3), host_length, host_in, io, transferred);
+    }
+
+    case MODE_SENSE_6:
+    case MODE_SENSE_10: {
+      uint8_t page = cdb[2] & 0x3f;
+      if (page != 0x08 && page != 0x3f) return fail(ILLEGAL_REQUEST, ASC_INVALID_FIELD_IN_CDB);
+
+      bool six = op == MODE_SENSE_6;
+      size_t header = six ? 4 : 8;
+      uint8_t mode[8 + 20] = {};
+      size_t len = header + 20;
+      mode[header] = 0x08;      // Caching page, all fields zero
+      mode[header + 1] = 0x12;
+      if (six) {
+        mode[0] = static_cast<uint8_t>(len - 1);
+        mode[2] = ro_ ? 0x80 : 0x00;  // Write protect
+      } else {
+        put_be16(mode, static_cast<uint16_t>(len - 2));
+        mode[3] = ro_ ? 0x80 : 0x00;
+      }
+      size_t allocation = six ? cdb[4] : get_be16(cdb + 7);
+      return respond(mode, len, allocation, host_length, host_in, io, transferred);
+    }
+
+    case START_STOP_UNIT:
+      if (cdb[4] & 0x02) {
+        bool start = cdb[4] & 0x01;
+        if (!start && prevent_removal_) {
+          return fail(ILLEGAL_REQUEST, ASC_MEDIUM_REMOVAL_PREVENTED, 0x02);
+        }
+        loaded_ = start;
+      }
+      return ScsiStatus::GOOD;
+
+    case PREVENT_ALLOW_MEDIUM_REMOVAL:
+      prevent_removal_ = cdb[4] & 0x01;
+      return ScsiStatus::GOOD;
+
+    case READ_FORMAT_CAPACITIES: {
+      uint8_t capacities[12] = {};
+      capacities[3] = 8;
+      put_be32(capacities + 4, static_cast<uint32_t>(std::min<uint64_t>(block_count_, 0xffffffff)));
+      capacities[8] = 0x02;  // Formatted media
+      capacities[9] = static_cast<uint8_t>(block_size_ >> 16);
+      capacities[10] = static_cast<uint8_t>(block_size_ >> 8);
+      capacities[11] = static_cast<uint8_t>(block_size_);
+      return respond(capacities, sizeof(capacities), get_be16(cdb + 7), host_length, host_in, io, transferred);
+    }
+
+    case READ_CAPACITY_10: {
+      if (!loaded_) return fail(NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+      uint8_t capacity[8];
+      uint64_t last = block_count_ ? block_count_ - 1 : 0;
+      put_be32(capacity, static_cast<uint32_t>(std::min<uint64_t>(last, 0xffffffff)));
+      put_be32(capacity + 4, block_size_);
+      return respond(capacity, sizeof(capacity), sizeof(capacity), host_length, host_in, io, transferred);
+    }
+
+    case SERVICE_ACTION_IN_16: {
+      if ((cdb[1] & 0x1f) != 0x10 || cdb_len < 16) return fail(ILLEGAL_REQUEST, ASC_INVALID_COMMAND);
+      if (!loaded_) return fail(NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+      uint8_t capacity[32] = {};
+      put_be64(capacity, block_count_ ? block_count_ - 1 : 0);
+      put_be32(capacity + 8, block_size_);
+      return respond(capacity, sizeof(capacity), get_be32(cdb + 10), host_length, host_in, io, transferred);
+    }
+
+    case READ_6:
+      return read_blocks(((cdb[1] & 0x1fu) << 16) | get_be16(cdb + 2), cdb[4] ? cdb[4] : 256,
+                         host_length, host_in, io, transferred);
+    case READ_10:
+      if (cdb_len < 10) break;
+      return read_blocks(get_be32(cdb + 2), get_be16(cdb + 7), host_length, host_in, io, transferred);
+    case READ_12:
+      if (cdb_len < 12) break;
+      return read_blocks(get_be32(cdb + 2), get_be32(cdb + 6), host_length, host_in, io, transferred);
+    case READ_16:
+      if (cdb_len < 16) break;
+      return read_blocks(get_be64(cdb + 2), get_be32(cdb + 10), host_length, host_in, io, transferred);
+
+    case WRITE_6:
+      return write_blocks(((cdb[1] & 0x1fu) << 16) | get_be16(cdb + 2), cdb[4] ? cdb[4] : 256,
+                          host_length, host_in, io, transferred);
+    case WRITE_10:
+      if (cdb_len < 10) break;
+      return write_blocks(get_be32(cdb + 2), get_be16(cdb + 7), host_length, host_in, io, transferred);
+    case WRITE_12:
+      if (cdb_len < 12) break;
+      return write_blocks(get_be32(cdb + 2), get_be32(cdb + 6), host_length, host_in, io, transferred);
+    case WRITE_16:
+      if (cdb_len < 16) break;
+      return write_blocks(get_be64(cdb + 2), get_be32(cdb + 10), host_length, host_in, io, transferred);
+
+    case VERIFY_10:
+      return loaded_ ? ScsiStatus::GOOD : fail(NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+
+    case SYNCHRONIZE_CACHE_10:
+      if (!ro_ && !reader_.flush()) return fail(MEDIUM_ERROR, ASC_WRITE_ERROR);
+      return ScsiStatus::GOOD;
+
+    case READ_TOC: {
+      if (!cdrom_ || cdb_len < 10) break;
+      if (!loaded_) return fail(NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+      bool msf = cdb[1] & 0x02;
+      uint8_t format = cdb[2] & 0x0f;
+      if (format == 0) format = cdb[9] >> 6;  // Pre-MMC drives put it here
+      uint8_t track = cdb[6];
+      uint32_t leadout = static_cast<uint32_t>(std::min<uint64_t>(block_count_, 0xffffffff));
+
+      // A single data track followed by the lead-out
+      uint8_t toc[20] = {};
+      size_t len;
+      if (format == 0) {
+        if (track > 1 && track != 0xaa) return fail(ILLEGAL_REQUEST, ASC_INVALID_FIELD_IN_CDB);
+        uint8_t* desc = toc + 4;
+        if (track <= 1) {
+          desc[1] = 0x14;  // ADR 1, data track
+          desc[2] = 1;
+          put_toc_address(desc + 4, 0, msf);
+          desc += 8;
+        }
+        desc[1] = 0x14;
+        desc[2] = 0xaa;
+        put_toc_address(desc + 4, leadout, msf);
+        len = static_cast<size_t>(desc + 8 - toc);
+      } else if (format == 1) {
+        toc[5] = 0x14;
+        toc[6] = 1;
+        put_toc_address(toc + 8, 0, msf);
+        len = 12;
+      } else {
+        return fail(ILLEGAL_REQUEST, ASC_INVALID_FIELD_IN_CDB);
+      }
+      put_be16(toc, static_cast<uint16_t>(len - 2));
+      toc[2] = 1;
+      toc[3] = 1;
+      return respond(toc, len, get_be16(cdb + 7), host_length, host_in, io, transferred);
+    }
+
+    case GET_CONFIGURATION: {
+      if (!cdrom_ || cdb_len < 10) break;
+      uint16_t profile = reader_.size() > CD_MAX_BYTES ? PROFILE_DVD_ROM : PROFILE_CD_ROM;
+      uint8_t config[16] = {};
+      put_be32(config, sizeof(config) - 4);
+      if (loaded_) put_be16(config + 6, profile);
+      // Profile List feature with the one profile
+      config[10] = 0x03;  // Persistent, current
+      config[11] = 4;
+      put_be16(config + 12, profile);
+      config[14] = loaded_ ? 0x01 : 0x00;
+      return respond(config, sizeof(config), get_be16(cdb + 7), host_length, host_in, io, transferred);
+    }
+
+    case GET_EVENT_STATUS_NOTIFICATION: {
+      if (!cdrom_ || cdb_len < 10) break;
+      if (!(cdb[1] & 0x01)) return fail(ILLEGAL_REQUEST, ASC_INVALID_FIELD_IN_CDB);  // Polled only
+      uint8_t event[8] = {};
+      size_t len = 4;
+      event[3] = 0x10;  // Supported: media class
+      if (cdb[4] & 0x10) {
+        event[1] = 6;
+        event[2] = 0x04;  // Media class, no event
+        event[5] = loaded_ ? 0x02 : 0x00;
+        len = 8;
+      } else {
+        event[1] = 2;
+        event[2] = 0x80;  // No event available
+      }
+      return respond(event, len, get_be16(cdb + 7), host_length, host_in, io, transferred);
+    }
+
+    default:
+      break;
+  }
+
+  LOG_DEBUG("Unsupported SCSI command 0x" + std::string(1, "0123456789abcdef"[op >> 4]) +
+            "0123456789abcdef"[op & 0x0f]);
+  return fail(ILLEGAL_REQUEST, ASC_INVALID_COMMAND);
+}
@@ -0,0 +1,557 @@
+#include "staging.h"
+#include "logger.h"
+#include "probecache.h"
+#include "trace.h"
+#include "util.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#ifdef ISODRIVE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef ISODRIVE_HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef ISODRIVE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Size of the input and output buffers of each decompressor
+static constexpr size_t STAGING_CHUNK_SIZE = 1024 * 1024;
+
+// Granularity at which runs of zeros are left as holes
+static constexpr size_t STAGING_BLOCK_SIZE = 4096;
+
+// Extension of staged images, and the infix of their partial copies
+static const char* const STAGED_EXTENSION = ".img";
+static const char* const TMP_INFIX = ".tmp.";
+
+namespace {
+    // Writes a decompressed stream at increasing offsets, skipping
+    // all-zero blocks so they stay holes in the staged file
+    class SparseWriter {
+    public:
+        SparseWriter(int fd, uint64_t offset) : fd_(fd), offset_(offset) {}
+
+        bool write(const uint8_t* data, size_t len);
+        uint64_t offset() const { return offset_; }
+
+    private:
+        int fd_;
+        uint64_t offset_;
+    };
+}
+
+// Helper: Check whether a buffer is entirely zero
+static bool is_zero(const uint8_t* data, size_t len) {
+  return len == 0 || (data[0] == 0 && std::memcmp(data, data + 1, len - 1) == 0);
+}
+
+// Helper: pwrite() all of a buffer, retrying short writes
+static bool pwrite_all(int fd, const uint8_t* data, size_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t n = pwrite(fd, data, len, static_cast<off_t>(offset));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += n;
+    len -= static_cast<size_t>(n);
+    offset += static_cast<uint64_t>(n);
+  }
+  return true;
+}
+
+// Helper: read() as much of a buffer as possible; returns 0 at end of file
+static ssize_t read_full(int fd, uint8_t* data, size_t len) {
+  size_t total = 0;
+  while (total < len) {
+    ssize_t n = read(fd, data + total, len - total);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) break;
+    total += static_cast<size_t>(n);
+  }
+  return static_cast<ssize_t>(total);
+}
+
+bool SparseWriter::write(const uint8_t* data, size_t len) {
+  size_t pos = 0;
+  while (pos < len) {
+    size_t n = std::min(STAGING_BLOCK_SIZE, len - pos);
+    if (is_zero(data + pos, n)) {
+      pos += n;
+      continue;
+    }
+
+    // Extend the run of non-zero blocks and write it in one call
+    size_t end = pos + n;
+    while (end < len) {
+      size_t m = std::min(STAGING_BLOCK_SIZE, len - end);
+      if (is_zero(data + end, m)) break;
+      end += m;
+    }
+    if (!pwrite_all(fd_, data + pos, end - pos, offset_ + pos)) {
+      return false;
+    }
+    pos = end;
+  }
+  offset_ += len;
+  return true;
+}
+
+// Helper: Number of decompression threads to use
+static unsigned worker_count() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+Compression detect_compression(const std::string& path) {
+  uint8_t magic[6] = {};
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return Compression::NONE;
+  ssize_t n = read_full(fd, magic, sizeof(magic));
+  close(fd);
+
+  if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+    return Compression::GZIP;
+  }
+  if (n >= 6 && std::memcmp(magic, "\xfd" "7zXZ\0", 6) == 0) {
+    return Compression::XZ;
+  }
+  // zstd frame, or a skippable frame (0x184D2A50-5F) that precedes one
+  if (n >= 4 && ((magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) ||
+                 ((magic[0] & 0xf0) == 0x50 && magic[1] == 0x2a && magic[2] == 0x4d && magic[3] == 0x18))) {
+    return Compression::ZSTD;
+  }
+  return Compression::NONE;
+}
+
+const char* compression_name(Compression compression) {
+  switch (compression) {
+    case Compression::GZIP: return "gzip";
+    case Compression::XZ: return "xz";
+    case Compression::ZSTD: return "zstd";
+    case Compression::NONE: break;
+  }
+  return "none";
+}
+
+bool compression_supported(Compression compression) {
+  switch (compression) {
+    case Compression::NONE: return true;
+#ifdef ISODRIVE_HAVE_ZLIB
+    case Compression::GZIP: return true;
+#endif
+#ifdef ISODRIVE_HAVE_LZMA
+    case Compression::XZ: return true;
+#endif
+#ifdef ISODRIVE_HAVE_ZSTD
+    case Compression::ZSTD: return true;
+#endif
+    default: break;
+  }
+  return false;
+}
+
+#ifdef ISODRIVE_HAVE_ZLIB
+// Helper: Decompress a gzip file (possibly several concatenated members)
+static bool decompress_gzip(int in, int out, uint64_t& size) {
+  z_stream zs = {};
+  if (inflateInit2(&zs, 15 + 16) != Z_OK) return false;
+
+  std::vector<uint8_t> inbuf(STAGING_CHUNK_SIZE);
+  std::vector<uint8_t> outbuf(STAGING_CHUNK_SIZE);
+  SparseWriter writer(out, 0);
+  size_t filled = 0;
+  bool eof = false;
+  bool ok = true;
+  while (ok) {
+    if (zs.avail_in == 0 && !eof) {
+      ssize_t n = read_full(in, inbuf.data(), inbuf.size());
+      if (n < 0) {
+        ok = false;
+        break;
+      }
+      eof = n == 0;
+      zs.next_in = inbuf.data();
+      zs.avail_in = static_cast<uInt>(n);
+    }
+
+    zs.next_out = outbuf.data() + filled;
+    zs.avail_out = static_cast<uInt>(outbuf.size() - filled);
+    int ret = inflate(&zs, Z_NO_FLUSH);
+    filled = outbuf.size() - zs.avail_out;
+
+    bool done = false;
+    if (ret == Z_STREAM_END) {
+      // Another member may follow
+      if (zs.avail_in == 0 && !eof) {
+        ssize_t n = read_full(in, inbuf.data(), inbuf.size());
+        if (n < 0) {
+          ok = false;
+          break;
+        }
+        eof = n == 0;
+        zs.next_in = inbuf.data();
+        zs.avail_in = static_cast<uInt>(n);
+      }
+      done = zs.avail_in == 0;
+      if (!done) inflateReset(&zs);
+    } else if (ret == Z_BUF_ERROR && zs.avail_in == 0 && eof) {
+      log_error("Compressed image is truncated");
+      ok = false;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      log_error(std::string("gzip data error: ") + (zs.msg ? zs.msg : "unknown"));
+      ok = false;
+    }
+
+    if (ok && (filled == outbuf.size() || done)) {
+      ok = writer.write(outbuf.data(), filled);
+      filled = 0;
+    }
+    if (done) break;
+  }
+  inflateEnd(&zs);
+  size = writer.offset();
+  return ok;
+}
+#endif
+
+#ifdef ISODRIVE_HAVE_LZMA
+// Helper: Decompress an xz file, using every core on multi-block files
+static bool decompress_xz(int in, int out, uint64_t& size) {
+  lzma_stream strm = LZMA_STREAM_INIT;
+#if LZMA_VERSION >= 50040002U
+  lzma_mt mt = {};
+  mt.flags = LZMA_CONCATENATED;
+  mt.threads = worker_count();
+  mt.memlimit_threading = std::max<uint64_t>(lzma_physmem() / 4, 64 << 20);
+  mt.memlimit_stop = UINT64_MAX;
+  lzma_ret ret = lzma_stream_decoder_mt(&strm, &mt);
+#else
+  lzma_ret ret = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+  if (ret != LZMA_OK) return false;
+
+  std::vector<uint8_t> inbuf(STAGING_CHUNK_SIZE);
+  std::vector<uint8_t> outbuf(STAGING_CHUNK_SIZE);
+  SparseWriter writer(out, 0);
+  size_t filled = 0;
+  bool eof = false;
+  bool ok = true;
+  while (ok) {
+    if (strm.avail_in == 0 && !eof) {
+      ssize_t n = read_full(in, inbuf.data(), inbuf.size());
+      if (n < 0) {
+        ok = false;
+        break;
+      }
+      eof = n == 0;
+      strm.next_in = inbuf.data();
+      strm.avail_in = static_cast<size_t>(n);
+    }
+
+    strm.next_out = outbuf.data() + filled;
+    strm.avail_out = outbuf.size() - filled;
+    ret = lzma_code(&strm, eof ? LZMA_FINISH : LZMA_RUN);
+    filled = outbuf.size() - strm.avail_out;
+
+    bool done = ret == LZMA_STREAM_END;
+    if (ret != LZMA_OK && !done) {
+      log_error(ret == LZMA_BUF_ERROR ? "Compressed image is truncated"
+                                      : "xz data error " + std::to_string(static_cast<int>(ret)));
+      ok = false;
+    }
+
+    if (ok && (filled == outbuf.size() || done)) {
+      ok = writer.write(outbuf.data(), filled);
+      filled = 0;
+    }
+    if (done) break;
+  }
+  lzma_end(&strm);
+  size = writer.offset();
+  return ok;
+}
+#endif
+
+#ifdef ISODRIVE_HAVE_ZSTD
+namespace {
+    // A run of compressed input and where its output starts
+    struct ZstdJob {
+        size_t in_offset;
+        size_t in_size;
+        uint64_t out_offset;
+    };
+}
+
+// Helper: Stream one job through a decompression context
+static bool decompress_zstd_job(ZSTD_DCtx* dctx, const uint8_t* src, const ZstdJob& job,
+                                int out, std::vector<uint8_t>& outbuf, uint64_t& end) {
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+  ZSTD_inBuffer input = {src + job.in_offset, job.in_size, 0};
+  SparseWriter writer(out, job.out_offset);
+  size_t filled = 0;
+  size_t ret = 1;
+  while (true) {
+    ZSTD_outBuffer output = {outbuf.data(), outbuf.size(), filled};
+    ret = ZSTD_decompressStream(dctx, &output, &input);
+    if (ZSTD_isError(ret)) {
+      log_error(std::string("zstd data error: ") + ZSTD_getErrorName(ret));
+      return false;
+    }
+    bool progress = output.pos > filled;
+    filled = output.pos;
+
+    bool done = input.pos == input.size && ret == 0;
+    if (filled == outbuf.size() || done) {
+      if (!writer.write(outbuf.data(), filled)) return false;
+      filled = 0;
+    }
+    if (done) break;
+    if (input.pos == input.size && !progress) {
+      log_error("Compressed image is truncated");
+      return false;
+    }
+  }
+  end = writer.offset();
+  return true;
+}
+
+// Helper: Decompress a zstd file, one frame per worker when the frame
+// sizes are known up front
+static bool decompress_zstd(int in, int out, uint64_t& size) {
+  struct stat st;
+  if (fstat(in, &st) != 0 || st.st_size == 0) return false;
+  size_t length = static_cast<size_t>(st.st_size);
+  void* map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, in, 0);
+  if (map == MAP_FAILED) return false;
+  madvise(map, length, MADV_SEQUENTIAL);
+  const uint8_t* src = static_cast<const uint8_t*>(map);
+
+  // Lay out every frame's output; a frame without a content size
+  // forces one sequential pass over the whole file
+  std::vector<ZstdJob> jobs;
+  uint64_t total = 0;
+  bool sizes_known = true;
+  for (size_t pos = 0; pos < length;) {
+    size_t frame = ZSTD_findFrameCompressedSize(src + pos, length - pos);
+    if (ZSTD_isError(frame)) {
+      log_error(std::string("zstd data error: ") + ZSTD_getErrorName(frame));
+      munmap(map, length);
+      return false;
+    }
+    unsigned long long content = ZSTD_getFrameContentSize(src + pos, frame);
+    if (content == ZSTD_CONTENTSIZE_UNKNOWN || content == ZSTD_CONTENTSIZE_ERROR) {
+      sizes_known = false;
+      break;
+    }
+    jobs.push_back({pos, frame, total});
+    total += content;
+    pos += frame;
+  }
+  if (!sizes_known) {
+    jobs.assign(1, {0, length, 0});
+  }
+
+  std::atomic<size_t> next(0);
+  std::atomic<bool> ok(true);
+  std::atomic<uint64_t> end(0);
+  auto worker = [&]() {
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    if (dctx) {
+      // Accept the large windows of zstd --long; the default stops at 128 MiB
+      ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, ZSTD_dParam_getBounds(ZSTD_d_windowLogMax).upperBound);
+    }
+    std::vector<uint8_t> outbuf(STAGING_CHUNK_SIZE);
+    for (size_t i = next++; i < jobs.size() && ok; i = next++) {
+      uint64_t job_end = 0;
+      if (!dctx || !decompress_zstd_job(dctx, src, jobs[i], out, outbuf, job_end)) {
+        ok = false;
+      }
+      uint64_t seen = end;
+      while (job_end > seen && !end.compare_exchange_weak(seen, job_end)) {}
+    }
+    ZSTD_freeDCtx(dctx);
+  };
+
+  size_t threads = std::min<size_t>(worker_count(), jobs.size());
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& t : pool) {
+    t.join();
+  }
+  munmap(map, length);
+
+  LOG_DEBUG("zstd: " + std::to_string(jobs.size()) + " job(s) on " + std::to_string(threads) + " thread(s)");
+  size = sizes_known ? total : end.load();
+  return ok;
+}
+#endif
+
+// Helper: Run the decompressor for a format
+static bool decompress(Compression compression, int in, int out, uint64_t& size) {
+  switch (compression) {
+#ifdef ISODRIVE_HAVE_ZLIB
+    case Compression::GZIP: return decompress_gzip(in, out, size);
+#endif
+#ifdef ISODRIVE_HAVE_LZMA
+    case Compression::XZ: return decompress_xz(in, out, size);
+#endif
+#ifdef ISODRIVE_HAVE_ZSTD
+    case Compression::ZSTD: return decompress_zstd(in, out, size);
+#endif
+    default: break;
+  }
+  return false;
+}
+
+std::string staging_dir() {
+  return probe_cache_dir() + "/staging";
+}
+
+// Helper: Whether the process that is writing a partial copy still runs
+static bool tmp_owner_alive(const std::string& name) {
+  size_t infix = name.rfind(TMP_INFIX);
+  if (infix == std::string::npos) return false;
+  pid_t pid = static_cast<pid_t>(atoi(name.c_str() + infix + strlen(TMP_INFIX)));
+  return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+// Helper: Drop older versions of this source, partial copies of exited
+// processes and, beyond STAGING_MAX_IMAGES, the least recently used
+// images that are not in use
+static void prune_staging_dir(const std::string& dir, const ImageKey& key, const std::vector<std::string>& in_use) {
+  std::string prefix = image_key_prefix(key);
+  std::vector<std::pair<struct timespec, fs::path>> staged;
+  size_t kept = 0;
+  std::error_code ec;
+  for (const auto& entry : fs::directory_iterator(dir, ec)) {
+    std::string name = entry.path().filename().string();
+    if (name.find(TMP_INFIX) != std::string::npos) {
+      if (tmp_owner_alive(name)) continue;
+      LOG_DEBUG("Removing abandoned partial image " + name);
+      fs::remove(entry.path(), ec);
+    } else if (name.compare(0, prefix.size(), prefix) == 0) {
+      LOG_DEBUG("Removing outdated staged image " + name);
+      fs::remove(entry.path(), ec);
+    } else if (std::find(in_use.begin(), in_use.end(), entry.path().string()) != in_use.end()) {
+      kept++;
+    } else if (entry.path().extension() == STAGED_EXTENSION) {
+      struct stat st;
+      if (stat(entry.path().c_str(), &st) == 0) {
+        staged.emplace_back(st.st_atim, entry.path());
+      }
+    }
+  }
+
+  std::sort(staged.begin(), staged.end(), [](const std::pair<struct timespec, fs::path>& a,
+                                             const std::pair<struct timespec, fs::path>& b) {
+    if (a.first.tv_sec != b.first.tv_sec) return a.first.tv_sec < b.first.tv_sec;
+    return a.first.tv_nsec < b.first.tv_nsec;
+  });
+  // Copies in use count towards the limit but are never evicted
+  size_t total = staged.size() + kept;
+  for (size_t i = 0; i < staged.size() && total >= STAGING_MAX_IMAGES; i++, total--) {
+    LOG_DEBUG("Evicting staged image " + staged[i].second.string());
+    fs::remove(staged[i].second, ec);
+  }
+}
+
+bool stage_image(const std::string& path, std::string& staged_path, const std::vector<std::string>& in_use) {
+  Compression compression = detect_compression(path);
+  if (compression == Compression::NONE) {
+    staged_path = path;
+    return true;
+  }
+
+  TraceSpan span("stage_image");
+  span.detail(path);
+  if (!compression_supported(compression)) {
+    log_error(std::string("This build cannot decompress ") + compression_name(compression) +
+              " images: " + path);
+    return false;
+  }
+
+  ImageKey key;
+  if (!image_key(path, key)) {
+    log_error("Cannot stat " + path + ": " + std::string(std::strerror(errno)));
+    return false;
+  }
+
+  std::string dir = staging_dir();
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    log_error("Cannot create staging directory " + dir + ": " + ec.message());
+    return false;
+  }
+
+  // One staged copy per source file; the name changes with the source
+  staged_path = dir + "/" + image_key_name(key) + STAGED_EXTENSION;
+  if (isfile(staged_path)) {
+    // The access time orders eviction; the modification time is part
+    // of the staged copy's own ImageKey and stays as it is
+    const struct timespec times[2] = {{0, UTIME_NOW}, {0, UTIME_OMIT}};
+    utimensat(AT_FDCWD, staged_path.c_str(), times, 0);
+    LOG_DEBUG("Reusing staged image " + staged_path);
+    return true;
+  }
+  prune_staging_dir(dir, key, in_use);
+
+  log_info(std::string("Decompressing ") + compression_name(compression) + " image " + path + "...");
+  std::string tmp = staged_path + TMP_INFIX + std::to_string(getpid());
+  int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    log_error("Cannot open " + path + ": " + std::string(std::strerror(errno)));
+    return false;
+  }
+  int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out < 0) {
+    log_error("Cannot create " + tmp + ": " + std::string(std::strerror(errno)));
+    close(in);
+    return false;
+  }
+
+  // The staged copy is only published once it is complete and on disk
+  uint64_t size = 0;
+  errno = 0;
+  bool ok = decompress(compression, in, out, size) &&
+            ftruncate(out, static_cast<off_t>(size)) == 0 && fdatasync(out) == 0;
+  // Both files went through the page cache in full; drop them so the
+  // staged copy's hot page map only learns what the host reads
+  posix_fadvise(in, 0, 0, POSIX_FADV_DONTNEED);
+  posix_fadvise(out, 0, 0, POSIX_FADV_DONTNEED);
+  close(in);
+  close(out);
+  ok = ok && rename(tmp.c_str(), staged_path.c_str()) == 0;
+  int err = ok ? 0 : errno;
+  if (!ok) {
+    log_error("Failed to decompress " + path + (err ? ": " + std::string(std::strerror(err)) : ""));
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  log_info("Staged " + std::to_string(size >> 20) + " MiB image as " + staged_path);
+  return true;
+}
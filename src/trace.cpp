@@ -0,0 +1,108 @@
+#include "trace.h"
+#include "logger.h"
+#include "util.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    struct TraceEvent {
+        const char* name;
+        int64_t start_us;
+        int64_t duration_us;
+        long tid;
+        std::string detail;
+    };
+
+    std::atomic<bool> g_trace_enabled{false};
+    std::mutex g_trace_mutex;
+    std::vector<TraceEvent> g_trace_events;
+    std::chrono::steady_clock::time_point g_trace_origin;
+}
+
+void trace_enable() {
+  std::lock_guard<std::mutex> lock(g_trace_mutex);
+  if (!g_trace_enabled.load(std::memory_order_relaxed)) {
+    g_trace_origin = std::chrono::steady_clock::now();
+    g_trace_enabled.store(true, std::memory_order_relaxed);
+  }
+}
+
+bool trace_enabled() {
+  return g_trace_enabled.load(std::memory_order_relaxed);
+}
+
+void trace_reset() {
+  std::lock_guard<std::mutex> lock(g_trace_mutex);
+  g_trace_enabled.store(false, std::memory_order_relaxed);
+  g_trace_events.clear();
+}
+
+bool trace_write(const std::string& path) {
+  std::vector<TraceEvent> events;
+  {
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    events = g_trace_events;
+  }
+
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) {
+    log_error("Cannot write trace file " + path);
+    return false;
+  }
+
+  long pid = static_cast<long>(getpid());
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  for (size_t i = 0; i < events.size(); i++) {
+    const TraceEvent& e = events[i];
+    out << "{\"name\":\"" << json_escape(e.name) << "\",\"cat\":\"isodrive\",\"ph\":\"X\""
+        << ",\"ts\":" << e.start_us << ",\"dur\":" << e.duration_us
+        << ",\"pid\":" << pid << ",\"tid\":" << e.tid;
+    if (!e.detail.empty()) {
+      out << ",\"args\":{\"detail\":\"" << json_escape(e.detail) << "\"}";
+    }
+    out << "}" << (i + 1 < events.size() ? "," : "") << "\n";
+  }
+  out << "]}\n";
+
+  if (!out) {
+    log_error("Failed to write trace file " + path);
+    return false;
+  }
+  LOG_DEBUG("Wrote " + std::to_string(events.size()) + " trace spans to " + path);
+  return true;
+}
+
+TraceSpan::TraceSpan(const char* name)
+    : name_(name), active_(g_trace_enabled.load(std::memory_order_relaxed)) {
+  if (active_) {
+    start_ = std::chrono::steady_clock::now();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (!active_) return;
+
+  auto end = std::chrono::steady_clock::now();
+  TraceEvent e;
+  e.name = name_;
+  e.tid = static_cast<long>(syscall(SYS_gettid));
+  e.detail = std::move(detail_);
+
+  std::lock_guard<std::mutex> lock(g_trace_mutex);
+  e.start_us = std::chrono::duration_cast<std::chrono::microseconds>(start_ - g_trace_origin).count();
+  e.duration_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start_).count();
+  g_trace_events.push_back(std::move(e));
+}
+
+void TraceSpan::detail(const std::string& detail) {
+  if (active_) {
+    detail_ = detail;
+  }
+}
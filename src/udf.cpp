@@ -0,0 +1,293 @@
+#include "udf.h"
+#include "logger.h"
+#include "util.h"
+#include <algorithm>
+#include <string>
+
+namespace {
+    // Descriptor tag identifiers (ECMA-167 3/7.2.1 and 4/7.2.1)
+    const uint16_t TAG_ANCHOR = 2;
+    const uint16_t TAG_PARTITION = 5;
+    const uint16_t TAG_LOGICAL_VOLUME = 6;
+    const uint16_t TAG_TERMINATING = 8;
+    const uint16_t TAG_FILE_SET = 256;
+    const uint16_t TAG_FILE_ID = 257;
+    const uint16_t TAG_ALLOCATION_EXTENT = 258;
+    const uint16_t TAG_FILE_ENTRY = 261;
+    const uint16_t TAG_EXTENDED_FILE_ENTRY = 266;
+
+    // Upper bounds that keep a corrupt volume from turning a probe into a scan
+    const uint32_t UDF_MAX_DESCRIPTORS = 64;
+    const int UDF_MAX_CONTINUATIONS = 16;
+    const uint64_t UDF_MAX_DIRECTORY = 4 * 1024 * 1024;
+
+    // ICB file type of directories and allocation descriptor kinds
+    const unsigned char FILE_TYPE_DIRECTORY = 4;
+    const uint16_t AD_SHORT = 0;
+    const uint16_t AD_LONG = 1;
+    const uint16_t AD_EMBEDDED = 3;
+
+    // Extent types in the top two bits of an allocation descriptor length
+    const uint32_t EXTENT_RECORDED = 0;
+    const uint32_t EXTENT_CONTINUATION = 3;
+
+    // File characteristics of a File Identifier Descriptor
+    const unsigned char FID_DELETED = 0x04;
+    const unsigned char FID_PARENT = 0x08;
+}
+
+// Helper: Check a descriptor tag's checksum and return its identifier, or 0
+static uint16_t tag_id(const unsigned char* tag) {
+  unsigned char sum = 0;
+  for (int i = 0; i < 16; i++) {
+    if (i != 4) sum = static_cast<unsigned char>(sum + tag[i]);
+  }
+  return sum == tag[4] ? le16(tag) : 0;
+}
+
+// Helper: Read a sector whose tag carries the expected identifier and location
+static const unsigned char* tagged_sector(ImageProbe& probe, uint64_t lba, uint16_t id, uint32_t location) {
+  const unsigned char* data = probe.sector(lba);
+  if (!data || tag_id(data) != id || le32(data + 12) != location) return nullptr;
+  return data;
+}
+
+// Helper: Decode an OSTA compressed Unicode identifier to UTF-8
+static std::string decode_dchars(const unsigned char* p, size_t len) {
+  std::string out;
+  if (len == 0) return out;
+  if (p[0] == 8) {
+    out.assign(reinterpret_cast<const char*>(p + 1), len - 1);
+  } else if (p[0] == 16) {
+    for (size_t i = 1; i + 1 < len; i += 2) {
+      unsigned int c = (static_cast<unsigned int>(p[i]) << 8) | p[i + 1];
+      if (c < 0x80) {
+        out += static_cast<char>(c);
+      } else if (c < 0x800) {
+        out += static_cast<char>(0xC0 | (c >> 6));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+      } else {
+        out += static_cast<char>(0xE0 | (c >> 12));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+      }
+    }
+  }
+  return out;
+}
+
+// Helper: Lowercase ASCII for case-insensitive comparisons
+static std::string fold_name(std::string name) {
+  for (char& c : name) {
+    if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+  }
+  return name;
+}
+
+UdfReader::UdfReader(ImageProbe& probe)
+    : probe_(probe), valid_(false), partition_number_(0), partition_start_(0),
+      partition_length_(0), fsd_lbn_(0), root_icb_(0) {
+  const unsigned char* anchor = tagged_sector(probe_, UDF_ANCHOR_SECTOR, TAG_ANCHOR,
+                                              static_cast<uint32_t>(UDF_ANCHOR_SECTOR));
+  if (!anchor) return;
+
+  // Main Volume Descriptor Sequence, then the reserve copy
+  uint32_t main_length = le32(anchor + 16);
+  uint32_t main_location = le32(anchor + 20);
+  uint32_t reserve_length = le32(anchor + 24);
+  uint32_t reserve_location = le32(anchor + 28);
+  if (!read_volume_descriptors(main_location, main_length) &&
+      !read_volume_descriptors(reserve_location, reserve_length)) {
+    LOG_DEBUG("UDF anchor found but no usable volume descriptor sequence");
+    return;
+  }
+
+  const unsigned char* fsd = tagged_sector(probe_, static_cast<uint64_t>(partition_start_) + fsd_lbn_,
+                                           TAG_FILE_SET, fsd_lbn_);
+  if (!fsd) {
+    LOG_DEBUG("UDF file set descriptor missing at block " + std::to_string(fsd_lbn_));
+    return;
+  }
+  root_icb_ = le32(fsd + 404);
+  valid_ = true;
+  LOG_DEBUG("UDF volume '" + volume_id_ + "', partition at sector " + std::to_string(partition_start_));
+}
+
+bool UdfReader::read_volume_descriptors(uint32_t location, uint32_t length) {
+  bool have_partition = false;
+  bool have_volume = false;
+  uint32_t map_partition = 0;
+  uint32_t count = std::min(length / static_cast<uint32_t>(ISO_SECTOR_SIZE), UDF_MAX_DESCRIPTORS);
+
+  for (uint32_t i = 0; i < count; i++) {
+    const unsigned char* vd = probe_.sector(static_cast<uint64_t>(location) + i);
+    if (!vd || le32(vd + 12) != location + i) break;
+    uint16_t id = tag_id(vd);
+    if (id == TAG_TERMINATING) break;
+
+    if (id == TAG_PARTITION && !have_partition) {
+      partition_number_ = le16(vd + 22);
+      partition_start_ = le32(vd + 188);
+      partition_length_ = le32(vd + 192);
+      have_partition = true;
+    } else if (id == TAG_LOGICAL_VOLUME && !have_volume) {
+      if (le32(vd + 212) != ISO_SECTOR_SIZE) {
+        LOG_DEBUG("UDF logical block size " + std::to_string(le32(vd + 212)) + " not supported");
+        return false;
+      }
+      // Only a single type 1 (physical) map; metadata and sparable maps are not followed
+      if (le32(vd + 268) < 1 || vd[440] != 1) {
+        LOG_DEBUG("UDF partition map type " + std::to_string(vd[440]) + " not supported");
+        return false;
+      }
+      map_partition = le16(vd + 444);
+      fsd_lbn_ = le32(vd + 252);
+      size_t id_len = std::min<size_t>(vd[84 + 127], 127);
+      volume_id_ = decode_dchars(vd + 84, id_len);
+      have_volume = true;
+    }
+  }
+  return have_partition && have_volume && map_partition == partition_number_;
+}
+
+bool UdfReader::read_allocation(const unsigned char* ads, size_t length, bool long_ad, Entry& entry) {
+  size_t step = long_ad ? 16 : 8;
+  int continuations = 0;
+  std::vector<unsigned char> next;
+
+  for (size_t pos = 0; pos + step <= length;) {
+    uint32_t raw = le32(ads + pos);
+    uint32_t bytes = raw & 0x3fffffff;
+    uint32_t type = raw >> 30;
+    uint32_t lbn = le32(ads + pos + 4);
+    if (bytes == 0) break;
+
+    if (type == EXTENT_CONTINUATION) {
+      // The rest of the list lives in an Allocation Extent Descriptor
+      if (++continuations > UDF_MAX_CONTINUATIONS) return false;
+      const unsigned char* aed = tagged_sector(probe_, static_cast<uint64_t>(partition_start_) + lbn,
+                                               TAG_ALLOCATION_EXTENT, lbn);
+      if (!aed) return false;
+      size_t aed_length = std::min<size_t>(le32(aed + 20), ISO_SECTOR_SIZE - 24);
+      next.assign(aed + 24, aed + 24 + aed_length);
+      ads = next.data();
+      length = next.size();
+      pos = 0;
+      continue;
+    }
+
+    if (type == EXTENT_RECORDED) {
+      if (static_cast<uint64_t>(lbn) + (bytes + ISO_SECTOR_SIZE - 1) / ISO_SECTOR_SIZE > partition_length_) {
+        return false;
+      }
+      entry.extents.push_back({static_cast<uint64_t>(partition_start_) + lbn, bytes});
+    }
+    pos += step;
+  }
+  return true;
+}
+
+bool UdfReader::read_entry(uint32_t lbn, Entry& entry) {
+  entry = Entry();
+  const unsigned char* fe = probe_.sector(static_cast<uint64_t>(partition_start_) + lbn);
+  if (!fe || le32(fe + 12) != lbn) return false;
+
+  size_t header;
+  size_t ea_length;
+  size_t ad_length;
+  uint16_t id = tag_id(fe);
+  if (id == TAG_FILE_ENTRY) {
+    ea_length = le32(fe + 168);
+    ad_length = le32(fe + 172);
+    header = 176;
+  } else if (id == TAG_EXTENDED_FILE_ENTRY) {
+    ea_length = le32(fe + 208);
+    ad_length = le32(fe + 212);
+    header = 216;
+  } else {
+    return false;
+  }
+  if (header + ea_length + ad_length > ISO_SECTOR_SIZE) return false;
+
+  entry.is_dir = fe[27] == FILE_TYPE_DIRECTORY;
+  entry.size = le64(fe + 56);
+  const unsigned char* ads = fe + header + ea_length;
+
+  switch (le16(fe + 34) & 7) {
+    case AD_SHORT:
+      return read_allocation(ads, ad_length, false, entry);
+    case AD_LONG:
+      return read_allocation(ads, ad_length, true, entry);
+    case AD_EMBEDDED:
+      entry.inline_data.assign(ads, ads + std::min<uint64_t>(ad_length, entry.size));
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool UdfReader::find_in_directory(const Entry& dir, const std::string& name, uint32_t& icb,
+                                  std::string& recorded) {
+  std::vector<unsigned char> data = dir.inline_data;
+  if (data.empty()) {
+    uint64_t total = std::min(dir.size, UDF_MAX_DIRECTORY);
+    for (const IsoExtent& extent : dir.extents) {
+      if (data.size() >= total) break;
+      size_t chunk = static_cast<size_t>(std::min<uint64_t>(extent.length, total - data.size()));
+      size_t at = data.size();
+      data.resize(at + chunk);
+      if (!probe_.read(extent.lba * ISO_SECTOR_SIZE, data.data() + at, chunk)) return false;
+    }
+  }
+
+  for (size_t pos = 0; pos + 38 <= data.size();) {
+    const unsigned char* fid = data.data() + pos;
+    if (tag_id(fid) != TAG_FILE_ID) break;
+    unsigned char characteristics = fid[18];
+    size_t id_length = fid[19];
+    size_t iu_length = le16(fid + 36);
+    size_t length = (38 + iu_length + id_length + 3) & ~static_cast<size_t>(3);
+    if (pos + 38 + iu_length + id_length > data.size()) break;
+
+    if (!(characteristics & (FID_DELETED | FID_PARENT)) && id_length > 0) {
+      std::string entry_name = decode_dchars(fid + 38 + iu_length, id_length);
+      if (fold_name(entry_name) == name) {
+        icb = le32(fid + 24);
+        recorded = entry_name;
+        return true;
+      }
+    }
+    pos += length;
+  }
+  return false;
+}
+
+bool UdfReader::lookup(const std::string& path, IsoFileInfo& info) {
+  if (!valid()) return false;
+
+  Entry entry;
+  if (!read_entry(root_icb_, entry)) return false;
+  std::string name;
+
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) end = path.size();
+    if (end > start) {
+      uint32_t icb = 0;
+      if (!entry.is_dir || !find_in_directory(entry, fold_name(path.substr(start, end - start)), icb, name) ||
+          !read_entry(icb, entry)) {
+        return false;
+      }
+    }
+    start = end + 1;
+  }
+
+  info = {name, entry.is_dir, entry.size, entry.extents};
+  return true;
+}
+
+bool UdfReader::exists(const std::string& path) {
+  IsoFileInfo info;
+  return lookup(path, info);
+}
@@ -0,0 +1,182 @@
+#include "uring.h"
+#include "logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+#ifdef __NR_io_uring_setup
+
+// Helper: io_uring_setup(2)
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+// Helper: io_uring_enter(2)
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+IoUring::~IoUring() {
+  if (sqes_) munmap(sqes_, sqes_size_);
+  if (cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+  if (ring_fd_ >= 0) close(ring_fd_);
+}
+
+bool IoUring::init(unsigned entries) {
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  int fd = sys_io_uring_setup(entries, &params);
+  if (fd < 0) {
+    LOG_DEBUG("io_uring unavailable: " + std::string(std::strerror(errno)));
+    return false;
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+
+  void* sq = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                  IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  void* cq = sq;
+  if (!single_mmap) {
+    cq = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+              IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) {
+      munmap(sq, sq_ring_size_);
+      close(fd);
+      return false;
+    }
+  }
+  size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                    IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    if (cq != sq) munmap(cq, cq_ring_size_);
+    munmap(sq, sq_ring_size_);
+    close(fd);
+    return false;
+  }
+
+  ring_fd_ = fd;
+  sq_ring_ = sq;
+  cq_ring_ = cq;
+  sqes_ = sqes;
+  sqes_size_ = sqes_size;
+
+  char* sq_base = static_cast<char*>(sq);
+  sq_head_ = reinterpret_cast<unsigned*>(sq_base + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq_base + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq_base + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq_base + params.sq_off.array);
+  sq_entries_ = params.sq_entries;
+
+  char* cq_base = static_cast<char*>(cq);
+  cq_head_ = reinterpret_cast<unsigned*>(cq_base + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq_base + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq_base + params.cq_off.ring_mask);
+  cqes_ = cq_base + params.cq_off.cqes;
+
+  iovecs_.resize(sq_entries_);
+  return true;
+}
+
+bool IoUring::queue_read(int fd, void* buf, size_t len, uint64_t offset, uint64_t user_data) {
+  if (!ready()) return false;
+
+  // Only this thread produces submissions, so the tail needs no atomics
+  unsigned tail = *sq_tail_;
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (tail - head >= sq_entries_) return false;
+
+  unsigned index = tail & *sq_mask_;
+  iovecs_[index].iov_base = buf;
+  iovecs_[index].iov_len = len;
+
+  struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_) + index;
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(&iovecs_[index]);
+  sqe->len = 1;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  to_submit_++;
+  return true;
+}
+
+bool IoUring::submit() {
+  while (to_submit_ > 0) {
+    int n = sys_io_uring_enter(ring_fd_, to_submit_, 0, 0);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      LOG_DEBUG("io_uring_enter failed: " + std::string(std::strerror(errno)));
+      return false;
+    }
+    if (n == 0) return false;
+    to_submit_ -= static_cast<unsigned>(n);
+    in_flight_ += static_cast<unsigned>(n);
+  }
+  return true;
+}
+
+bool IoUring::reap(uint64_t& user_data, int& result, bool block) {
+  if (!ready()) return false;
+  while (true) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+      const struct io_uring_cqe* cqe = static_cast<const struct io_uring_cqe*>(cqes_) + (head & *cq_mask_);
+      user_data = cqe->user_data;
+      result = cqe->res;
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      in_flight_--;
+      return true;
+    }
+    if (!block || in_flight_ == 0) return false;
+
+    if (sys_io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+      LOG_DEBUG("io_uring_enter failed: " + std::string(std::strerror(errno)));
+      return false;
+    }
+  }
+}
+
+#else // No io_uring system calls on this platform
+
+IoUring::~IoUring() {}
+
+bool IoUring::init(unsigned) {
+  return false;
+}
+
+bool IoUring::queue_read(int, void*, size_t, uint64_t, uint64_t) {
+  return false;
+}
+
+bool IoUring::submit() {
+  return false;
+}
+
+bool IoUring::reap(uint64_t&, int&, bool) {
+  return false;
+}
+
+#endif
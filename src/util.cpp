@@ -1,30 +1,29 @@
 #include "util.h"
+#include "imageprobe.h"
 #include "logger.h"
-#include <algorithm>
-#include <cctype>
+#include "trace.h"
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <mntent.h>
 #include <string>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
-// ISO 9660 constants
-constexpr int ISO_SECTOR_SIZE = 2048;
-constexpr int ISO_PVD_SECTOR = 16;  // Primary Volume Descriptor is at sector 16
-constexpr int ISO_PVD_OFFSET = ISO_PVD_SECTOR * ISO_SECTOR_SIZE;  // 32768
-
 std::string fs_mount_point(const std::string& filesystem_type) {
+  TRACE_SPAN("fs_mount_point");
   struct mntent *ent;
   FILE *mounts;
   std::string mount_point;
 
   mounts = setmntent("/proc/mounts", "r");
   if (!mounts) {
-    log_debug("Failed to open /proc/mounts");
+    LOG_DEBUG("Failed to open /proc/mounts");
     return "";
   }
 
@@ -40,12 +39,12 @@ std::string fs_mount_point(const std::string& filesystem_type) {
   if (mount_point.empty() && filesystem_type == "configfs") {
     if (fs::exists("/config/usb_gadget")) {
       mount_point = "/config";
-      log_debug("Found configfs at /config (Android fallback)");
+      LOG_DEBUG("Found configfs at /config (Android fallback)");
     }
   }
 
   if (!mount_point.empty()) {
-    log_debug("Found " + filesystem_type + " at " + mount_point);
+    LOG_DEBUG("Found " + filesystem_type + " at " + mount_point);
   }
 
   return mount_point;
@@ -64,257 +63,122 @@ bool isfile(const std::string& path) {
 }
 
 bool is_hybrid_iso(const std::string& path) {
-  std::ifstream file(path, std::ios::binary);
-  if (!file) {
-    log_debug("Cannot open file for hybrid ISO check: " + path);
-    return false;
-  }
-
-  file.seekg(510);
-  if (file.fail()) {
-    log_debug("Failed to seek to offset 510 in: " + path);
-    return false;
-  }
-
-  unsigned char buffer[2];
-  file.read(reinterpret_cast<char*>(buffer), 2);
-
-  if (file.gcount() != 2) {
-    log_debug("Failed to read 2 bytes at offset 510 from: " + path);
-    return false;
-  }
-
-  bool is_hybrid = (buffer[0] == 0x55 && buffer[1] == 0xAA);
-  log_debug("ISO " + path + " hybrid check: " + (is_hybrid ? "true" : "false"));
-  return is_hybrid;
+  TRACE_SPAN("is_hybrid_iso");
+  return probe_image(path).is_hybrid;
 }
 
-// Helper: Read ISO 9660 Primary Volume Descriptor and extract volume label
-static std::string read_iso_volume_label(const std::string& path) {
-  std::ifstream file(path, std::ios::binary);
-  if (!file) {
-    return "";
-  }
-
-  // Seek to Primary Volume Descriptor (sector 16)
-  file.seekg(ISO_PVD_OFFSET);
-  if (file.fail()) {
-    return "";
-  }
-
-  // Read the sector
-  char buffer[ISO_SECTOR_SIZE];
-  file.read(buffer, ISO_SECTOR_SIZE);
-  if (file.gcount() != ISO_SECTOR_SIZE) {
-    return "";
-  }
-
-  // Verify this is a Primary Volume Descriptor
-  // Byte 0: Type (1 = PVD)
-  // Bytes 1-5: "CD001"
-  if (buffer[0] != 1 || std::strncmp(buffer + 1, "CD001", 5) != 0) {
-    log_debug("Not a valid ISO 9660 Primary Volume Descriptor");
-    return "";
-  }
-
-  // Volume Identifier is at offset 40, 32 bytes, space-padded
-  std::string volume_id(buffer + 40, 32);
-  
-  // Trim trailing spaces
-  size_t end = volume_id.find_last_not_of(' ');
-  if (end != std::string::npos) {
-    volume_id = volume_id.substr(0, end + 1);
-  } else {
-    volume_id.clear();
-  }
-
-  log_debug("ISO volume label: " + volume_id);
-  return volume_id;
+bool is_windows_iso(const std::string& path) {
+  TRACE_SPAN("is_windows_iso");
+  return probe_image(path).windows.is_windows;
 }
 
-// Helper: Check if a specific path exists within the ISO (basic check via volume label patterns)
-static bool iso_contains_windows_markers(const std::string& volume_label) {
-  std::string upper_label = volume_label;
-  std::transform(upper_label.begin(), upper_label.end(), upper_label.begin(), ::toupper);
-
-  // Common Windows ISO volume labels
-  if (upper_label.find("WIN") != std::string::npos) return true;
-  if (upper_label.find("WINDOWS") != std::string::npos) return true;
-  if (upper_label.find("CCCOMA") != std::string::npos) return true;  // Windows Media Creation Tool
-  if (upper_label.find("ESD-ISO") != std::string::npos) return true;  // Windows ESD
-  if (upper_label.find("J_CCSA") != std::string::npos) return true;   // Some Windows ISOs
-  if (upper_label.find("CPBA") != std::string::npos) return true;     // Some Windows ISOs
-  
-  return false;
+WindowsIsoInfo get_windows_iso_info(const std::string& path) {
+  TRACE_SPAN("get_windows_iso_info");
+  return probe_image(path).windows;
 }
 
-// Helper: Detect Windows version from volume label
-static WindowsVersion detect_version_from_label(const std::string& volume_label) {
-  std::string upper_label = volume_label;
-  std::transform(upper_label.begin(), upper_label.end(), upper_label.begin(), ::toupper);
-
-  // Windows 11 patterns
-  if (upper_label.find("WIN11") != std::string::npos) return WindowsVersion::WIN11;
-  if (upper_label.find("WINDOWS 11") != std::string::npos) return WindowsVersion::WIN11;
-  if (upper_label.find("W11") != std::string::npos) return WindowsVersion::WIN11;
-  
-  // Windows 10 patterns
-  if (upper_label.find("WIN10") != std::string::npos) return WindowsVersion::WIN10;
-  if (upper_label.find("WINDOWS 10") != std::string::npos) return WindowsVersion::WIN10;
-  if (upper_label.find("W10") != std::string::npos) return WindowsVersion::WIN10;
-
-  // Recent Windows ISO naming conventions
-  // CCCOMA_X64FRE - typically Windows 10/11
-  // Check for presence of newer patterns
-  if (upper_label.find("CCCOMA") != std::string::npos) {
-    // This is a Media Creation Tool ISO, but we can't determine version without more info
-    return WindowsVersion::WIN_UNKNOWN;
-  }
-
-  return WindowsVersion::WIN_UNKNOWN;
+WindowsVersion get_windows_version(const std::string& path) {
+  WindowsIsoInfo info = get_windows_iso_info(path);
+  return info.version;
 }
 
-// Helper: Search ISO for specific file signatures
-static bool search_iso_for_bootloader(std::ifstream& file, bool& has_uefi, bool& has_legacy) {
-  has_uefi = false;
-  has_legacy = false;
-
-  // Read El Torito Boot Record at sector 17
-  file.seekg(17 * ISO_SECTOR_SIZE);
-  if (file.fail()) {
-    return false;
+std::string windows_version_to_string(WindowsVersion version) {
+  switch (version) {
+    case WindowsVersion::WIN10:
+      return "Windows 10";
+    case WindowsVersion::WIN11:
+      return "Windows 11";
+    case WindowsVersion::WIN_UNKNOWN:
+      return "Windows (unknown version)";
+    case WindowsVersion::NONE:
+    default:
+      return "Not Windows";
   }
+}
 
-  char buffer[ISO_SECTOR_SIZE];
-  file.read(buffer, ISO_SECTOR_SIZE);
-  if (file.gcount() != ISO_SECTOR_SIZE) {
+bool attribute_write(const std::string& path, const std::string& value, int* err) {
+  std::string data = value + "\n";
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    if (err) *err = errno;
     return false;
   }
 
-  // Check for El Torito signature
-  // Byte 0: Type (0 = Boot Record)
-  // Bytes 1-5: "CD001"
-  // Bytes 7-38: "EL TORITO SPECIFICATION"
-  if (buffer[0] == 0 && std::strncmp(buffer + 1, "CD001", 5) == 0) {
-    if (std::strncmp(buffer + 7, "EL TORITO SPECIFICATION", 23) == 0) {
-      log_debug("Found El Torito boot record");
-      has_legacy = true;
-    }
-  }
-
-  // For UEFI detection, we look for the EFI system partition marker
-  // by scanning the volume descriptors for EFI boot catalog entries
-  // In practice, we check for common patterns in the first few sectors
-
-  // Simple heuristic: If it's a Windows ISO and has El Torito, 
-  // modern Windows ISOs almost always have UEFI support
-  // A more thorough check would require parsing the directory structure
-
-  // Check sectors for EFI signatures
-  for (int sector = 16; sector < 20; sector++) {
-    file.seekg(sector * ISO_SECTOR_SIZE);
-    if (file.fail()) break;
-    
-    file.read(buffer, ISO_SECTOR_SIZE);
-    if (file.gcount() != ISO_SECTOR_SIZE) break;
+  ssize_t n;
+  do {
+    n = write(fd, data.data(), data.size());
+  } while (n < 0 && errno == EINTR);
+  int saved = errno;
+  close(fd);
 
-    // Look for "EFI" string in the sector (boot catalog reference)
-    std::string sector_str(buffer, ISO_SECTOR_SIZE);
-    if (sector_str.find("EFI BOOT") != std::string::npos ||
-        sector_str.find("efi") != std::string::npos ||
-        sector_str.find("BOOTX64") != std::string::npos) {
-      has_uefi = true;
-      log_debug("Found UEFI boot markers in ISO");
-      break;
-    }
-  }
-
-  // If we found El Torito and it's a recent ISO, assume UEFI is supported
-  // (This is a reasonable heuristic for modern Windows ISOs)
-  if (has_legacy && !has_uefi) {
-    // Most modern Windows ISOs are dual-boot (UEFI + Legacy)
-    // Mark UEFI as likely available
-    log_debug("Assuming UEFI support for modern Windows ISO");
-    has_uefi = true;
+  if (n != static_cast<ssize_t>(data.size())) {
+    if (err) *err = (n < 0) ? saved : EIO;
+    return false;
   }
-
   return true;
 }
 
-bool is_windows_iso(const std::string& path) {
-  std::string volume_label = read_iso_volume_label(path);
-  if (volume_label.empty()) {
+bool write_file_atomic(const std::string& path, const std::string& data, bool durable, int* err) {
+  std::string tmp = path + ".tmp." + std::to_string(getpid());
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    if (err) *err = errno;
     return false;
   }
-  return iso_contains_windows_markers(volume_label);
-}
 
-WindowsIsoInfo get_windows_iso_info(const std::string& path) {
-  WindowsIsoInfo info = {};
-  info.is_windows = false;
-  info.version = WindowsVersion::NONE;
-  info.has_uefi = false;
-  info.has_legacy = false;
-
-  // Read volume label
-  info.volume_label = read_iso_volume_label(path);
-  if (info.volume_label.empty()) {
-    log_debug("Could not read volume label from: " + path);
-    return info;
-  }
-
-  // Check if it's a Windows ISO
-  info.is_windows = iso_contains_windows_markers(info.volume_label);
-  if (!info.is_windows) {
-    return info;
+  int saved = 0;
+  size_t done = 0;
+  while (done < data.size() && !saved) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      saved = n < 0 ? errno : EIO;
+    } else {
+      done += static_cast<size_t>(n);
+    }
   }
-
-  // Detect version
-  info.version = detect_version_from_label(info.volume_label);
-
-  // Check for boot support
-  std::ifstream file(path, std::ios::binary);
-  if (file) {
-    search_iso_for_bootloader(file, info.has_uefi, info.has_legacy);
+  if (!saved && durable && fsync(fd) != 0) saved = errno;
+  if (close(fd) != 0 && !saved) saved = errno;
+  if (!saved && rename(tmp.c_str(), path.c_str()) != 0) saved = errno;
+  if (saved) {
+    unlink(tmp.c_str());
+    if (err) *err = saved;
+    return false;
   }
-
-  log_debug("Windows ISO detected: " + info.volume_label + 
-            ", version: " + windows_version_to_string(info.version) +
-            ", UEFI: " + (info.has_uefi ? "yes" : "no") +
-            ", Legacy: " + (info.has_legacy ? "yes" : "no"));
-
-  return info;
+  return true;
 }
 
-WindowsVersion get_windows_version(const std::string& path) {
-  WindowsIsoInfo info = get_windows_iso_info(path);
-  return info.version;
-}
+bool attribute_read(const std::string& path, std::string& value) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+
+  value.clear();
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      close(fd);
+      return false;
+    }
+    value.append(buffer, static_cast<size_t>(n));
+  }
+  close(fd);
 
-std::string windows_version_to_string(WindowsVersion version) {
-  switch (version) {
-    case WindowsVersion::WIN10:
-      return "Windows 10";
-    case WindowsVersion::WIN11:
-      return "Windows 11";
-    case WindowsVersion::WIN_UNKNOWN:
-      return "Windows (unknown version)";
-    case WindowsVersion::NONE:
-    default:
-      return "Not Windows";
+  while (!value.empty() && (value.back() == '\n' || value.back() == '\0')) {
+    value.pop_back();
   }
+  return true;
 }
 
 bool sysfs_write(const std::string& path, const std::string& content) {
-  log_debug("Write: " + content + " -> " + path);
-  std::ofstream sysfsFile(path);
-  if (sysfsFile.is_open()) {
-      sysfsFile << content << std::endl;
-      return true;
-  } else {
-      log_error("Failed to open " + path + " for writing.");
-      return false;
+  LOG_DEBUG("Write: " + content + " -> " + path);
+  int err = 0;
+  if (!attribute_write(path, content, &err)) {
+    log_error("Failed to write " + path + ": " + std::strerror(err));
+    return false;
   }
+  return true;
 }
 
 std::string sysfs_read(const std::string& path) {
@@ -322,10 +186,33 @@ std::string sysfs_read(const std::string& path) {
   std::ifstream sysfsFile(path);
 
   if (!sysfsFile.is_open()) {
-    log_debug("Cannot open for reading: " + path);
+    LOG_DEBUG("Cannot open for reading: " + path);
     return "";
   }
   sysfsFile >> value;
-  log_debug("Read: " + value + " <- " + path);
+  LOG_DEBUG("Read: " + value + " <- " + path);
   return value;
-}
\ No newline at end of file
+}
+
+std::string json_escape(const std::string& s) {
+  std::string out;
+  out.reserve(s.size());
+  for (char c : s) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out += c;
+        }
+    }
+  }
+  return out;
+}
@@ -0,0 +1,427 @@
+#include "verify.h"
+#include "digest.h"
+#include "logger.h"
+#include "trace.h"
+#include "util.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+    const char* const CACHE_FILE = "verify.cache";
+    const char* const CACHE_HEADER = "isodrive-verify-cache 1";
+
+    // Hashing granularity, and how far the reader thread may run ahead
+    constexpr uint64_t HASH_CHUNK = 4ull << 20;
+    constexpr uint64_t READ_AHEAD_WINDOW = 64ull << 20;
+
+    // Volume descriptors start at sector 16; give up after a few
+    constexpr uint64_t ISO_SECTOR = 2048;
+    constexpr int MAX_VOLUME_DESCRIPTORS = 16;
+
+    // implantisomd5 excludes this many trailing sectors unless told otherwise
+    constexpr uint64_t DEFAULT_SKIP_SECTORS = 15;
+
+    struct CacheEntry {
+        ImageKey key;
+        std::string digest;
+        bool passed;
+    };
+
+    // Images verified in parallel update the cache one at a time
+    std::mutex g_cache_mutex;
+}
+
+// Helper: Check for a digest of the given length in hex
+static bool is_hex_digest(const std::string& s, size_t len) {
+  return s.size() == len && std::all_of(s.begin(), s.end(), [](char c) { return std::isxdigit(static_cast<unsigned char>(c)); });
+}
+
+// Helper: Lowercase a string
+static std::string lowercase(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return s;
+}
+
+// Helper: Parse a GNU ("HASH  name", "HASH *name", "HASH") or BSD
+// ("SHA256 (name) = HASH") checksum line
+static bool parse_checksum_line(const std::string& line, std::string& digest, std::string& name) {
+  if (line.compare(0, 8, "SHA256 (") == 0) {
+    size_t close = line.rfind(") = ");
+    if (close == std::string::npos) return false;
+    name = line.substr(8, close - 8);
+    digest = line.substr(close + 4);
+  } else {
+    size_t space = line.find(' ');
+    digest = line.substr(0, space);
+    name = space == std::string::npos ? "" : line.substr(space + 1);
+    if (!name.empty() && (name[0] == ' ' || name[0] == '*')) name.erase(0, 1);
+  }
+  while (!digest.empty() && std::isspace(static_cast<unsigned char>(digest.back()))) digest.pop_back();
+  while (!name.empty() && std::isspace(static_cast<unsigned char>(name.back()))) name.pop_back();
+  digest = lowercase(digest);
+  return is_hex_digest(digest, 64);
+}
+
+// Helper: Find the digest listed for an image in a checksum file
+static bool read_checksum_file(const std::string& file, const std::string& image_name, bool single_image,
+                               std::string& digest) {
+  std::ifstream in(file);
+  if (!in) return false;
+  std::string line, found, d, name;
+  int listed = 0;
+  while (std::getline(in, line)) {
+    if (!parse_checksum_line(line, d, name)) continue;
+    listed++;
+    if (fs::path(name).filename().string() == image_name) {
+      digest = d;
+      return true;
+    }
+    if (found.empty()) found = d;
+  }
+  // A per-image sidecar may list its only digest under another name
+  if (single_image && listed == 1) {
+    digest = found;
+    return true;
+  }
+  return false;
+}
+
+bool find_sidecar_checksum(const std::string& path, ExpectedChecksum& expected) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  std::string name = fs::path(path).filename().string();
+  std::string dir = fs::path(path).parent_path().string();
+  if (dir.empty()) dir = ".";
+
+  const std::pair<std::string, bool> candidates[] = {
+    {path + ".sha256", true},
+    {path + ".sha256sum", true},
+    {dir + "/SHA256SUMS", false},
+  };
+  for (const auto& candidate : candidates) {
+    std::string digest;
+    if (read_checksum_file(candidate.first, name, candidate.second, digest)) {
+      expected = ExpectedChecksum();
+      expected.algorithm = "sha256";
+      expected.digest = digest;
+      expected.origin = candidate.first;
+      expected.length = static_cast<uint64_t>(st.st_size);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool read_implanted_md5(const std::string& path, ExpectedChecksum& expected) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  bool found = false;
+  uint8_t vd[ISO_SECTOR];
+  for (int i = 0; i < MAX_VOLUME_DESCRIPTORS && !found; i++) {
+    uint64_t offset = (16 + i) * ISO_SECTOR;
+    if (pread(fd, vd, sizeof(vd), static_cast<off_t>(offset)) != static_cast<ssize_t>(sizeof(vd)) ||
+        std::memcmp(vd + 1, "CD001", 5) != 0 || vd[0] == 0xff) {
+      break;
+    }
+    if (vd[0] != 1) continue;
+
+    // Application-use area: "ISO MD5SUM = <hex>;SKIPSECTORS = <n>;..."
+    std::string appdata(reinterpret_cast<const char*>(vd + ISO_APPLICATION_USE_OFFSET), ISO_APPLICATION_USE_SIZE);
+    size_t md5 = appdata.find("ISO MD5SUM = ");
+    if (md5 == std::string::npos) break;
+    std::string digest = lowercase(appdata.substr(md5 + 13, 32));
+    if (!is_hex_digest(digest, 32)) break;
+
+    uint64_t skip = DEFAULT_SKIP_SECTORS;
+    size_t skip_at = appdata.find("SKIPSECTORS = ");
+    if (skip_at != std::string::npos) {
+      skip = std::strtoull(appdata.c_str() + skip_at + 14, nullptr, 10);
+    }
+
+    // Volume space size (both-endian, little-endian half first)
+    uint64_t blocks = static_cast<uint64_t>(vd[80]) | (static_cast<uint64_t>(vd[81]) << 8) |
+                      (static_cast<uint64_t>(vd[82]) << 16) | (static_cast<uint64_t>(vd[83]) << 24);
+    if (blocks <= skip) break;
+
+    expected = ExpectedChecksum();
+    expected.algorithm = "md5";
+    expected.digest = digest;
+    expected.origin = "implantisomd5";
+    expected.length = (blocks - skip) * ISO_SECTOR;
+    expected.blank_offset = offset + ISO_APPLICATION_USE_OFFSET;
+    expected.blank_length = ISO_APPLICATION_USE_SIZE;
+    found = true;
+  }
+  close(fd);
+  return found;
+}
+
+bool find_expected_checksum(const std::string& path, ExpectedChecksum& expected) {
+  return find_sidecar_checksum(path, expected) || read_implanted_md5(path, expected);
+}
+
+// Helper: Hash a mapped image, blanking the requested range, while a
+// second thread faults in the pages ahead
+template <typename Hasher>
+static std::string hash_mapped(const uint8_t* map, const ExpectedChecksum& expected) {
+  Hasher hasher;
+  const uint64_t length = expected.length;
+  const uint64_t blank_end = expected.blank_offset + expected.blank_length;
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+  std::mutex mutex;
+  std::condition_variable progress;
+  uint64_t hashed = 0;
+  bool stop = false;
+
+  std::thread reader([&]() {
+    for (uint64_t off = 0; off < length; off += HASH_CHUNK) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        progress.wait(lock, [&]() { return stop || off < hashed + READ_AHEAD_WINDOW; });
+        if (stop) return;
+      }
+      uint64_t n = std::min(HASH_CHUNK, length - off);
+      madvise(const_cast<uint8_t*>(map + off), n, MADV_WILLNEED);
+      volatile uint8_t sink = 0;
+      for (uint64_t p = off; p < off + n; p += page) {
+        sink = sink ^ map[p];
+      }
+    }
+  });
+
+  static const std::string spaces(ISO_APPLICATION_USE_SIZE, ' ');
+  for (uint64_t off = 0; off < length; off += HASH_CHUNK) {
+    uint64_t end = std::min(off + HASH_CHUNK, length);
+    uint64_t pos = off;
+    if (expected.blank_length > 0 && expected.blank_offset < end && blank_end > off) {
+      uint64_t from = std::max(off, expected.blank_offset);
+      uint64_t to = std::min(end, blank_end);
+      hasher.update(map + pos, from - pos);
+      for (uint64_t b = from; b < to; b += spaces.size()) {
+        hasher.update(spaces.data(), std::min<uint64_t>(spaces.size(), to - b));
+      }
+      pos = to;
+    }
+    hasher.update(map + pos, end - pos);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      hashed = end;
+    }
+    progress.notify_one();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  progress.notify_one();
+  reader.join();
+  return hasher.hex_digest();
+}
+
+bool hash_image(const std::string& path, const ExpectedChecksum& expected, std::string& digest) {
+  TraceSpan span("hash_image");
+  span.detail(path);
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG_DEBUG("Cannot open " + path + ": " + std::string(std::strerror(errno)));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < expected.length) {
+    LOG_DEBUG(path + " is shorter than its checksum covers");
+    close(fd);
+    return false;
+  }
+
+  const uint8_t* map = nullptr;
+  if (expected.length > 0) {
+    void* m = mmap(nullptr, expected.length, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+      LOG_DEBUG("Cannot map " + path + ": " + std::string(std::strerror(errno)));
+      close(fd);
+      return false;
+    }
+    map = static_cast<const uint8_t*>(m);
+    madvise(const_cast<uint8_t*>(map), expected.length, MADV_SEQUENTIAL);
+  }
+
+  static const uint8_t empty[1] = {0};
+  digest = expected.algorithm == "md5" ? hash_mapped<Md5>(map ? map : empty, expected)
+                                       : hash_mapped<Sha256>(map ? map : empty, expected);
+  if (map) {
+    munmap(const_cast<uint8_t*>(map), expected.length);
+    // Hashing faulted in the whole image; leaving it cached would make
+    // every page look hot when the image is next unmounted
+    posix_fadvise(fd, 0, static_cast<off_t>(expected.length), POSIX_FADV_DONTNEED);
+  }
+  close(fd);
+  return true;
+}
+
+bool verify_image(const std::string& path, const ExpectedChecksum& expected, VerifyResult& result) {
+  result = VerifyResult();
+  ImageKey key;
+  bool have_key = image_key(path, key);
+  if (have_key && verify_cache_lookup(key, expected.digest, result.passed)) {
+    result.cached = true;
+    return true;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  if (!hash_image(path, expected, result.actual)) {
+    return false;
+  }
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  result.bytes = expected.length;
+  result.passed = result.actual == expected.digest;
+  if (have_key) {
+    verify_cache_store(key, expected.digest, result.passed);
+  }
+  return true;
+}
+
+bool verify_images(const std::vector<std::string>& paths) {
+  TRACE_SPAN("verify_images");
+  std::vector<ExpectedChecksum> expected(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (!find_expected_checksum(paths[i], expected[i])) {
+      log_error("No checksum found for " + paths[i] + " (expected " + paths[i] +
+                ".sha256, a SHA256SUMS entry or an implantisomd5 checksum)");
+      return false;
+    }
+  }
+
+  // One pipeline per image; results are logged from this thread
+  std::vector<VerifyResult> results(paths.size());
+  std::vector<char> readable(paths.size(), 0);
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < paths.size(); i++) {
+    workers.emplace_back([&, i]() { readable[i] = verify_image(paths[i], expected[i], results[i]); });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < paths.size(); i++) {
+    const VerifyResult& r = results[i];
+    if (!readable[i]) {
+      log_error("Cannot verify " + paths[i] + ": image unreadable or shorter than its checksum covers");
+      ok = false;
+    } else if (r.cached) {
+      if (r.passed) log_info("Verified " + paths[i] + " (cached verdict)");
+      else log_error("Checksum mismatch for " + paths[i] + " (cached verdict)");
+      ok = ok && r.passed;
+    } else if (r.passed) {
+      double mib = static_cast<double>(r.bytes) / (1 << 20);
+      char line[160];
+      snprintf(line, sizeof(line), ": %.0f MiB in %.2f s (%.0f MiB/s, %s%s%s)", mib, r.seconds,
+               r.seconds > 0 ? mib / r.seconds : 0.0, expected[i].algorithm.c_str(),
+               expected[i].algorithm == "sha256" ? " " : "",
+               expected[i].algorithm == "sha256" ? Sha256::implementation() : "");
+      log_info("Verified " + paths[i] + " against " + expected[i].origin + line);
+    } else {
+      log_error("Checksum mismatch for " + paths[i] + " (" + expected[i].origin + "): expected " +
+                expected[i].digest + ", got " + r.actual);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// Helper: Read every cache entry, oldest first
+static std::vector<CacheEntry> load_cache() {
+  std::vector<CacheEntry> entries;
+  std::ifstream file((fs::path(probe_cache_dir()) / CACHE_FILE).string());
+  std::string line;
+  if (!std::getline(file, line) || line != CACHE_HEADER) {
+    return entries;
+  }
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    CacheEntry entry;
+    int passed;
+    if (fields >> entry.key.dev >> entry.key.ino >> entry.key.size >> entry.key.mtime_sec >>
+        entry.key.mtime_nsec >> entry.digest >> passed) {
+      entry.passed = passed != 0;
+      entries.push_back(entry);
+    }
+  }
+  return entries;
+}
+
+// Helper: Write every entry to the cache file
+static bool save_cache(const std::vector<CacheEntry>& entries) {
+  std::string dir = probe_cache_dir();
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    LOG_DEBUG("Cannot create verify cache directory " + dir + ": " + ec.message());
+    return false;
+  }
+
+  std::ostringstream out;
+  out << CACHE_HEADER << "\n";
+  for (const CacheEntry& entry : entries) {
+    out << entry.key.dev << ' ' << entry.key.ino << ' ' << entry.key.size << ' ' << entry.key.mtime_sec << ' '
+        << entry.key.mtime_nsec << ' ' << entry.digest << ' ' << entry.passed << "\n";
+  }
+  std::string data = out.str();
+
+  std::string path = (fs::path(dir) / CACHE_FILE).string();
+  int err = 0;
+  if (!write_file_atomic(path, data, true, &err)) {
+    LOG_DEBUG("Failed to update verify cache " + path + ": " + std::strerror(err));
+    return false;
+  }
+  return true;
+}
+
+bool verify_cache_lookup(const ImageKey& key, const std::string& digest, bool& passed) {
+  std::lock_guard<std::mutex> lock(g_cache_mutex);
+  for (const CacheEntry& entry : load_cache()) {
+    if (entry.key == key && entry.digest == digest) {
+      passed = entry.passed;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool verify_cache_store(const ImageKey& key, const std::string& digest, bool passed) {
+  std::lock_guard<std::mutex> lock(g_cache_mutex);
+  std::vector<CacheEntry> entries = load_cache();
+  entries.erase(std::remove_if(entries.begin(), entries.end(),
+                               [&](const CacheEntry& entry) { return entry.key == key; }),
+                entries.end());
+  entries.push_back({key, digest, passed});
+  if (entries.size() > VERIFY_CACHE_MAX_ENTRIES) {
+    entries.erase(entries.begin(), entries.end() - VERIFY_CACHE_MAX_ENTRIES);
+  }
+  return save_cache(entries);
+}
@@ -0,0 +1,176 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/bootloader.h"
+#include "../src/include/imageprobe.h"
+#include "../src/include/logger.h"
+#include "../src/include/mountrequest.h"
+#include "../src/include/patternscan.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static const std::string IMAGE_PATH = "/tmp/isodrive_test_bootloader.iso";
+
+// Helper: Deterministic filler bytes
+static std::string noise(size_t len, uint32_t seed) {
+    std::string data(len, '\0');
+    for (char& c : data) {
+        seed = seed * 1103515245 + 12345;
+        c = static_cast<char>(seed >> 16);
+    }
+    return data;
+}
+
+// Helper: Tags of the patterns found by a byte-by-byte search
+static uint32_t naive_scan(const std::vector<ScanPattern>& patterns, const std::string& data) {
+    uint32_t tags = 0;
+    for (const ScanPattern& p : patterns) {
+        if (data.find(p.text) != std::string::npos) tags |= p.tag;
+    }
+    return tags;
+}
+
+// Helper: Scan with the vector code and with the portable code
+static bool scan_both(const PatternScanner& scanner, const std::string& data, uint32_t& vector, uint32_t& portable) {
+    vector = scanner.scan(data.data(), data.size());
+    pattern_scan_force_portable(true);
+    portable = scanner.scan(data.data(), data.size());
+    pattern_scan_force_portable(false);
+    return vector == portable;
+}
+
+// Helper: ISO with an El Torito catalog at sector 20 listing one BIOS image at sector 30
+static std::string catalog_image(const std::string& boot_image) {
+    std::string data(256 * 2048, '\0');
+    size_t pvd = 16 * 2048;
+    data[pvd] = 1;
+    std::memcpy(&data[pvd + 1], "CD001", 5);
+    std::memcpy(&data[pvd + 40], "LIVE_CD                         ", 32);
+
+    size_t record = 17 * 2048;
+    std::memcpy(&data[record + 1], "CD001", 5);
+    std::memcpy(&data[record + 7], "EL TORITO SPECIFICATION", 23);
+    put32(data, record + 0x47, 20);
+
+    size_t catalog = 20 * 2048;
+    data[catalog] = 0x01;
+    data[catalog + 30] = 0x55;
+    data[catalog + 31] = static_cast<char>(0xaa);
+    uint16_t sum = 0;
+    for (size_t i = 0; i < 32; i += 2) {
+        sum = static_cast<uint16_t>(sum + (static_cast<unsigned char>(data[catalog + i]) |
+                                           (static_cast<unsigned char>(data[catalog + i + 1]) << 8)));
+    }
+    put16(data, catalog + 28, static_cast<uint16_t>(0x10000 - sum));
+    data[catalog + 32] = static_cast<char>(0x88);
+    put16(data, catalog + 32 + 6, 4);
+    put32(data, catalog + 32 + 8, 30);
+
+    data.replace(30 * 2048, boot_image.size(), boot_image);
+    return data;
+}
+
+// Helper: Hybrid MBR with one partition and the given boot code
+static void hybrid_mbr(std::string& data, const std::string& boot_code) {
+    data.replace(0, boot_code.size(), boot_code);
+    data[446] = static_cast<char>(0x80);
+    data[446 + 4] = 0x17;
+    put32(data, 446 + 12, 1024);
+    data[510] = 0x55;
+    data[511] = static_cast<char>(0xaa);
+}
+
+TEST(test_scanner_matches_naive_search) {
+    std::vector<ScanPattern> patterns = {
+        {"GRUB", 1}, {"ISOLINUX", 2}, {"ISO", 4}, {"limine", 8}, {"zz", 16},
+    };
+    PatternScanner scanner(patterns);
+
+    // Plant patterns at block edges, across them and at the very end
+    const size_t offsets[] = {0, 14, 15, 16, 31, 32, 33, 1000};
+    for (size_t offset : offsets) {
+        for (const ScanPattern& p : patterns) {
+            std::string data = noise(1100, static_cast<uint32_t>(offset * 7 + p.tag));
+            data.replace(offset, p.text.size(), p.text);
+            uint32_t vector, portable;
+            ASSERT_TRUE(scan_both(scanner, data, vector, portable));
+            ASSERT_EQ(naive_scan(patterns, data), vector);
+            ASSERT_TRUE(vector & p.tag);
+
+            std::string tail = data.substr(0, 1100 - p.text.size()) + p.text;
+            ASSERT_TRUE(scan_both(scanner, tail, vector, portable));
+            ASSERT_EQ(naive_scan(patterns, tail), vector);
+        }
+    }
+
+    // A prefix cut off by the end of the buffer is not a match
+    std::string cut = std::string(40, 'x') + "ISOLINU";
+    uint32_t vector, portable;
+    ASSERT_TRUE(scan_both(scanner, cut, vector, portable));
+    ASSERT_EQ(4u, vector);
+    ASSERT_EQ(0u, scanner.scan("G", 1));
+    return true;
+}
+
+TEST(test_scanner_many_prefixes) {
+    // More distinct prefixes than the vector code compares falls back to portable
+    std::vector<ScanPattern> patterns;
+    for (int i = 0; i < 20; i++) {
+        patterns.push_back({std::string(1, static_cast<char>('a' + i)) + "#" + std::to_string(i),
+                            1u << i});
+    }
+    PatternScanner scanner(patterns);
+    std::string data = std::string(100, '.') + "c#2" + std::string(100, '.') + "t#19";
+    ASSERT_EQ((1u << 2) | (1u << 19), scanner.scan(data.data(), data.size()));
+    return true;
+}
+
+TEST(test_fingerprint_regions) {
+    std::string data = catalog_image(noise(4096, 1) + "ISOLINUX 6.04" + noise(100, 2));
+    hybrid_mbr(data, std::string("\xeb\x63\x90", 3) + std::string("GRUB \0Geom\0Hard Disk", 20));
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+
+    ImageProbeResult result = probe_image(IMAGE_PATH);
+    ASSERT_EQ(BOOTLOADER_GRUB, result.bootloaders.system_area);
+    ASSERT_EQ(BOOTLOADER_ISOLINUX, result.bootloaders.boot_images);
+    ASSERT_EQ(std::string("grub,isolinux"),
+              bootloader_names(result.bootloaders.system_area | result.bootloaders.boot_images));
+    ASSERT_EQ(std::string(""), bootloader_names(0));
+    fs::remove(IMAGE_PATH);
+    return true;
+}
+
+TEST(test_mode_from_fingerprint) {
+    MountRequest request;
+    ImageRequest image;
+    image.path = IMAGE_PATH;
+    request.images.push_back(image);
+    std::vector<LunMedia> media;
+    WindowsMountOptions win_opts;
+
+    // Partitions, but only the El Torito image carries a loader
+    std::string data = catalog_image("ISOLINUX");
+    hybrid_mbr(data, "");
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+    ASSERT_TRUE(resolve_images(request, probe_image, media, win_opts));
+    ASSERT_TRUE(media[0].cdrom);
+
+    // isohybrid boot code boots the same image as a disk
+    hybrid_mbr(data, "isolinux.bin missing or corrupt.");
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+    ASSERT_TRUE(resolve_images(request, probe_image, media, win_opts));
+    ASSERT_TRUE(!media[0].cdrom);
+    fs::remove(IMAGE_PATH);
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
@@ -0,0 +1,148 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/bootwarm.h"
+#include "../src/include/logger.h"
+#include "../src/include/partitiontable.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Helper: ISO with a BIOS no-emulation image and an EFI image in its boot catalog
+static std::string el_torito_image() {
+    std::string data(4 << 20, '\0');
+    size_t record = 17 * 2048;
+    std::memcpy(&data[record + 1], "CD001", 5);
+    std::memcpy(&data[record + 7], "EL TORITO SPECIFICATION", 23);
+    put32(data, record + 0x47, 20);
+
+    size_t catalog = 20 * 2048;
+    data[catalog] = 0x01;
+    data[catalog + 30] = 0x55;
+    data[catalog + 31] = static_cast<char>(0xaa);
+    put16(data, catalog + 28, 0x10000 - 0xaa56);
+    data[catalog + 32] = static_cast<char>(0x88);
+    put16(data, catalog + 32 + 6, 4);
+    put32(data, catalog + 32 + 8, 30);
+    data[catalog + 64] = static_cast<char>(0x91);
+    data[catalog + 65] = static_cast<char>(0xef);
+    put16(data, catalog + 66, 1);
+    data[catalog + 96] = static_cast<char>(0x88);
+    put32(data, catalog + 96 + 8, 40);
+
+    // FAT boot sector of the EFI image: 2880 sectors of 512 bytes
+    size_t bpb = 40 * 2048;
+    put16(data, bpb + 11, 512);
+    put16(data, bpb + 19, 2880);
+    data[bpb + 510] = 0x55;
+    data[bpb + 511] = static_cast<char>(0xaa);
+    return data;
+}
+
+// Helper: Disk image with a protective MBR and a GPT holding an ESP and a data partition
+static std::string gpt_image() {
+    std::string data(24 << 20, '\0');
+    data[446 + 4] = static_cast<char>(0xee);
+    put32(data, 446 + 8, 1);
+    put32(data, 446 + 12, 0xffffffff);
+    data[510] = 0x55;
+    data[511] = static_cast<char>(0xaa);
+
+    std::memcpy(&data[512], "EFI PART", 8);
+    put64(data, 512 + 72, 2);
+    put32(data, 512 + 80, 4);
+    put32(data, 512 + 84, 128);
+
+    static const unsigned char esp[16] = {
+        0x28, 0x73, 0x2a, 0xc1, 0x1f, 0xf8, 0xd2, 0x11,
+        0xba, 0x4b, 0x00, 0xa0, 0xc9, 0x3e, 0xc9, 0x3b,
+    };
+    std::memcpy(&data[1024], esp, 16);
+    put64(data, 1024 + 32, 2048);
+    put64(data, 1024 + 40, 4095);
+    data[1024 + 128] = 0x42;
+    put64(data, 1024 + 128 + 32, 4096);
+    put64(data, 1024 + 128 + 40, 40959);
+
+    put32(data, 512 + 12, 92);
+    put64(data, 512 + 24, 1);
+    put64(data, 512 + 32, data.size() / 512 - 1);
+    put32(data, 512 + 88, crc32_update(0, &data[1024], 4 * 128));
+    put32(data, 512 + 16, crc32_update(0, &data[512], 92));
+    return data;
+}
+
+TEST(test_el_torito_regions) {
+    TestDir dir("bootwarm_eltorito");
+    std::string image = dir.file("boot.iso", el_torito_image());
+
+    std::vector<BootRegion> regions;
+    ASSERT_TRUE(find_boot_regions(image, regions));
+    ASSERT_EQ(static_cast<size_t>(4), regions.size());
+    ASSERT_EQ(static_cast<uint64_t>(0), regions[0].offset);
+    ASSERT_EQ(static_cast<uint64_t>(20 * 2048), regions[1].offset);
+    ASSERT_EQ(static_cast<uint64_t>(2048), regions[1].length);
+    ASSERT_EQ(std::string("boot catalog"), regions[1].what);
+
+    // The no-emulation loader is read beyond its four load sectors
+    ASSERT_EQ(static_cast<uint64_t>(30 * 2048), regions[2].offset);
+    ASSERT_EQ(static_cast<uint64_t>(64 << 10), regions[2].length);
+
+    // The EFI image size comes from its FAT boot sector
+    ASSERT_EQ(std::string("EFI boot image"), regions[3].what);
+    ASSERT_EQ(static_cast<uint64_t>(40 * 2048), regions[3].offset);
+    ASSERT_EQ(static_cast<uint64_t>(2880 * 512), regions[3].length);
+
+    // The budget keeps the earlier regions and cuts the rest
+    ASSERT_TRUE(find_boot_regions(image, regions, 50000));
+    ASSERT_EQ(static_cast<size_t>(3), regions.size());
+    ASSERT_EQ(static_cast<uint64_t>(50000 - 40960 - 2048), regions[2].length);
+    return true;
+}
+
+TEST(test_gpt_regions) {
+    TestDir dir("bootwarm_gpt");
+    std::string image = dir.file("disk.img", gpt_image());
+
+    std::vector<BootRegion> regions;
+    ASSERT_TRUE(find_boot_regions(image, regions));
+    ASSERT_EQ(static_cast<size_t>(3), regions.size());
+    ASSERT_EQ(std::string("EFI system partition"), regions[1].what);
+    ASSERT_EQ(static_cast<uint64_t>(1 << 20), regions[1].offset);
+    ASSERT_EQ(static_cast<uint64_t>(1 << 20), regions[1].length);
+
+    // Only the start of other partitions is warmed
+    ASSERT_EQ(std::string("partition start"), regions[2].what);
+    ASSERT_EQ(static_cast<uint64_t>(2 << 20), regions[2].offset);
+    ASSERT_EQ(BOOT_WARM_PARTITION_HEAD, regions[2].length);
+
+    ASSERT_TRUE(!find_boot_regions(dir.path + "/missing.img", regions));
+    return true;
+}
+
+TEST(test_boot_warmer) {
+    TestDir dir("bootwarm_warmer");
+    std::string iso = dir.file("boot.iso", el_torito_image());
+    std::string disk = dir.file("disk.img", gpt_image());
+
+    // Freshly written images are already resident
+    BootWarmer warmer({iso, disk, dir.path + "/missing.img"});
+    uint64_t expected = 40960 + 2048 + (64 << 10) + 2880 * 512 + 40960 + (2 << 20);
+    ASSERT_EQ(expected, warmer.bytes());
+    ASSERT_TRUE(warmer.wait(10000));
+
+    BootWarmer none({});
+    ASSERT_EQ(static_cast<uint64_t>(0), none.bytes());
+    ASSERT_TRUE(none.wait(0));
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
@@ -0,0 +1,189 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/clone.h"
+#include "../src/include/logger.h"
+#include "../src/include/mountrequest.h"
+#include "../src/include/probecache.h"
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Helper: Test directory that can also hold sparse files
+class CloneDir : public TestDir {
+public:
+    explicit CloneDir(const std::string& name) : TestDir("clone_" + name) {}
+
+    // 16 MiB file with data only in its first and last 64 KiB
+    std::string sparse(const std::string& name) {
+        std::string full = path + "/" + name;
+        int fd = open(full.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        std::string head(64 << 10, 'h');
+        std::string tail(64 << 10, 't');
+        pwrite(fd, head.data(), head.size(), 0);
+        pwrite(fd, tail.data(), tail.size(), (16 << 20) - static_cast<off_t>(tail.size()));
+        close(fd);
+        return full;
+    }
+};
+
+// Helper: Read a whole file
+static std::string slurp(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+TEST(test_clone_file_keeps_holes) {
+    CloneDir dir("sparse");
+    std::string source = dir.sparse("disk.img");
+    std::string target = dir.path + "/copy.img";
+
+    CloneMethod method;
+    ASSERT_TRUE(clone_file(source, target, method));
+    ASSERT_TRUE(method == CloneMethod::REFLINK || method == CloneMethod::COPY);
+    ASSERT_TRUE(slurp(target) == slurp(source));
+
+    // A copy allocates no more than the source (a reflink allocates nothing new)
+    struct stat src_st, dst_st;
+    ASSERT_TRUE(stat(source.c_str(), &src_st) == 0 && stat(target.c_str(), &dst_st) == 0);
+    ASSERT_EQ(src_st.st_size, dst_st.st_size);
+    ASSERT_TRUE(dst_st.st_blocks <= src_st.st_blocks + 8);
+
+    ASSERT_TRUE(!clone_file(dir.path + "/missing.img", target, method));
+    return true;
+}
+
+TEST(test_clone_image_leaves_source_untouched) {
+    CloneDir dir("image");
+    std::string source = dir.file("golden.img", std::string(100000, 'g'));
+
+    std::string first, second;
+    CloneMethod method;
+    ASSERT_TRUE(clone_image(source, first, method));
+    ASSERT_TRUE(method != CloneMethod::POOL);
+    ASSERT_EQ(dir.path + "/.isodrive-clones", fs::path(first).parent_path().string());
+    ASSERT_TRUE(is_clone(first));
+    ASSERT_TRUE(!is_clone(source));
+
+    {
+        std::fstream f(first, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(10);
+        f << "written by the host";
+    }
+    ASSERT_TRUE(slurp(source) == std::string(100000, 'g'));
+
+    // Every mount gets a fresh clone
+    ASSERT_TRUE(clone_image(source, second, method));
+    ASSERT_TRUE(first != second);
+    ASSERT_TRUE(slurp(second) == std::string(100000, 'g'));
+
+    ASSERT_TRUE(clone_discard(first));
+    ASSERT_TRUE(!fs::exists(first));
+    ASSERT_TRUE(!clone_discard(source));
+    ASSERT_TRUE(fs::exists(source));
+    return true;
+}
+
+TEST(test_clone_pool) {
+    CloneDir dir("pool");
+    std::string source = dir.file("golden.img", std::string(4096, 'p'));
+    std::string pool = dir.path + "/.isodrive-clones/pool";
+
+    ASSERT_TRUE(clone_pool_fill(source));
+    ASSERT_TRUE(clone_pool_fill(source));
+    ASSERT_EQ(1, static_cast<int>(std::distance(fs::directory_iterator(pool), fs::directory_iterator())));
+
+    std::string cloned;
+    CloneMethod method;
+    ASSERT_TRUE(clone_image(source, cloned, method));
+    ASSERT_TRUE(method == CloneMethod::POOL);
+    ASSERT_TRUE(slurp(cloned) == std::string(4096, 'p'));
+    ASSERT_TRUE(fs::is_empty(pool));
+
+    // A modified source does not get the old version's pooled clone
+    ASSERT_TRUE(clone_pool_fill(source));
+    dir.file("golden.img", std::string(4096, 'q'));
+    ASSERT_TRUE(clone_image(source, cloned, method));
+    ASSERT_TRUE(method != CloneMethod::POOL);
+    ASSERT_TRUE(slurp(cloned) == std::string(4096, 'q'));
+
+    // Refilling for the new version drops the old one, and the pool is bounded
+    ASSERT_TRUE(clone_pool_fill(source));
+    for (size_t i = 0; i < CLONE_POOL_MAX_ENTRIES + 2; i++) {
+        ASSERT_TRUE(clone_pool_fill(dir.file("other" + std::to_string(i) + ".img", "x")));
+    }
+    ASSERT_EQ(static_cast<int>(CLONE_POOL_MAX_ENTRIES),
+              static_cast<int>(std::distance(fs::directory_iterator(pool), fs::directory_iterator())));
+    return true;
+}
+
+TEST(test_clone_pool_keeps_partial_clones) {
+    CloneDir dir("partial");
+    std::string source = dir.file("golden.img", std::string(4096, 'p'));
+    std::string pool = dir.path + "/.isodrive-clones/pool";
+    ASSERT_TRUE(clone_pool_fill(source));
+    std::string pooled = fs::directory_iterator(pool)->path().string();
+
+    // Another process is refilling for a newer version of the same source
+    std::string partial = pooled + ".tmp.1";
+    std::ofstream(partial) << "partial";
+    dir.file("golden.img", std::string(4096, 'q'));
+    ASSERT_TRUE(clone_pool_fill(source));
+    ASSERT_TRUE(fs::exists(partial));
+    ASSERT_TRUE(!fs::exists(pooled));
+    ASSERT_EQ(2, static_cast<int>(std::distance(fs::directory_iterator(pool), fs::directory_iterator())));
+    return true;
+}
+
+TEST(test_clone_pool_reflink_only) {
+    CloneDir dir("reflink_only");
+    std::string source = dir.file("golden.img", std::string(4096, 'p'));
+    std::string target = dir.path + "/reflinked.img";
+
+    // Without copying, a file is only cloned where a reflink works
+    CloneMethod method;
+    bool cloned = clone_file(source, target, method, false);
+    ASSERT_TRUE(cloned ? method == CloneMethod::REFLINK : !fs::exists(target));
+
+    std::string pool = dir.path + "/.isodrive-clones/pool";
+    ASSERT_EQ(cloned, clone_pool_fill(source, false));
+    ASSERT_EQ(cloned, fs::exists(pool) && !fs::is_empty(pool));
+    ASSERT_TRUE(clone_pool_fill(source, true));
+    return true;
+}
+
+TEST(test_failed_request_discards_clones) {
+    CloneDir dir("failed");
+    MountRequest request;
+    ImageRequest image;
+    image.path = dir.file("golden.img", std::string(4096, 'g'));
+    image.ro = false;
+    image.clone = true;
+    image.force_hdd = true;
+    request.images.push_back(image);
+    image.path = dir.path + "/missing.img";
+    request.images.push_back(image);
+
+    std::vector<LunMedia> media;
+    WindowsMountOptions win_opts;
+    ASSERT_TRUE(!resolve_images(request, probe_image, media, win_opts));
+    ASSERT_TRUE(media.empty());
+    for (const auto& entry : fs::directory_iterator(dir.path + "/.isodrive-clones")) {
+        ASSERT_TRUE(entry.is_directory());
+    }
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
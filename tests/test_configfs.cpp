@@ -1,5 +1,10 @@
 #include "simple_test.h"
 #include "mock_sysfs.h"
+#include "test_fixtures.h"
+#include "../src/include/configfsisomanager.h"
+#include "../src/include/gadgetsnapshot.h"
+#include "../src/include/gadgettransaction.h"
+#include "../src/include/util.h"
 #include "../src/include/logger.h"
 #include <filesystem>
 #include <fstream>
@@ -8,35 +13,6 @@
 
 namespace fs = std::filesystem;
 
-// Test helper: create a temp directory structure
-class TempDir {
-public:
-    std::string path;
-    
-    TempDir(const std::string& name) : path("/tmp/isodrive_test_" + name) {
-        fs::create_directories(path);
-    }
-    
-    ~TempDir() {
-        fs::remove_all(path);
-    }
-    
-    std::string create_file(const std::string& relative_path, const std::string& content = "") {
-        fs::path full_path = fs::path(path) / relative_path;
-        fs::create_directories(full_path.parent_path());
-        std::ofstream f(full_path);
-        f << content;
-        f.close();
-        return full_path.string();
-    }
-    
-    std::string create_dir(const std::string& relative_path) {
-        fs::path full_path = fs::path(path) / relative_path;
-        fs::create_directories(full_path);
-        return full_path.string();
-    }
-};
-
 // ============================================================================
 // Tests for configfs support detection and path discovery
 // ============================================================================
@@ -100,9 +76,9 @@ TEST(test_mock_sysfs_multiple_paths) {
 // ============================================================================
 
 TEST(test_temp_dir_helper) {
-    TempDir tmp("configfs_test");
+    TestDir tmp("configfs_test");
     
-    std::string file = tmp.create_file("test.txt", "hello");
+    std::string file = tmp.file("test.txt", "hello");
     ASSERT_TRUE(fs::exists(file));
     
     std::ifstream f(file);
@@ -110,22 +86,22 @@ TEST(test_temp_dir_helper) {
     f >> content;
     ASSERT_EQ(std::string("hello"), content);
     
-    std::string dir = tmp.create_dir("subdir/nested");
+    std::string dir = tmp.dir("subdir/nested");
     ASSERT_TRUE(fs::is_directory(dir));
     
-    // TempDir destructor cleans up
+    // TestDir destructor cleans up
     return true;
 }
 
 TEST(test_gadget_structure_simulation) {
     // Simulates the structure we'd expect from configfs
-    TempDir tmp("gadget_sim");
+    TestDir tmp("gadget_sim");
     
     // Create a simulated gadget structure
-    std::string gadget_root = tmp.create_dir("usb_gadget/g1");
-    std::string udc_file = tmp.create_file("usb_gadget/g1/UDC", "musb-hdrc.0");
-    std::string configs_dir = tmp.create_dir("usb_gadget/g1/configs/c.1");
-    std::string functions_dir = tmp.create_dir("usb_gadget/g1/functions");
+    std::string gadget_root = tmp.dir("usb_gadget/g1");
+    std::string udc_file = tmp.file("usb_gadget/g1/UDC", "musb-hdrc.0");
+    std::string configs_dir = tmp.dir("usb_gadget/g1/configs/c.1");
+    std::string functions_dir = tmp.dir("usb_gadget/g1/functions");
     
     // Verify structure exists
     ASSERT_TRUE(fs::is_directory(gadget_root));
@@ -143,15 +119,15 @@ TEST(test_gadget_structure_simulation) {
 }
 
 TEST(test_mass_storage_structure_simulation) {
-    TempDir tmp("mass_storage_sim");
+    TestDir tmp("mass_storage_sim");
     
     // Create mass_storage function structure
-    std::string lun_dir = tmp.create_dir("mass_storage.0/lun.0");
-    std::string file_path = tmp.create_file("mass_storage.0/lun.0/file", "");
-    std::string cdrom_path = tmp.create_file("mass_storage.0/lun.0/cdrom", "0");
-    std::string ro_path = tmp.create_file("mass_storage.0/lun.0/ro", "1");
-    std::string removable_path = tmp.create_file("mass_storage.0/lun.0/removable", "1");
-    std::string stall_path = tmp.create_file("mass_storage.0/stall", "1");
+    std::string lun_dir = tmp.dir("mass_storage.0/lun.0");
+    std::string file_path = tmp.file("mass_storage.0/lun.0/file", "");
+    std::string cdrom_path = tmp.file("mass_storage.0/lun.0/cdrom", "0");
+    std::string ro_path = tmp.file("mass_storage.0/lun.0/ro", "1");
+    std::string removable_path = tmp.file("mass_storage.0/lun.0/removable", "1");
+    std::string stall_path = tmp.file("mass_storage.0/stall", "1");
     
     ASSERT_TRUE(fs::is_directory(lun_dir));
     ASSERT_TRUE(fs::exists(file_path));
@@ -163,6 +139,400 @@ TEST(test_mass_storage_structure_simulation) {
     return true;
 }
 
+// ============================================================================
+// Tests for diff-based attribute transactions
+// ============================================================================
+
+static std::string read_all(const std::string& path) {
+    std::string value;
+    attribute_read(path, value);
+    return value;
+}
+
+TEST(test_transaction_skips_unchanged) {
+    TestDir tmp("txn_skip");
+    std::string vendor = tmp.file("idVendor", "0x058f\n");
+    std::string product = tmp.file("idProduct", "0x1234\n");
+
+    GadgetTransaction txn;
+    txn.set(vendor, "0x58f");
+    txn.set(product, "0x6387");
+    ASSERT_EQ(1u, txn.pending());
+    ASSERT_TRUE(txn.commit());
+    ASSERT_EQ(1u, txn.written());
+    ASSERT_EQ(std::string("0x6387"), read_all(product));
+    return true;
+}
+
+TEST(test_transaction_nothing_to_do) {
+    TestDir tmp("txn_noop");
+    std::string file = tmp.file("lun.0/file", "/data/test.iso\n");
+    std::string ro = tmp.file("lun.0/ro", "1\n");
+
+    GadgetTransaction txn;
+    txn.set(ro, "1");
+    txn.set(file, "/data/test.iso");
+    ASSERT_EQ(0u, txn.pending());
+    ASSERT_TRUE(txn.commit());
+    ASSERT_EQ(0u, txn.written());
+    return true;
+}
+
+TEST(test_transaction_sequential_writes) {
+    TestDir tmp("txn_seq");
+    std::string file = tmp.file("lun.0/file", "/data/test.iso\n");
+
+    // Clearing and re-setting the same value must both be written
+    GadgetTransaction txn;
+    txn.set(file, "");
+    txn.set(file, "/data/test.iso");
+    ASSERT_EQ(2u, txn.pending());
+    ASSERT_TRUE(txn.commit());
+    ASSERT_EQ(std::string("/data/test.iso"), read_all(file));
+    return true;
+}
+
+TEST(test_transaction_rollback) {
+    TestDir tmp("txn_rollback");
+    std::string vendor = tmp.file("idVendor", "0x1d6b\n");
+    std::string product = tmp.file("idProduct", "0x0104\n");
+    // A directory cannot be opened for writing, so this write fails
+    std::string broken = tmp.dir("bcdUSB");
+
+    GadgetTransaction txn;
+    txn.set(vendor, "0x058f");
+    txn.set(product, "0x6387");
+    txn.set(broken, "0x0200");
+    ASSERT_TRUE(!txn.commit());
+
+    ASSERT_EQ(std::string("0x1d6b"), read_all(vendor));
+    ASSERT_EQ(std::string("0x0104"), read_all(product));
+    return true;
+}
+
+TEST(test_transaction_pending_under) {
+    TestDir tmp("txn_under");
+    std::string vendor = tmp.file("g1/idVendor", "0x058f\n");
+    std::string file = tmp.file("g1/functions/mass_storage.0/lun.0/file", "/a.iso\n");
+    std::string ro = tmp.file("g1/functions/mass_storage.0/lun.0/ro", "1\n");
+
+    // Only LUN attributes change, so media can be swapped in place
+    GadgetTransaction txn;
+    txn.set(vendor, "0x058f");
+    txn.set(ro, "1");
+    txn.set(file, "/b.iso");
+    ASSERT_EQ(1u, txn.pending());
+    ASSERT_EQ(1u, txn.pending_under(tmp.path + "/g1/functions/mass_storage.0/lun.0"));
+    ASSERT_EQ(0u, txn.pending_under(tmp.path + "/g1/strings"));
+    return true;
+}
+
+TEST(test_transaction_values_equal) {
+    ASSERT_TRUE(GadgetTransaction::values_equal("/g1/idVendor", "0x058f", "0x58f"));
+    ASSERT_TRUE(GadgetTransaction::values_equal("/g1/configs/c.1/MaxPower", "500", "500\n"));
+    ASSERT_TRUE(GadgetTransaction::values_equal("lun.0/file", "", ""));
+    ASSERT_TRUE(!GadgetTransaction::values_equal("lun.0/ro", "0", ""));
+    ASSERT_TRUE(!GadgetTransaction::values_equal("lun.0/file", "/a.iso", "/b.iso"));
+
+    // Strings that happen to parse as numbers are compared verbatim
+    ASSERT_TRUE(!GadgetTransaction::values_equal("/g1/strings/0x409/serialnumber", "000000000001", "1"));
+    ASSERT_TRUE(!GadgetTransaction::values_equal("/g1/strings/0x409/product", "010", "8"));
+    ASSERT_TRUE(GadgetTransaction::values_equal("/g1/strings/0x409/product", "Pixel", "Pixel\n"));
+    ASSERT_TRUE(GadgetTransaction::numeric_attribute("bcdUSB"));
+    ASSERT_TRUE(!GadgetTransaction::numeric_attribute("/g1/strings/0x409/serialnumber"));
+    return true;
+}
+
+// ============================================================================
+// Tests for mount orchestration against a fake configfs tree
+// ============================================================================
+
+// Helper: Build a configfs-like tree with one bound gadget
+static std::string create_fake_configfs(TestDir& tmp) {
+    tmp.file("usb_gadget/g1/UDC", "fake-udc.0\n");
+    tmp.file("usb_gadget/g1/idVendor", "0x18d1\n");
+    tmp.dir("usb_gadget/g1/configs/c.1");
+    tmp.file("usb_gadget/g1/functions/mass_storage.0/stall", "1\n");
+    std::string lun = "usb_gadget/g1/functions/mass_storage.0/lun.0/";
+    tmp.file(lun + "file", "\n");
+    tmp.file(lun + "cdrom", "0\n");
+    tmp.file(lun + "ro", "1\n");
+    tmp.file(lun + "removable", "1\n");
+    tmp.file(lun + "forced_eject", "");
+    return tmp.path;
+}
+
+static WindowsMountOptions no_windows() {
+    WindowsMountOptions opts = {};
+    opts.version = WindowsVersion::NONE;
+    return opts;
+}
+
+TEST(test_session_discovery) {
+    TestDir tmp("session");
+    create_fake_configfs(tmp);
+    tmp.file("usb_gadget/g0/UDC", "\n");
+
+    GadgetSession session(tmp.path);
+    ASSERT_TRUE(session.supported());
+    ASSERT_EQ(tmp.path + "/usb_gadget/g1", session.gadget_root());
+    ASSERT_EQ(tmp.path + "/usb_gadget/g1/configs/c.1", session.config_root());
+    ASSERT_EQ(std::string("fake-udc.0"), session.udc());
+    ASSERT_TRUE(session.lun_supports("forced_eject"));
+    ASSERT_TRUE(!session.lun_supports("nofua"));
+    ASSERT_TRUE(!session.function_linked("mass_storage.0"));
+    return true;
+}
+
+TEST(test_session_missing_configfs) {
+    GadgetSession session("/tmp/isodrive_test_does_not_exist");
+    ASSERT_TRUE(!session.supported());
+    ASSERT_TRUE(session.gadget_root().empty());
+    return true;
+}
+
+TEST(test_mount_iso_full_cycle) {
+    TestDir tmp("mount_full");
+    create_fake_configfs(tmp);
+    std::string lun = tmp.path + "/usb_gadget/g1/functions/mass_storage.0/lun.0/";
+
+    GadgetSession session(tmp.path);
+    ASSERT_TRUE(mount_iso(session, "/data/a.iso", true, true, no_windows()));
+    ASSERT_EQ(std::string("/data/a.iso"), read_all(lun + "file"));
+    ASSERT_EQ(std::string("1"), read_all(lun + "cdrom"));
+    ASSERT_EQ(std::string("0"), read_all(tmp.path + "/usb_gadget/g1/functions/mass_storage.0/stall"));
+    ASSERT_TRUE(session.function_linked("mass_storage.0"));
+    ASSERT_EQ(std::string("fake-udc.0"), read_all(tmp.path + "/usb_gadget/g1/UDC"));
+
+    ASSERT_TRUE(mount_iso(session, "", false, true, no_windows()));
+    ASSERT_EQ(std::string(""), read_all(lun + "file"));
+    ASSERT_TRUE(!session.function_linked("mass_storage.0"));
+    return true;
+}
+
+TEST(test_mount_iso_unchanged_skips_udc_cycle) {
+    TestDir tmp("mount_noop");
+    create_fake_configfs(tmp);
+    std::string udc = tmp.path + "/usb_gadget/g1/UDC";
+
+    GadgetSession session(tmp.path);
+    ASSERT_TRUE(mount_iso(session, "/data/a.iso", true, true, no_windows()));
+
+    // Any UDC cycle would rewrite the marker with the UDC name
+    attribute_write(udc, "marker");
+    ASSERT_TRUE(mount_iso(session, "/data/a.iso", true, true, no_windows()));
+    ASSERT_EQ(std::string("marker"), read_all(udc));
+    return true;
+}
+
+TEST(test_mount_iso_swaps_media_in_place) {
+    TestDir tmp("mount_swap");
+    create_fake_configfs(tmp);
+    std::string udc = tmp.path + "/usb_gadget/g1/UDC";
+    std::string lun = tmp.path + "/usb_gadget/g1/functions/mass_storage.0/lun.0/";
+
+    GadgetSession session(tmp.path);
+    ASSERT_TRUE(prepare_mass_storage(session));
+    ASSERT_TRUE(session.function_linked("mass_storage.0"));
+
+    attribute_write(udc, "marker");
+    ASSERT_TRUE(mount_iso(session, "/data/a.iso", false, true, no_windows()));
+    ASSERT_TRUE(mount_iso(session, "/data/b.iso", false, true, no_windows()));
+    ASSERT_EQ(std::string("/data/b.iso"), read_all(lun + "file"));
+    ASSERT_EQ(std::string("1"), read_all(lun + "forced_eject"));
+    ASSERT_EQ(std::string("marker"), read_all(udc));
+
+    // Changing the device type needs a full re-enumeration
+    ASSERT_TRUE(mount_iso(session, "/data/b.iso", true, true, no_windows()));
+    ASSERT_EQ(std::string("fake-udc.0"), read_all(udc));
+
+    ASSERT_TRUE(eject_iso(session));
+    ASSERT_EQ(std::string(""), read_all(lun + "file"));
+    ASSERT_TRUE(session.function_linked("mass_storage.0"));
+    return true;
+}
+
+TEST(test_mount_images_multiple_luns) {
+    TestDir tmp("mount_multi");
+    create_fake_configfs(tmp);
+    std::string udc = tmp.path + "/usb_gadget/g1/UDC";
+    std::string ms = tmp.path + "/usb_gadget/g1/functions/mass_storage.0/";
+
+    GadgetSession session(tmp.path);
+    std::vector<LunMedia> images = {
+        {"/data/installer.iso", true, true, false},
+        {"/data/drivers.img", false, false, false},
+    };
+    ASSERT_TRUE(mount_images(session, images, no_windows()));
+    ASSERT_EQ(2u, session.lun_count("mass_storage.0"));
+    ASSERT_EQ(std::string("/data/installer.iso"), read_all(ms + "lun.0/file"));
+    ASSERT_EQ(std::string("1"), read_all(ms + "lun.0/cdrom"));
+    ASSERT_EQ(std::string("/data/drivers.img"), read_all(ms + "lun.1/file"));
+    ASSERT_EQ(std::string("0"), read_all(ms + "lun.1/cdrom"));
+    ASSERT_EQ(std::string("0"), read_all(ms + "lun.1/ro"));
+    ASSERT_TRUE(session.function_linked("mass_storage.0"));
+
+    // Same set again: nothing to do
+    attribute_write(udc, "marker");
+    ASSERT_TRUE(mount_images(session, images, no_windows()));
+    ASSERT_EQ(std::string("marker"), read_all(udc));
+
+    // Unmounting clears every LUN
+    ASSERT_TRUE(mount_images(session, {}, no_windows()));
+    ASSERT_EQ(std::string(""), read_all(ms + "lun.0/file"));
+    ASSERT_EQ(std::string(""), read_all(ms + "lun.1/file"));
+    ASSERT_TRUE(!session.function_linked("mass_storage.0"));
+    return true;
+}
+
+TEST(test_mount_images_adding_lun_relinks) {
+    TestDir tmp("mount_relink");
+    create_fake_configfs(tmp);
+    std::string ms = tmp.path + "/usb_gadget/g1/functions/mass_storage.0/";
+
+    GadgetSession session(tmp.path);
+    ASSERT_TRUE(mount_iso(session, "/data/a.iso", true, true, no_windows()));
+
+    std::vector<LunMedia> images = {
+        {"/data/a.iso", true, true, false},
+        {"/data/b.img", false, true, false},
+    };
+    ASSERT_TRUE(mount_images(session, images, no_windows()));
+    ASSERT_EQ(std::string("/data/b.img"), read_all(ms + "lun.1/file"));
+    ASSERT_EQ(std::string("0"), read_all(ms + "stall"));
+    ASSERT_TRUE(session.function_linked("mass_storage.0"));
+
+    ASSERT_TRUE(eject_iso(session));
+    ASSERT_EQ(std::string(""), read_all(ms + "lun.0/file"));
+    ASSERT_EQ(std::string(""), read_all(ms + "lun.1/file"));
+    return true;
+}
+
+// Helper: Give the fake gadget its own descriptors and an adb function
+static void add_original_functions(TestDir& tmp) {
+    tmp.file("usb_gadget/g1/idProduct", "0x4ee7\n");
+    tmp.file("usb_gadget/g1/bcdUSB", "0x0210\n");
+    tmp.file("usb_gadget/g1/strings/0x409/manufacturer", "Google\n");
+    tmp.file("usb_gadget/g1/strings/0x409/product", "Pixel\n");
+    tmp.file("usb_gadget/g1/strings/0x409/serialnumber", "0A1B2C\n");
+    tmp.file("usb_gadget/g1/configs/c.1/MaxPower", "250\n");
+    tmp.dir("usb_gadget/g1/functions/ffs.adb");
+    fs::create_symlink(tmp.path + "/usb_gadget/g1/functions/ffs.adb", tmp.path + "/usb_gadget/g1/configs/c.1/f1");
+}
+
+static WindowsMountOptions windows10() {
+    WindowsMountOptions opts = {};
+    opts.enabled = true;
+    opts.version = WindowsVersion::WIN10;
+    opts.has_uefi = true;
+    return opts;
+}
+
+TEST(test_snapshot_round_trip) {
+    TestDir tmp("snapshot");
+    create_fake_configfs(tmp);
+    add_original_functions(tmp);
+
+    GadgetSession session(tmp.path);
+    GadgetSnapshot taken;
+    ASSERT_TRUE(gadget_snapshot_take(session, taken));
+    ASSERT_EQ(static_cast<size_t>(1), taken.links.size());
+    ASSERT_EQ(std::string("f1"), taken.links[0].first);
+    ASSERT_TRUE(taken.absent.empty());
+
+    ASSERT_TRUE(gadget_snapshot_save(taken));
+    GadgetSnapshot loaded;
+    ASSERT_TRUE(gadget_snapshot_load(session.gadget_root(), loaded));
+    ASSERT_TRUE(taken.attributes == loaded.attributes);
+    ASSERT_TRUE(taken.links == loaded.links);
+    ASSERT_TRUE(loaded.attributes.back() == std::make_pair(std::string("configs/c.1/MaxPower"), std::string("250")));
+
+    // Another gadget with the same directory name does not match
+    ASSERT_TRUE(!gadget_snapshot_load(tmp.path + "/other/g1", loaded));
+
+    ASSERT_TRUE(gadget_snapshot_links_match(session, taken));
+    ASSERT_TRUE(session.ensure_function("mass_storage.0") && session.link_function("mass_storage.0"));
+    ASSERT_TRUE(!gadget_snapshot_links_match(session, taken));
+    return true;
+}
+
+TEST(test_unmount_restores_original_gadget) {
+    TestDir tmp("snapshot_restore");
+    create_fake_configfs(tmp);
+    add_original_functions(tmp);
+    std::string g1 = tmp.path + "/usb_gadget/g1/";
+
+    GadgetSession session(tmp.path);
+    ASSERT_TRUE(mount_iso(session, "/data/win10.iso", true, true, windows10()));
+    ASSERT_EQ(std::string("0x058f"), read_all(g1 + "idVendor"));
+    ASSERT_EQ(std::string("Generic"), read_all(g1 + "strings/0x409/manufacturer"));
+    ASSERT_EQ(std::string("500"), read_all(g1 + "configs/c.1/MaxPower"));
+    ASSERT_TRUE(isfile(gadget_snapshot_path(session.gadget_root())));
+
+    // A second mount keeps the snapshot from before the first one
+    ASSERT_TRUE(mount_iso(session, "/data/other.iso", true, true, windows10()));
+
+    // The adb link disappears behind isodrive's back
+    fs::remove(g1 + "configs/c.1/f1");
+
+    ASSERT_TRUE(mount_iso(session, "", false, true, no_windows()));
+    ASSERT_EQ(std::string("0x18d1"), read_all(g1 + "idVendor"));
+    ASSERT_EQ(std::string("0x4ee7"), read_all(g1 + "idProduct"));
+    ASSERT_EQ(std::string("0x0210"), read_all(g1 + "bcdUSB"));
+    ASSERT_EQ(std::string("Google"), read_all(g1 + "strings/0x409/manufacturer"));
+    ASSERT_EQ(std::string("Pixel"), read_all(g1 + "strings/0x409/product"));
+    ASSERT_EQ(std::string("0A1B2C"), read_all(g1 + "strings/0x409/serialnumber"));
+    ASSERT_EQ(std::string("250"), read_all(g1 + "configs/c.1/MaxPower"));
+    ASSERT_TRUE(fs::is_symlink(g1 + "configs/c.1/f1"));
+    ASSERT_TRUE(!session.function_linked("mass_storage.0"));
+    ASSERT_EQ(std::string("fake-udc.0"), read_all(g1 + "UDC"));
+    ASSERT_TRUE(!isfile(gadget_snapshot_path(session.gadget_root())));
+
+    // Nothing left to restore: a second unmount leaves the gadget alone
+    attribute_write(g1 + "UDC", "marker");
+    ASSERT_TRUE(mount_iso(session, "", false, true, no_windows()));
+    ASSERT_EQ(std::string("marker"), read_all(g1 + "UDC"));
+    return true;
+}
+
+TEST(test_snapshot_tied_to_boot_and_mount) {
+    TestDir tmp("snapshot_stale");
+    create_fake_configfs(tmp);
+    add_original_functions(tmp);
+    std::string g1 = tmp.path + "/usb_gadget/g1/";
+
+    GadgetSession session(tmp.path);
+    GadgetSnapshot snapshot;
+    ASSERT_TRUE(gadget_snapshot_take(session, snapshot));
+    ASSERT_EQ(gadget_snapshot_boot_id(), snapshot.boot_id);
+
+    // A snapshot from another boot is neither restored nor kept
+    snapshot.boot_id = "earlier-boot";
+    snapshot.attributes[0].second = "0x1234";
+    ASSERT_TRUE(gadget_snapshot_save(snapshot));
+    GadgetSnapshot loaded;
+    ASSERT_TRUE(!gadget_snapshot_load(session.gadget_root(), loaded));
+    ASSERT_TRUE(mount_iso(session, "", false, true, no_windows()));
+    ASSERT_EQ(std::string("0x18d1"), read_all(g1 + "idVendor"));
+    ASSERT_TRUE(gadget_snapshot_ensure(session));
+    ASSERT_TRUE(gadget_snapshot_load(session.gadget_root(), loaded));
+    ASSERT_EQ(std::string("0x18d1"), loaded.attributes[0].second);
+
+    // With nothing of isodrive's linked, the gadget's current state is retaken
+    attribute_write(g1 + "idVendor", "0x2717");
+    ASSERT_TRUE(gadget_snapshot_ensure(session));
+    ASSERT_TRUE(gadget_snapshot_load(session.gadget_root(), loaded));
+    ASSERT_EQ(std::string("0x2717"), loaded.attributes[0].second);
+
+    // While a mount is active the snapshot from before it is kept
+    ASSERT_TRUE(mount_iso(session, "/data/a.iso", true, true, no_windows()));
+    attribute_write(g1 + "idVendor", "0x058f");
+    ASSERT_TRUE(gadget_snapshot_ensure(session));
+    ASSERT_TRUE(gadget_snapshot_load(session.gadget_root(), loaded));
+    ASSERT_EQ(std::string("0x2717"), loaded.attributes[0].second);
+    return true;
+}
+
 // ============================================================================
 // Logging tests
 // ============================================================================
@@ -0,0 +1,207 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/daemon.h"
+#include "../src/include/logger.h"
+#include "../src/include/mountrequest.h"
+#include "../src/include/probecache.h"
+#include "../src/include/util.h"
+#include <csignal>
+#include <filesystem>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Helper: Build a configfs-like tree with one bound gadget
+class FakeConfigfs : public TestDir {
+public:
+    explicit FakeConfigfs(const std::string& name) : TestDir("daemon_" + name) {
+        file("usb_gadget/g1/UDC", "fake-udc.0\n");
+        dir("usb_gadget/g1/configs/c.1");
+        file("usb_gadget/g1/functions/mass_storage.0/stall", "1\n");
+        std::string lun = "usb_gadget/g1/functions/mass_storage.0/lun.0/";
+        file(lun + "file", "\n");
+        file(lun + "cdrom", "0\n");
+        file(lun + "ro", "1\n");
+        file(lun + "removable", "1\n");
+        file(lun + "forced_eject", "");
+        image = file("image.img", std::string(4096, '\0'));
+    }
+
+    std::string read(const std::string& relative) {
+        std::string value;
+        attribute_read(path + "/" + relative, value);
+        return value;
+    }
+
+    std::string image;
+};
+
+// Helper: Encode a single-image mount request
+static std::string mount_request(const std::string& image, LogLevel verbosity = LogLevel::INFO) {
+    MountRequest request;
+    ImageRequest img;
+    img.path = image;
+    img.ro = false;
+    request.images.push_back(img);
+    return encode_request(request, verbosity);
+}
+
+TEST(test_request_round_trip) {
+    MountRequest request;
+    request.command = RequestCommand::PREPARE;
+    request.use_usb3 = true;
+    request.force_win11 = true;
+    request.verify = true;
+    ImageRequest a;
+    a.path = "/sdcard/with space.iso";
+    a.cdrom = true;
+    a.windows = true;
+    ImageRequest b;
+    b.path = "/sdcard/drivers.img";
+    b.ro = false;
+    b.clone = true;
+    request.images = {a, b};
+
+    std::string text = encode_request(request, LogLevel::DEBUG);
+    ASSERT_TRUE(text.size() > 2 && text.compare(text.size() - 2, 2, "\n\n") == 0);
+
+    MountRequest decoded;
+    LogLevel verbosity;
+    ASSERT_TRUE(decode_request(text, decoded, verbosity));
+    ASSERT_TRUE(verbosity == LogLevel::DEBUG);
+    ASSERT_TRUE(decoded.command == RequestCommand::PREPARE);
+    ASSERT_TRUE(decoded.use_usb3 && decoded.force_win11 && !decoded.force_win10 && decoded.verify);
+    ASSERT_EQ(2u, decoded.images.size());
+    ASSERT_EQ(std::string("/sdcard/with space.iso"), decoded.images[0].path);
+    ASSERT_TRUE(decoded.images[0].cdrom && decoded.images[0].ro && decoded.images[0].windows);
+    ASSERT_TRUE(!decoded.images[0].clone);
+    ASSERT_TRUE(!decoded.images[1].ro && !decoded.images[1].cdrom && decoded.images[1].clone);
+    ASSERT_TRUE(!decoded.no_probe_cache);
+
+    request.no_probe_cache = true;
+    text = encode_request(request, LogLevel::INFO);
+    ASSERT_TRUE(text.find("option noprobe-cache\n") != std::string::npos);
+    ASSERT_TRUE(decode_request(text, decoded, verbosity));
+    ASSERT_TRUE(decoded.no_probe_cache && decoded.verify);
+    return true;
+}
+
+TEST(test_request_rejects_malformed) {
+    MountRequest request;
+    LogLevel verbosity;
+    ASSERT_TRUE(!decode_request("", request, verbosity));
+    ASSERT_TRUE(!decode_request("isodrive 99\n\n", request, verbosity));
+    ASSERT_TRUE(!decode_request("isodrive 1\ncommand format\n\n", request, verbosity));
+    ASSERT_TRUE(!decode_request("isodrive 1\nimage - relative.iso\n\n", request, verbosity));
+    ASSERT_TRUE(!decode_request("isodrive 1\nimage x /a.iso\n\n", request, verbosity));
+    ASSERT_TRUE(decode_request("isodrive 1\n\n", request, verbosity));
+    ASSERT_TRUE(request.command == RequestCommand::MOUNT && request.images.empty());
+    return true;
+}
+
+TEST(test_daemon_handles_mount_and_status) {
+    FakeConfigfs tree("handle");
+    IsoDaemon daemon(tree.path);
+
+    std::string response = daemon.handle(mount_request(tree.image));
+    ASSERT_TRUE(response.find("exit 0\n") != std::string::npos);
+    ASSERT_EQ(tree.image, tree.read("usb_gadget/g1/functions/mass_storage.0/lun.0/file"));
+    ASSERT_EQ(std::string("0"), tree.read("usb_gadget/g1/functions/mass_storage.0/lun.0/ro"));
+    ASSERT_EQ(1u, daemon.cached_probes());
+
+    // Second request reuses the probe result held in memory
+    response = daemon.handle(mount_request(tree.image));
+    ASSERT_TRUE(response.find("exit 0\n") != std::string::npos);
+    ASSERT_TRUE(response.find("unchanged") != std::string::npos);
+
+    MountRequest status;
+    status.command = RequestCommand::STATUS;
+    response = daemon.handle(encode_request(status, LogLevel::INFO));
+    ASSERT_TRUE(response.find("log 3 LUN 0: " + tree.image) != std::string::npos);
+    ASSERT_TRUE(response.find("exit 0\n") != std::string::npos);
+    return true;
+}
+
+TEST(test_daemon_noprobe_cache_bypasses_memory) {
+    FakeConfigfs tree("noprobe");
+    IsoDaemon daemon(tree.path);
+
+    std::string response = daemon.handle(mount_request(tree.image));
+    ASSERT_TRUE(response.find("exit 0\n") != std::string::npos);
+    ASSERT_EQ(1u, daemon.cached_probes());
+
+    MountRequest request;
+    ImageRequest image;
+    image.path = tree.image;
+    image.ro = false;
+    request.images.push_back(image);
+    request.no_probe_cache = true;
+    response = daemon.handle(encode_request(request, LogLevel::DEBUG));
+    ASSERT_TRUE(response.find("exit 0\n") != std::string::npos);
+    ASSERT_TRUE(response.find("held in memory") == std::string::npos);
+    ASSERT_TRUE(response.find("Probe cache") == std::string::npos);
+    return true;
+}
+
+TEST(test_daemon_reports_errors) {
+    FakeConfigfs tree("errors");
+    IsoDaemon daemon(tree.path);
+
+    std::string response = daemon.handle("garbage\n\n");
+    ASSERT_TRUE(response.find("exit 1\n") != std::string::npos);
+
+    response = daemon.handle(mount_request(tree.path + "/missing.iso"));
+    ASSERT_TRUE(response.find("log 1 File not found") != std::string::npos);
+    ASSERT_TRUE(response.find("exit 1\n") != std::string::npos);
+
+    // Output above the requested verbosity is not sent
+    response = daemon.handle(mount_request(tree.image, LogLevel::ERROR));
+    ASSERT_EQ(std::string("exit 0\n"), response);
+    return true;
+}
+
+TEST(test_daemon_socket_round_trip) {
+    if (getuid() != 0) {
+        // The daemon only answers root clients
+        return true;
+    }
+    FakeConfigfs tree("socket");
+    std::string socket_path = tree.path + "/isodrived.sock";
+
+    int exit_code = -1;
+    ASSERT_TRUE(!daemon_forward(mount_request(tree.image), socket_path, exit_code));
+
+    pid_t child = fork();
+    if (child == 0) {
+        IsoDaemon daemon(tree.path);
+        _exit(daemon.serve(socket_path) ? 0 : 1);
+    }
+    ASSERT_TRUE(child > 0);
+
+    bool handled = false;
+    for (int i = 0; i < 200 && !handled; i++) {
+        handled = daemon_forward(mount_request(tree.image), socket_path, exit_code);
+        if (!handled) usleep(10000);
+    }
+
+    kill(child, SIGTERM);
+    int status = 0;
+    waitpid(child, &status, 0);
+
+    ASSERT_TRUE(handled);
+    ASSERT_EQ(0, exit_code);
+    ASSERT_EQ(tree.image, tree.read("usb_gadget/g1/functions/mass_storage.0/lun.0/file"));
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ASSERT_TRUE(!fs::exists(socket_path));
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+    probe_cache_set_enabled(false);
+
+    return run_tests();
+}
@@ -0,0 +1,168 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/eltorito.h"
+#include "../src/include/imageprobe.h"
+#include "../src/include/logger.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+static const std::string IMAGE_PATH = "/tmp/isodrive_test_eltorito.iso";
+
+// Helper: Catalog entry (boot indicator, media, count, RBA) at index i
+static void entry(std::string& data, size_t i, unsigned char indicator, unsigned char media, uint16_t count,
+                  uint32_t rba) {
+    size_t pos = 20 * 2048 + i * 32;
+    data[pos] = static_cast<char>(indicator);
+    data[pos + 1] = static_cast<char>(media);
+    put16(data, pos + 6, count);
+    put32(data, pos + 8, rba);
+}
+
+// Helper: Section header at index i
+static void section(std::string& data, size_t i, unsigned char indicator, unsigned char platform, uint16_t count) {
+    size_t pos = 20 * 2048 + i * 32;
+    data[pos] = static_cast<char>(indicator);
+    data[pos + 1] = static_cast<char>(platform);
+    put16(data, pos + 2, count);
+}
+
+// Helper: ISO with a PVD, a boot record pointing at sector 20 and a validation entry
+static std::string catalog_image(const std::string& label, unsigned char platform) {
+    std::string data(64 * 2048, '\0');
+    size_t pvd = 16 * 2048;
+    data[pvd] = 1;
+    std::memcpy(&data[pvd + 1], "CD001", 5);
+    std::string id = label;
+    id.resize(32, ' ');
+    std::memcpy(&data[pvd + 40], id.data(), 32);
+
+    size_t record = 17 * 2048;
+    std::memcpy(&data[record + 1], "CD001", 5);
+    std::memcpy(&data[record + 7], "EL TORITO SPECIFICATION", 23);
+    put32(data, record + 0x47, 20);
+
+    size_t catalog = 20 * 2048;
+    data[catalog] = 0x01;
+    data[catalog + 1] = static_cast<char>(platform);
+    data[catalog + 30] = 0x55;
+    data[catalog + 31] = static_cast<char>(0xaa);
+    uint16_t sum = 0;
+    for (size_t i = 0; i < 32; i += 2) {
+        sum = static_cast<uint16_t>(sum + (static_cast<unsigned char>(data[catalog + i]) |
+                                           (static_cast<unsigned char>(data[catalog + i + 1]) << 8)));
+    }
+    put16(data, catalog + 28, static_cast<uint16_t>(0x10000 - sum));
+    return data;
+}
+
+// Helper: Write an image and parse its catalog
+static bool parse(const std::string& data, BootCatalog& catalog) {
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+    ImageProbe probe(IMAGE_PATH);
+    return read_boot_catalog(probe, catalog);
+}
+
+TEST(test_catalog_sections) {
+    std::string data = catalog_image("MULTI", ELTORITO_PLATFORM_BIOS);
+    entry(data, 1, 0x88, 0, 4, 30);
+    section(data, 2, 0x90, ELTORITO_PLATFORM_EFI, 2);
+    entry(data, 3, 0x88, 0, 5760, 40);
+    data[20 * 2048 + 4 * 32] = 0x44;  // Extension of entry 3
+    entry(data, 5, 0x00, 0, 4, 45);
+    section(data, 6, 0x91, 0x02, 1);
+    entry(data, 7, 0x88, 2, 1, 50);
+    entry(data, 8, 0x88, 0, 4, 60);  // After the final section: ignored
+
+    BootCatalog catalog;
+    ASSERT_TRUE(parse(data, catalog));
+    ASSERT_EQ(static_cast<uint32_t>(20), catalog.lba);
+    ASSERT_EQ(static_cast<size_t>(4), catalog.entries.size());
+    ASSERT_TRUE(catalog.has_bios);
+    ASSERT_TRUE(catalog.has_uefi);
+
+    const BootEntry& bios = catalog.entries[0];
+    ASSERT_TRUE(bios.platform == ELTORITO_PLATFORM_BIOS && bios.bootable);
+    ASSERT_EQ(static_cast<uint64_t>(30 * 2048), bios.offset);
+    ASSERT_EQ(static_cast<uint64_t>(2048), bios.length);
+
+    const BootEntry& efi = catalog.entries[1];
+    ASSERT_TRUE(efi.platform == ELTORITO_PLATFORM_EFI);
+    ASSERT_EQ(static_cast<uint32_t>(40), efi.load_rba);
+    ASSERT_EQ(static_cast<uint64_t>(5760 * 512), efi.length);
+    ASSERT_TRUE(!catalog.entries[2].bootable);
+
+    // Floppy emulation loads the whole floppy
+    ASSERT_EQ(static_cast<unsigned char>(2), catalog.entries[3].media);
+    ASSERT_EQ(static_cast<uint64_t>(1474560), catalog.entries[3].length);
+    fs::remove(IMAGE_PATH);
+    return true;
+}
+
+TEST(test_catalog_validation) {
+    std::string data = catalog_image("BROKEN", ELTORITO_PLATFORM_BIOS);
+    entry(data, 1, 0x88, 0, 4, 30);
+    BootCatalog catalog;
+    ASSERT_TRUE(parse(data, catalog));
+
+    data[20 * 2048 + 28] ^= 1;
+    ASSERT_TRUE(!parse(data, catalog));
+
+    // No boot record at all
+    data[17 * 2048 + 7] = 'X';
+    ASSERT_TRUE(!parse(data, catalog));
+    fs::remove(IMAGE_PATH);
+    return true;
+}
+
+TEST(test_windows_boot_support_from_catalog) {
+    // A BIOS-only catalog is no longer assumed to boot on UEFI
+    std::string data = catalog_image("WIN10_X64", ELTORITO_PLATFORM_BIOS);
+    entry(data, 1, 0x88, 0, 8, 30);
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+    ImageProbeResult result = probe_image(IMAGE_PATH);
+    ASSERT_TRUE(result.windows.is_windows);
+    ASSERT_TRUE(result.windows.has_legacy);
+    ASSERT_TRUE(!result.windows.has_uefi);
+
+    // An EFI-only catalog boots on UEFI only
+    data = catalog_image("WIN11_X64", ELTORITO_PLATFORM_EFI);
+    entry(data, 1, 0x88, 0, 0, 30);
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+    result = probe_image(IMAGE_PATH);
+    ASSERT_TRUE(result.windows.has_uefi);
+    ASSERT_TRUE(!result.windows.has_legacy);
+    fs::remove(IMAGE_PATH);
+    return true;
+}
+
+TEST(test_linux_boot_support_from_catalog) {
+    // The catalog is read for non-Windows ISOs too
+    std::string data = catalog_image("UBUNTU_24_04", ELTORITO_PLATFORM_BIOS);
+    entry(data, 1, 0x88, 0, 4, 30);
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+    ImageProbeResult result = probe_image(IMAGE_PATH);
+    ASSERT_TRUE(!result.windows.is_windows);
+    ASSERT_TRUE(result.boot_legacy);
+    ASSERT_TRUE(!result.boot_uefi);
+    ASSERT_TRUE(!result.windows.has_legacy);
+
+    data = catalog_image("UBUNTU_24_04", ELTORITO_PLATFORM_EFI);
+    entry(data, 1, 0x88, 0, 0, 30);
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+    result = probe_image(IMAGE_PATH);
+    ASSERT_TRUE(result.boot_uefi);
+    ASSERT_TRUE(!result.boot_legacy);
+    fs::remove(IMAGE_PATH);
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
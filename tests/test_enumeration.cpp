@@ -0,0 +1,213 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/configfsisomanager.h"
+#include "../src/include/enumeration.h"
+#include "../src/include/logger.h"
+#include "../src/include/mountrequest.h"
+#include "../src/include/probecache.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// Helper: Build a fake UDC class directory and configfs tree under one root
+class FakeUdc : public TestDir {
+public:
+    explicit FakeUdc(const std::string& name) : TestDir("enumeration_" + name) {
+        file("class/fake-udc.0/state", "configured\n");
+        file("class/fake-udc.0/current_speed", "high-speed\n");
+        udc_set_class_root(path + "/class");
+    }
+
+    ~FakeUdc() {
+        udc_set_class_root("");
+    }
+
+    std::string slurp(const std::string& relative) {
+        std::ifstream in(path + "/" + relative);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        return ss.str();
+    }
+
+    // Add a configfs tree with one bound gadget on fake-udc.0
+    void add_configfs() {
+        file("configfs/usb_gadget/g1/UDC", "fake-udc.0\n");
+        dir("configfs/usb_gadget/g1/configs/c.1");
+        file("configfs/usb_gadget/g1/functions/mass_storage.0/stall", "1\n");
+        std::string lun = "configfs/usb_gadget/g1/functions/mass_storage.0/lun.0/";
+        file(lun + "file", "\n");
+        file(lun + "cdrom", "0\n");
+        file(lun + "ro", "1\n");
+        file(lun + "removable", "1\n");
+        file(lun + "forced_eject", "");
+    }
+};
+
+// Helper: Probe stand-in that reports a plain (non-hybrid) image
+static ImageProbeResult plain_probe(const std::string&) {
+    return ImageProbeResult();
+}
+
+TEST(test_wait_configured_reports_speed) {
+    FakeUdc udc("configured");
+    EnumerationResult result;
+    ASSERT_TRUE(wait_for_configured("fake-udc.0", std::chrono::steady_clock::now(), 1000, result));
+    ASSERT_TRUE(result.configured);
+    ASSERT_EQ(std::string("configured"), result.state);
+    ASSERT_EQ(std::string("high-speed"), result.speed);
+    ASSERT_TRUE(result.elapsed_ms < 1000);
+    return true;
+}
+
+TEST(test_wait_times_out) {
+    FakeUdc udc("timeout");
+    udc.file("class/fake-udc.0/state", "default\n");
+
+    auto start = std::chrono::steady_clock::now();
+    EnumerationResult result;
+    ASSERT_TRUE(!wait_for_configured("fake-udc.0", start, 120, result));
+    ASSERT_TRUE(!result.configured);
+    ASSERT_EQ(std::string("default"), result.state);
+    ASSERT_TRUE(result.elapsed_ms >= 120);
+    return true;
+}
+
+TEST(test_wait_missing_udc) {
+    FakeUdc udc("missing");
+    EnumerationResult result;
+    ASSERT_TRUE(!wait_for_configured("no-such-udc", std::chrono::steady_clock::now(), 100, result));
+    ASSERT_TRUE(result.state.empty());
+    return true;
+}
+
+TEST(test_enumeration_json) {
+    EnumerationResult result;
+    result.configured = true;
+    result.state = "configured";
+    result.speed = "super-speed";
+    result.elapsed_ms = 412.25;
+    ASSERT_EQ(std::string("{\"udc\":\"a600000.dwc3\",\"configured\":true,\"state\":\"configured\","
+                          "\"speed\":\"super-speed\",\"elapsed_ms\":412.2}"),
+              enumeration_to_json("a600000.dwc3", result));
+    return true;
+}
+
+TEST(test_enumeration_record_appends) {
+    FakeUdc udc("record");
+    EnumerationResult result;
+    result.configured = true;
+    result.state = "configured";
+    ASSERT_TRUE(enumeration_record("fake-udc.0", result));
+    ASSERT_TRUE(enumeration_record("fake-udc.0", result));
+
+    std::string log = udc.slurp("state/enumeration.jsonl");
+    size_t first = log.find('\n');
+    ASSERT_TRUE(first != std::string::npos);
+    ASSERT_EQ(log.size() - 1, log.find('\n', first + 1));
+    ASSERT_EQ(0u, log.find("{\"time\":"));
+    ASSERT_TRUE(log.find("\"kernel\":\"") != std::string::npos);
+    ASSERT_TRUE(log.find("\"udc\":\"fake-udc.0\"") != std::string::npos);
+    return true;
+}
+
+TEST(test_run_request_waits_after_bind) {
+    FakeUdc udc("run_request");
+    udc.add_configfs();
+    std::string image = udc.file("image.img", std::string(4096, '\0'));
+
+    MountRequest request;
+    ImageRequest img;
+    img.path = image;
+    request.images.push_back(img);
+    request.wait_timeout_ms = 1000;
+
+    GadgetSession session(udc.path + "/configfs");
+    ASSERT_TRUE(run_request(session, request, plain_probe));
+    ASSERT_TRUE(udc.slurp("state/enumeration.jsonl").find("\"configured\":true") != std::string::npos);
+    return true;
+}
+
+TEST(test_run_request_wait_timeout_fails) {
+    FakeUdc udc("run_request_timeout");
+    udc.add_configfs();
+    udc.file("class/fake-udc.0/state", "addressed\n");
+    std::string image = udc.file("image.img", std::string(4096, '\0'));
+
+    MountRequest request;
+    ImageRequest img;
+    img.path = image;
+    request.images.push_back(img);
+    request.wait_timeout_ms = 100;
+
+    GadgetSession session(udc.path + "/configfs");
+    ASSERT_TRUE(!run_request(session, request, plain_probe));
+    ASSERT_TRUE(udc.slurp("state/enumeration.jsonl").find("\"state\":\"addressed\"") != std::string::npos);
+    return true;
+}
+
+// Helper: Milliseconds since start
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(test_unbind_waits_for_detach) {
+    FakeUdc udc("unbind");
+    udc.add_configfs();
+    std::string gadget = udc.path + "/configfs/usb_gadget/g1";
+
+    // The controller finishes disconnecting a little after the write
+    std::thread controller([&udc] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(80));
+        udc.file("class/fake-udc.0/state", "not attached\n");
+    });
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(set_udc("", gadget));
+    double waited = elapsed_ms(start);
+    controller.join();
+    ASSERT_TRUE(waited >= 80 && waited < UDC_DETACH_TIMEOUT_MS);
+    ASSERT_EQ(std::string("not attached"), udc_state("fake-udc.0"));
+
+    // A UDC that never reports the change costs the bounded wait, not a failure
+    udc.file("class/fake-udc.0/state", "configured\n");
+    ASSERT_TRUE(set_udc("fake-udc.0", gadget));
+    start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(set_udc("", gadget));
+    ASSERT_TRUE(elapsed_ms(start) >= UDC_DETACH_TIMEOUT_MS);
+
+    // Nor does a UDC that was detached before the unbind
+    udc.file("class/fake-udc.0/state", "not attached\n");
+    ASSERT_TRUE(set_udc("fake-udc.0", gadget));
+    start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(set_udc("", gadget));
+    ASSERT_TRUE(elapsed_ms(start) < UDC_DETACH_TIMEOUT_MS);
+
+    // Without a state attribute there is nothing to wait for
+    ASSERT_TRUE(set_udc("fake-udc.1", gadget));
+    start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(set_udc("", gadget));
+    ASSERT_TRUE(elapsed_ms(start) < UDC_DETACH_TIMEOUT_MS);
+    return true;
+}
+
+TEST(test_udc_write_errors_fail_fast) {
+    FakeUdc udc("udc_error");
+    fs::create_directories(udc.path + "/gadget/UDC");
+
+    // EISDIR is not something a settling controller returns
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(!set_udc("fake-udc.0", udc.path + "/gadget"));
+    ASSERT_TRUE(elapsed_ms(start) < 100);
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
@@ -0,0 +1,328 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/ffsbackend.h"
+#include "../src/include/imagereader.h"
+#include "../src/include/logger.h"
+#include "../src/include/scsi.h"
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <linux/usb/ch9.h>
+#include <linux/usb/functionfs.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Helper: Image whose every byte depends on its offset
+static std::string pattern(size_t size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<char>((i * 131) ^ (i >> 9));
+    }
+    return data;
+}
+
+// Helper: ScsiTransfer that records sent data and replays received data
+class MemoryTransfer : public ScsiTransfer {
+public:
+    std::string sent;
+    std::string incoming;
+
+    bool send(const uint8_t* data, size_t len) override {
+        sent.append(reinterpret_cast<const char*>(data), len);
+        return true;
+    }
+
+    bool receive(uint8_t* data, size_t len) override {
+        if (incoming.size() < len) return false;
+        std::memcpy(data, incoming.data(), len);
+        incoming.erase(0, len);
+        return true;
+    }
+};
+
+// Helper: Build a Command Block Wrapper
+static std::string cbw(uint32_t tag, uint32_t length, bool in, const std::vector<uint8_t>& cdb) {
+    uint8_t w[31] = {};
+    std::memcpy(w, "USBC", 4);
+    std::memcpy(w + 4, &tag, 4);
+    std::memcpy(w + 8, &length, 4);
+    w[12] = in ? 0x80 : 0x00;
+    w[14] = static_cast<uint8_t>(cdb.size());
+    std::memcpy(w + 15, cdb.data(), cdb.size());
+    return std::string(reinterpret_cast<char*>(w), sizeof(w));
+}
+
+// Helper: Receive one endpoint transfer from a stand-in socket
+static std::string transfer(int fd) {
+    std::vector<char> buf(1 << 20);
+    ssize_t n = recv(fd, buf.data(), buf.size(), 0);
+    return n < 0 ? "" : std::string(buf.data(), static_cast<size_t>(n));
+}
+
+// Helper: READ(10) CDB
+static std::vector<uint8_t> read10(uint32_t lba, uint16_t blocks) {
+    return {0x28, 0, static_cast<uint8_t>(lba >> 24), static_cast<uint8_t>(lba >> 16),
+            static_cast<uint8_t>(lba >> 8), static_cast<uint8_t>(lba), 0,
+            static_cast<uint8_t>(blocks >> 8), static_cast<uint8_t>(blocks), 0};
+}
+
+TEST(test_ffs_descriptors) {
+    std::vector<uint8_t> d = ffs_descriptors();
+    // Header (12) + three counts (12) + FS/HS (9+7+7 each) + SS (9+7+6+7+6)
+    ASSERT_EQ(static_cast<size_t>(12 + 12 + 23 + 23 + 35), d.size());
+    ASSERT_EQ(static_cast<uint8_t>(FUNCTIONFS_DESCRIPTORS_MAGIC_V2), d[0]);
+    ASSERT_EQ(static_cast<uint8_t>(d.size()), d[4]);
+
+    // First interface: mass storage, SCSI, Bulk-Only
+    const uint8_t* intf = d.data() + 24;
+    ASSERT_EQ(USB_DT_INTERFACE, static_cast<int>(intf[1]));
+    ASSERT_EQ(USB_CLASS_MASS_STORAGE, static_cast<int>(intf[5]));
+    ASSERT_EQ(0x06, static_cast<int>(intf[6]));
+    ASSERT_EQ(0x50, static_cast<int>(intf[7]));
+    ASSERT_EQ(0x81, static_cast<int>(intf[9 + 2]));
+
+    std::vector<uint8_t> s = ffs_strings();
+    ASSERT_EQ(static_cast<uint8_t>(FUNCTIONFS_STRINGS_MAGIC), s[0]);
+    ASSERT_TRUE(std::string(reinterpret_cast<const char*>(s.data()) + 18) == "isodrive Mass Storage");
+    return true;
+}
+
+TEST(test_ffs_open_endpoints_standin) {
+    TestDir dir("ffs_open");
+    dir.file("ep0", "");
+    dir.file("ep1", "");
+    dir.file("ep2", "");
+
+    FfsEndpoints endpoints;
+    ASSERT_TRUE(ffs_open_endpoints(dir.path, endpoints));
+    ASSERT_TRUE(endpoints.ep0 >= 0 && endpoints.ep_in >= 0 && endpoints.ep_out >= 0);
+    ffs_close_endpoints(endpoints);
+    ASSERT_EQ(-1, endpoints.ep0);
+
+    std::vector<uint8_t> expected = ffs_descriptors();
+    std::vector<uint8_t> strings = ffs_strings();
+    expected.insert(expected.end(), strings.begin(), strings.end());
+    std::ifstream in(dir.path + "/ep0", std::ios::binary);
+    std::string written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ASSERT_TRUE(written == std::string(expected.begin(), expected.end()));
+
+    fs::remove(dir.path + "/ep2");
+    ASSERT_TRUE(!ffs_open_endpoints(dir.path, endpoints));
+    ASSERT_EQ(-1, endpoints.ep0);
+    return true;
+}
+
+TEST(test_image_reader_sequential_and_random) {
+    TestDir dir("ffs_reader");
+    std::string data = pattern(3 * ImageReader::CHUNK_SIZE + 1000);
+    std::string image = dir.file("disk.img", data);
+    int fd = open(image.c_str(), O_RDWR);
+    ASSERT_TRUE(fd >= 0);
+
+    {
+        ImageReader reader(fd, data.size());
+        std::string out;
+        while (out.size() < data.size()) {
+            size_t len = 0;
+            const uint8_t* p = reader.read(out.size(), 70000, len);
+            ASSERT_TRUE(p != nullptr && len > 0);
+            out.append(reinterpret_cast<const char*>(p), len);
+        }
+        ASSERT_TRUE(out == data);
+
+        size_t len = 0;
+        const uint8_t* p = reader.read(ImageReader::CHUNK_SIZE - 10, 100, len);
+        ASSERT_EQ(static_cast<size_t>(10), len);
+        ASSERT_TRUE(std::memcmp(p, data.data() + ImageReader::CHUNK_SIZE - 10, 10) == 0);
+        ASSERT_TRUE(reader.read(data.size(), 1, len) == nullptr);
+
+        // Writes replace cached data
+        ASSERT_TRUE(reader.write(5, reinterpret_cast<const uint8_t*>("hello"), 5));
+        p = reader.read(0, 16, len);
+        ASSERT_TRUE(p != nullptr && std::memcmp(p + 5, "hello", 5) == 0);
+    }
+    close(fd);
+    return true;
+}
+
+TEST(test_scsi_disk_commands) {
+    TestDir dir("ffs_scsi_disk");
+    std::string data = pattern(64 * 512);
+    int fd = open(dir.file("disk.img", data).c_str(), O_RDONLY);
+    ImageReader reader(fd, data.size());
+    ScsiLun lun(reader, false, true);
+    size_t moved = 0;
+
+    MemoryTransfer inquiry;
+    uint8_t inquiry_cdb[6] = {0x12, 0, 0, 0, 36, 0};
+    ASSERT_TRUE(lun.execute(inquiry_cdb, 6, 36, true, inquiry, moved) == ScsiStatus::GOOD);
+    ASSERT_EQ(static_cast<size_t>(36), moved);
+    ASSERT_EQ(0, static_cast<int>(inquiry.sent[0]));
+    ASSERT_EQ(std::string("isodrive"), inquiry.sent.substr(8, 8));
+
+    MemoryTransfer capacity;
+    uint8_t capacity_cdb[10] = {0x25};
+    ASSERT_TRUE(lun.execute(capacity_cdb, 10, 8, true, capacity, moved) == ScsiStatus::GOOD);
+    ASSERT_EQ(63, static_cast<int>(static_cast<uint8_t>(capacity.sent[3])));
+    ASSERT_EQ(2, static_cast<int>(static_cast<uint8_t>(capacity.sent[6])));
+
+    MemoryTransfer read;
+    std::vector<uint8_t> cdb = read10(3, 5);
+    ASSERT_TRUE(lun.execute(cdb.data(), cdb.size(), 5 * 512, true, read, moved) == ScsiStatus::GOOD);
+    ASSERT_TRUE(read.sent == data.substr(3 * 512, 5 * 512));
+
+    // Host buffer smaller than the data: phase error
+    MemoryTransfer small;
+    ASSERT_TRUE(lun.execute(cdb.data(), cdb.size(), 512, true, small, moved) == ScsiStatus::PHASE_ERROR);
+
+    // Reads past the end and writes to a read-only LUN fail with sense data
+    MemoryTransfer none;
+    cdb = read10(63, 2);
+    ASSERT_TRUE(lun.execute(cdb.data(), cdb.size(), 1024, true, none, moved) == ScsiStatus::CHECK_CONDITION);
+    MemoryTransfer sense;
+    uint8_t sense_cdb[6] = {0x03, 0, 0, 0, 18, 0};
+    ASSERT_TRUE(lun.execute(sense_cdb, 6, 18, true, sense, moved) == ScsiStatus::GOOD);
+    ASSERT_EQ(0x05, static_cast<int>(sense.sent[2]));
+    ASSERT_EQ(0x21, static_cast<int>(sense.sent[12]));
+
+    MemoryTransfer write;
+    write.incoming = std::string(512, 'x');
+    uint8_t write_cdb[10] = {0x2a, 0, 0, 0, 0, 0, 0, 0, 1, 0};
+    ASSERT_TRUE(lun.execute(write_cdb, 10, 512, false, write, moved) == ScsiStatus::CHECK_CONDITION);
+    sense.sent.clear();
+    lun.execute(sense_cdb, 6, 18, true, sense, moved);
+    ASSERT_EQ(0x07, static_cast<int>(sense.sent[2]));
+
+    // Unknown opcode
+    uint8_t unknown[6] = {0xd7};
+    ASSERT_TRUE(lun.execute(unknown, 6, 0, false, none, moved) == ScsiStatus::CHECK_CONDITION);
+    close(fd);
+    return true;
+}
+
+TEST(test_scsi_cdrom_commands) {
+    TestDir dir("ffs_scsi_cdrom");
+    std::string data = pattern(100 * 2048);
+    int fd = open(dir.file("cd.iso", data).c_str(), O_RDONLY);
+    ImageReader reader(fd, data.size());
+    ScsiLun lun(reader, true, true);
+    ASSERT_EQ(2048u, lun.block_size());
+    ASSERT_EQ(static_cast<uint64_t>(100), lun.block_count());
+    size_t moved = 0;
+
+    MemoryTransfer toc;
+    uint8_t toc_cdb[10] = {0x43, 0, 0, 0, 0, 0, 0, 0, 0xff, 0};
+    ASSERT_TRUE(lun.execute(toc_cdb, 10, 0xff, true, toc, moved) == ScsiStatus::GOOD);
+    ASSERT_EQ(static_cast<size_t>(20), toc.sent.size());
+    ASSERT_EQ(1, static_cast<int>(toc.sent[6]));                             // Track 1
+    ASSERT_EQ(0xaa, static_cast<int>(static_cast<uint8_t>(toc.sent[14])));  // Lead-out
+    ASSERT_EQ(100, static_cast<int>(toc.sent[19]));                         // at LBA 100
+
+    MemoryTransfer config;
+    uint8_t config_cdb[10] = {0x46, 0, 0, 0, 0, 0, 0, 0, 16, 0};
+    ASSERT_TRUE(lun.execute(config_cdb, 10, 16, true, config, moved) == ScsiStatus::GOOD);
+    ASSERT_EQ(0x08, static_cast<int>(config.sent[7]));  // CD-ROM profile
+
+    MemoryTransfer read;
+    std::vector<uint8_t> cdb = read10(99, 1);
+    ASSERT_TRUE(lun.execute(cdb.data(), cdb.size(), 2048, true, read, moved) == ScsiStatus::GOOD);
+    ASSERT_TRUE(read.sent == data.substr(99 * 2048));
+
+    // Ejecting through START STOP UNIT empties the drive
+    MemoryTransfer none;
+    uint8_t eject[6] = {0x1b, 0, 0, 0, 0x02, 0};
+    uint8_t tur[6] = {0x00};
+    ASSERT_TRUE(lun.execute(eject, 6, 0, false, none, moved) == ScsiStatus::GOOD);
+    ASSERT_TRUE(lun.execute(tur, 6, 0, false, none, moved) == ScsiStatus::CHECK_CONDITION);
+    close(fd);
+    return true;
+}
+
+TEST(test_bot_server_over_standin_endpoints) {
+    TestDir dir("ffs_bot");
+    std::string data = pattern(256 * 512);
+    std::string image = dir.file("disk.img", data);
+    int fd = open(image.c_str(), O_RDWR);
+
+    // Host-side and device-side ends of each endpoint
+    int ep0[2], in[2], out[2];
+    ASSERT_TRUE(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, ep0) == 0);
+    ASSERT_TRUE(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, in) == 0);
+    ASSERT_TRUE(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, out) == 0);
+    FfsEndpoints endpoints;
+    endpoints.ep0 = ep0[1];
+    endpoints.ep_in = in[1];
+    endpoints.ep_out = out[1];
+
+    ImageReader reader(fd, data.size());
+    ScsiLun lun(reader, false, false);
+    BotServer server(endpoints, lun);
+    std::thread serving([&]() { server.serve(); });
+
+    // Get Max LUN on ep0
+    struct usb_functionfs_event event = {};
+    event.type = FUNCTIONFS_SETUP;
+    event.u.setup.bRequestType = USB_DIR_IN | USB_TYPE_CLASS | USB_RECIP_INTERFACE;
+    event.u.setup.bRequest = 0xfe;
+    event.u.setup.wLength = 1;
+    ASSERT_TRUE(write(ep0[0], &event, sizeof(event)) == static_cast<ssize_t>(sizeof(event)));
+    ASSERT_TRUE(transfer(ep0[0]) == std::string(1, '\0'));
+
+    // READ(10): data transfer then a passing CSW with the tag echoed
+    std::string command = cbw(7, 16 * 512, true, read10(10, 16));
+    ASSERT_TRUE(write(out[0], command.data(), command.size()) == 31);
+    ASSERT_TRUE(transfer(in[0]) == data.substr(10 * 512, 16 * 512));
+    std::string csw = transfer(in[0]);
+    ASSERT_EQ(static_cast<size_t>(13), csw.size());
+    ASSERT_EQ(std::string("USBS"), csw.substr(0, 4));
+    ASSERT_EQ(7, static_cast<int>(csw[4]));
+    ASSERT_EQ(0, static_cast<int>(csw[12]));
+
+    // INQUIRY into a larger host buffer: short transfer and a residue
+    command = cbw(8, 512, true, {0x12, 0, 0, 0, 36, 0});
+    ASSERT_TRUE(write(out[0], command.data(), command.size()) == 31);
+    ASSERT_EQ(static_cast<size_t>(36), transfer(in[0]).size());
+    csw = transfer(in[0]);
+    ASSERT_EQ(512 - 36, static_cast<int>(static_cast<uint8_t>(csw[8])) | (static_cast<uint8_t>(csw[9]) << 8));
+
+    // WRITE(10) from the host lands in the image
+    command = cbw(9, 1024, false, {0x2a, 0, 0, 0, 0, 4, 0, 0, 2, 0});
+    std::string payload(1024, 'w');
+    ASSERT_TRUE(write(out[0], command.data(), command.size()) == 31);
+    ASSERT_TRUE(write(out[0], payload.data(), payload.size()) == 1024);
+    csw = transfer(in[0]);
+    ASSERT_EQ(0, static_cast<int>(csw[12]));
+    char written[1024];
+    ASSERT_TRUE(pread(fd, written, sizeof(written), 4 * 512) == 1024);
+    ASSERT_TRUE(std::string(written, sizeof(written)) == payload);
+
+    // Unsupported command: failed CSW, no data
+    command = cbw(10, 0, false, {0xd7, 0, 0, 0, 0, 0});
+    ASSERT_TRUE(write(out[0], command.data(), command.size()) == 31);
+    csw = transfer(in[0]);
+    ASSERT_EQ(1, static_cast<int>(csw[12]));
+
+    server.stop();
+    serving.join();
+    ASSERT_EQ(static_cast<uint64_t>(4), server.commands());
+
+    for (int* pair : {ep0, in, out}) {
+        close(pair[0]);
+        close(pair[1]);
+    }
+    close(fd);
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
@@ -0,0 +1,104 @@
+#ifndef TEST_FIXTURES_H
+#define TEST_FIXTURES_H
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include "../src/include/probecache.h"
+
+/**
+ * @file test_fixtures.h
+ * @brief Temporary directories and image builders shared by the tests.
+ */
+
+/**
+ * @class TestDir
+ * @brief Temporary directory that also serves as the state directory.
+ *
+ * Created empty as /tmp/isodrive_test_<name>, with probe_cache_dir()
+ * pointed at its "state" subdirectory, and removed on destruction.
+ * Every test that touches isodrive's state uses it, or a fixture
+ * derived from it, so no test reads or writes the real state directory.
+ */
+class TestDir {
+public:
+    std::string path;
+
+    explicit TestDir(const std::string& name) : path("/tmp/isodrive_test_" + name) {
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+        probe_cache_set_dir(path + "/state");
+    }
+
+    ~TestDir() {
+        probe_cache_set_dir("");
+        std::filesystem::remove_all(path);
+    }
+
+    TestDir(const TestDir&) = delete;
+    TestDir& operator=(const TestDir&) = delete;
+
+    /**
+     * @brief Write a file in the directory, creating its parent directories.
+     *
+     * @param name File name relative to the directory.
+     * @param content File contents.
+     * @return Full path of the file.
+     */
+    std::string file(const std::string& name, const std::string& content) {
+        std::filesystem::path full = std::filesystem::path(path) / name;
+        std::filesystem::create_directories(full.parent_path());
+        std::ofstream f(full, std::ios::binary);
+        f << content;
+        return full.string();
+    }
+
+    /**
+     * @brief Create a subdirectory and its parents.
+     *
+     * @param name Directory name relative to the directory.
+     * @return Full path of the subdirectory.
+     */
+    std::string dir(const std::string& name) {
+        std::filesystem::path full = std::filesystem::path(path) / name;
+        std::filesystem::create_directories(full);
+        return full.string();
+    }
+};
+
+// Helper: Little-endian stores into an image buffer
+inline void put16(std::string& data, size_t pos, uint16_t v) {
+    data[pos] = static_cast<char>(v);
+    data[pos + 1] = static_cast<char>(v >> 8);
+}
+
+inline void put32(std::string& data, size_t pos, uint32_t v) {
+    put16(data, pos, static_cast<uint16_t>(v));
+    put16(data, pos + 2, static_cast<uint16_t>(v >> 16));
+}
+
+inline void put64(std::string& data, size_t pos, uint64_t v) {
+    put32(data, pos, static_cast<uint32_t>(v));
+    put32(data, pos + 4, static_cast<uint32_t>(v >> 32));
+}
+
+// Helper: Minimal ISO 9660 image with the given label
+inline std::string create_labeled_iso(const std::string& filename, const std::string& label) {
+    std::ofstream f(filename, std::ios::binary);
+    char sector[2048];
+    memset(sector, 0, sizeof(sector));
+    for (int i = 0; i < 16; i++) {
+        f.write(sector, sizeof(sector));
+    }
+    sector[0] = 1;
+    memcpy(sector + 1, "CD001", 5);
+    std::string vol_id = label;
+    vol_id.resize(32, ' ');
+    memcpy(sector + 40, vol_id.data(), 32);
+    f.write(sector, sizeof(sector));
+    return filename;
+}
+
+#endif // ifndef TEST_FIXTURES_H
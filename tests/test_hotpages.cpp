@@ -0,0 +1,200 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/hotpages.h"
+#include "../src/include/logger.h"
+#include "../src/include/probecache.h"
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Helper: Test directory whose files are fully resident
+class HotPagesDir : public TestDir {
+public:
+    explicit HotPagesDir(const std::string& name) : TestDir("hotpages_" + name) {}
+
+    // Written through the page cache, so the whole file is resident
+    std::string file(const std::string& name, size_t size) {
+        return TestDir::file(name, std::string(size, 'i'));
+    }
+};
+
+// Helper: Number of files in a directory
+static size_t count_files(const std::string& dir) {
+    std::error_code ec;
+    size_t count = 0;
+    for (auto it = fs::directory_iterator(dir, ec); !ec && it != fs::directory_iterator(); ++it) {
+        count++;
+    }
+    return count;
+}
+
+TEST(test_hot_pages_from_residency) {
+    // Short holes are bridged, long ones split the run; only bit 0 counts
+    std::vector<unsigned char> residency(80, 0);
+    residency[0] = 1;
+    residency[1] = 1;
+    residency[5] = 0x81;
+    residency[30] = 2;
+    residency[40] = 1;
+    residency[79] = 1;
+
+    std::vector<PageRange> ranges;
+    hot_pages_from_residency(residency.data(), residency.size(), 4096, ranges);
+    ASSERT_EQ(static_cast<size_t>(3), ranges.size());
+    ASSERT_TRUE(ranges[0] == (PageRange{0, 6 * 4096}));
+    ASSERT_TRUE(ranges[1] == (PageRange{40 * 4096, 4096}));
+    ASSERT_TRUE(ranges[2] == (PageRange{79 * 4096, 4096}));
+
+    std::vector<unsigned char> cold(10, 0);
+    hot_pages_from_residency(cold.data(), cold.size(), 4096, ranges);
+    ASSERT_TRUE(ranges.empty());
+    return true;
+}
+
+TEST(test_hot_pages_snapshot_resident_file) {
+    HotPagesDir dir("snapshot");
+    std::string image = dir.file("disk.img", (1 << 20) + 100);
+
+    std::vector<PageRange> ranges;
+    ASSERT_TRUE(hot_pages_snapshot(image, ranges));
+    ASSERT_TRUE(!ranges.empty());
+    uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t limit = ((1 << 20) + 100 + page - 1) / page * page;
+    for (const PageRange& range : ranges) {
+        ASSERT_EQ(static_cast<uint64_t>(0), range.offset % page);
+        ASSERT_TRUE(range.length > 0 && range.offset + range.length <= limit);
+    }
+
+    std::string empty = dir.file("empty.img", 0);
+    ASSERT_TRUE(hot_pages_snapshot(empty, ranges));
+    ASSERT_TRUE(ranges.empty());
+    ASSERT_TRUE(!hot_pages_snapshot(dir.path + "/missing.img", ranges));
+    ASSERT_TRUE(!hot_pages_snapshot(dir.path, ranges));
+    return true;
+}
+
+TEST(test_hot_pages_save_and_load) {
+    HotPagesDir dir("save");
+    std::string image = dir.file("disk.img", 64 << 10);
+    ImageKey key;
+    ASSERT_TRUE(image_key(image, key));
+
+    std::vector<PageRange> saved = {{0, 8192, 0}, {32768, 4096, 3}};
+    ASSERT_TRUE(hot_pages_save(key, saved));
+    std::vector<PageRange> loaded;
+    ASSERT_TRUE(hot_pages_load(key, loaded));
+    ASSERT_TRUE(loaded == saved);
+
+    // A modified image has no map, and saving its map drops the old one
+    ImageKey modified = key;
+    modified.mtime_nsec++;
+    ASSERT_TRUE(!hot_pages_load(modified, loaded));
+    ASSERT_TRUE(hot_pages_save(modified, saved));
+    ASSERT_EQ(static_cast<size_t>(1), count_files(hot_pages_dir()));
+    ASSERT_TRUE(!hot_pages_load(key, loaded));
+
+    // Unordered or out-of-range entries reject the whole map
+    std::string path = hot_pages_dir() + "/" + image_key_name(modified) + ".pages";
+    {
+        std::ofstream f(path);
+        f << "isodrive-hot-pages 2\n8192 4096 0\n0 4096 0\n";
+    }
+    ASSERT_TRUE(!hot_pages_load(modified, loaded));
+    {
+        std::ofstream f(path);
+        f << "isodrive-hot-pages 2\n" << (1 << 20) << " 4096 0\n";
+    }
+    ASSERT_TRUE(!hot_pages_load(modified, loaded));
+    return true;
+}
+
+TEST(test_hot_pages_record_and_prefetch) {
+    HotPagesDir dir("prefetch");
+    std::string image = dir.file("disk.img", 256 << 10);
+    ImageKey key;
+    ASSERT_TRUE(image_key(image, key));
+
+    // Nothing recorded yet, and without a baseline residency alone teaches nothing
+    ASSERT_EQ(static_cast<uint64_t>(0), hot_pages_prefetch(image));
+    ASSERT_TRUE(!hot_pages_record(image));
+
+    // Known hot pages that are still resident stay in the map, one session older
+    ASSERT_TRUE(hot_pages_save(key, {{0, 8192}}));
+    ASSERT_TRUE(hot_pages_record(image));
+    std::vector<PageRange> loaded;
+    ASSERT_TRUE(hot_pages_load(key, loaded));
+    ASSERT_EQ(static_cast<size_t>(1), loaded.size());
+    ASSERT_TRUE(loaded[0] == (PageRange{0, 8192, 1}));
+
+    ASSERT_EQ(static_cast<uint64_t>(8192), hot_pages_prefetch(image));
+    ASSERT_EQ(static_cast<uint64_t>(4096), hot_pages_prefetch(image, 4096));
+    return true;
+}
+
+TEST(test_hot_pages_record_drops_stale_ranges) {
+    HotPagesDir dir("aging");
+    std::string image = dir.file("disk.img", 256 << 10);
+    ImageKey key;
+    ASSERT_TRUE(image_key(image, key));
+
+    // Resident only because it is prefetched, never faulted in by the
+    // host: the range ages each session and is then dropped
+    ASSERT_TRUE(hot_pages_save(key, {{0, 8192}, {128 << 10, 4096, HOT_PAGES_MAX_AGE}}));
+    std::vector<PageRange> loaded;
+    for (uint32_t age = 1; age <= HOT_PAGES_MAX_AGE; age++) {
+        ASSERT_TRUE(hot_pages_record(image));
+        ASSERT_TRUE(hot_pages_load(key, loaded));
+        ASSERT_EQ(static_cast<size_t>(1), loaded.size());
+        ASSERT_TRUE(loaded[0] == (PageRange{0, 8192, age}));
+    }
+    ASSERT_TRUE(!hot_pages_record(image));
+    ASSERT_TRUE(!hot_pages_load(key, loaded));
+    ASSERT_EQ(static_cast<uint64_t>(0), hot_pages_prefetch(image));
+    return true;
+}
+
+TEST(test_hot_pages_record_ignores_baseline) {
+    HotPagesDir dir("baseline");
+    std::string image = dir.file("disk.img", 256 << 10);
+
+    // Everything was resident before the session, so nothing is hot
+    ASSERT_TRUE(hot_pages_mark_baseline(image));
+    ASSERT_EQ(static_cast<size_t>(1), count_files(hot_pages_dir()));
+    ASSERT_TRUE(!hot_pages_record(image));
+    ASSERT_EQ(static_cast<size_t>(0), count_files(hot_pages_dir()));
+
+    // Where the page cache can be dropped (not tmpfs), pages read during
+    // the session are learned
+    int fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+    ASSERT_TRUE(fd >= 0);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    std::vector<PageRange> resident;
+    ASSERT_TRUE(hot_pages_snapshot(image, resident));
+    if (resident.empty()) {
+        ASSERT_TRUE(hot_pages_mark_baseline(image));
+        char buf[4096];
+        ASSERT_EQ(static_cast<ssize_t>(sizeof(buf)), pread(fd, buf, sizeof(buf), 64 << 10));
+        ASSERT_TRUE(hot_pages_record(image));
+
+        ImageKey key;
+        std::vector<PageRange> loaded;
+        ASSERT_TRUE(image_key(image, key) && hot_pages_load(key, loaded));
+        ASSERT_TRUE(!loaded.empty());
+        ASSERT_TRUE(loaded.back().offset + loaded.back().length <= static_cast<uint64_t>(256 << 10));
+    }
+    close(fd);
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
@@ -0,0 +1,368 @@
+#include "simple_test.h"
+#include "../src/include/iso9660.h"
+#include "../src/include/imageprobe.h"
+#include "../src/include/logger.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Sector layout of the synthetic image
+//   16 PVD, 17 El Torito boot record, 18 Joliet SVD (optional), 19 terminator
+//   20 path table, 21 Joliet path table
+//   22-25 primary directories (root, EFI, EFI/BOOT, SOURCES)
+//   26-29 Joliet directories
+//   30 bootx64.efi, 31-32 install.wim, 33 readme
+struct IsoLayout {
+    bool joliet = false;
+    bool rock_ridge = false;
+    bool bootx64 = true;
+    bool install_wim = true;
+    std::string label = "TEST_ISO";
+};
+
+class IsoBuilder {
+public:
+    std::vector<unsigned char> data;
+
+    IsoBuilder() : data(34 * 2048, 0) {}
+
+    unsigned char* sector(uint32_t lba) { return &data[lba * 2048]; }
+
+    static void both16(unsigned char* p, uint16_t v) {
+        p[0] = v & 0xFF; p[1] = v >> 8; p[2] = v >> 8; p[3] = v & 0xFF;
+    }
+
+    static void both32(unsigned char* p, uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            p[i] = (v >> (8 * i)) & 0xFF;
+            p[7 - i] = (v >> (8 * i)) & 0xFF;
+        }
+    }
+
+    static void le32(unsigned char* p, uint32_t v) {
+        for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF;
+    }
+
+    static std::string ucs2(const std::string& s) {
+        std::string out;
+        for (char c : s) { out += '\0'; out += c; }
+        return out;
+    }
+
+    // Append a directory record and return the new write position
+    size_t record(uint32_t dir_lba, size_t pos, uint32_t extent, uint32_t len, uint8_t flags,
+                  const std::string& id, const std::string& su = "") {
+        size_t id_len = id.size();
+        size_t rec_len = 33 + id_len + (id_len % 2 == 0 ? 1 : 0) + su.size();
+        rec_len += rec_len % 2;
+        unsigned char* r = sector(dir_lba) + pos;
+        r[0] = static_cast<unsigned char>(rec_len);
+        both32(r + 2, extent);
+        both32(r + 10, len);
+        r[25] = flags;
+        both16(r + 28, 1);
+        r[32] = static_cast<unsigned char>(id_len);
+        memcpy(r + 33, id.data(), id_len);
+        memcpy(r + 33 + id_len + (id_len % 2 == 0 ? 1 : 0), su.data(), su.size());
+        return pos + rec_len;
+    }
+
+    size_t dots(uint32_t lba, uint32_t parent, const std::string& su = "") {
+        size_t pos = record(lba, 0, lba, 2048, 0x02, std::string(1, '\0'), su);
+        return record(lba, pos, parent, 2048, 0x02, std::string(1, '\1'));
+    }
+
+    void descriptor(uint32_t lba, uint8_t type, const std::string& label, uint32_t root,
+                    uint32_t pt_lba, uint32_t pt_size, bool joliet) {
+        unsigned char* vd = sector(lba);
+        vd[0] = type;
+        memcpy(vd + 1, "CD001", 5);
+        vd[6] = 1;
+        std::string vol_id = label;
+        vol_id.resize(32, ' ');
+        memcpy(vd + 40, vol_id.data(), 32);
+        both32(vd + 80, static_cast<uint32_t>(data.size() / 2048));
+        if (joliet) memcpy(vd + 88, "%/E", 3);
+        both16(vd + 128, 2048);
+        both32(vd + 132, pt_size);
+        le32(vd + 140, pt_lba);
+        unsigned char* r = vd + 156;
+        r[0] = 34;
+        both32(r + 2, root);
+        both32(r + 10, 2048);
+        r[25] = 0x02;
+        r[32] = 1;
+    }
+
+    uint32_t path_table(uint32_t lba, const std::vector<std::pair<std::string, std::pair<uint32_t, uint16_t>>>& dirs) {
+        unsigned char* p = sector(lba);
+        size_t pos = 0;
+        for (const auto& d : dirs) {
+            const std::string& name = d.first;
+            p[pos] = static_cast<unsigned char>(name.size());
+            le32(p + pos + 2, d.second.first);
+            p[pos + 6] = d.second.second & 0xFF;
+            p[pos + 7] = d.second.second >> 8;
+            memcpy(p + pos + 8, name.data(), name.size());
+            pos += 8 + name.size() + (name.size() % 2);
+        }
+        return static_cast<uint32_t>(pos);
+    }
+
+    static std::string rr_name(const std::string& name) {
+        std::string nm = "NM";
+        nm += static_cast<char>(5 + name.size());
+        nm += '\1';
+        nm += '\0';
+        return nm + name;
+    }
+
+    std::string build(const IsoLayout& layout) {
+        std::string sp;
+        if (layout.rock_ridge) {
+            sp = std::string("SP\7\1\xBE\xEF\0", 7);
+        }
+
+        // Primary tree
+        uint32_t pt_size = path_table(20, {
+            {std::string(1, '\0'), {22, 1}}, {"EFI", {23, 1}}, {"SOURCES", {25, 1}}, {"BOOT", {24, 2}}});
+        descriptor(16, 1, layout.label, 22, 20, pt_size, false);
+
+        unsigned char* boot = sector(17);
+        memcpy(boot + 1, "CD001", 5);
+        boot[6] = 1;
+        memcpy(boot + 7, "EL TORITO SPECIFICATION", 23);
+
+        size_t pos = dots(22, 22, sp);
+        pos = record(22, pos, 23, 2048, 0x02, "EFI");
+        pos = record(22, pos, 33, 100, 0x00, "README.TXT;1",
+                     layout.rock_ridge ? rr_name("Readme-Long-Name.txt") : "");
+        record(22, pos, 25, 2048, 0x02, "SOURCES");
+
+        pos = dots(23, 22);
+        record(23, pos, 24, 2048, 0x02, "BOOT");
+
+        pos = dots(24, 23);
+        if (layout.bootx64) record(24, pos, 30, 2048, 0x00, "BOOTX64.EFI;1");
+
+        pos = dots(25, 22);
+        if (layout.install_wim) {
+            pos = record(25, pos, 31, 2048, 0x80, "INSTALL.WIM;1");
+            record(25, pos, 32, 1000, 0x00, "INSTALL.WIM;1");
+        }
+
+        // Joliet tree
+        if (layout.joliet) {
+            uint32_t jpt_size = path_table(21, {
+                {std::string(1, '\0'), {26, 1}}, {ucs2("efi"), {27, 1}}, {ucs2("sources"), {29, 1}},
+                {ucs2("boot"), {28, 2}}});
+            descriptor(18, 2, layout.label, 26, 21, jpt_size, true);
+
+            pos = dots(26, 26);
+            pos = record(26, pos, 27, 2048, 0x02, ucs2("efi"));
+            pos = record(26, pos, 33, 100, 0x00, ucs2("Long Joliet Name.txt;1"));
+            record(26, pos, 29, 2048, 0x02, ucs2("sources"));
+
+            pos = dots(27, 26);
+            record(27, pos, 28, 2048, 0x02, ucs2("boot"));
+
+            pos = dots(28, 27);
+            if (layout.bootx64) record(28, pos, 30, 2048, 0x00, ucs2("bootx64.efi;1"));
+
+            pos = dots(29, 26);
+            if (layout.install_wim) {
+                pos = record(29, pos, 31, 2048, 0x80, ucs2("install.wim;1"));
+                record(29, pos, 32, 1000, 0x00, ucs2("install.wim;1"));
+            }
+        }
+
+        unsigned char* term = sector(19);
+        term[0] = 255;
+        memcpy(term + 1, "CD001", 5);
+
+        std::string filename = "temp_test_tree.iso";
+        std::ofstream f(filename, std::ios::binary);
+        f.write(reinterpret_cast<const char*>(data.data()), data.size());
+        return filename;
+    }
+};
+
+static std::string build_iso(const IsoLayout& layout) {
+    IsoBuilder builder;
+    return builder.build(layout);
+}
+
+// =============================================================================
+// Path lookups
+// =============================================================================
+
+TEST(test_iso9660_plain_lookup) {
+    std::string filename = build_iso(IsoLayout());
+    ImageProbe probe(filename);
+    Iso9660Reader iso(probe);
+
+    ASSERT_TRUE(iso.valid());
+    ASSERT_TRUE(!iso.joliet());
+    ASSERT_TRUE(!iso.rock_ridge());
+
+    IsoFileInfo info;
+    ASSERT_TRUE(iso.lookup("/efi/boot/bootx64.efi", info));
+    ASSERT_TRUE(!info.is_dir);
+    ASSERT_EQ(2048u, info.size);
+    ASSERT_EQ(1u, info.extents.size());
+    ASSERT_EQ(30u, info.extents[0].lba);
+
+    ASSERT_TRUE(iso.exists("/EFI/BOOT/BOOTX64.EFI"));
+    ASSERT_TRUE(iso.exists("/efi/boot"));
+    ASSERT_TRUE(!iso.exists("/efi/boot/bootaa64.efi"));
+    ASSERT_TRUE(!iso.exists("/missing/bootx64.efi"));
+    fs::remove(filename);
+    return true;
+}
+
+TEST(test_iso9660_multi_extent) {
+    std::string filename = build_iso(IsoLayout());
+    ImageProbe probe(filename);
+    Iso9660Reader iso(probe);
+
+    IsoFileInfo info;
+    ASSERT_TRUE(iso.lookup("/sources/install.wim", info));
+    ASSERT_EQ(2u, info.extents.size());
+    ASSERT_EQ(31u, info.extents[0].lba);
+    ASSERT_EQ(32u, info.extents[1].lba);
+    ASSERT_EQ(3048u, info.size);
+    fs::remove(filename);
+    return true;
+}
+
+TEST(test_iso9660_joliet_names) {
+    IsoLayout layout;
+    layout.joliet = true;
+    std::string filename = build_iso(layout);
+    ImageProbe probe(filename);
+    Iso9660Reader iso(probe);
+
+    ASSERT_TRUE(iso.valid());
+    ASSERT_TRUE(iso.joliet());
+    ASSERT_TRUE(iso.exists("/Long Joliet Name.txt"));
+    ASSERT_TRUE(iso.exists("/efi/boot/bootx64.efi"));
+
+    IsoFileInfo info;
+    ASSERT_TRUE(iso.lookup("/sources/install.wim", info));
+    ASSERT_EQ(3048u, info.size);
+    fs::remove(filename);
+    return true;
+}
+
+TEST(test_iso9660_rock_ridge_names) {
+    IsoLayout layout;
+    layout.rock_ridge = true;
+    layout.joliet = true;
+    std::string filename = build_iso(layout);
+    ImageProbe probe(filename);
+    Iso9660Reader iso(probe);
+
+    // Rock Ridge takes precedence over Joliet
+    ASSERT_TRUE(iso.rock_ridge());
+    ASSERT_TRUE(!iso.joliet());
+
+    IsoFileInfo info;
+    ASSERT_TRUE(iso.lookup("/Readme-Long-Name.txt", info));
+    ASSERT_EQ(std::string("readme-long-name.txt"), info.name);
+    ASSERT_EQ(100u, info.size);
+    ASSERT_TRUE(!iso.exists("/readme.txt"));
+    fs::remove(filename);
+    return true;
+}
+
+TEST(test_iso9660_malformed_record) {
+    std::string filename = build_iso(IsoLayout());
+    {
+        // Give the root's "EFI" record a name longer than the record itself
+        std::fstream f(filename, std::ios::binary | std::ios::in | std::ios::out);
+        std::vector<char> dir(2048);
+        f.seekg(22 * 2048);
+        f.read(dir.data(), dir.size());
+        size_t pos = static_cast<unsigned char>(dir[0]);
+        pos += static_cast<unsigned char>(dir[pos]);
+        ASSERT_EQ(std::string("EFI"), std::string(&dir[pos + 33], 3));
+        f.seekp(22 * 2048 + pos + 32);
+        f.put(static_cast<char>(255));
+    }
+    ImageProbe probe(filename);
+    Iso9660Reader iso(probe);
+    ASSERT_TRUE(iso.valid());
+    ASSERT_TRUE(!iso.exists("/readme.txt"));
+    fs::remove(filename);
+    return true;
+}
+
+TEST(test_iso9660_not_iso) {
+    std::string filename = "temp_not_iso.img";
+    {
+        std::ofstream f(filename, std::ios::binary);
+        std::vector<char> zeros(40 * 2048, 0);
+        f.write(zeros.data(), zeros.size());
+    }
+    ImageProbe probe(filename);
+    Iso9660Reader iso(probe);
+    ASSERT_TRUE(!iso.valid());
+    ASSERT_TRUE(!iso.exists("/efi/boot/bootx64.efi"));
+    fs::remove(filename);
+    return true;
+}
+
+// =============================================================================
+// Detection driven by directory lookups
+// =============================================================================
+
+TEST(test_probe_windows_by_install_wim) {
+    IsoLayout layout;
+    layout.label = "ESD_INSTALL";
+    std::string filename = build_iso(layout);
+    ImageProbeResult result = probe_image(filename);
+    fs::remove(filename);
+
+    ASSERT_TRUE(result.windows.is_windows);
+    ASSERT_TRUE(result.windows.has_uefi);
+    ASSERT_TRUE(result.windows.has_legacy);
+    return true;
+}
+
+TEST(test_probe_windows_without_efi_loader) {
+    IsoLayout layout;
+    layout.label = "WIN10_X64";
+    layout.bootx64 = false;
+    std::string filename = build_iso(layout);
+    ImageProbeResult result = probe_image(filename);
+    fs::remove(filename);
+
+    ASSERT_TRUE(result.windows.is_windows);
+    ASSERT_TRUE(result.windows.has_legacy);
+    ASSERT_TRUE(!result.windows.has_uefi);
+    return true;
+}
+
+TEST(test_probe_linux_tree_not_windows) {
+    IsoLayout layout;
+    layout.label = "ARCH_202401";
+    layout.install_wim = false;
+    std::string filename = build_iso(layout);
+    ImageProbeResult result = probe_image(filename);
+    fs::remove(filename);
+
+    ASSERT_TRUE(result.is_iso9660);
+    ASSERT_TRUE(!result.windows.is_windows);
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
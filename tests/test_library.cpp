@@ -0,0 +1,114 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/library.h"
+#include "../src/include/logger.h"
+#include "../src/include/probecache.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Helper: Test directory with two library directories in it
+class LibraryDir : public TestDir {
+public:
+    LibraryDir() : TestDir("library") {
+        fs::create_directories(path + "/isos");
+        fs::create_directories(path + "/other");
+    }
+};
+
+// Helper: Minimal ISO 9660 image with the given label
+TEST(test_library_is_image) {
+    ASSERT_TRUE(library_is_image("ubuntu.iso"));
+    ASSERT_TRUE(library_is_image("DISK.IMG"));
+    ASSERT_TRUE(library_is_image("floppy.ima"));
+    ASSERT_TRUE(!library_is_image("ubuntu.iso.sha256"));
+    ASSERT_TRUE(!library_is_image("disk.img.zst"));
+    ASSERT_TRUE(!library_is_image(".hidden.iso"));
+    ASSERT_TRUE(!library_is_image("SHA256SUMS"));
+    return true;
+}
+
+TEST(test_library_incremental_scan) {
+    LibraryDir dir;
+    std::string isos = dir.path + "/isos";
+    for (int i = 0; i < 12; i++) {
+        create_labeled_iso(isos + "/image" + std::to_string(i + 10) + ".iso", "LABEL_" + std::to_string(i + 10));
+    }
+    create_labeled_iso(isos + "/win.iso", "WIN11_23H2");
+    std::ofstream(isos + "/notes.txt") << "not an image";
+
+    std::vector<LibraryEntry> entries;
+    LibraryScanStats stats;
+    ASSERT_TRUE(scan_library(isos, entries, stats, 4));
+    ASSERT_EQ(static_cast<size_t>(13), entries.size());
+    ASSERT_EQ(static_cast<size_t>(13), stats.probed);
+    ASSERT_EQ(std::string("LABEL_10"), entries[0].result.windows.volume_label);
+    ASSERT_TRUE(entries[12].result.windows.is_windows);
+    ASSERT_TRUE(entries[12].result.windows.version == WindowsVersion::WIN11);
+
+    // An unchanged library is answered from the index without rewriting it
+    std::string index = dir.path + "/state/library.index";
+    auto written = fs::last_write_time(index);
+    ASSERT_TRUE(scan_library(isos, entries, stats));
+    ASSERT_EQ(static_cast<size_t>(0), stats.probed);
+    ASSERT_EQ(static_cast<size_t>(13), stats.indexed);
+    ASSERT_EQ(std::string("WIN11_23H2"), entries[12].result.windows.volume_label);
+    ASSERT_TRUE(written == fs::last_write_time(index));
+
+    // Only the changed image is probed again
+    create_labeled_iso(isos + "/image10.iso", "RELABELED");
+    fs::last_write_time(isos + "/image10.iso", written + std::chrono::seconds(5));
+    ASSERT_TRUE(scan_library(isos, entries, stats));
+    ASSERT_EQ(static_cast<size_t>(1), stats.probed);
+    ASSERT_EQ(std::string("RELABELED"), entries[0].result.windows.volume_label);
+
+    // Another library shares the index; removing images drops only theirs
+    create_labeled_iso(dir.path + "/other/extra.img", "EXTRA");
+    ASSERT_TRUE(scan_library(dir.path + "/other", entries, stats));
+    ASSERT_EQ(static_cast<size_t>(1), stats.probed);
+    fs::remove(isos + "/image11.iso");
+    ASSERT_TRUE(scan_library(isos, entries, stats));
+    ASSERT_EQ(static_cast<size_t>(12), entries.size());
+    ASSERT_EQ(static_cast<size_t>(0), stats.probed);
+    ASSERT_TRUE(scan_library(dir.path + "/other", entries, stats));
+    ASSERT_EQ(static_cast<size_t>(1), stats.indexed);
+
+    ASSERT_TRUE(!scan_library(dir.path + "/missing", entries, stats));
+    return true;
+}
+
+TEST(test_library_output) {
+    LibraryDir dir;
+    create_labeled_iso(dir.path + "/isos/win.iso", "WIN10_X64");
+    std::ofstream(dir.path + "/isos/blank.img") << std::string(100, '\0');
+
+    std::vector<LibraryEntry> entries;
+    LibraryScanStats stats;
+    ASSERT_TRUE(scan_library(dir.path + "/isos", entries, stats));
+    ASSERT_EQ(static_cast<size_t>(2), entries.size());
+
+    std::string table = library_to_table(entries);
+    ASSERT_TRUE(table.compare(0, 4, "FILE") == 0);
+    ASSERT_TRUE(table.find("win.iso    WIN10_X64  10") != std::string::npos);
+    ASSERT_TRUE(table.find("34.0 KiB") != std::string::npos);
+    ASSERT_TRUE(table.find("100 B") != std::string::npos);
+
+    std::string json = library_to_json(entries);
+    ASSERT_TRUE(json.find("\"label\":\"WIN10_X64\",\"iso9660\":true,\"windows\":true,"
+                          "\"windows_version\":\"10\"") != std::string::npos);
+    ASSERT_TRUE(json.find("\"windows_version\":null") != std::string::npos);
+    ASSERT_EQ(std::string("[]\n"), library_to_json({}));
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
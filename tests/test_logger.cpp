@@ -0,0 +1,109 @@
+#include "simple_test.h"
+#include "../src/include/logger.h"
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static const std::string LOG_PATH = "/tmp/isodrive_test_logger.jsonl";
+
+static int g_formatted = 0;
+
+// Helper: Message builder that counts how often it runs
+static std::string counted(const std::string& text) {
+    g_formatted++;
+    return text;
+}
+
+TEST(test_macros_skip_disabled_levels) {
+    std::vector<std::string> seen;
+    log_set_sink([&seen](LogLevel, const std::string& message) { seen.push_back(message); });
+    log_set_level(LogLevel::INFO);
+    g_formatted = 0;
+
+    LOG_DEBUG(counted("hidden"));
+    ASSERT_EQ(0, g_formatted);
+    LOG_INFO(counted("shown"));
+    ASSERT_EQ(1, g_formatted);
+    ASSERT_EQ(static_cast<size_t>(1), seen.size());
+
+    log_set_level(LogLevel::DEBUG);
+    LOG_DEBUG(counted("debug"));
+#ifdef ISODRIVE_NO_DEBUG_LOG
+    ASSERT_EQ(1, g_formatted);
+#else
+    ASSERT_EQ(2, g_formatted);
+    ASSERT_EQ(std::string("debug"), seen.back());
+#endif
+
+    log_set_level(LogLevel::ERROR);
+    ASSERT_TRUE(!log_enabled(LogLevel::WARN));
+    ASSERT_TRUE(log_enabled(LogLevel::ERROR));
+    log_set_sink(nullptr);
+    log_set_level(LogLevel::SILENT);
+    return true;
+}
+
+TEST(test_json_log_from_threads) {
+    fs::remove(LOG_PATH);
+    ASSERT_TRUE(log_open_json(LOG_PATH, LogLevel::INFO));
+
+    // The JSON log takes INFO while the console stays silent
+    ASSERT_TRUE(log_enabled(LogLevel::INFO));
+    ASSERT_TRUE(!log_enabled(LogLevel::DEBUG));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t] {
+            for (int i = 0; i < 100; i++) {
+                LOG_INFO("thread " + std::to_string(t) + " \"line\"\n" + std::to_string(i));
+                LOG_DEBUG("not recorded");
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    log_close_json();
+    ASSERT_TRUE(!log_enabled(LogLevel::INFO));
+
+    std::ifstream in(LOG_PATH);
+    std::string line;
+    size_t lines = 0;
+    std::map<std::string, long long> last_time;
+    while (std::getline(in, line)) {
+        lines++;
+        ASSERT_TRUE(line.rfind("{\"mono_us\":", 0) == 0);
+        ASSERT_TRUE(line.back() == '}');
+        ASSERT_TRUE(line.find("\"level\":\"info\"") != std::string::npos);
+        ASSERT_TRUE(line.find("\\\"line\\\"\\n") != std::string::npos);
+
+        // Timestamps never go backwards within a thread
+        size_t tid = line.find("\"tid\":");
+        std::string thread = line.substr(tid, line.find(',', tid) - tid);
+        long long time = std::stoll(line.substr(11));
+        ASSERT_TRUE(time >= last_time[thread]);
+        last_time[thread] = time;
+    }
+    ASSERT_EQ(static_cast<size_t>(400), lines);
+    ASSERT_EQ(static_cast<size_t>(4), last_time.size());
+    fs::remove(LOG_PATH);
+    return true;
+}
+
+TEST(test_json_log_open_failure) {
+    ASSERT_TRUE(!log_open_json("/nonexistent-dir/log.jsonl"));
+    ASSERT_TRUE(!log_enabled(LogLevel::INFO));
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
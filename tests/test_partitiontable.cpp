@@ -0,0 +1,202 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/imageprobe.h"
+#include "../src/include/logger.h"
+#include "../src/include/mountrequest.h"
+#include "../src/include/partitiontable.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Helper: MBR partition entry
+static void mbr_entry(std::string& data, int index, unsigned char status, unsigned char type,
+                      uint32_t first, uint32_t sectors) {
+    size_t entry = 446 + 16 * index;
+    data[entry] = static_cast<char>(status);
+    data[entry + 4] = static_cast<char>(type);
+    put32(data, entry + 8, first);
+    put32(data, entry + 12, sectors);
+    data[510] = 0x55;
+    data[511] = static_cast<char>(0xaa);
+}
+
+// Helper: ISO 9660 image whose Primary Volume Descriptor declares its size
+static std::string iso_image(uint32_t sectors) {
+    std::string data(sectors * 2048, '\0');
+    size_t pvd = 16 * 2048;
+    data[pvd] = 1;
+    std::memcpy(&data[pvd + 1], "CD001", 5);
+    std::memcpy(&data[pvd + 40], "HYBRID_TEST                     ", 32);
+    put32(data, pvd + 80, sectors);
+    data[pvd + 128] = 0x00;
+    data[pvd + 129] = 0x08;
+    return data;
+}
+
+// Helper: GPT header at lba describing entries at entries_lba
+static void gpt_header(std::string& data, uint64_t lba, uint64_t alternate, uint64_t entries_lba) {
+    size_t h = lba * 512;
+    std::memcpy(&data[h], "EFI PART", 8);
+    put32(data, h + 8, 0x00010000);
+    put32(data, h + 12, 92);
+    put32(data, h + 16, 0);
+    put64(data, h + 24, lba);
+    put64(data, h + 32, alternate);
+    put64(data, h + 72, entries_lba);
+    put32(data, h + 80, 128);
+    put32(data, h + 84, 128);
+    put32(data, h + 88, crc32_update(0, &data[entries_lba * 512], 128 * 128));
+    put32(data, h + 16, crc32_update(0, &data[h], 92));
+}
+
+// Helper: Disk image with a protective MBR, an ESP and a data partition, and both GPT copies
+static std::string gpt_image(uint64_t bytes) {
+    std::string data(bytes, '\0');
+    uint64_t last = bytes / 512 - 1;
+    mbr_entry(data, 0, 0x00, 0xee, 1, 0xffffffff);
+
+    static const unsigned char esp[16] = {
+        0x28, 0x73, 0x2a, 0xc1, 0x1f, 0xf8, 0xd2, 0x11,
+        0xba, 0x4b, 0x00, 0xa0, 0xc9, 0x3e, 0xc9, 0x3b,
+    };
+    std::string entries(128 * 128, '\0');
+    std::memcpy(&entries[0], esp, 16);
+    put64(entries, 32, 2048);
+    put64(entries, 40, 4095);
+    entries[128] = 0x42;
+    put64(entries, 128 + 32, 4096);
+    put64(entries, 128 + 40, last - 34);
+
+    data.replace(2 * 512, entries.size(), entries);
+    data.replace((last - 32) * 512, entries.size(), entries);
+    gpt_header(data, 1, last, 2);
+    gpt_header(data, last, 1, last - 32);
+    return data;
+}
+
+// Helper: Parse the partition table of an image file
+static bool parse(const std::string& path, PartitionTable& table) {
+    ImageProbe probe(path);
+    return read_partition_table(probe, table);
+}
+
+TEST(test_crc32) {
+    ASSERT_EQ(0xcbf43926u, crc32_update(0, "123456789", 9));
+    uint32_t split = crc32_update(crc32_update(0, "1234", 4), "56789", 5);
+    ASSERT_EQ(0xcbf43926u, split);
+    return true;
+}
+
+TEST(test_isohybrid_mbr) {
+    TestDir dir("partitiontable");
+    std::string data = iso_image(1024);
+    mbr_entry(data, 0, 0x80, 0x17, 0, 4096);
+    mbr_entry(data, 1, 0x00, 0xef, 200, 64);
+    std::string path = dir.file("hybrid.iso", data);
+
+    PartitionTable table;
+    ASSERT_TRUE(parse(path, table));
+    ASSERT_TRUE(table.scheme == PartitionScheme::MBR);
+    ASSERT_EQ(static_cast<size_t>(2), table.partitions.size());
+    ASSERT_TRUE(table.partitions[0].bootable);
+    ASSERT_EQ(1, table.esp);
+    ASSERT_EQ(static_cast<uint64_t>(200 * 512), table.partitions[1].offset);
+    ASSERT_EQ(static_cast<uint64_t>(1024 * 2048), table.volume_size);
+    ASSERT_EQ(static_cast<uint64_t>(1024 * 2048), table.declared_size);
+    ASSERT_TRUE(!table.truncated);
+
+    // A partial download is caught from the volume descriptor alone
+    path = dir.file("hybrid.iso", data.substr(0, 700 * 2048));
+    ASSERT_TRUE(parse(path, table));
+    ASSERT_TRUE(table.truncated);
+
+    ImageProbeResult result = probe_image(path);
+    ASSERT_TRUE(result.truncated);
+    ASSERT_TRUE(result.has_esp);
+    ASSERT_TRUE(result.partitions == PartitionScheme::MBR);
+    return true;
+}
+
+TEST(test_mbr_without_table) {
+    TestDir dir("partitiontable");
+    std::string data = iso_image(64);
+    data[510] = 0x55;
+    data[511] = static_cast<char>(0xaa);
+    PartitionTable table;
+    ASSERT_TRUE(parse(dir.file("bootcode.iso", data), table));
+    ASSERT_TRUE(table.scheme == PartitionScheme::NONE);
+
+    // Boot code running into the table area is not a table
+    mbr_entry(data, 0, 0x80, 0x83, 0, 128);
+    data[446 + 16] = 0x31;
+    ASSERT_TRUE(parse(dir.file("bootcode.iso", data), table));
+    ASSERT_TRUE(table.scheme == PartitionScheme::NONE);
+    ASSERT_TRUE(table.partitions.empty());
+    return true;
+}
+
+TEST(test_gpt_primary_and_backup) {
+    TestDir dir("partitiontable");
+    std::string data = gpt_image(8 << 20);
+    PartitionTable table;
+    ASSERT_TRUE(parse(dir.file("disk.img", data), table));
+    ASSERT_TRUE(table.scheme == PartitionScheme::GPT);
+    ASSERT_EQ(static_cast<size_t>(2), table.partitions.size());
+    ASSERT_EQ(0, table.esp);
+    ASSERT_EQ(static_cast<uint64_t>(1 << 20), table.partitions[0].offset);
+    ASSERT_EQ(static_cast<uint64_t>(1 << 20), table.partitions[0].length);
+    ASSERT_TRUE(table.backup_gpt);
+    ASSERT_EQ(static_cast<uint64_t>(8 << 20), table.declared_size);
+    ASSERT_TRUE(!table.truncated);
+
+    // A damaged primary header falls back to the backup
+    std::string damaged = data;
+    damaged[512 + 40] ^= 1;
+    ASSERT_TRUE(parse(dir.file("disk.img", damaged), table));
+    ASSERT_TRUE(table.scheme == PartitionScheme::GPT);
+    ASSERT_EQ(static_cast<size_t>(2), table.partitions.size());
+
+    // Losing the tail loses the backup header the primary points to
+    ASSERT_TRUE(parse(dir.file("disk.img", data.substr(0, 6 << 20)), table));
+    ASSERT_TRUE(table.scheme == PartitionScheme::GPT);
+    ASSERT_TRUE(!table.backup_gpt);
+    ASSERT_TRUE(table.truncated);
+    return true;
+}
+
+TEST(test_resolve_rejects_truncated) {
+    TestDir dir("partitiontable");
+    std::string data = iso_image(512);
+    MountRequest request;
+    ImageRequest image;
+    image.path = dir.file("short.iso", data.substr(0, 300 * 2048));
+    request.images.push_back(image);
+
+    std::vector<LunMedia> media;
+    WindowsMountOptions win_opts;
+    ASSERT_TRUE(!resolve_images(request, probe_image, media, win_opts));
+
+    // Boot code without partitions is mounted as a CD-ROM
+    data[510] = 0x55;
+    data[511] = static_cast<char>(0xaa);
+    request.images[0].path = dir.file("bootcode.iso", data);
+    ASSERT_TRUE(resolve_images(request, probe_image, media, win_opts));
+    ASSERT_TRUE(media[0].cdrom);
+
+    mbr_entry(data, 0, 0x80, 0x17, 0, 2048);
+    request.images[0].path = dir.file("hybrid.iso", data);
+    ASSERT_TRUE(resolve_images(request, probe_image, media, win_opts));
+    ASSERT_TRUE(!media[0].cdrom);
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
@@ -0,0 +1,162 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/probecache.h"
+#include "../src/include/logger.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Helper to create a minimal ISO 9660 image with the given label
+TEST(test_probe_cache_store_and_hit) {
+    TestDir dir("probecache");
+    std::string filename = create_labeled_iso("temp_cache.iso", "WIN11_23H2");
+
+    ImageProbeResult first = probe_image_cached(filename);
+    ASSERT_TRUE(first.windows.is_windows);
+    ASSERT_TRUE(fs::exists(probe_cache_dir() + "/probe.cache"));
+
+    ImageKey key;
+    ASSERT_TRUE(image_key(filename, key));
+    ImageProbeResult cached;
+    ASSERT_TRUE(probe_cache_lookup(key, cached));
+    ASSERT_TRUE(cached.windows.is_windows);
+    ASSERT_TRUE(cached.windows.version == WindowsVersion::WIN11);
+    ASSERT_EQ(std::string("WIN11_23H2"), cached.windows.volume_label);
+    ASSERT_EQ(first.size, cached.size);
+
+    fs::remove(filename);
+    return true;
+}
+
+TEST(test_probe_cache_hit_skips_image_io) {
+    TestDir dir("probecache");
+    std::string filename = create_labeled_iso("temp_cache.iso", "WIN10_X64");
+    probe_image_cached(filename);
+
+    // Overwrite the content in place while keeping size and mtime
+    ImageKey before;
+    ASSERT_TRUE(image_key(filename, before));
+    auto mtime = fs::last_write_time(filename);
+    create_labeled_iso(filename, "UBUNTU_24_04");
+    fs::last_write_time(filename, mtime);
+
+    ImageProbeResult result = probe_image_cached(filename);
+    ASSERT_EQ(std::string("WIN10_X64"), result.windows.volume_label);
+
+    fs::remove(filename);
+    return true;
+}
+
+TEST(test_probe_cache_invalidated_by_mtime) {
+    TestDir dir("probecache");
+    std::string filename = create_labeled_iso("temp_cache.iso", "WIN10_X64");
+    probe_image_cached(filename);
+
+    create_labeled_iso(filename, "UBUNTU_24_04");
+    fs::last_write_time(filename, fs::last_write_time(filename) + std::chrono::seconds(5));
+
+    ImageProbeResult result = probe_image_cached(filename);
+    ASSERT_TRUE(!result.windows.is_windows);
+
+    fs::remove(filename);
+    return true;
+}
+
+TEST(test_probe_cache_disabled) {
+    TestDir dir("probecache");
+    probe_cache_set_enabled(false);
+    std::string filename = create_labeled_iso("temp_cache.iso", "WIN10_X64");
+
+    ImageProbeResult result = probe_image_cached(filename);
+    ASSERT_TRUE(result.windows.is_windows);
+    ASSERT_TRUE(!fs::exists(probe_cache_dir() + "/probe.cache"));
+
+    probe_cache_set_enabled(true);
+    fs::remove(filename);
+    return true;
+}
+
+TEST(test_probe_cache_eviction) {
+    TestDir dir("probecache");
+    ImageProbeResult result = {};
+    result.readable = true;
+
+    for (uint64_t i = 0; i < PROBE_CACHE_MAX_ENTRIES + 5; i++) {
+        ImageKey key = {1, i, 4096, 0, 0};
+        ASSERT_TRUE(probe_cache_store(key, result));
+    }
+
+    // The oldest entries are evicted, the newest survive
+    ImageProbeResult out;
+    ImageKey newest = {1, PROBE_CACHE_MAX_ENTRIES + 4, 4096, 0, 0};
+    ASSERT_TRUE(probe_cache_lookup(newest, out));
+
+    size_t lines = 0;
+    std::ifstream f(probe_cache_dir() + "/probe.cache");
+    std::string line;
+    while (std::getline(f, line)) lines++;
+    ASSERT_EQ(PROBE_CACHE_MAX_ENTRIES + 1, lines);  // header + entries
+    return true;
+}
+
+TEST(test_probe_cache_hit_defers_lru_update) {
+    TestDir dir("probecache");
+    ImageProbeResult result = {};
+    result.readable = true;
+    for (uint64_t i = 0; i < PROBE_CACHE_MAX_ENTRIES; i++) {
+        ImageKey key = {1, i, 4096, 0, 0};
+        ASSERT_TRUE(probe_cache_store(key, result));
+    }
+
+    // A hit leaves the file alone
+    std::string path = probe_cache_dir() + "/probe.cache";
+    auto written = fs::last_write_time(path);
+    std::ifstream before(path);
+    std::string contents((std::istreambuf_iterator<char>(before)), std::istreambuf_iterator<char>());
+    ImageKey oldest = {1, 0, 4096, 0, 0};
+    ImageProbeResult out;
+    ASSERT_TRUE(probe_cache_lookup(oldest, out));
+    std::ifstream after(path);
+    ASSERT_EQ(contents, std::string((std::istreambuf_iterator<char>(after)), std::istreambuf_iterator<char>()));
+    ASSERT_TRUE(written == fs::last_write_time(path));
+
+    // The next store writes the use back, so the used entry outlives the next oldest
+    ImageKey extra = {1, PROBE_CACHE_MAX_ENTRIES, 4096, 0, 0};
+    ASSERT_TRUE(probe_cache_store(extra, result));
+    ASSERT_TRUE(probe_cache_lookup(oldest, out));
+    ImageKey second = {1, 1, 4096, 0, 0};
+    ASSERT_TRUE(!probe_cache_lookup(second, out));
+    ASSERT_TRUE(fs::exists(probe_cache_dir() + "/probe.cache.lock"));
+
+    // A process that only hits flushes its uses, so a later one that
+    // never saw them still evicts around the used entry
+    ImageKey third = {1, 2, 4096, 0, 0};
+    pid_t child = fork();
+    if (child == 0) {
+        ImageProbeResult hit;
+        _exit(probe_cache_lookup(third, hit) && probe_cache_flush() ? 0 : 1);
+    }
+    ASSERT_TRUE(child > 0);
+    int status = 0;
+    waitpid(child, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ImageKey another = {1, PROBE_CACHE_MAX_ENTRIES + 1, 4096, 0, 0};
+    ASSERT_TRUE(probe_cache_store(another, result));
+    ASSERT_TRUE(probe_cache_lookup(third, out));
+    ImageKey fourth = {1, 3, 4096, 0, 0};
+    ASSERT_TRUE(!probe_cache_lookup(fourth, out));
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
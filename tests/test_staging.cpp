@@ -0,0 +1,298 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/logger.h"
+#include "../src/include/mountrequest.h"
+#include "../src/include/probecache.h"
+#include "../src/include/staging.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#ifdef ISODRIVE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef ISODRIVE_HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef ISODRIVE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Helper: An 8 MiB disk image that is mostly zeros
+static std::string sample_image() {
+    std::string image(8 << 20, '\0');
+    for (size_t i = 0; i < 64 * 1024; i++) {
+        image[i] = static_cast<char>(i * 7);
+    }
+    std::memcpy(&image[6 << 20], "isodrive staging test", 21);
+    return image;
+}
+
+// Helper: Read a whole file
+static std::string slurp(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+#ifdef ISODRIVE_HAVE_ZLIB
+// Helper: gzip data as two concatenated members
+static std::string gzip(const std::string& data) {
+    std::string out;
+    size_t half = data.size() / 2;
+    for (const std::string& part : {data.substr(0, half), data.substr(half)}) {
+        z_stream zs = {};
+        deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+        std::vector<unsigned char> buf(deflateBound(&zs, part.size()));
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(part.data()));
+        zs.avail_in = part.size();
+        zs.next_out = buf.data();
+        zs.avail_out = buf.size();
+        deflate(&zs, Z_FINISH);
+        out.append(reinterpret_cast<char*>(buf.data()), zs.total_out);
+        deflateEnd(&zs);
+    }
+    return out;
+}
+#endif
+
+#ifdef ISODRIVE_HAVE_LZMA
+// Helper: xz data split into 1 MiB blocks so it can be decoded in parallel
+static std::string xz(const std::string& data) {
+    lzma_stream strm = LZMA_STREAM_INIT;
+    lzma_mt mt = {};
+    mt.threads = 2;
+    mt.block_size = 1 << 20;
+    mt.preset = 1;
+    mt.check = LZMA_CHECK_CRC64;
+    if (lzma_stream_encoder_mt(&strm, &mt) != LZMA_OK) return "";
+
+    std::vector<uint8_t> buf(data.size() + 65536);
+    strm.next_in = reinterpret_cast<const uint8_t*>(data.data());
+    strm.avail_in = data.size();
+    strm.next_out = buf.data();
+    strm.avail_out = buf.size();
+    while (lzma_code(&strm, LZMA_FINISH) == LZMA_OK) {}
+    std::string out(reinterpret_cast<char*>(buf.data()), strm.total_out);
+    lzma_end(&strm);
+    return out;
+}
+#endif
+
+#ifdef ISODRIVE_HAVE_ZSTD
+// Helper: zstd data as independent frames of frame_size input bytes each
+static std::string zstd(const std::string& data, size_t frame_size, bool content_size) {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_contentSizeFlag, content_size ? 1 : 0);
+    std::string out;
+    for (size_t pos = 0; pos < data.size(); pos += frame_size) {
+        size_t len = std::min(frame_size, data.size() - pos);
+        std::string frame(ZSTD_compressBound(len), '\0');
+        size_t n = ZSTD_compress2(cctx, &frame[0], frame.size(), data.data() + pos, len);
+        if (ZSTD_isError(n)) {
+            out.clear();
+            break;
+        }
+        out.append(frame, 0, n);
+    }
+    ZSTD_freeCCtx(cctx);
+    return out;
+}
+#endif
+
+TEST(test_detect_compression) {
+    TestDir dir("staging_detect");
+    ASSERT_TRUE(detect_compression(dir.file("plain.img", std::string(4096, '\0'))) == Compression::NONE);
+    ASSERT_TRUE(detect_compression(dir.file("a.gz", "\x1f\x8b\x08\x00")) == Compression::GZIP);
+    ASSERT_TRUE(detect_compression(dir.file("a.xz", std::string("\xfd" "7zXZ\0\0", 7))) == Compression::XZ);
+    ASSERT_TRUE(detect_compression(dir.file("a.zst", "\x28\xb5\x2f\xfd\x00")) == Compression::ZSTD);
+    ASSERT_TRUE(detect_compression(dir.file("seek.zst", "\x5e\x2a\x4d\x18\x00")) == Compression::ZSTD);
+    ASSERT_TRUE(detect_compression(dir.path + "/missing") == Compression::NONE);
+    ASSERT_EQ(std::string("xz"), std::string(compression_name(Compression::XZ)));
+    return true;
+}
+
+TEST(test_plain_image_not_staged) {
+    TestDir dir("staging_plain");
+    std::string image = dir.file("plain.img", std::string(4096, '\0'));
+    std::string staged;
+    ASSERT_TRUE(stage_image(image, staged));
+    ASSERT_EQ(image, staged);
+    ASSERT_TRUE(!fs::exists(staging_dir()));
+    return true;
+}
+
+#ifdef ISODRIVE_HAVE_ZLIB
+TEST(test_stage_gzip_sparse_and_reused) {
+    TestDir dir("staging_gzip");
+    std::string original = sample_image();
+    std::string image = dir.file("disk.img.gz", gzip(original));
+
+    std::string staged;
+    ASSERT_TRUE(stage_image(image, staged));
+    ASSERT_TRUE(staged != image);
+    ASSERT_TRUE(slurp(staged) == original);
+
+    // Zero runs are left as holes
+    struct stat st;
+    ASSERT_TRUE(stat(staged.c_str(), &st) == 0);
+    ASSERT_TRUE(static_cast<uint64_t>(st.st_blocks) * 512 < original.size() / 2);
+
+    // An unchanged source reuses the staged copy
+    std::string again;
+    ASSERT_TRUE(stage_image(image, again));
+    ASSERT_EQ(staged, again);
+
+    // A modified source gets a new copy and the old one is removed
+    std::string changed = original;
+    changed[100] = 'x';
+    // Rewritten in place, so it keeps its inode; set the time explicitly
+    // since a coarse-grained mtime may not change within the second
+    dir.file("disk.img.gz", gzip(changed));
+    const struct timespec times[2] = {{0, UTIME_OMIT}, {st.st_mtim.tv_sec + 10, 0}};
+    ASSERT_TRUE(utimensat(AT_FDCWD, image.c_str(), times, 0) == 0);
+    std::string updated;
+    ASSERT_TRUE(stage_image(image, updated));
+    ASSERT_TRUE(slurp(updated) == changed);
+    ASSERT_EQ(1, static_cast<int>(std::distance(fs::directory_iterator(staging_dir()), fs::directory_iterator())));
+    return true;
+}
+
+TEST(test_stage_keeps_live_partials_and_evicts_lru) {
+    TestDir dir("staging_lru");
+    std::vector<std::string> images, staged;
+    for (size_t i = 0; i <= STAGING_MAX_IMAGES; i++) {
+        images.push_back(dir.file("disk" + std::to_string(i) + ".img.gz",
+                                  gzip(std::string(4096, static_cast<char>('a' + i)))));
+    }
+    for (size_t i = 0; i < STAGING_MAX_IMAGES; i++) {
+        std::string path;
+        ASSERT_TRUE(stage_image(images[i], path));
+        staged.push_back(path);
+        // Deterministic access times, oldest first
+        const struct timespec times[2] = {{static_cast<time_t>(1000 + i), 0}, {0, UTIME_OMIT}};
+        ASSERT_TRUE(utimensat(AT_FDCWD, path.c_str(), times, 0) == 0);
+    }
+
+    // A partial copy of a running process stays, one of an exited process goes
+    std::string live = staging_dir() + "/other.img.tmp." + std::to_string(getpid());
+    std::string dead = staging_dir() + "/other.img.tmp.999999999";
+    std::ofstream(live) << "partial";
+    std::ofstream(dead) << "partial";
+
+    // Reusing the oldest makes it the most recently used
+    std::string path;
+    ASSERT_TRUE(stage_image(images[0], path));
+    ASSERT_TRUE(stage_image(images[STAGING_MAX_IMAGES], path));
+    ASSERT_TRUE(fs::exists(staged[0]));
+    ASSERT_TRUE(!fs::exists(staged[1]));
+    ASSERT_TRUE(fs::exists(live));
+    ASSERT_TRUE(!fs::exists(dead));
+    ASSERT_EQ(static_cast<int>(STAGING_MAX_IMAGES) + 1,
+              static_cast<int>(std::distance(fs::directory_iterator(staging_dir()), fs::directory_iterator())));
+    return true;
+}
+
+TEST(test_stage_never_evicts_copies_in_use) {
+    TestDir dir("staging_in_use");
+    std::vector<std::string> in_use;
+    for (size_t i = 0; i <= STAGING_MAX_IMAGES; i++) {
+        std::string image = dir.file("disk" + std::to_string(i) + ".img.gz",
+                                     gzip(std::string(4096, static_cast<char>('a' + i))));
+        std::string path;
+        ASSERT_TRUE(stage_image(image, path, in_use));
+        in_use.push_back(path);
+    }
+
+    // One request with more images than the limit keeps all of them
+    for (const std::string& path : in_use) {
+        ASSERT_TRUE(fs::exists(path));
+    }
+
+    // A later request evicts only copies that are not in use
+    std::string path;
+    ASSERT_TRUE(stage_image(dir.file("next.img.gz", gzip("next")), path, {in_use[0]}));
+    ASSERT_TRUE(fs::exists(in_use[0]));
+    ASSERT_TRUE(fs::exists(path));
+    ASSERT_EQ(static_cast<int>(STAGING_MAX_IMAGES),
+              static_cast<int>(std::distance(fs::directory_iterator(staging_dir()), fs::directory_iterator())));
+    return true;
+}
+
+TEST(test_stage_truncated_gzip_fails) {
+    TestDir dir("staging_truncated");
+    std::string data = gzip(sample_image());
+    std::string image = dir.file("bad.gz", data.substr(0, data.size() / 4));
+
+    std::string staged;
+    ASSERT_TRUE(!stage_image(image, staged));
+    ASSERT_EQ(0, static_cast<int>(std::distance(fs::directory_iterator(staging_dir()), fs::directory_iterator())));
+    return true;
+}
+
+TEST(test_compressed_rw_rejected) {
+    TestDir dir("staging_rw");
+    MountRequest request;
+    ImageRequest img;
+    img.path = dir.file("disk.img.gz", gzip(std::string(4096, 'a')));
+    img.ro = false;
+    request.images.push_back(img);
+    ASSERT_TRUE(!validate_request(request));
+
+    request.images[0].ro = true;
+    ASSERT_TRUE(validate_request(request));
+    return true;
+}
+#endif
+
+#ifdef ISODRIVE_HAVE_LZMA
+TEST(test_stage_xz_multiblock) {
+    TestDir dir("staging_xz");
+    std::string original = sample_image();
+    std::string compressed = xz(original);
+    ASSERT_TRUE(!compressed.empty());
+    std::string image = dir.file("disk.img.xz", compressed);
+
+    std::string staged;
+    ASSERT_TRUE(stage_image(image, staged));
+    ASSERT_TRUE(slurp(staged) == original);
+    return true;
+}
+#endif
+
+#ifdef ISODRIVE_HAVE_ZSTD
+TEST(test_stage_zstd_frames) {
+    TestDir dir("staging_zstd");
+    std::string original = sample_image();
+
+    // Frames with a content size are decompressed in parallel
+    std::string compressed = zstd(original, 1 << 20, true);
+    ASSERT_TRUE(!compressed.empty());
+    std::string staged;
+    ASSERT_TRUE(stage_image(dir.file("frames.img.zst", compressed), staged));
+    ASSERT_TRUE(slurp(staged) == original);
+
+    // A frame without one is decompressed in a single pass
+    compressed = zstd(original, original.size(), false);
+    ASSERT_TRUE(ZSTD_getFrameContentSize(compressed.data(), compressed.size()) == ZSTD_CONTENTSIZE_UNKNOWN);
+    ASSERT_TRUE(stage_image(dir.file("stream.img.zst", compressed), staged));
+    ASSERT_TRUE(slurp(staged) == original);
+    return true;
+}
+#endif
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
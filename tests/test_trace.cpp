@@ -0,0 +1,77 @@
+#include "simple_test.h"
+#include "../src/include/logger.h"
+#include "../src/include/trace.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+static const std::string TRACE_FILE = "/tmp/isodrive_test_trace.json";
+
+// Helper: Read a whole file
+static std::string slurp(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// Helper: Count occurrences of a substring
+static size_t count(const std::string& haystack, const std::string& needle) {
+    size_t n = 0;
+    for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) {
+        n++;
+    }
+    return n;
+}
+
+TEST(test_trace_disabled_records_nothing) {
+    trace_reset();
+    {
+        TRACE_SPAN("ignored");
+    }
+    ASSERT_TRUE(!trace_enabled());
+    ASSERT_TRUE(trace_write(TRACE_FILE));
+    ASSERT_EQ(0u, count(slurp(TRACE_FILE), "\"name\""));
+    fs::remove(TRACE_FILE);
+    return true;
+}
+
+TEST(test_trace_writes_chrome_events) {
+    trace_reset();
+    trace_enable();
+    {
+        TRACE_SPAN("outer");
+        TraceSpan inner("inner");
+        inner.detail("/sdcard/\"quoted\".iso");
+    }
+    ASSERT_TRUE(trace_write(TRACE_FILE));
+    trace_reset();
+
+    std::string json = slurp(TRACE_FILE);
+    fs::remove(TRACE_FILE);
+
+    ASSERT_TRUE(json.find("\"traceEvents\":[") != std::string::npos);
+    ASSERT_EQ(2u, count(json, "\"ph\":\"X\""));
+    ASSERT_TRUE(json.find("\"name\":\"outer\"") != std::string::npos);
+    ASSERT_TRUE(json.find("\"name\":\"inner\"") != std::string::npos);
+    ASSERT_TRUE(json.find("\"detail\":\"/sdcard/\\\"quoted\\\".iso\"") != std::string::npos);
+
+    // The inner span closes first, so it is recorded first
+    ASSERT_TRUE(json.find("\"inner\"") < json.find("\"outer\""));
+    return true;
+}
+
+TEST(test_trace_write_fails_on_bad_path) {
+    ASSERT_TRUE(!trace_write("/nonexistent_dir/trace.json"));
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
@@ -0,0 +1,236 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/imageprobe.h"
+#include "../src/include/logger.h"
+#include "../src/include/udf.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+static const std::string IMAGE_PATH = "/tmp/isodrive_test_udf.iso";
+
+// Partition placement of the synthetic volume, in 2048-byte sectors
+static const uint32_t PARTITION_START = 300;
+static const uint32_t PARTITION_LENGTH = 200;
+
+// Helper: Descriptor tag with its checksum
+static void tag(std::string& data, size_t pos, uint16_t id, uint32_t location) {
+    put16(data, pos, id);
+    put16(data, pos + 2, 2);
+    put32(data, pos + 12, location);
+    unsigned char sum = 0;
+    for (int i = 0; i < 16; i++) {
+        if (i != 4) sum = static_cast<unsigned char>(sum + data[pos + i]);
+    }
+    data[pos + 4] = static_cast<char>(sum);
+}
+
+// Helper: Byte offset of a logical block inside the partition
+static size_t block(uint32_t lbn) {
+    return static_cast<size_t>(PARTITION_START + lbn) * 2048;
+}
+
+// Helper: File Identifier Descriptor padded to a multiple of four bytes
+static std::string fid(const std::string& name, uint32_t icb, unsigned char characteristics = 0,
+                       bool unicode = false) {
+    std::string id;
+    if (!name.empty()) {
+        id += static_cast<char>(unicode ? 16 : 8);
+        for (char c : name) {
+            if (unicode) id += '\0';
+            id += c;
+        }
+    }
+    std::string out((38 + id.size() + 3) & ~static_cast<size_t>(3), '\0');
+    out[18] = static_cast<char>(characteristics);
+    out[19] = static_cast<char>(id.size());
+    put32(out, 20, 2048);
+    put32(out, 24, icb);
+    out.replace(38, id.size(), id);
+    tag(out, 0, 257, 0);
+    return out;
+}
+
+// Helper: File Entry at lbn with embedded data (flags 3) or short_ads (flags 0)
+static void file_entry(std::string& data, uint32_t lbn, unsigned char type, uint16_t flags, uint64_t size,
+                       const std::string& descriptors) {
+    size_t fe = block(lbn);
+    data[fe + 27] = static_cast<char>(type);
+    put16(data, fe + 34, flags);
+    put32(data, fe + 56, static_cast<uint32_t>(size));
+    put32(data, fe + 172, static_cast<uint32_t>(descriptors.size()));
+    data.replace(fe + 176, descriptors.size(), descriptors);
+    tag(data, fe, 261, lbn);
+}
+
+// Helper: Directory holding its identifiers inside the File Entry
+static void embedded_directory(std::string& data, uint32_t lbn, const std::string& fids) {
+    file_entry(data, lbn, 4, 3, fids.size(), fids);
+}
+
+// Helper: Allocation descriptor of the given kind
+static std::string short_ad(uint32_t length, uint32_t lbn) {
+    std::string ad(8, '\0');
+    put32(ad, 0, length);
+    put32(ad, 4, lbn);
+    return ad;
+}
+
+static std::string long_ad(uint32_t length, uint32_t lbn) {
+    std::string ad(16, '\0');
+    put32(ad, 0, length);
+    put32(ad, 4, lbn);
+    return ad;
+}
+
+// Helper: UDF bridge image whose ISO 9660 side carries no directory tree
+//
+// /SOURCES/install.wim  extended entry, two long_ad extents (second via an AED)
+// /efi/boot/BOOTX64.EFI short_ad extent
+static std::string udf_image() {
+    std::string data(512 * 2048, '\0');
+    size_t pvd = 16 * 2048;
+    data[pvd] = 1;
+    std::memcpy(&data[pvd + 1], "CD001", 5);
+    std::memcpy(&data[pvd + 40], "DVD_ROM                         ", 32);
+
+    size_t anchor = 256 * 2048;
+    put32(data, anchor + 16, 3 * 2048);
+    put32(data, anchor + 20, 32);
+    tag(data, anchor, 2, 256);
+
+    size_t pd = 32 * 2048;
+    put16(data, pd + 22, 0);
+    put32(data, pd + 188, PARTITION_START);
+    put32(data, pd + 192, PARTITION_LENGTH);
+    tag(data, pd, 5, 32);
+
+    size_t lvd = 33 * 2048;
+    data[lvd + 84] = 8;
+    std::memcpy(&data[lvd + 85], "UDF_TEST", 8);
+    data[lvd + 84 + 127] = 9;
+    put32(data, lvd + 212, 2048);
+    put32(data, lvd + 252, 0);
+    put32(data, lvd + 268, 1);
+    data[lvd + 440] = 1;
+    data[lvd + 441] = 6;
+    put16(data, lvd + 442, 1);
+    put16(data, lvd + 444, 0);
+    tag(data, lvd, 6, 33);
+    tag(data, 34 * 2048, 8, 34);
+
+    // File set descriptor pointing at the root entry
+    put32(data, block(0) + 400, 2048);
+    put32(data, block(0) + 404, 1);
+    tag(data, block(0), 256, 0);
+
+    // Root directory stored in its own block, including a deleted decoy
+    std::string root = fid("", 1, 0x0a) + fid("efi", 5, 0x02) + fid("sources", 9, 0x06) +
+                       fid("SOURCES", 3, 0x02);
+    data.replace(block(2), root.size(), root);
+    file_entry(data, 1, 4, 0, root.size(), short_ad(static_cast<uint32_t>(root.size()), 2));
+
+    embedded_directory(data, 3, fid("", 1, 0x0a) + fid("install.wim", 4, 0, true));
+
+    size_t efe = block(4);
+    data[efe + 27] = 5;
+    put16(data, efe + 34, 1);
+    put32(data, efe + 56, 5 * 2048 + 100);
+    std::string ads = long_ad(2 * 2048, 20) + long_ad((3u << 30) | 2048, 6);
+    put32(data, efe + 212, static_cast<uint32_t>(ads.size()));
+    data.replace(efe + 216, ads.size(), ads);
+    tag(data, efe, 266, 4);
+
+    std::string more = long_ad(3 * 2048 + 100, 40);
+    put32(data, block(6) + 20, static_cast<uint32_t>(more.size()));
+    data.replace(block(6) + 24, more.size(), more);
+    tag(data, block(6), 258, 6);
+
+    embedded_directory(data, 5, fid("", 1, 0x0a) + fid("boot", 7, 0x02));
+    embedded_directory(data, 7, fid("", 5, 0x0a) + fid("BOOTX64.EFI", 8));
+    file_entry(data, 8, 5, 0, 4096, short_ad(4096, 60));
+    return data;
+}
+
+TEST(test_udf_lookup) {
+    std::ofstream(IMAGE_PATH, std::ios::binary) << udf_image();
+    ImageProbe probe(IMAGE_PATH);
+    UdfReader udf(probe);
+    ASSERT_TRUE(udf.valid());
+    ASSERT_EQ(std::string("UDF_TEST"), udf.volume_id());
+
+    IsoFileInfo info;
+    ASSERT_TRUE(udf.lookup("/sources/INSTALL.WIM", info));
+    ASSERT_EQ(std::string("install.wim"), info.name);
+    ASSERT_TRUE(!info.is_dir);
+    ASSERT_EQ(static_cast<uint64_t>(5 * 2048 + 100), info.size);
+    ASSERT_EQ(static_cast<size_t>(2), info.extents.size());
+    ASSERT_EQ(static_cast<uint64_t>(PARTITION_START + 20), info.extents[0].lba);
+    ASSERT_EQ(static_cast<uint64_t>(2 * 2048), info.extents[0].length);
+    ASSERT_EQ(static_cast<uint64_t>(PARTITION_START + 40), info.extents[1].lba);
+    ASSERT_EQ(static_cast<uint64_t>(3 * 2048 + 100), info.extents[1].length);
+
+    ASSERT_TRUE(udf.lookup("/efi/boot/bootx64.efi", info));
+    ASSERT_EQ(static_cast<uint64_t>(4096), info.size);
+    ASSERT_EQ(static_cast<uint64_t>(PARTITION_START + 60), info.extents[0].lba);
+
+    ASSERT_TRUE(udf.lookup("/efi", info));
+    ASSERT_TRUE(info.is_dir);
+    ASSERT_TRUE(!udf.exists("/sources/boot.wim"));
+    ASSERT_TRUE(!udf.exists("/efi/boot/bootx64.efi/x"));
+    fs::remove(IMAGE_PATH);
+    return true;
+}
+
+TEST(test_udf_rejects_damage) {
+    std::string data = udf_image();
+    data[256 * 2048 + 5] ^= 1;  // Anchor tag checksum no longer matches
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+    {
+        ImageProbe probe(IMAGE_PATH);
+        ASSERT_TRUE(!UdfReader(probe).valid());
+    }
+
+    // Metadata partition maps (UDF 2.50) are not followed
+    data = udf_image();
+    data[33 * 2048 + 440] = 2;
+    tag(data, 33 * 2048, 6, 33);
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+    {
+        ImageProbe probe(IMAGE_PATH);
+        ASSERT_TRUE(!UdfReader(probe).valid());
+    }
+
+    // An extent past the partition end fails the lookup
+    data = udf_image();
+    put32(data, block(8) + 180, PARTITION_LENGTH);
+    tag(data, block(8), 261, 8);
+    std::ofstream(IMAGE_PATH, std::ios::binary) << data;
+    ImageProbe probe(IMAGE_PATH);
+    UdfReader udf(probe);
+    ASSERT_TRUE(udf.valid());
+    ASSERT_TRUE(!udf.exists("/efi/boot/bootx64.efi"));
+    fs::remove(IMAGE_PATH);
+    return true;
+}
+
+TEST(test_windows_detected_from_udf) {
+    std::ofstream(IMAGE_PATH, std::ios::binary) << udf_image();
+    ImageProbeResult result = probe_image(IMAGE_PATH);
+    ASSERT_TRUE(result.is_iso9660);
+    ASSERT_TRUE(result.windows.is_windows);
+    ASSERT_TRUE(result.windows.has_uefi);
+    ASSERT_TRUE(!result.windows.has_legacy);
+    fs::remove(IMAGE_PATH);
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}
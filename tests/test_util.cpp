@@ -1,10 +1,14 @@
 #include "simple_test.h"
 #include "../src/include/util.h"
+#include "../src/include/imageprobe.h"
 #include "../src/include/logger.h"
 #include <fstream>
 #include <filesystem>
 #include <cstdio>
+#include <cerrno>
 #include <cstring>
+#include <iterator>
+#include <sstream>
 
 namespace fs = std::filesystem;
 
@@ -214,6 +218,114 @@ TEST(test_windows_version_to_string) {
     return true;
 }
 
+// =============================================================================
+// Single-pass image probe tests
+// =============================================================================
+
+TEST(test_probe_image_windows) {
+    std::string filename = create_iso9660_iso("WIN10_22H2_X64", true);
+    ImageProbeResult result = probe_image(filename);
+    fs::remove(filename);
+
+    ASSERT_TRUE(result.readable);
+    ASSERT_TRUE(result.is_iso9660);
+    ASSERT_TRUE(!result.is_hybrid);
+    ASSERT_EQ(19u * 2048u, result.size);
+    ASSERT_TRUE(result.windows.is_windows);
+    ASSERT_TRUE(result.windows.version == WindowsVersion::WIN10);
+    ASSERT_TRUE(result.windows.has_legacy);
+    ASSERT_EQ(std::string("WIN10_22H2_X64"), result.windows.volume_label);
+    return true;
+}
+
+TEST(test_probe_image_hybrid_non_iso) {
+    std::string filename = create_dummy_iso(true);
+    ImageProbeResult result = probe_image(filename);
+    fs::remove(filename);
+
+    ASSERT_TRUE(result.readable);
+    ASSERT_TRUE(result.is_hybrid);
+    ASSERT_TRUE(!result.is_iso9660);
+    ASSERT_TRUE(!result.windows.is_windows);
+    return true;
+}
+
+TEST(test_probe_image_missing) {
+    ImageProbeResult result = probe_image("does_not_exist.iso");
+    ASSERT_TRUE(!result.readable);
+    ASSERT_TRUE(!result.is_hybrid);
+    ASSERT_TRUE(result.windows.version == WindowsVersion::NONE);
+    return true;
+}
+
+TEST(test_image_probe_sector_beyond_head) {
+    std::string filename = create_iso9660_iso("UBUNTU_22_04");
+    ImageProbe probe(filename, 1);
+    ASSERT_TRUE(probe.is_open());
+    // Sector 16 lies outside the one-sector head and is read on demand
+    const unsigned char* pvd = probe.sector(16);
+    ASSERT_TRUE(pvd != nullptr);
+    ASSERT_TRUE(pvd[0] == 1);
+    ASSERT_TRUE(probe.sector(16) == pvd);
+    ASSERT_TRUE(probe.sector(100) == nullptr);
+    fs::remove(filename);
+    return true;
+}
+
+TEST(test_probe_result_round_trip) {
+    ImageProbeResult result = {};
+    result.is_iso9660 = true;
+    result.windows.is_windows = true;
+    result.windows.version = WindowsVersion::WIN11;
+    result.boot_uefi = true;
+    result.partitions = PartitionScheme::GPT;
+    result.declared_size = 1234567;
+    result.bootloaders.boot_images = 5;
+
+    std::ostringstream out;
+    probe_result_write(out, result);
+    std::istringstream in(out.str() + " rest");
+    ImageProbeResult read = {};
+    ASSERT_TRUE(probe_result_read(in, read));
+    ASSERT_TRUE(read.is_iso9660 && !read.is_hybrid && read.windows.is_windows);
+    ASSERT_TRUE(read.windows.version == WindowsVersion::WIN11);
+    ASSERT_TRUE(read.windows.has_uefi && !read.windows.has_legacy);
+    ASSERT_TRUE(read.partitions == PartitionScheme::GPT);
+    ASSERT_EQ(static_cast<uint64_t>(1234567), read.declared_size);
+    ASSERT_EQ(5u, static_cast<unsigned>(read.bootloaders.boot_images));
+
+    std::istringstream truncated("1 0 1");
+    ASSERT_TRUE(!probe_result_read(truncated, read));
+    return true;
+}
+
+TEST(test_write_file_atomic) {
+    std::string dir = "/tmp/isodrive_test_atomic";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    std::string path = dir + "/state";
+
+    ASSERT_TRUE(write_file_atomic(path, "first\n", false));
+    ASSERT_TRUE(write_file_atomic(path, "second\n", true));
+    std::ifstream f(path);
+    std::string contents((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(std::string("second\n"), contents);
+    ASSERT_EQ(static_cast<size_t>(1), static_cast<size_t>(std::distance(fs::directory_iterator(dir),
+                                                                        fs::directory_iterator())));
+
+    int err = 0;
+    ASSERT_TRUE(!write_file_atomic(dir + "/missing/state", "x", true, &err));
+    ASSERT_EQ(ENOENT, err);
+    fs::remove_all(dir);
+    return true;
+}
+
+TEST(test_json_escape) {
+    ASSERT_EQ(std::string("plain"), json_escape("plain"));
+    ASSERT_EQ(std::string("a\\\"b\\\\c\\n\\r\\t\\u0001"), json_escape("a\"b\\c\n\r\t\x01"));
+    return true;
+}
+
 int main() {
     // Suppress log output during tests
     log_set_level(LogLevel::SILENT);
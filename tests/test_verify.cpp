@@ -0,0 +1,174 @@
+#include "simple_test.h"
+#include "test_fixtures.h"
+#include "../src/include/digest.h"
+#include "../src/include/logger.h"
+#include "../src/include/probecache.h"
+#include "../src/include/verify.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Helper: SHA-256 of a string in one update
+static std::string sha256(const std::string& data) {
+    Sha256 h;
+    h.update(data.data(), data.size());
+    return h.hex_digest();
+}
+
+// Helper: MD5 of a string in one update
+static std::string md5(const std::string& data) {
+    Md5 h;
+    h.update(data.data(), data.size());
+    return h.hex_digest();
+}
+
+// Helper: Image contents that differ in every 64-byte block
+static std::string sample(size_t size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<char>((i * 2654435761u) >> 13);
+    }
+    return data;
+}
+
+TEST(test_sha256_vectors) {
+    for (bool portable : {false, true}) {
+        sha256_force_portable(portable);
+        ASSERT_EQ(std::string("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"), sha256(""));
+        ASSERT_EQ(std::string("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"), sha256("abc"));
+        ASSERT_EQ(std::string("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"),
+                  sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"));
+        ASSERT_EQ(std::string("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"),
+                  sha256(std::string(1000000, 'a')));
+    }
+    sha256_force_portable(false);
+
+    // Split updates match a single one, and both implementations agree
+    std::string data = sample(100000);
+    std::string whole = sha256(data);
+    Sha256 split;
+    for (size_t pos = 0, step = 1; pos < data.size(); pos += step, step = step * 3 % 1031 + 1) {
+        split.update(data.data() + pos, std::min(step, data.size() - pos));
+    }
+    ASSERT_EQ(whole, split.hex_digest());
+    sha256_force_portable(true);
+    ASSERT_EQ(whole, sha256(data));
+    sha256_force_portable(false);
+    return true;
+}
+
+TEST(test_md5_vectors) {
+    ASSERT_EQ(std::string("d41d8cd98f00b204e9800998ecf8427e"), md5(""));
+    ASSERT_EQ(std::string("900150983cd24fb0d6963f7d28e17f72"), md5("abc"));
+    ASSERT_EQ(std::string("f96b697d7cb7938d525a2f31aaf161d0"), md5("message digest"));
+    ASSERT_EQ(std::string("57edf4a22be3c955ac49da2e2107b67a"),
+              md5("12345678901234567890123456789012345678901234567890123456789012345678901234567890"));
+    return true;
+}
+
+TEST(test_sidecar_checksums) {
+    TestDir dir("verify_sidecar");
+    std::string data = sample(5000);
+    std::string image = dir.file("disk.img", data);
+    std::string digest = sha256(data);
+    ExpectedChecksum expected;
+
+    ASSERT_TRUE(!find_expected_checksum(image, expected));
+
+    // SHA256SUMS must name the image
+    dir.file("SHA256SUMS", std::string(64, '0') + "  other.img\n");
+    ASSERT_TRUE(!find_sidecar_checksum(image, expected));
+    dir.file("SHA256SUMS", std::string(64, '0') + "  other.img\nSHA256 (disk.img) = " + digest + "\n");
+    ASSERT_TRUE(find_sidecar_checksum(image, expected));
+    ASSERT_EQ(digest, expected.digest);
+    ASSERT_EQ(dir.path + "/SHA256SUMS", expected.origin);
+
+    // A per-image sidecar wins, and its only entry may carry any name
+    dir.file("disk.img.sha256sum", digest + " *renamed.img\n");
+    ASSERT_TRUE(find_sidecar_checksum(image, expected));
+    ASSERT_EQ(image + ".sha256sum", expected.origin);
+    dir.file("disk.img.sha256", "  \n" + digest + "\n");
+    ASSERT_TRUE(find_expected_checksum(image, expected));
+    ASSERT_EQ(image + ".sha256", expected.origin);
+    ASSERT_EQ(std::string("sha256"), expected.algorithm);
+    ASSERT_EQ(static_cast<uint64_t>(5000), expected.length);
+    return true;
+}
+
+TEST(test_verify_image_and_cache) {
+    TestDir dir("verify_cache");
+    std::string data = sample(9 << 20);
+    std::string image = dir.file("disk.img", data);
+    dir.file("disk.img.sha256", sha256(data) + "  disk.img\n");
+
+    ExpectedChecksum expected;
+    ASSERT_TRUE(find_expected_checksum(image, expected));
+    VerifyResult result;
+    ASSERT_TRUE(verify_image(image, expected, result));
+    ASSERT_TRUE(result.passed && !result.cached);
+    ASSERT_EQ(static_cast<uint64_t>(9 << 20), result.bytes);
+
+    ASSERT_TRUE(verify_image(image, expected, result));
+    ASSERT_TRUE(result.passed && result.cached);
+    ASSERT_TRUE(verify_images({image}));
+
+    // A corrupted copy is hashed again and fails
+    data[7 << 20] ^= 1;
+    dir.file("disk.img", data);
+    ASSERT_TRUE(verify_image(image, expected, result));
+    ASSERT_TRUE(!result.passed && !result.cached);
+    ASSERT_TRUE(!verify_images({image}));
+
+    ASSERT_TRUE(!verify_images({dir.file("unchecked.img", "x")}));
+    return true;
+}
+
+TEST(test_implanted_md5) {
+    TestDir dir("verify_implant");
+    const size_t sectors = 40;
+    std::string data = sample(sectors * 2048);
+
+    // Primary Volume Descriptor at sector 16, terminator at 17
+    size_t pvd = 16 * 2048;
+    data[pvd] = 1;
+    std::memcpy(&data[pvd + 1], "CD001", 5);
+    data[pvd + 80] = static_cast<char>(sectors);
+    data[pvd + 81] = data[pvd + 82] = data[pvd + 83] = 0;
+    data[pvd + 2048] = static_cast<char>(0xff);
+    std::memcpy(&data[pvd + 2048 + 1], "CD001", 5);
+
+    // implantisomd5 hashes the application-use area as spaces and skips the tail
+    std::string hashed = data.substr(0, (sectors - 15) * 2048);
+    std::memset(&hashed[pvd + 883], ' ', 512);
+    std::string appdata = "ISO MD5SUM = " + md5(hashed) + ";SKIPSECTORS = 15;RHLISOSTATUS=1;";
+    std::memset(&data[pvd + 883], ' ', 512);
+    std::memcpy(&data[pvd + 883], appdata.data(), appdata.size());
+    std::string image = dir.file("installer.iso", data);
+
+    ExpectedChecksum expected;
+    ASSERT_TRUE(find_expected_checksum(image, expected));
+    ASSERT_EQ(std::string("md5"), expected.algorithm);
+    ASSERT_EQ(std::string("implantisomd5"), expected.origin);
+    ASSERT_EQ(static_cast<uint64_t>((sectors - 15) * 2048), expected.length);
+    ASSERT_TRUE(verify_images({image}));
+
+    // Changes in the skipped tail do not matter; changes before it do
+    data[data.size() - 1] ^= 1;
+    dir.file("installer.iso", data);
+    ASSERT_TRUE(verify_images({image}));
+    data[100] ^= 1;
+    dir.file("installer.iso", data);
+    ASSERT_TRUE(!verify_images({image}));
+    return true;
+}
+
+int main() {
+    // Suppress log output during tests
+    log_set_level(LogLevel::SILENT);
+
+    return run_tests();
+}